@@ -0,0 +1,150 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aof.h"
+#include "bench.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_aof [dir] [threads] [clients] [seconds] [pipeline]
+//
+// starts the sharded server in process with the append only log in dir
+// (the current one by default, pick a real disk: tmpfs makes fsync free)
+// and reports the SET throughput of pipelining clients once per fsync
+// policy, next to a run without the log. under always every batch of
+// replies waits for an fdatasync, so the gap to everysec is what one
+// sync per loop iteration costs on that disk
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 17379
+#define VALUE "vvvvvvvvvvvvvvvv"
+#define REPLY "+OK\r\n"
+
+typedef struct Client {
+  uint16_t port;
+  size_t pipeline;
+  unsigned int seed;
+  atomic_bool *stop;
+  uint64_t ops;
+} Client;
+
+static void *client_run(void *arg) {
+  Client *client = arg;
+  int fd = bench_connect(client->port);
+
+  size_t cap = client->pipeline * 64;
+  char *req = malloc(cap);
+  size_t want = client->pipeline * (sizeof(REPLY) - 1);
+  char *resp = malloc(want);
+  while (!atomic_load(client->stop)) {
+    size_t len = 0;
+    for (size_t i = 0; i < client->pipeline; i++) {
+      char key[16];
+      int key_len = snprintf(key, sizeof(key), "k%06u",
+                             rand_r(&client->seed) % 1000000);
+      len += snprintf(req + len, cap - len,
+                      "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n" VALUE "\r\n",
+                      key_len, key, sizeof(VALUE) - 1);
+    }
+    for (size_t sent = 0; sent < len;) {
+      ssize_t res = write(fd, req + sent, len - sent);
+      if (res <= 0) {
+        ERROR(true, "bench write failed")
+      }
+      sent += res;
+    }
+    for (size_t got = 0; got < want;) {
+      ssize_t res = read(fd, resp + got, want - got);
+      if (res <= 0) {
+        ERROR(true, "bench read failed")
+      }
+      got += res;
+    }
+    client->ops += client->pipeline;
+  }
+
+  free(req);
+  free(resp);
+  close(fd);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  const char *dir = argc > 1 ? argv[1] : ".";
+  size_t threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+  size_t clients = argc > 3 ? strtoul(argv[3], NULL, 10) : 8;
+  double seconds = argc > 4 ? atof(argv[4]) : 2.0;
+  size_t pipeline = argc > 5 ? strtoul(argv[5], NULL, 10) : 16;
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/bench_aof.aof", dir);
+
+  // off first, then each policy from the cheapest
+  const char *runs[] = {"off", "no", "everysec", "always"};
+  printf("%10s %12s %14s %12s\n", "fsync", "ops", "ops/sec", "log MB");
+  for (size_t run = 0; run < sizeof(runs) / sizeof(runs[0]); run++) {
+    // a fresh port per run, the previous listeners may linger in TIME_WAIT
+    ServerConfig config = {
+        .address = INADDR_LOOPBACK,
+        .port = (uint16_t)(BENCH_PORT + run),
+        .threads = threads,
+    };
+    if (run > 0) {
+      config.aof_path = path;
+      (void)aof_parse_fsync(runs[run], &config.aof_fsync);
+    }
+    (void)unlink(path);
+    Shards *shards = shards_new(&config);
+    if (!aof_open(shards)) {
+      ERROR(true, "bench could not open the log")
+    }
+    pthread_t server;
+    pthread_create(&server, NULL, bench_shards_thread, shards);
+
+    atomic_bool stop;
+    atomic_init(&stop, false);
+    Client *state = calloc(clients, sizeof(Client));
+    pthread_t *tids = calloc(clients, sizeof(pthread_t));
+    for (size_t i = 0; i < clients; i++) {
+      state[i] = (Client){.port = config.port,
+                          .pipeline = pipeline,
+                          .seed = (unsigned int)(i + 1),
+                          .stop = &stop};
+      pthread_create(&tids[i], NULL, client_run, &state[i]);
+    }
+
+    uint64_t start = monotonic_ns();
+    usleep((useconds_t)(seconds * 1e6));
+    atomic_store(&stop, true);
+    uint64_t ops = 0;
+    for (size_t i = 0; i < clients; i++) {
+      pthread_join(tids[i], NULL);
+      ops += state[i].ops;
+    }
+    double elapsed = (double)(monotonic_ns() - start) / 1e9;
+
+    shards_stop(shards);
+    pthread_join(server, NULL);
+    shards_cleanup(shards);
+    free(state);
+    free(tids);
+
+    struct stat st = {0};
+    (void)stat(path, &st);
+    printf("%10s %12lu %14.0f %12.1f\n", runs[run], ops,
+           (double)ops / elapsed, run > 0 ? (double)st.st_size / 1e6 : 0.0);
+  }
+  (void)unlink(path);
+
+  return 0;
+}
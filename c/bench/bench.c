@@ -0,0 +1,35 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "shard.h"
+#include "utils.h"
+
+int bench_connect(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(port),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  // the listeners come up asynchronously
+  for (int tries = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+       tries++) {
+    if (tries == 100) {
+      ERROR(true, "bench could not connect")
+    }
+    usleep(10000);
+  }
+  int opt = 1;
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  return fd;
+}
+
+void *bench_shards_thread(void *shards) {
+  shards_run(shards);
+  return NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// shared by the benches that run the server in process and drive it over
+// loopback, time them with monotonic_ns from utils.h
+
+// a TCP_NODELAY client of 127.0.0.1:port, exits when it cannot connect
+int bench_connect(uint16_t port);
+// pthread body running shards_run on shards
+void *bench_shards_thread(void *shards);
+
+#endif // BENCH_H
@@ -0,0 +1,216 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dlist.h"
+#include "evict.h"
+#include "hashmap.h"
+#include "keyspace.h"
+#include "utils.h"
+
+// usage: bench_eviction [keys] [cache %] [requests] [requests per tick]
+//
+// replays a zipfian (s = 0.99) trace of GETs over keys (default 1M) as a
+// cache would: a miss SETs the key, which evicts under maxmemory. the
+// limit holds about cache % (default 10) of the keys. reports the hit
+// rate of the sampled policies next to an exact LRU holding as many keys,
+// and the cpu cost of eviction per evicted key and per request. the
+// access clock advances one tick every [requests per tick] requests
+// (default 1000), it runs on 100 ms ticks in the server
+
+int LOG_LEVEL = 0;
+
+#define VALUE_LEN 32
+
+typedef struct LruItem {
+  HNode node;
+  DList list;
+  uint32_t id;
+} LruItem;
+
+// the cumulative distribution, ids are drawn by binary search on it
+static double *zipf_cdf(size_t keys) {
+  double *cdf = malloc(keys * sizeof(double));
+  double sum = 0;
+  for (size_t i = 0; i < keys; i++) {
+    sum += 1.0 / pow((double)(i + 1), 0.99);
+    cdf[i] = sum;
+  }
+  for (size_t i = 0; i < keys; i++) {
+    cdf[i] /= sum;
+  }
+  return cdf;
+}
+
+static uint32_t *zipf_trace(size_t keys, size_t requests) {
+  double *cdf = zipf_cdf(keys);
+  uint32_t *trace = malloc(requests * sizeof(uint32_t));
+  unsigned int seed = 1;
+  for (size_t i = 0; i < requests; i++) {
+    double u = (double)rand_r(&seed) / ((double)RAND_MAX + 1.0);
+    size_t lo = 0;
+    size_t hi = keys - 1;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (cdf[mid] < u) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    // scattered, so the hot keys are not the first ones inserted
+    trace[i] = (uint32_t)((lo * 2654435761ULL) % keys);
+  }
+  free(cdf);
+  return trace;
+}
+
+static int key_of(char *buf, uint32_t id) {
+  return sprintf(buf, "key:%08u", id);
+}
+
+// the keyspace bytes of count keys, the limit holding about that many
+static size_t memory_for(size_t count) {
+  Keyspace ks;
+  keyspace_init(&ks);
+  uint8_t value[VALUE_LEN];
+  memset(value, 'v', sizeof(value));
+  char key[32];
+  for (uint32_t i = 0; i < count; i++) {
+    int len = key_of(key, i);
+    keyspace_set(&ks, (uint8_t *)key, (size_t)len, value, sizeof(value));
+  }
+  size_t bytes = keyspace_memory(&ks);
+  keyspace_cleanup(&ks);
+  return bytes;
+}
+
+typedef struct Result {
+  double hit_rate;
+  size_t keys; // held at the end
+  uint64_t evicted;
+  uint64_t evict_ns;
+  uint64_t total_ns;
+} Result;
+
+// hits are counted over the second half of the trace, the first one
+// warms the cache up
+static Result run_sampled(const uint32_t *trace, size_t requests,
+                          size_t per_tick, size_t limit,
+                          enum EvictPolicy policy, size_t samples) {
+  Keyspace ks;
+  keyspace_init(&ks);
+  Evictor ev;
+  evictor_init(&ev, &ks, policy, samples);
+  ks.clock = 0;
+  uint8_t value[VALUE_LEN];
+  memset(value, 'v', sizeof(value));
+  char key[32];
+  size_t hits = 0;
+  uint64_t evict_ns = 0;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < requests; i++) {
+    if (i % per_tick == 0) {
+      ks.clock = (uint32_t)(i / per_tick);
+    }
+    int len = key_of(key, trace[i]);
+    if (keyspace_get(&ks, (uint8_t *)key, (size_t)len)) {
+      hits += i >= requests / 2;
+      continue;
+    }
+    keyspace_set(&ks, (uint8_t *)key, (size_t)len, value, sizeof(value));
+    if (keyspace_memory(&ks) > limit) {
+      uint64_t begin = monotonic_ns();
+      (void)evict_until(&ev, &ks, limit, NULL, NULL);
+      evict_ns += monotonic_ns() - begin;
+    }
+  }
+  Result res = {.hit_rate = (double)hits / (double)(requests / 2),
+                .keys = keyspace_size(&ks),
+                .evicted = ev.evicted,
+                .evict_ns = evict_ns,
+                .total_ns = monotonic_ns() - start};
+  evictor_cleanup(&ev);
+  keyspace_cleanup(&ks);
+  return res;
+}
+
+static uint64_t lru_eq(HNode *lhs, HNode *rhs) {
+  return container_of(lhs, LruItem, node)->id ==
+         container_of(rhs, LruItem, node)->id;
+}
+
+// exact LRU holding capacity keys: a map plus a list in access order
+static double run_exact(const uint32_t *trace, size_t requests,
+                        size_t capacity) {
+  HMap map = {0};
+  hmap_initialize(&map, NULL, lru_eq);
+  DList order;
+  dlist_init(&order);
+  size_t hits = 0;
+  for (size_t i = 0; i < requests; i++) {
+    LruItem probe = {.node.hash = trace[i] * 0x9e3779b97f4a7c15ULL,
+                     .id = trace[i]};
+    HNode *node = hmap_lookup(&map, &probe.node);
+    if (node) {
+      LruItem *item = container_of(node, LruItem, node);
+      dlist_detach(&item->list);
+      dlist_push_back(&order, &item->list);
+      hits += i >= requests / 2;
+      continue;
+    }
+    if (hmap_size(&map) == capacity) {
+      LruItem *oldest = container_of(order.next, LruItem, list);
+      dlist_detach(&oldest->list);
+      (void)hmap_pop(&map, &oldest->node);
+      free(oldest);
+    }
+    LruItem *item = malloc(sizeof(LruItem));
+    *item = probe;
+    hmap_insert(&map, &item->node);
+    dlist_push_back(&order, &item->list);
+  }
+  while (!dlist_empty(&order)) {
+    LruItem *item = container_of(order.next, LruItem, list);
+    dlist_detach(&item->list);
+    free(item);
+  }
+  hmap_destroy(&map);
+  return (double)hits / (double)(requests / 2);
+}
+
+int main(int argc, char **argv) {
+  size_t keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  double cache = argc > 2 ? atof(argv[2]) : 10.0;
+  size_t requests = argc > 3 ? strtoul(argv[3], NULL, 10) : 10000000;
+  size_t per_tick = argc > 4 ? strtoul(argv[4], NULL, 10) : 1000;
+
+  uint32_t *trace = zipf_trace(keys, requests);
+  size_t limit = memory_for((size_t)((double)keys * cache / 100.0));
+  printf("%zu keys, %zu requests, limit %zu bytes\n", keys, requests, limit);
+  printf("%-14s %8s %9s %9s %10s %12s %10s\n", "policy", "samples",
+         "hit rate", "exact", "keys", "ns/eviction", "ns/request");
+
+  const struct {
+    enum EvictPolicy policy;
+    size_t samples;
+  } runs[] = {
+      {EVICT_ALLKEYS_LRU, 3},  {EVICT_ALLKEYS_LRU, 5},
+      {EVICT_ALLKEYS_LRU, 10}, {EVICT_ALLKEYS_LFU, 5},
+      {EVICT_ALLKEYS_LFU, 10},
+  };
+  for (size_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+    Result res = run_sampled(trace, requests, per_tick, limit,
+                             runs[r].policy, runs[r].samples);
+    double exact = run_exact(trace, requests, res.keys);
+    printf("%-14s %8zu %8.2f%% %8.2f%% %10zu %12.0f %10.1f\n",
+           evict_policy_name(runs[r].policy), runs[r].samples,
+           res.hit_rate * 100, exact * 100, res.keys,
+           res.evicted ? (double)res.evict_ns / (double)res.evicted : 0.0,
+           (double)res.total_ns / (double)requests);
+  }
+  free(trace);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "heap.h"
+#include "keyspace.h"
+#include "utils.h"
+
+// usage: bench_expiry [keys] [max_ttl_ms] [budget]
+//
+// gives every key a random ttl up to max_ttl_ms, then drives the active
+// expiry cycle the way the server loop does (sleeping for the timeout it
+// returns) until every key is gone. reports the cpu spent expiring, how
+// far behind its deadline an expired key is still in memory (reclaim
+// lag), and how much of the heap was given back
+
+int LOG_LEVEL = 0;
+
+// small chunks plus the mmapped ones (tables, heap)
+static size_t heap_used(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+int main(int argc, char **argv) {
+  size_t keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+  uint64_t max_ttl = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000;
+  size_t budget = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000;
+
+  Keyspace ks;
+  keyspace_init(&ks);
+  size_t before = heap_used();
+  char key[32];
+  for (size_t i = 0; i < keys; i++) {
+    int len = sprintf(key, "counter:%zu", i);
+    keyspace_set(&ks, (uint8_t *)key, (size_t)len, (uint8_t *)"1", 1);
+  }
+
+  // deadlines are set a day out and moved back once they are all in,
+  // so no key expires while the bench is still setting ttls
+  unsigned int seed = 1;
+  uint64_t base = time_ms() + 86400000;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < keys; i++) {
+    int len = sprintf(key, "counter:%zu", i);
+    Entry *entry = keyspace_get(&ks, (uint8_t *)key, (size_t)len);
+    uint64_t ttl = 1 + (uint64_t)rand_r(&seed) % max_ttl;
+    keyspace_set_expiry(&ks, entry, base + ttl);
+  }
+  double set_ns = (double)(monotonic_ns() - start) / (double)keys;
+  // the same shift for every deadline keeps the heap ordered
+  uint64_t shift = base - time_ms();
+  for (size_t i = 0; i < heap_size(&ks.expires); i++) {
+    heap_at(&ks.expires, i)->val -= shift;
+  }
+  size_t peak = heap_used() - before;
+  printf("%zu keys, ttl up to %llu ms, budget %zu per cycle\n", keys,
+         (unsigned long long)max_ttl, budget);
+  printf("set ttl:      %8.1f ns/key\n", set_ns);
+
+  uint64_t busy = 0;
+  uint64_t cycles = 0;
+  uint64_t max_lag = 0;
+  double lag_sum = 0;
+  uint64_t lag_samples = 0;
+  uint64_t loop_start = monotonic_ns();
+  for (;;) {
+    uint64_t now = time_ms();
+    uint64_t cycle_start = monotonic_ns();
+    int timeout = keyspace_expire_cycle(&ks, now, budget);
+    busy += monotonic_ns() - cycle_start;
+    cycles++;
+
+    // the oldest deadline still waiting for its key to be deleted
+    HeapItem *top = heap_top(&ks.expires);
+    if (top && top->val <= now) {
+      uint64_t lag = now - top->val;
+      max_lag = lag > max_lag ? lag : max_lag;
+      lag_sum += (double)lag;
+      lag_samples++;
+    }
+    if (timeout < 0) {
+      break;
+    }
+    if (timeout > 0) {
+      usleep((useconds_t)timeout * 1000);
+    }
+  }
+  double wall = (double)(monotonic_ns() - loop_start) / 1e9;
+
+  printf("expire:       %8.1f ns/key, %.2f%% of %.1f s, %llu cycles\n",
+         (double)busy / (double)keys, 100.0 * (double)busy / 1e9 / wall,
+         wall, (unsigned long long)cycles);
+  printf("reclaim lag:  %8.2f ms avg, %llu ms max\n",
+         lag_samples ? lag_sum / (double)lag_samples : 0.0,
+         (unsigned long long)max_lag);
+  printf("heap:         %8.1f MB at peak, %.1f MB left\n",
+         (double)peak / 1e6, (double)(heap_used() - before) / 1e6);
+  if (ks.expired != keys) {
+    ERROR(true, "bench lost track of keys")
+  }
+  keyspace_cleanup(&ks);
+  return 0;
+}
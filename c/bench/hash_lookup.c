@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hashmap.h"
+#include "utils.h"
+
+// usage: bench_hash_lookup_<engine> [keys...]
+//
+// the per-command hashing and lookup cost of string keys. first ns per
+// hash of fnv-1a (the hash keys used to go through) against the seeded
+// wyhash in hash.h over a few key lengths, then lookups per second of
+// "user:<n>" keys through the generic hmap_lookup, which calls eq
+// through a pointer, against hmap_lookup_key, which compares in place.
+// built once per hashtable engine, e.g. bench_hash_lookup_chained 100000
+
+int LOG_LEVEL = 0;
+
+// laid out like Entry: the node, the key length and the key bytes
+typedef struct Item {
+  HNode node;
+  uint32_t len;
+  uint8_t data[];
+} Item;
+
+// what the generic path passes to hmap_lookup
+typedef struct ItemRef {
+  HNode node;
+  const uint8_t *data;
+  size_t len;
+} ItemRef;
+
+static uint64_t fnv1a(const uint8_t *key, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ key[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static uint64_t item_eq(HNode *lhs, HNode *rhs) {
+  Item *item = container_of(lhs, Item, node);
+  ItemRef *ref = container_of(rhs, ItemRef, node);
+  return item->len == ref->len && memcmp(item->data, ref->data, ref->len) == 0;
+}
+
+// keeps the hashes alive, so the loops are not optimized away
+static volatile uint64_t hash_sink;
+
+static void bench_hashes(void) {
+  const size_t rounds = 20000000;
+  const size_t lens[] = {8, 16, 32, 64, 256};
+  uint8_t buf[256];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = (uint8_t)(i * 31 + 7);
+  }
+  printf("%8s %12s %12s\n", "key len", "fnv1a ns", "wyhash ns");
+  for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+    // the first byte changes every round so no hash can be hoisted
+    uint64_t sink = 0;
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < rounds; i++) {
+      buf[0] = (uint8_t)i;
+      sink += fnv1a(buf, lens[l]);
+    }
+    double fnv = (double)(monotonic_ns() - start) / (double)rounds;
+    start = monotonic_ns();
+    for (size_t i = 0; i < rounds; i++) {
+      buf[0] = (uint8_t)i;
+      sink += hash_bytes(buf, lens[l]);
+    }
+    double wy = (double)(monotonic_ns() - start) / (double)rounds;
+    hash_sink = sink;
+    printf("%8zu %12.2f %12.2f\n", lens[l], fnv, wy);
+  }
+}
+
+static Item *item_new(size_t i) {
+  char key[32];
+  int len = snprintf(key, sizeof(key), "user:%zu", i);
+  Item *item = malloc(sizeof(Item) + (size_t)len);
+  item->node.hash = hash_bytes((const uint8_t *)key, (size_t)len);
+  item->len = (uint32_t)len;
+  memcpy(item->data, key, (size_t)len);
+  return item;
+}
+
+static void report(const char *path, size_t ops, uint64_t start) {
+  double secs = (double)(monotonic_ns() - start) / 1e9;
+  printf("  %-22s %8.2f Mlookups/s\n", path, (double)ops / secs / 1e6);
+}
+
+static void run(size_t keys) {
+  HMap generic = {0};
+  HMap keyed = {0};
+  hmap_initialize(&generic, NULL, item_eq);
+  hmap_initialize_keys(&keyed, HKEY_LAYOUT(Item, node, len, data));
+  Item **items = malloc(keys * sizeof(Item *));
+  for (size_t i = 0; i < keys; i++) {
+    items[i] = item_new(i);
+    hmap_insert(&generic, &items[i]->node);
+    // the same keys again, one node can only be in one map
+    Item *copy = item_new(i);
+    hmap_insert(&keyed, &copy->node);
+  }
+
+  // keys are formatted up front so only hash + lookup are timed, in a
+  // scattered order so the tables are not walked sequentially
+  const size_t lookups = 10000000;
+  char (*probes)[32] = malloc(keys * sizeof(*probes));
+  size_t *lens = malloc(keys * sizeof(size_t));
+  for (size_t i = 0; i < keys; i++) {
+    size_t n = (i * 2654435761ULL) % keys;
+    lens[i] = (size_t)snprintf(probes[i], sizeof(probes[i]), "user:%zu", n);
+  }
+
+  printf("%zu keys\n", keys);
+  size_t found = 0;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < lookups; i++) {
+    const uint8_t *key = (const uint8_t *)probes[i % keys];
+    size_t len = lens[i % keys];
+    ItemRef ref = {.node.hash = hash_bytes(key, len), .data = key, .len = len};
+    found += hmap_lookup(&generic, &ref.node) != NULL;
+  }
+  report("generic (eq pointer)", lookups, start);
+
+  start = monotonic_ns();
+  for (size_t i = 0; i < lookups; i++) {
+    const uint8_t *key = (const uint8_t *)probes[i % keys];
+    size_t len = lens[i % keys];
+    found += hmap_lookup_key(&keyed, hash_bytes(key, len), key, len) != NULL;
+  }
+  report("specialized (in place)", lookups, start);
+
+  if (found != 2 * lookups) {
+    fprintf(stderr, "lookups missed keys\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < keys; i++) {
+    Item *item = items[i];
+    HNode *copy = hmap_pop_key(&keyed, item->node.hash, item->data, item->len);
+    free(container_of(copy, Item, node));
+    free(item);
+  }
+  hmap_destroy(&generic);
+  hmap_destroy(&keyed);
+  free(items);
+  free(probes);
+  free(lens);
+}
+
+int main(int argc, char **argv) {
+#ifdef HTABLE_SWISS
+  printf("engine: swiss\n");
+#else
+  printf("engine: chained\n");
+#endif
+  bench_hashes();
+  if (argc < 2) {
+    run(1000);
+    run(1000000);
+  }
+  for (int i = 1; i < argc; i++) {
+    run(strtoul(argv[i], NULL, 10));
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,119 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hashmap.h"
+#include "utils.h"
+
+// usage: bench_hashtable_<engine> [keys...]
+//
+// insert / lookup (hit and miss) / delete throughput through hmap_* and
+// heap bytes per key (nodes + tables), built once per hashtable engine,
+// e.g. bench_hashtable_chained 1000000 50000000
+
+int LOG_LEVEL = 0;
+
+typedef struct Item {
+  HNode node;
+  uint64_t key;
+} Item;
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static uint64_t item_eq(HNode *lhs, HNode *rhs) {
+  return container_of(lhs, Item, node)->key ==
+         container_of(rhs, Item, node)->key;
+}
+
+static size_t heap_bytes(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static void report(const char *phase, size_t ops, uint64_t start) {
+  double secs = (double)(monotonic_ns() - start) / 1e9;
+  printf("  %-12s %8.2f Mops/s\n", phase, (double)ops / secs / 1e6);
+}
+
+static void run(size_t keys) {
+  // lookups go in a shuffled order so they are not cache friendly
+  uint64_t *order = malloc(keys * sizeof(uint64_t));
+  for (size_t i = 0; i < keys; i++) {
+    order[i] = i;
+  }
+  for (size_t i = keys - 1; i > 0; i--) {
+    size_t j = mix64(i) % (i + 1);
+    uint64_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  size_t before = heap_bytes();
+  HMap map = {0};
+  hmap_initialize(&map, NULL, item_eq);
+
+  printf("%zu keys\n", keys);
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < keys; i++) {
+    Item *item = malloc(sizeof(Item));
+    *item = (Item){.node.hash = mix64(i), .key = i};
+    hmap_insert(&map, &item->node);
+  }
+  report("insert", keys, start);
+  printf("  %-12s %8.1f\n", "bytes / key",
+         (double)(heap_bytes() - before) / (double)keys);
+
+  size_t found = 0;
+  start = monotonic_ns();
+  for (size_t i = 0; i < keys; i++) {
+    Item key = {.node.hash = mix64(order[i]), .key = order[i]};
+    found += hmap_lookup(&map, &key.node) != NULL;
+  }
+  report("lookup hit", keys, start);
+
+  start = monotonic_ns();
+  for (size_t i = 0; i < keys; i++) {
+    Item key = {.node.hash = mix64(keys + i), .key = keys + i};
+    found += hmap_lookup(&map, &key.node) != NULL;
+  }
+  report("lookup miss", keys, start);
+
+  start = monotonic_ns();
+  for (size_t i = 0; i < keys; i++) {
+    Item key = {.node.hash = mix64(order[i]), .key = order[i]};
+    HNode *node = hmap_pop(&map, &key.node);
+    found -= node != NULL;
+    free(container_of(node, Item, node));
+  }
+  report("delete", keys, start);
+
+  if (found != 0 || hmap_size(&map) != 0) {
+    fprintf(stderr, "hashtable lost keys\n");
+    exit(EXIT_FAILURE);
+  }
+  hmap_destroy(&map);
+  free(order);
+}
+
+int main(int argc, char **argv) {
+#ifdef HTABLE_SWISS
+  printf("engine: swiss, node %zu bytes\n", sizeof(HNode));
+#else
+  printf("engine: chained, node %zu bytes\n", sizeof(HNode));
+#endif
+  if (argc < 2) {
+    run(1000000);
+  }
+  for (int i = 1; i < argc; i++) {
+    run(strtoul(argv[i], NULL, 10));
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_idle_conns [conns] [seconds]
+//
+// server side memory per idle connection (each sent one PING, so it went
+// through a full read / reply cycle) and connect + PING + close rate.
+// client and server share the process, so each conn costs two fds: raise
+// ulimit -n above 2 * conns
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 16579
+
+// resident set size from /proc, in bytes
+static size_t rss_bytes(void) {
+  size_t pages = 0;
+  size_t resident = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (!file) {
+    return 0;
+  }
+  if (fscanf(file, "%zu %zu", &pages, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(file);
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static int ping(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(BENCH_PORT),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  for (int tries = 0; connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+       tries++) {
+    if (tries == 100) {
+      ERROR(true, "bench could not connect")
+    }
+    usleep(10000);
+  }
+  int opt = 1;
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+  const char req[] = "*1\r\n$4\r\nPING\r\n";
+  char resp[8];
+  if (write(fd, req, sizeof(req) - 1) != sizeof(req) - 1) {
+    ERROR(true, "bench write failed")
+  }
+  for (size_t got = 0; got < 7;) { // +PONG\r\n
+    ssize_t res = read(fd, resp + got, 7 - got);
+    if (res <= 0) {
+      ERROR(true, "bench read failed")
+    }
+    got += res;
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  size_t conns = argc > 1 ? strtoul(argv[1], NULL, 10) : 8000;
+  double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+
+  ServerConfig config = {
+      .address = INADDR_LOOPBACK,
+      .port = BENCH_PORT,
+      .threads = 1,
+  };
+  Shards *shards = shards_new(&config);
+  pthread_t server;
+  pthread_create(&server, NULL, bench_shards_thread, shards);
+  close(ping()); // the server is up and warm
+
+  int *fds = malloc(conns * sizeof(int));
+  size_t before = rss_bytes();
+  for (size_t i = 0; i < conns; i++) {
+    fds[i] = ping();
+  }
+  size_t after = rss_bytes();
+  printf("%zu idle conns: %.0f bytes of rss each\n", conns,
+         (double)(after - before) / (double)conns);
+  for (size_t i = 0; i < conns; i++) {
+    close(fds[i]);
+  }
+  free(fds);
+
+  size_t done = 0;
+  uint64_t start = monotonic_ns();
+  uint64_t deadline = start + (uint64_t)(seconds * 1e9);
+  while (monotonic_ns() < deadline) {
+    close(ping());
+    done++;
+  }
+  double elapsed = (double)(monotonic_ns() - start) / 1e9;
+  printf("churn: %.0f connect+PING+close per sec\n", (double)done / elapsed);
+
+  shards_stop(shards);
+  pthread_join(server, NULL);
+  shards_cleanup(shards);
+  return 0;
+}
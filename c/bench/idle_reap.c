@@ -0,0 +1,141 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_idle_reap [conns] [idle_timeout_ms]
+//
+// a child process opens conns connections and leaves them idle, the
+// server closes them once they are idle past the timeout. reports how
+// late the last one went (reap lag) and the server thread's cpu time
+// while reaping. the client sits in its own process so each side needs
+// conns fds: raise ulimit -n above conns (100k conns need 100k+)
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 16679
+// source addresses are spread over 127.0.0.2, .3, ... so conns may
+// exceed the ephemeral port range
+#define CONNS_PER_ADDR 20000
+
+static uint64_t thread_cpu_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int client_connect(size_t i) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    ERROR(true, "bench socket failed (is ulimit -n high enough?)")
+  }
+  struct sockaddr_in local = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i / CONNS_PER_ADDR)};
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(BENCH_PORT),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  if (bind(fd, (struct sockaddr *)&local, sizeof(local)) ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    ERROR(true, "bench could not connect")
+  }
+  return fd;
+}
+
+// opens every conn, reports on ready and keeps them until killed
+static void client_run(size_t conns, int ready) {
+  for (size_t i = 0; i < conns; i++) {
+    (void)client_connect(i);
+  }
+  char done = 1;
+  if (write(ready, &done, 1) != 1) {
+    ERROR(true, "bench client could not report")
+  }
+  pause();
+}
+
+static size_t conns_open(Server *serv) {
+  return __atomic_load_n(&serv->pool.stats.objects_used, __ATOMIC_RELAXED);
+}
+
+int main(int argc, char **argv) {
+  size_t conns = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+  uint64_t timeout_ms = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000;
+
+  ServerConfig config = {
+      .address = INADDR_LOOPBACK,
+      .port = BENCH_PORT,
+      .threads = 1,
+      .idle_timeout_ms = timeout_ms,
+  };
+  Shards *shards = shards_new(&config);
+  Server *serv = shards->servers[0];
+  pthread_t server;
+  pthread_create(&server, NULL, bench_shards_thread, shards);
+  clockid_t server_cpu;
+  pthread_getcpuclockid(server, &server_cpu);
+
+  int ready[2];
+  if (pipe(ready)) {
+    ERROR(true, "bench pipe failed")
+  }
+  uint64_t start = monotonic_ns();
+  pid_t child = fork();
+  if (child == 0) {
+    close(ready[0]);
+    client_run(conns, ready[1]);
+    _exit(0);
+  }
+  close(ready[1]);
+  char done = 0;
+  if (read(ready[0], &done, 1) != 1) {
+    ERROR(true, "bench client failed")
+  }
+  uint64_t opened = monotonic_ns();
+  printf("%zu conns open after %.0f ms, idle timeout %llu ms\n", conns,
+         (double)(opened - start) / 1e6, (unsigned long long)timeout_ms);
+
+  // the server may already be closing the first conns while the client
+  // opens the last ones. the last conn was connected by `opened`, so it
+  // is due by then plus the timeout
+  uint64_t cpu_start = thread_cpu_ns(server_cpu);
+  uint64_t first_close = 0;
+  size_t most = 0;
+  for (size_t open; (open = conns_open(serv)) > 0 || !most;) {
+    if (open > most) {
+      most = open;
+    } else if (open < most && !first_close) {
+      first_close = monotonic_ns();
+    }
+    usleep(200);
+  }
+  uint64_t closed = monotonic_ns();
+  uint64_t cpu = thread_cpu_ns(server_cpu) - cpu_start;
+  double lag = (double)closed / 1e6 - (double)opened / 1e6 -
+               (double)timeout_ms;
+
+  printf("reaped in %.1f ms (first to last close), last one %.1f ms past "
+         "its deadline\n",
+         (double)(closed - first_close) / 1e6, lag);
+  printf("server cpu from then on: %.1f ms, %.2f us per conn\n",
+         (double)cpu / 1e6, (double)cpu / 1e3 / (double)conns);
+
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+  shards_stop(shards);
+  pthread_join(server, NULL);
+  shards_cleanup(shards);
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_io_engine [clients] [seconds] [pipeline]
+//
+// SET+GET throughput of the reactor against the io_uring engine, on
+// long lived pipelining connections and under connection churn (connect,
+// one SET+GET, close). io_uring falls back to the reactor when the kernel
+// lacks it, the row is then labelled as such
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 16479
+#define VALUE "vvvvvvvv"
+// "+OK\r\n" then "$8\r\nvvvvvvvv\r\n"
+#define PAIR_REPLY_LEN (5 + 14)
+
+typedef struct Client {
+  uint16_t port;
+  size_t pipeline;
+  bool churn;
+  unsigned int seed;
+  atomic_bool *stop;
+  uint64_t ops;
+} Client;
+
+static void client_round(Client *client, int fd, char *req, size_t cap,
+                         char *resp) {
+  size_t len = 0;
+  for (size_t i = 0; i < client->pipeline; i++) {
+    char key[16];
+    int key_len = snprintf(key, sizeof(key), "k%06u",
+                           rand_r(&client->seed) % 1000000);
+    len += snprintf(req + len, cap - len,
+                    "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$8\r\n" VALUE "\r\n"
+                    "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
+                    key_len, key, key_len, key);
+  }
+  for (size_t sent = 0; sent < len;) {
+    ssize_t res = write(fd, req + sent, len - sent);
+    if (res <= 0) {
+      ERROR(true, "bench write failed")
+    }
+    sent += res;
+  }
+  size_t want = client->pipeline * PAIR_REPLY_LEN;
+  for (size_t got = 0; got < want;) {
+    ssize_t res = read(fd, resp + got, want - got);
+    if (res <= 0) {
+      ERROR(true, "bench read failed")
+    }
+    got += res;
+  }
+  client->ops += client->pipeline * 2;
+}
+
+static void *client_run(void *arg) {
+  Client *client = arg;
+  size_t cap = client->pipeline * 96;
+  char *req = malloc(cap);
+  char *resp = malloc(client->pipeline * PAIR_REPLY_LEN);
+
+  int fd = client->churn ? -1 : bench_connect(client->port);
+  while (!atomic_load(client->stop)) {
+    if (client->churn) {
+      fd = bench_connect(client->port);
+    }
+    client_round(client, fd, req, cap, resp);
+    if (client->churn) {
+      close(fd);
+    }
+  }
+  if (!client->churn) {
+    close(fd);
+  }
+
+  free(req);
+  free(resp);
+  return NULL;
+}
+
+static double run(bool io_uring, bool churn, uint16_t port, size_t clients,
+                  double seconds, size_t pipeline, bool *used_uring) {
+  ServerConfig config = {
+      .address = INADDR_LOOPBACK,
+      .port = port,
+      .threads = 1,
+      .io_uring = io_uring,
+  };
+  Shards *shards = shards_new(&config);
+  *used_uring = shards->servers[0]->uring != NULL;
+  pthread_t server;
+  pthread_create(&server, NULL, bench_shards_thread, shards);
+
+  atomic_bool stop;
+  atomic_init(&stop, false);
+  Client *state = calloc(clients, sizeof(Client));
+  pthread_t *tids = calloc(clients, sizeof(pthread_t));
+  for (size_t i = 0; i < clients; i++) {
+    state[i] = (Client){.port = port,
+                        .pipeline = churn ? 1 : pipeline,
+                        .churn = churn,
+                        .seed = (unsigned int)(i + 1),
+                        .stop = &stop};
+    pthread_create(&tids[i], NULL, client_run, &state[i]);
+  }
+
+  uint64_t start = monotonic_ns();
+  usleep((useconds_t)(seconds * 1e6));
+  atomic_store(&stop, true);
+  uint64_t ops = 0;
+  for (size_t i = 0; i < clients; i++) {
+    pthread_join(tids[i], NULL);
+    ops += state[i].ops;
+  }
+  double elapsed = (double)(monotonic_ns() - start) / 1e9;
+
+  shards_stop(shards);
+  pthread_join(server, NULL);
+  shards_cleanup(shards);
+  free(state);
+  free(tids);
+  return (double)ops / elapsed;
+}
+
+int main(int argc, char **argv) {
+  size_t clients = argc > 1 ? strtoul(argv[1], NULL, 10) : 16;
+  double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+  size_t pipeline = argc > 3 ? strtoul(argv[3], NULL, 10) : 16;
+
+  printf("%-10s %-10s %14s\n", "engine", "workload", "ops/sec");
+  uint16_t port = BENCH_PORT;
+  for (int churn = 0; churn <= 1; churn++) {
+    for (int io_uring = 0; io_uring <= 1; io_uring++) {
+      bool used_uring = false;
+      double rate = run(io_uring, churn, port++, clients, seconds, pipeline,
+                        &used_uring);
+      const char *engine = used_uring ? "io_uring" : reactor_backend();
+      if (io_uring && !used_uring) {
+        engine = "fallback";
+      }
+      printf("%-10s %-10s %14.0f\n", engine, churn ? "churn" : "pipeline",
+             rate);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keyspace.h"
+#include "utils.h"
+
+// usage: bench_keyspace_latency [keys]
+//
+// times every SET while the keyspace grows from empty through many
+// progressive resizes, a stall while rehashing shows up in p999 / max.
+// max latency is split between SETs that did rehash work and those that
+// did not, so allocator / page fault noise can be told apart
+
+int LOG_LEVEL = 0;
+
+static int cmp_u64(const void *lhs, const void *rhs) {
+  uint64_t l = *(const uint64_t *)lhs;
+  uint64_t r = *(const uint64_t *)rhs;
+  return (l > r) - (l < r);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double p) {
+  size_t idx = (size_t)(p * (double)(n - 1));
+  return sorted[idx];
+}
+
+int main(int argc, char **argv) {
+  size_t keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+
+  uint64_t *lat = malloc(keys * sizeof(uint64_t));
+  Keyspace ks;
+  keyspace_init(&ks);
+
+  size_t resizes = 0;
+  bool resizing = false;
+  uint64_t max_resizing = 0;
+  uint64_t max_idle = 0;
+  char key[32];
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < keys; i++) {
+    int len = snprintf(key, sizeof(key), "key:%zu", i);
+    uint64_t t0 = monotonic_ns();
+    keyspace_set(&ks, (const uint8_t *)key, len, (const uint8_t *)key, len);
+    lat[i] = monotonic_ns() - t0;
+
+    bool now_resizing = ks.map.ht2.tab != NULL;
+    resizes += now_resizing && !resizing;
+    if (now_resizing || resizing) {
+      max_resizing = lat[i] > max_resizing ? lat[i] : max_resizing;
+    } else {
+      max_idle = lat[i] > max_idle ? lat[i] : max_idle;
+    }
+    resizing = now_resizing;
+  }
+  double secs = (double)(monotonic_ns() - start) / 1e9;
+
+  qsort(lat, keys, sizeof(uint64_t), cmp_u64);
+  printf("keys: %zu, resizes: %zu, %.2f Mops/s\n", keys, resizes,
+         (double)keys / secs / 1e6);
+  printf("SET latency (ns): p50 %lu  p99 %lu  p999 %lu  p9999 %lu  max %lu\n",
+         percentile(lat, keys, 0.5), percentile(lat, keys, 0.99),
+         percentile(lat, keys, 0.999), percentile(lat, keys, 0.9999),
+         lat[keys - 1]);
+  printf("max while rehashing: %lu ns, max otherwise: %lu ns\n", max_resizing,
+         max_idle);
+
+  keyspace_cleanup(&ks);
+  free(lat);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keyspace.h"
+#include "utils.h"
+
+// usage: bench_keyspace_memory [keys]
+//
+// heap bytes per key (allocator overhead and hash table included) and
+// SET / GET rate for three value shapes: integer counters, short strings
+// and ~100 byte strings, keys look like "counter:123456"
+
+int LOG_LEVEL = 0;
+
+#define LONG_VALUE_LEN 100
+
+// small chunks plus the mmapped ones (tables, heap)
+static size_t heap_used(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static size_t make_value(int shape, size_t i, char *buf) {
+  switch (shape) {
+  case 0:
+    return (size_t)sprintf(buf, "%zu", i * 7);
+  case 1:
+    return (size_t)sprintf(buf, "user-%08zx", i);
+  default:
+    memset(buf, 'a' + (int)(i % 26), LONG_VALUE_LEN);
+    return LONG_VALUE_LEN;
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  const char *shapes[] = {"counter", "short", "100B"};
+
+  printf("%-10s %14s %14s %14s\n", "values", "bytes/key", "set/sec",
+         "get/sec");
+  for (int shape = 0; shape < 3; shape++) {
+    Keyspace ks;
+    keyspace_init(&ks);
+    size_t before = heap_used();
+
+    char key[32];
+    char val[LONG_VALUE_LEN];
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < keys; i++) {
+      int key_len = sprintf(key, "counter:%zu", i);
+      size_t val_len = make_value(shape, i, val);
+      keyspace_set(&ks, (uint8_t *)key, (size_t)key_len, (uint8_t *)val,
+                   val_len);
+    }
+    double set_secs = (double)(monotonic_ns() - start) / 1e9;
+    size_t used = heap_used() - before;
+
+    size_t found = 0;
+    start = monotonic_ns();
+    for (size_t i = 0; i < keys; i++) {
+      int key_len = sprintf(key, "counter:%zu", i);
+      found += keyspace_get(&ks, (uint8_t *)key, (size_t)key_len) != NULL;
+    }
+    double get_secs = (double)(monotonic_ns() - start) / 1e9;
+    if (found != keys) {
+      ERROR(true, "bench lost keys")
+    }
+
+    printf("%-10s %14.1f %14.0f %14.0f\n", shapes[shape],
+           (double)used / (double)keys, (double)keys / set_secs,
+           (double)keys / get_secs);
+    keyspace_cleanup(&ks);
+  }
+  return 0;
+}
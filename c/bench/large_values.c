@@ -0,0 +1,172 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "keyspace.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_large_values [threads] [clients] [seconds] [pipeline]
+//
+// GET throughput on 64KB to 1MB values, once with every reply copied
+// into the conn's output and once with the values sent by reference
+// (writev straight from the keyspace's blobs). next to ops/sec and MB/s
+// it prints the value bytes the server copied per reply, from the
+// servers' reply_copied counters. the keyspace is filled in process
+// before the clients connect
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 18379
+#define KEYS 16
+
+typedef struct Client {
+  uint16_t port;
+  size_t pipeline;
+  size_t reply_len;
+  unsigned int seed;
+  atomic_bool *stop;
+  uint64_t ops;
+} Client;
+
+static void *client_run(void *arg) {
+  Client *client = arg;
+  int fd = bench_connect(client->port);
+
+  size_t cap = client->pipeline * 32;
+  char *req = malloc(cap);
+  // replies are only counted, not looked at
+  size_t want = client->pipeline * client->reply_len;
+  char *resp = malloc(1 << 20);
+  while (!atomic_load(client->stop)) {
+    size_t len = 0;
+    for (size_t i = 0; i < client->pipeline; i++) {
+      len += snprintf(req + len, cap - len,
+                      "*2\r\n$3\r\nGET\r\n$3\r\nk%02u\r\n",
+                      rand_r(&client->seed) % KEYS);
+    }
+    for (size_t sent = 0; sent < len;) {
+      ssize_t res = write(fd, req + sent, len - sent);
+      if (res <= 0) {
+        ERROR(true, "bench write failed")
+      }
+      sent += res;
+    }
+    for (size_t got = 0; got < want;) {
+      size_t chunk = want - got < (1 << 20) ? want - got : (1 << 20);
+      ssize_t res = read(fd, resp, chunk);
+      if (res <= 0) {
+        ERROR(true, "bench read failed")
+      }
+      got += res;
+    }
+    client->ops += client->pipeline;
+  }
+
+  free(req);
+  free(resp);
+  close(fd);
+  return NULL;
+}
+
+// every key of the run holds a value of size bytes, set on its owner
+static void fill(Shards *shards, size_t size) {
+  uint8_t *value = malloc(size);
+  memset(value, 'v', size);
+  for (unsigned int i = 0; i < KEYS; i++) {
+    char key[8];
+    int len = snprintf(key, sizeof(key), "k%02u", i);
+    Server *owner =
+        shards->servers[shards_owner(shards, (uint8_t *)key, (size_t)len)];
+    if (!keyspace_set(&owner->keyspace, (uint8_t *)key, (size_t)len, value,
+                      size)) {
+      ERROR(true, "bench could not fill the keyspace")
+    }
+  }
+  free(value);
+}
+
+static void run(size_t run, size_t size, bool refs, size_t threads,
+                size_t clients, double seconds, size_t pipeline) {
+  // a fresh port per run, the previous listeners may linger in TIME_WAIT
+  ServerConfig config = {
+      .address = INADDR_LOOPBACK,
+      .port = (uint16_t)(BENCH_PORT + run),
+      .threads = threads,
+      .reply_ref_min = refs ? 0 : SIZE_MAX,
+  };
+  Shards *shards = shards_new(&config);
+  fill(shards, size);
+  pthread_t server;
+  pthread_create(&server, NULL, bench_shards_thread, shards);
+
+  char header[32];
+  size_t reply_len = (size_t)snprintf(header, sizeof(header), "$%zu\r\n",
+                                      size) + size + 2;
+  atomic_bool stop;
+  atomic_init(&stop, false);
+  Client *state = calloc(clients, sizeof(Client));
+  pthread_t *tids = calloc(clients, sizeof(pthread_t));
+  for (size_t i = 0; i < clients; i++) {
+    state[i] = (Client){.port = config.port,
+                        .pipeline = pipeline,
+                        .reply_len = reply_len,
+                        .seed = (unsigned int)(i + 1),
+                        .stop = &stop};
+    pthread_create(&tids[i], NULL, client_run, &state[i]);
+  }
+
+  uint64_t start = monotonic_ns();
+  usleep((useconds_t)(seconds * 1e6));
+  atomic_store(&stop, true);
+  uint64_t ops = 0;
+  for (size_t i = 0; i < clients; i++) {
+    pthread_join(tids[i], NULL);
+    ops += state[i].ops;
+  }
+  double elapsed = (double)(monotonic_ns() - start) / 1e9;
+
+  shards_stop(shards);
+  pthread_join(server, NULL);
+  // also counts replies the clients did not wait for, close enough
+  uint64_t copied = 0;
+  uint64_t replies = 0;
+  for (size_t i = 0; i < shards->count; i++) {
+    copied += shards->servers[i]->reply_copied;
+    replies += (shards->servers[i]->reply_copied +
+                shards->servers[i]->reply_referenced) / size;
+  }
+  shards_cleanup(shards);
+  free(state);
+  free(tids);
+
+  printf("%8zuK %6s %12.0f %10.0f %14.0f\n", size / 1024,
+         refs ? "ref" : "copy", (double)ops / elapsed,
+         (double)ops * (double)size / elapsed / 1e6,
+         replies ? (double)copied / (double)replies : 0.0);
+}
+
+int main(int argc, char **argv) {
+  size_t threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 1;
+  size_t clients = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+  double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+  size_t pipeline = argc > 4 ? strtoul(argv[4], NULL, 10) : 4;
+
+  const size_t sizes[] = {64 * 1024, 256 * 1024, 1024 * 1024};
+  printf("%9s %6s %12s %10s %14s\n", "value", "reply", "ops/sec", "MB/s",
+         "copied/reply");
+  size_t runs = 0;
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    run(runs++, sizes[s], false, threads, clients, seconds, pipeline);
+    run(runs++, sizes[s], true, threads, clients, seconds, pipeline);
+  }
+  return 0;
+}
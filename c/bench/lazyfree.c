@@ -0,0 +1,197 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "keyspace.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_lazyfree [members] [keys] [clients]
+//
+// GET latency of concurrent clients while one more client deletes a big
+// sorted set (members, default 2M) with DEL, then the whole keyspace
+// (keys, default 2M strings plus the set) with FLUSHALL. once with the
+// values freed inline on the loop and once on the lazy free thread
+// (FLUSHALL SYNC against ASYNC). the server runs in process on one
+// shard, so every GET waits behind the delete. reports how long the
+// delete took and the GET p50 / p99 / p99.9 / max of the window around it
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 19379
+#define MAX_SAMPLES (1 << 22)
+// "$5\r\nvalue\r\n", "$-1\r\n" once FLUSHALL removed the key
+#define GET_REPLY_LEN 11
+#define GET_NULL_LEN 5
+
+typedef struct Client {
+  uint16_t port;
+  atomic_bool *stop;
+  uint64_t *lat;
+  size_t count;
+} Client;
+
+static void send_all(int fd, const char *req, size_t len) {
+  for (size_t sent = 0; sent < len;) {
+    ssize_t res = write(fd, req + sent, len - sent);
+    if (res <= 0) {
+      ERROR(true, "bench write failed")
+    }
+    sent += (size_t)res;
+  }
+}
+
+static void read_reply(int fd, char *buf, size_t want) {
+  for (size_t got = 0; got < want;) {
+    ssize_t res = read(fd, buf + got, want - got);
+    if (res <= 0) {
+      ERROR(true, "bench read failed")
+    }
+    got += (size_t)res;
+  }
+}
+
+static void read_get_reply(int fd) {
+  char buf[GET_REPLY_LEN];
+  size_t got = 0;
+  while (got < GET_NULL_LEN || (buf[1] != '-' && got < GET_REPLY_LEN)) {
+    ssize_t res = read(fd, buf + got, sizeof(buf) - got);
+    if (res <= 0) {
+      ERROR(true, "bench read failed")
+    }
+    got += (size_t)res;
+  }
+}
+
+// one GET at a time, each timed
+static void *client_run(void *arg) {
+  Client *client = arg;
+  int fd = bench_connect(client->port);
+  const char req[] = "*2\r\n$3\r\nGET\r\n$3\r\nhot\r\n";
+  while (!atomic_load(client->stop) && client->count < MAX_SAMPLES) {
+    uint64_t start = monotonic_ns();
+    send_all(fd, req, sizeof(req) - 1);
+    read_get_reply(fd);
+    client->lat[client->count++] = monotonic_ns() - start;
+  }
+  close(fd);
+  return NULL;
+}
+
+static void fill(Keyspace *ks, size_t members, size_t keys) {
+  keyspace_set(ks, (const uint8_t *)"hot", 3, (const uint8_t *)"value", 5);
+  Entry *big = keyspace_new_zset(ks, (const uint8_t *)"big", 3, members);
+  char name[32];
+  for (size_t i = 0; i < members; i++) {
+    int len = snprintf(name, sizeof(name), "member:%zu", i);
+    keyspace_zadd(ks, big, (uint8_t *)name, (size_t)len, (double)i);
+  }
+  for (size_t i = 0; i < keys; i++) {
+    int len = snprintf(name, sizeof(name), "key:%zu", i);
+    keyspace_set(ks, (uint8_t *)name, (size_t)len, (const uint8_t *)"v", 1);
+  }
+}
+
+static int cmp_u64(const void *lhs, const void *rhs) {
+  uint64_t a = *(const uint64_t *)lhs;
+  uint64_t b = *(const uint64_t *)rhs;
+  return (a > b) - (a < b);
+}
+
+// the GETs of every client during cmd, from 50 ms before it to 50 ms
+// after its reply
+static void measure(uint16_t port, int fd, const char *name,
+                    const char *cmd, size_t reply_len, size_t clients) {
+  atomic_bool stop;
+  atomic_init(&stop, false);
+  Client *state = calloc(clients, sizeof(Client));
+  pthread_t *tids = calloc(clients, sizeof(pthread_t));
+  for (size_t i = 0; i < clients; i++) {
+    state[i] = (Client){.port = port,
+                        .stop = &stop,
+                        .lat = malloc(MAX_SAMPLES * sizeof(uint64_t))};
+    pthread_create(&tids[i], NULL, client_run, &state[i]);
+  }
+  usleep(50000);
+  char reply[64];
+  uint64_t start = monotonic_ns();
+  send_all(fd, cmd, strlen(cmd));
+  read_reply(fd, reply, reply_len);
+  double cmd_ms = (double)(monotonic_ns() - start) / 1e6;
+  usleep(50000);
+  atomic_store(&stop, true);
+
+  size_t total = 0;
+  for (size_t i = 0; i < clients; i++) {
+    pthread_join(tids[i], NULL);
+    total += state[i].count;
+  }
+  uint64_t *lat = malloc((total ? total : 1) * sizeof(uint64_t));
+  size_t n = 0;
+  for (size_t i = 0; i < clients; i++) {
+    memcpy(lat + n, state[i].lat, state[i].count * sizeof(uint64_t));
+    n += state[i].count;
+    free(state[i].lat);
+  }
+  qsort(lat, n, sizeof(uint64_t), cmp_u64);
+  printf("%-16s %10.2f %8zu %10.1f %10.1f %10.1f %10.1f\n", name, cmd_ms, n,
+         n ? (double)lat[n / 2] / 1e3 : 0.0,
+         n ? (double)lat[n * 99 / 100] / 1e3 : 0.0,
+         n ? (double)lat[n * 999 / 1000] / 1e3 : 0.0,
+         n ? (double)lat[n - 1] / 1e3 : 0.0);
+  free(lat);
+  free(state);
+  free(tids);
+}
+
+static void run(size_t run, bool lazy, size_t members, size_t keys,
+                size_t clients) {
+  // a fresh port per run, the previous listener may linger in TIME_WAIT
+  ServerConfig config = {
+      .address = INADDR_LOOPBACK,
+      .port = (uint16_t)(BENCH_PORT + run),
+      .threads = 1,
+  };
+  Shards *shards = shards_new(&config);
+  Keyspace *ks = &shards->servers[0]->keyspace;
+  if (!lazy) {
+    ks->lazy = NULL;
+  }
+  fill(ks, members, keys);
+  pthread_t server;
+  pthread_create(&server, NULL, bench_shards_thread, shards);
+
+  int fd = bench_connect(config.port);
+  measure(config.port, fd, lazy ? "DEL lazy" : "DEL inline",
+          "*2\r\n$3\r\nDEL\r\n$3\r\nbig\r\n", 4, clients);
+  measure(config.port, fd, lazy ? "FLUSHALL ASYNC" : "FLUSHALL SYNC",
+          lazy ? "*2\r\n$8\r\nFLUSHALL\r\n$5\r\nASYNC\r\n"
+               : "*2\r\n$8\r\nFLUSHALL\r\n$4\r\nSYNC\r\n",
+          5, clients);
+  close(fd);
+
+  shards_stop(shards);
+  pthread_join(server, NULL);
+  shards_cleanup(shards);
+}
+
+int main(int argc, char **argv) {
+  size_t members = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+  size_t keys = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000;
+  size_t clients = argc > 3 ? strtoul(argv[3], NULL, 10) : 4;
+
+  printf("%zu members, %zu keys, %zu GET clients\n", members, keys, clients);
+  printf("%-16s %10s %8s %10s %10s %10s %10s\n", "command", "ms", "GETs",
+         "p50 us", "p99 us", "p99.9 us", "max us");
+  run(0, false, members, keys, clients);
+  run(1, true, members, keys, clients);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,691 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "utils.h"
+
+// usage: redis_mini_bench [options], see --help
+//
+// closed loop load generator for a running server: every connection
+// sends a pipeline of SET / GET and waits for all of the replies before
+// sending the next one. threads each drive their share of the
+// connections from an epoll loop. with --rate the connections also wait
+// for their next slot of a fixed schedule
+//
+// latencies are reported twice. uncorrected is from the write to the
+// reply. corrected accounts for coordinated omission: a closed loop stops
+// sending while the server stalls, so the requests that would have been
+// sent meanwhile never see the stall. with --rate their latency counts
+// from when the schedule meant to send them (as wrk2 does), without it
+// every sample above the mean latency is backfilled with the ones that
+// would have followed it at that interval (as HdrHistogram does)
+
+int LOG_LEVEL = 0;
+
+#define BENCH_EVENTS 64
+// GET / SET bytes besides the key and value
+#define CMD_OVERHEAD 64
+
+typedef struct BenchConfig {
+  const char *host;
+  uint16_t port;
+  const char *socket; // unix socket instead of host and port, or NULL
+  size_t threads;
+  size_t conns;
+  size_t pipeline;
+  double duration; // seconds
+  size_t keys;
+  double zipf; // exponent, 0 for uniform keys
+  size_t value_size;
+  unsigned sets; // SET:GET ratio
+  unsigned gets;
+  double rate; // ops/sec over all connections, 0 for as fast as it goes
+  bool load;
+  bool oneline;
+  const char *name;
+} BenchConfig;
+
+typedef struct BenchConn {
+  int fd;
+  char *wbuf;
+  size_t wlen;
+  size_t wsent;
+  char *rbuf;
+  size_t rlen;
+  size_t rcap;
+  size_t pending; // replies still to come for the batch in flight
+  uint64_t sent_at; // when the batch went out
+  uint64_t due_at; // when it was meant to, then when the next one is
+} BenchConn;
+
+typedef struct Worker {
+  const BenchConfig *config;
+  const double *cdf; // zipfian keys, NULL for uniform
+  const char *value;
+  pthread_t thread;
+  int epfd;
+  BenchConn *conns;
+  size_t nconns;
+  uint64_t interval; // ns between batches of a connection, with --rate
+  unsigned int seed;
+  atomic_bool *stop;
+  uint64_t sets;
+  uint64_t gets;
+  uint64_t errors;
+  Histogram uncorrected; // ns
+  Histogram corrected; // ns, from the schedule with --rate
+} Worker;
+
+static void usage(const char *name) {
+  printf("usage: %s [options]\n"
+         "  -H, --host ADDR      server ipv4 address (default 127.0.0.1)\n"
+         "  -p, --port PORT      server port (default 6379)\n"
+         "  -S, --socket PATH    server unix socket, instead of the\n"
+         "                       host and port\n"
+         "  -t, --threads N      load generating threads (default 2)\n"
+         "  -c, --connections N  over all threads (default 50)\n"
+         "  -P, --pipeline N     commands per batch (default 1)\n"
+         "  -d, --duration SECS  (default 10)\n"
+         "  -k, --keys N         keyspace size (default 100000)\n"
+         "  -D, --distribution uniform|zipf\n"
+         "                       how keys are drawn (default uniform)\n"
+         "  -Z, --zipf-exponent S\n"
+         "                       skew of zipf keys (default 0.99)\n"
+         "  -s, --value-size BYTES\n"
+         "                       SET value size (default 32)\n"
+         "  -r, --ratio SETS:GETS\n"
+         "                       command mix (default 1:10)\n"
+         "  -R, --rate OPS       send at this rate over all connections\n"
+         "                       instead of as fast as replies come back\n"
+         "  -l, --load           SET every key once before the run\n"
+         "  -n, --name NAME      label of the run\n"
+         "  -q, --oneline        print a single summary line\n"
+         "  -h, --help           print this help and exit\n",
+         name);
+}
+
+static bool parse_ratio(const char *arg, unsigned *sets, unsigned *gets) {
+  char *end = NULL;
+  unsigned long s = strtoul(arg, &end, 10);
+  if (*end != ':') {
+    return false;
+  }
+  unsigned long g = strtoul(end + 1, &end, 10);
+  if (*end || s + g == 0) {
+    return false;
+  }
+  *sets = (unsigned)s;
+  *gets = (unsigned)g;
+  return true;
+}
+
+static void parse_args(int argc, char **argv, BenchConfig *config) {
+  static const struct option options[] = {
+      {"host", required_argument, NULL, 'H'},
+      {"port", required_argument, NULL, 'p'},
+      {"socket", required_argument, NULL, 'S'},
+      {"threads", required_argument, NULL, 't'},
+      {"connections", required_argument, NULL, 'c'},
+      {"pipeline", required_argument, NULL, 'P'},
+      {"duration", required_argument, NULL, 'd'},
+      {"keys", required_argument, NULL, 'k'},
+      {"distribution", required_argument, NULL, 'D'},
+      {"zipf-exponent", required_argument, NULL, 'Z'},
+      {"value-size", required_argument, NULL, 's'},
+      {"ratio", required_argument, NULL, 'r'},
+      {"rate", required_argument, NULL, 'R'},
+      {"load", no_argument, NULL, 'l'},
+      {"name", required_argument, NULL, 'n'},
+      {"oneline", no_argument, NULL, 'q'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  bool zipf = false;
+  double exponent = 0.99;
+  int opt = 0;
+  while ((opt = getopt_long(argc, argv, "H:p:S:t:c:P:d:k:D:Z:s:r:R:ln:qh",
+                            options, NULL)) != -1) {
+    switch (opt) {
+    case 'H':
+      config->host = optarg;
+      break;
+    case 'p':
+      config->port = (uint16_t)atoi(optarg);
+      break;
+    case 'S':
+      config->socket = optarg;
+      break;
+    case 't':
+      config->threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      config->conns = strtoul(optarg, NULL, 10);
+      break;
+    case 'P':
+      config->pipeline = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      config->duration = atof(optarg);
+      break;
+    case 'k':
+      config->keys = strtoul(optarg, NULL, 10);
+      break;
+    case 'D':
+      if (strcmp(optarg, "uniform") && strcmp(optarg, "zipf")) {
+        fprintf(stderr, "--distribution must be uniform or zipf\n");
+        exit(EXIT_FAILURE);
+      }
+      zipf = !strcmp(optarg, "zipf");
+      break;
+    case 'Z':
+      exponent = atof(optarg);
+      break;
+    case 's':
+      config->value_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      if (!parse_ratio(optarg, &config->sets, &config->gets)) {
+        fprintf(stderr, "--ratio must be SETS:GETS, as in 1:10\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'R':
+      config->rate = atof(optarg);
+      break;
+    case 'l':
+      config->load = true;
+      break;
+    case 'n':
+      config->name = optarg;
+      break;
+    case 'q':
+      config->oneline = true;
+      break;
+    case 'h':
+      usage(argv[0]);
+      exit(EXIT_SUCCESS);
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!config->threads || !config->conns || !config->pipeline ||
+      !config->keys || config->duration <= 0) {
+    fprintf(stderr, "threads, connections, pipeline, keys and duration "
+                    "must be positive\n");
+    exit(EXIT_FAILURE);
+  }
+  config->threads =
+      config->threads < config->conns ? config->threads : config->conns;
+  config->zipf = zipf ? exponent : 0;
+}
+
+static int bench_connect_unix(const BenchConfig *config) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(config->socket) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "bench: socket path %s is too long\n", config->socket);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, config->socket);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    ERROR(true, "bench: could not connect")
+  }
+  return fd;
+}
+
+static int bench_connect(const BenchConfig *config) {
+  if (config->socket) {
+    return bench_connect_unix(config);
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(config->port)};
+  if (inet_pton(AF_INET, config->host, &addr.sin_addr) != 1) {
+    fprintf(stderr, "bench: %s is not an ipv4 address\n", config->host);
+    exit(EXIT_FAILURE);
+  }
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    ERROR(true, "bench: could not connect")
+  }
+  int opt = 1;
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  return fd;
+}
+
+// the cumulative distribution, ranks are drawn by binary search on it
+static double *zipf_cdf(size_t keys, double exponent) {
+  double *cdf = malloc(keys * sizeof(double));
+  double sum = 0;
+  for (size_t i = 0; i < keys; i++) {
+    sum += 1.0 / pow((double)(i + 1), exponent);
+    cdf[i] = sum;
+  }
+  for (size_t i = 0; i < keys; i++) {
+    cdf[i] /= sum;
+  }
+  return cdf;
+}
+
+static size_t next_key(Worker *worker) {
+  size_t keys = worker->config->keys;
+  double u = (double)rand_r(&worker->seed) / ((double)RAND_MAX + 1.0);
+  if (!worker->cdf) {
+    return (size_t)(u * (double)keys);
+  }
+  size_t lo = 0;
+  size_t hi = keys - 1;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (worker->cdf[mid] < u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  // scattered, so the hot keys do not all land on one shard
+  return (size_t)((lo * 2654435761ULL) % keys);
+}
+
+static size_t format_set(char *buf, size_t key, const char *value,
+                         size_t value_size) {
+  char name[24];
+  int len = snprintf(name, sizeof(name), "key:%zu", key);
+  size_t at = (size_t)sprintf(buf, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n",
+                              len, name, value_size);
+  memcpy(buf + at, value, value_size);
+  memcpy(buf + at + value_size, "\r\n", 2);
+  return at + value_size + 2;
+}
+
+static size_t format_get(char *buf, size_t key) {
+  char name[24];
+  int len = snprintf(name, sizeof(name), "key:%zu", key);
+  return (size_t)sprintf(buf, "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n", len, name);
+}
+
+// length of the reply at buf, 0 while it is incomplete. only the types
+// SET and GET answer with: simple strings, errors and bulk strings
+static size_t reply_len(const char *buf, size_t len, bool *error) {
+  const char *eol = memchr(buf, '\n', len);
+  if (!eol) {
+    return 0;
+  }
+  size_t line = (size_t)(eol - buf) + 1;
+  *error = buf[0] == '-';
+  if (buf[0] != '$') {
+    return line;
+  }
+  long bulk = strtol(buf + 1, NULL, 10);
+  if (bulk < 0) {
+    return line; // nil
+  }
+  return len < line + (size_t)bulk + 2 ? 0 : line + (size_t)bulk + 2;
+}
+
+// SET of every key, pipelined on one blocking connection
+static void load_keys(const BenchConfig *config, const char *value) {
+  enum { BATCH = 256 };
+  int fd = bench_connect(config);
+  size_t cap = BATCH * (config->value_size + CMD_OVERHEAD);
+  char *buf = malloc(cap);
+  char reply[BATCH * 5]; // "+OK\r\n"
+  for (size_t key = 0; key < config->keys; key += BATCH) {
+    size_t batch = config->keys - key < BATCH ? config->keys - key : BATCH;
+    size_t len = 0;
+    for (size_t i = 0; i < batch; i++) {
+      len += format_set(buf + len, key + i, value, config->value_size);
+    }
+    for (size_t sent = 0; sent < len;) {
+      ssize_t res = write(fd, buf + sent, len - sent);
+      if (res <= 0) {
+        ERROR(true, "bench: load write failed")
+      }
+      sent += (size_t)res;
+    }
+    for (size_t got = 0; got < batch * 5;) {
+      ssize_t res = read(fd, reply + got, batch * 5 - got);
+      if (res <= 0) {
+        ERROR(true, "bench: load read failed")
+      }
+      got += (size_t)res;
+    }
+    if (reply[0] != '+') {
+      fprintf(stderr, "bench: load refused: %.*s\n", 64, reply);
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(buf);
+  close(fd);
+}
+
+static void conn_send(Worker *worker, BenchConn *conn, uint64_t now) {
+  const BenchConfig *config = worker->config;
+  unsigned total = config->sets + config->gets;
+  conn->wlen = 0;
+  conn->wsent = 0;
+  for (size_t i = 0; i < config->pipeline; i++) {
+    size_t key = next_key(worker);
+    if ((unsigned)rand_r(&worker->seed) % total < config->sets) {
+      conn->wlen += format_set(conn->wbuf + conn->wlen, key, worker->value,
+                               config->value_size);
+      worker->sets++;
+    } else {
+      conn->wlen += format_get(conn->wbuf + conn->wlen, key);
+      worker->gets++;
+    }
+  }
+  conn->pending = config->pipeline;
+  conn->sent_at = now;
+  if (!worker->interval) {
+    conn->due_at = now;
+  }
+  // a whole batch fits the socket buffer but for huge values, the rest
+  // goes out on EPOLLOUT
+  ssize_t res = write(conn->fd, conn->wbuf, conn->wlen);
+  conn->wsent = res > 0 ? (size_t)res : 0;
+  if (conn->wsent < conn->wlen) {
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = conn};
+    epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+static void conn_writable(Worker *worker, BenchConn *conn) {
+  ssize_t res =
+      write(conn->fd, conn->wbuf + conn->wsent, conn->wlen - conn->wsent);
+  if (res < 0 && errno != EAGAIN) {
+    ERROR(true, "bench: write failed")
+  }
+  conn->wsent += res > 0 ? (size_t)res : 0;
+  if (conn->wsent == conn->wlen) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+    epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+  }
+}
+
+static void conn_readable(Worker *worker, BenchConn *conn) {
+  ssize_t res = read(conn->fd, conn->rbuf + conn->rlen,
+                     conn->rcap - conn->rlen);
+  if (res == 0) {
+    fprintf(stderr, "bench: server closed the connection\n");
+    exit(EXIT_FAILURE);
+  }
+  if (res < 0 && errno != EAGAIN) {
+    ERROR(true, "bench: read failed")
+  }
+  if (res < 0) {
+    return;
+  }
+  conn->rlen += (size_t)res;
+
+  uint64_t now = monotonic_ns();
+  size_t at = 0;
+  for (;;) {
+    bool error = false;
+    size_t len = reply_len(conn->rbuf + at, conn->rlen - at, &error);
+    if (!len) {
+      break;
+    }
+    if (!conn->pending) {
+      fprintf(stderr, "bench: reply to nothing sent\n");
+      exit(EXIT_FAILURE);
+    }
+    at += len;
+    worker->errors += error;
+    conn->pending--;
+    hist_record(&worker->uncorrected, now - conn->sent_at);
+    hist_record(&worker->corrected, now - conn->due_at);
+  }
+  memmove(conn->rbuf, conn->rbuf + at, conn->rlen - at);
+  conn->rlen -= at;
+  // a GET of a value an earlier run set larger than --value-size
+  if (conn->rlen == conn->rcap) {
+    conn->rcap *= 2;
+    conn->rbuf = realloc(conn->rbuf, conn->rcap);
+  }
+  if (!conn->pending) {
+    conn->due_at += worker->interval;
+  }
+}
+
+// sends what is due, returns the epoll timeout until the next one is
+static int send_due(Worker *worker) {
+  uint64_t now = monotonic_ns();
+  uint64_t next = UINT64_MAX;
+  for (size_t i = 0; i < worker->nconns; i++) {
+    BenchConn *conn = &worker->conns[i];
+    if (conn->pending) {
+      continue;
+    }
+    if (conn->due_at <= now) {
+      conn_send(worker, conn, now);
+    } else if (conn->due_at < next) {
+      next = conn->due_at;
+    }
+  }
+  if (next == UINT64_MAX) {
+    return -1;
+  }
+  // spins the last millisecond, epoll does not wait for less
+  return next - now < 1000000 ? 0 : (int)((next - now) / 1000000);
+}
+
+static void *worker_run(void *arg) {
+  Worker *worker = arg;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < worker->nconns; i++) {
+    // the schedule is spread over the connections, no thundering herd
+    worker->conns[i].due_at =
+        start + worker->interval * i / worker->nconns;
+  }
+  struct epoll_event events[BENCH_EVENTS];
+  while (!atomic_load_explicit(worker->stop, memory_order_relaxed)) {
+    int timeout = send_due(worker);
+    // wakes up to check the stop flag at least every 100 ms
+    timeout = timeout < 0 || timeout > 100 ? 100 : timeout;
+    int n = epoll_wait(worker->epfd, events, BENCH_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+      BenchConn *conn = events[i].data.ptr;
+      if (events[i].events & EPOLLOUT) {
+        conn_writable(worker, conn);
+      }
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        conn_readable(worker, conn);
+      }
+    }
+  }
+  return NULL;
+}
+
+static void worker_init(Worker *worker, const BenchConfig *config,
+                        size_t nconns, size_t id) {
+  worker->config = config;
+  worker->nconns = nconns;
+  worker->seed = (unsigned int)(id + 1);
+  worker->epfd = epoll_create1(0);
+  worker->conns = calloc(nconns, sizeof(BenchConn));
+  if (config->rate > 0) {
+    double batches = config->rate / (double)config->pipeline;
+    worker->interval =
+        (uint64_t)(1e9 * (double)config->conns / batches);
+  }
+  size_t batch = config->pipeline * (config->value_size + CMD_OVERHEAD);
+  for (size_t i = 0; i < nconns; i++) {
+    BenchConn *conn = &worker->conns[i];
+    conn->fd = bench_connect(config);
+    conn->wbuf = malloc(batch);
+    conn->rcap = batch + 4096;
+    conn->rbuf = malloc(conn->rcap);
+    fd_to_nonblocking(conn->fd);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+    epoll_ctl(worker->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+  }
+}
+
+static void worker_cleanup(Worker *worker) {
+  for (size_t i = 0; i < worker->nconns; i++) {
+    close(worker->conns[i].fd);
+    free(worker->conns[i].wbuf);
+    free(worker->conns[i].rbuf);
+  }
+  free(worker->conns);
+  close(worker->epfd);
+}
+
+// HdrHistogram's correction: a sample v above the expected interval
+// stands for the requests that would have been sent while it waited,
+// which would have waited v - interval, v - 2 * interval and so on
+static void correct_omission(HistSnapshot *snap, uint64_t interval) {
+  if (!interval) {
+    return;
+  }
+  static HistSnapshot raw;
+  raw = *snap;
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    if (!raw.counts[i]) {
+      continue;
+    }
+    uint64_t value = hist_bucket_min(i);
+    for (uint64_t missed = value; missed >= 2 * interval;) {
+      missed -= interval;
+      hist_snapshot_add(snap, missed, raw.counts[i]);
+    }
+  }
+}
+
+static void print_row(const char *label, const HistSnapshot *snap) {
+  static const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+  printf("%-12s", label);
+  for (size_t i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+    printf(" %9.1f", (double)hist_value_at(snap, percentiles[i]) / 1e3);
+  }
+  printf(" %9.1f\n", (double)snap->max / 1e3);
+}
+
+static void report(const BenchConfig *config, double elapsed,
+                   uint64_t sets, uint64_t gets, uint64_t errors,
+                   const HistSnapshot *uncorrected,
+                   const HistSnapshot *corrected) {
+  double ops = (double)uncorrected->total / elapsed;
+  if (config->oneline) {
+    printf("%-28s %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+           config->name ? config->name : "-", ops,
+           (double)hist_value_at(corrected, 50) / 1e3,
+           (double)hist_value_at(corrected, 99) / 1e3,
+           (double)hist_value_at(corrected, 99.9) / 1e3,
+           (double)hist_value_at(uncorrected, 99.9) / 1e3,
+           (double)corrected->max / 1e3);
+    return;
+  }
+  if (config->name) {
+    printf("%s\n", config->name);
+  }
+  if (config->socket) {
+    printf("%s, ", config->socket);
+  } else {
+    printf("%s:%u, ", config->host, config->port);
+  }
+  printf("%zu threads, %zu connections, pipeline %zu, %zu keys (",
+         config->threads, config->conns, config->pipeline, config->keys);
+  if (config->zipf > 0) {
+    printf("zipf %.2f", config->zipf);
+  } else {
+    printf("uniform");
+  }
+  printf("), %zu B values, %u:%u SET:GET", config->value_size,
+         config->sets, config->gets);
+  if (config->rate > 0) {
+    printf(", %.0f ops/sec target", config->rate);
+  }
+  printf("\n%lu ops in %.2f s: %.0f ops/sec (%lu SET, %lu GET sent), "
+         "%lu errors\n",
+         (unsigned long)uncorrected->total, elapsed, ops,
+         (unsigned long)sets, (unsigned long)gets, (unsigned long)errors);
+  printf("%-12s %9s %9s %9s %9s %9s %9s\n", "latency us", "p50", "p90",
+         "p99", "p99.9", "p99.99", "max");
+  print_row("uncorrected", uncorrected);
+  print_row("corrected", corrected);
+}
+
+int main(int argc, char **argv) {
+  BenchConfig config = {
+      .host = "127.0.0.1",
+      .port = 6379,
+      .threads = 2,
+      .conns = 50,
+      .pipeline = 1,
+      .duration = 10,
+      .keys = 100000,
+      .value_size = 32,
+      .sets = 1,
+      .gets = 10,
+  };
+  parse_args(argc, argv, &config);
+
+  char *value = malloc(config.value_size + 1);
+  memset(value, 'v', config.value_size);
+  if (config.load) {
+    load_keys(&config, value);
+  }
+  double *cdf = config.zipf > 0 ? zipf_cdf(config.keys, config.zipf) : NULL;
+
+  atomic_bool stop;
+  atomic_init(&stop, false);
+  Worker *workers = calloc(config.threads, sizeof(Worker));
+  for (size_t i = 0; i < config.threads; i++) {
+    size_t nconns = config.conns / config.threads +
+                    (i < config.conns % config.threads);
+    workers[i].cdf = cdf;
+    workers[i].value = value;
+    workers[i].stop = &stop;
+    worker_init(&workers[i], &config, nconns, i);
+  }
+
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < config.threads; i++) {
+    pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+  }
+  usleep((useconds_t)(config.duration * 1e6));
+  atomic_store(&stop, true);
+
+  static HistSnapshot uncorrected;
+  static HistSnapshot corrected;
+  uint64_t sets = 0;
+  uint64_t gets = 0;
+  uint64_t errors = 0;
+  for (size_t i = 0; i < config.threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    hist_collect(&workers[i].uncorrected, &uncorrected);
+    hist_collect(&workers[i].corrected, &corrected);
+    sets += workers[i].sets;
+    gets += workers[i].gets;
+    errors += workers[i].errors;
+    worker_cleanup(&workers[i]);
+  }
+  double elapsed = (double)(monotonic_ns() - start) / 1e9;
+  if (config.rate <= 0 && corrected.total) {
+    correct_omission(&corrected, corrected.sum / corrected.total);
+  }
+  report(&config, elapsed, sets, gets, errors, &uncorrected, &corrected);
+
+  free(workers);
+  free(cdf);
+  free(value);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "log.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_logging [clients] [seconds] [pipeline] [log file]
+//
+// SET+GET throughput of pipelining clients (default 4, 2 s each, 1 deep)
+// against a one shard server in process, at every runtime log level
+// (DEBUG) with the lines printed on the loop thread (sync) and handed to
+// the writer thread (async). the lines go to log file (default
+// /dev/null), the table to stdout. levels above LOG_LEVEL_MAX are
+// compiled out, configure with -DLOG_LEVEL_MAX=3 to see all of them
+// printed
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 17379
+#define VALUE "vvvvvvvv"
+// "+OK\r\n" then "$8\r\nvvvvvvvv\r\n"
+#define PAIR_REPLY_LEN (5 + 14)
+
+typedef struct Client {
+  uint16_t port;
+  size_t pipeline;
+  unsigned int seed;
+  atomic_bool *stop;
+  uint64_t ops;
+} Client;
+
+static void *client_run(void *arg) {
+  Client *client = arg;
+  int fd = bench_connect(client->port);
+
+  size_t cap = client->pipeline * 96;
+  char *req = malloc(cap);
+  char *resp = malloc(client->pipeline * PAIR_REPLY_LEN);
+  while (!atomic_load(client->stop)) {
+    size_t len = 0;
+    for (size_t i = 0; i < client->pipeline; i++) {
+      char key[16];
+      int key_len = snprintf(key, sizeof(key), "k%06u",
+                             rand_r(&client->seed) % 1000000);
+      len += (size_t)snprintf(
+          req + len, cap - len,
+          "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$8\r\n" VALUE "\r\n"
+          "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
+          key_len, key, key_len, key);
+    }
+    for (size_t sent = 0; sent < len;) {
+      ssize_t res = write(fd, req + sent, len - sent);
+      if (res <= 0) {
+        ERROR(true, "bench write failed")
+      }
+      sent += (size_t)res;
+    }
+    size_t want = client->pipeline * PAIR_REPLY_LEN;
+    for (size_t got = 0; got < want;) {
+      ssize_t res = read(fd, resp + got, want - got);
+      if (res <= 0) {
+        ERROR(true, "bench read failed")
+      }
+      got += (size_t)res;
+    }
+    client->ops += client->pipeline * 2;
+  }
+
+  free(req);
+  free(resp);
+  close(fd);
+  return NULL;
+}
+
+static double run(uint16_t port, size_t clients, double seconds,
+                  size_t pipeline) {
+  ServerConfig config = {
+      .address = INADDR_LOOPBACK,
+      .port = port,
+      .threads = 1,
+  };
+  Shards *shards = shards_new(&config);
+  pthread_t server;
+  pthread_create(&server, NULL, bench_shards_thread, shards);
+
+  atomic_bool stop;
+  atomic_init(&stop, false);
+  Client *state = calloc(clients, sizeof(Client));
+  pthread_t *tids = calloc(clients, sizeof(pthread_t));
+  for (size_t i = 0; i < clients; i++) {
+    state[i] = (Client){.port = port,
+                        .pipeline = pipeline,
+                        .seed = (unsigned int)(i + 1),
+                        .stop = &stop};
+    pthread_create(&tids[i], NULL, client_run, &state[i]);
+  }
+
+  uint64_t start = monotonic_ns();
+  usleep((useconds_t)(seconds * 1e6));
+  atomic_store(&stop, true);
+  uint64_t ops = 0;
+  for (size_t i = 0; i < clients; i++) {
+    pthread_join(tids[i], NULL);
+    ops += state[i].ops;
+  }
+  double elapsed = (double)(monotonic_ns() - start) / 1e9;
+
+  shards_stop(shards);
+  pthread_join(server, NULL);
+  shards_cleanup(shards);
+  free(state);
+  free(tids);
+  return (double)ops / elapsed;
+}
+
+int main(int argc, char **argv) {
+  size_t clients = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+  double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+  size_t pipeline = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+  const char *path = argc > 4 ? argv[4] : "/dev/null";
+
+  // the table keeps the real stdout, the log lines get the file
+  FILE *table = fdopen(dup(STDOUT_FILENO), "w");
+  if (!table || !freopen(path, "w", stdout)) {
+    ERROR(true, "bench could not open the log file")
+  }
+  // a line per write, as stdout is on a terminal
+  (void)setvbuf(stdout, NULL, _IOLBF, 0);
+  fprintf(table, "LOG_LEVEL_MAX %d, %zu clients, pipeline %zu\n",
+          LOG_LEVEL_MAX, clients, pipeline);
+  fprintf(table, "%6s %6s %14s %10s\n", "level", "mode", "ops/sec",
+          "dropped");
+  uint16_t port = BENCH_PORT;
+  for (int level = 0; level <= 3; level++) {
+    for (int async = 0; async <= 1; async++) {
+      LOG_LEVEL = level;
+      if (async && !log_start(STDOUT_FILENO)) {
+        ERROR(true, "bench could not start the log writer")
+      }
+      uint64_t dropped = log_dropped();
+      // a fresh port per run, the previous listener may linger in
+      // TIME_WAIT
+      double ops = run(port++, clients, seconds, pipeline);
+      log_stop();
+      (void)fflush(stdout);
+      fprintf(table, "%6d %6s %14.0f %10lu\n", level,
+              async ? "async" : "sync", ops,
+              (unsigned long)(log_dropped() - dropped));
+      (void)fflush(table);
+    }
+  }
+  fclose(table);
+  return EXIT_SUCCESS;
+}
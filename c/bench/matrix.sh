@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# usage: matrix.sh SERVER BENCH [PORT] [SECONDS]
+#
+# the standard scenario matrix (make bench): starts SERVER on PORT
+# (default 16379) in a scratch dir, runs BENCH against it for SECONDS
+# (default 5) per scenario and prints a line each. the server listens on
+# a unix socket in the scratch dir too, the last scenarios compare it
+# with loopback tcp. THREADS picks the server's reactor threads
+# (default 2)
+
+set -e
+
+server=$(realpath "$1")
+bench=$(realpath "$2")
+port=${3:-16379}
+seconds=${4:-5}
+threads=${THREADS:-2}
+
+dir=$(mktemp -d)
+cd "$dir"
+sock="$dir/redis_mini.sock"
+"$server" --port "$port" --threads "$threads" --snapshot "$dir/dump.snap" \
+  --unixsocket "$sock" >/dev/null 2>&1 &
+pid=$!
+trap 'kill $pid 2>/dev/null; wait $pid 2>/dev/null; rm -rf "$dir"' EXIT
+
+# the listeners come up asynchronously
+for _ in $(seq 100); do
+  (exec 3<>/dev/tcp/127.0.0.1/"$port") 2>/dev/null && break
+  sleep 0.1
+done
+
+run() {
+  local name=$1
+  shift
+  "$bench" --port "$port" --duration "$seconds" --oneline --name "$name" "$@"
+}
+
+echo "redis_mini, $threads threads, ${seconds}s per scenario, latency us"
+printf "%-28s %12s %9s %9s %9s %9s %9s\n" scenario ops/sec p50 p99 p99.9 \
+  raw-p99.9 max
+run "get/set 10:1 uniform" --ratio 1:10 --load
+run "get/set 10:1 zipf" --ratio 1:10 --distribution zipf
+run "set only" --ratio 1:0
+run "get only" --ratio 0:1
+run "pipeline 16" --ratio 1:10 --pipeline 16
+run "500 connections" --ratio 1:10 --connections 500
+run "1KB values" --ratio 1:10 --value-size 1024
+run "16KB values" --ratio 1:10 --value-size 16384 --connections 10
+run "rate 20k ops/sec" --ratio 1:10 --rate 20000
+run "get/set 10:1 tcp 1 conn" --ratio 1:10 --connections 1
+run "get/set 10:1 unix 1 conn" --ratio 1:10 --connections 1 --socket "$sock"
+run "get/set 10:1 unix" --ratio 1:10 --load --socket "$sock"
+run "pipeline 16 unix" --ratio 1:10 --pipeline 16 --socket "$sock"
@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "utils.h"
+
+// usage: bench_reactor_<backend> [wakeups] [idle counts...]
+//
+// registers N idle fds plus one active eventfd, then measures the cost of
+// one wakeup (signal the active fd, wait, drain it) as N grows
+
+int LOG_LEVEL = 0;
+
+static size_t raise_fd_limit(void) {
+  struct rlimit lim;
+  getrlimit(RLIMIT_NOFILE, &lim);
+  lim.rlim_cur = lim.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &lim);
+  return lim.rlim_cur;
+}
+
+static double bench_wakeups(size_t n_idle, size_t wakeups) {
+  Reactor reactor;
+  reactor_init(&reactor);
+
+  int *idle = calloc(n_idle, sizeof(int));
+  for (size_t i = 0; i < n_idle; i++) {
+    idle[i] = eventfd(0, EFD_NONBLOCK);
+    if (idle[i] < 0) {
+      ERROR(true, "eventfd")
+    }
+    reactor_add(&reactor, idle[i], REACTOR_READ);
+  }
+  int active = eventfd(0, EFD_NONBLOCK);
+  reactor_add(&reactor, active, REACTOR_READ);
+
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < wakeups; i++) {
+    uint64_t one = 1;
+    (void)write(active, &one, sizeof(one));
+    if (reactor_wait(&reactor, -1) != 1) {
+      ERROR(true, "unexpected wakeup")
+    }
+    (void)read(active, &one, sizeof(one));
+  }
+  uint64_t elapsed = monotonic_ns() - start;
+
+  close(active);
+  for (size_t i = 0; i < n_idle; i++) {
+    close(idle[i]);
+  }
+  free(idle);
+  reactor_cleanup(&reactor);
+
+  return (double)elapsed / (double)wakeups;
+}
+
+int main(int argc, char **argv) {
+  size_t wakeups = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+  size_t defaults[] = {0, 100, 1000, 10000, 50000};
+  size_t limit = raise_fd_limit();
+
+  printf("backend: %s, wakeups per run: %zu\n", reactor_backend(), wakeups);
+  printf("%12s %16s\n", "idle fds", "ns / wakeup");
+
+  size_t runs = argc > 2 ? (size_t)argc - 2 : sizeof(defaults) / sizeof(*defaults);
+  for (size_t i = 0; i < runs; i++) {
+    size_t n_idle = argc > 2 ? strtoul(argv[i + 2], NULL, 10) : defaults[i];
+    if (n_idle + 16 > limit) {
+      printf("%12zu %16s\n", n_idle, "(fd limit)");
+      continue;
+    }
+    printf("%12zu %16.0f\n", n_idle, bench_wakeups(n_idle, wakeups));
+  }
+
+  return EXIT_SUCCESS;
+}
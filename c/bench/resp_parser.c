@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resp.h"
+#include "utils.h"
+#include "vector.h"
+
+// usage: bench_resp_parser [stream MB] [rounds] [value size]
+//
+// parses a pipelined stream of SET/GET commands, once as a single buffer
+// and once fed in read()-sized chunks so every message boundary has to be
+// resumed, and reports parser throughput in GB/s
+
+int LOG_LEVEL = 0;
+
+const size_t CHUNK_SIZE = 16 * 1024;
+
+static void append(Vector *buf, const char *data, size_t len) {
+  size_t old = vector_length(buf);
+  if (!vector_grow(buf, old + len)) {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(buf->data + old, data, len);
+}
+
+static size_t build_stream(Vector *buf, size_t bytes, size_t value_size) {
+  char *value = malloc(value_size);
+  memset(value, 'x', value_size);
+  char head[128];
+  size_t commands = 0;
+  for (size_t i = 0; vector_length(buf) < bytes; i++, commands++) {
+    int n = 0;
+    if (i % 2 == 0) {
+      n = snprintf(head, sizeof(head),
+                   "*3\r\n$3\r\nSET\r\n$%d\r\nkey:%08zu\r\n$%zu\r\n", 12, i,
+                   value_size);
+      append(buf, head, n);
+      append(buf, value, value_size);
+      append(buf, "\r\n", 2);
+    } else {
+      n = snprintf(head, sizeof(head), "*2\r\n$3\r\nGET\r\n$%d\r\nkey:%08zu\r\n",
+                   12, i - 1);
+      append(buf, head, n);
+    }
+  }
+  free(value);
+  return commands;
+}
+
+// feeds at most `chunk` new bytes per call, like successive reads would
+static size_t parse_stream(RespParser *parser, const uint8_t *data,
+                           size_t len, size_t chunk) {
+  size_t parsed = 0;
+  size_t avail = chunk < len ? chunk : len;
+  resp_parser_reset(parser, 0);
+  while (parser->start < len) {
+    enum RespStatus status = resp_parse(parser, data, avail);
+    if (status == RESP_COMPLETE) {
+      parsed++;
+      resp_parser_reset(parser, parser->pos);
+    } else if (status == RESP_INCOMPLETE) {
+      avail = avail + chunk < len ? avail + chunk : len;
+    } else {
+      fprintf(stderr, "parse error: %s\n", parser->error);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return parsed;
+}
+
+static void run(const char *name, RespParser *parser, Vector *stream,
+                size_t rounds, size_t chunk, size_t commands) {
+  uint64_t start = monotonic_ns();
+  for (size_t r = 0; r < rounds; r++) {
+    if (parse_stream(parser, stream->data, vector_length(stream), chunk) !=
+        commands) {
+      fprintf(stderr, "command count mismatch\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  double secs = (double)(monotonic_ns() - start) / 1e9;
+  double bytes = (double)vector_length(stream) * (double)rounds;
+  printf("%-12s %8.2f GB/s %10.2f Mcmd/s\n", name, bytes / secs / 1e9,
+         (double)commands * (double)rounds / secs / 1e6);
+}
+
+int main(int argc, char **argv) {
+  size_t mbytes = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+  size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 5;
+  size_t value_size = argc > 3 ? strtoul(argv[3], NULL, 10) : 16;
+
+  Vector stream;
+  vector_initialize(&stream, 0, sizeof(uint8_t));
+  size_t commands = build_stream(&stream, mbytes << 20, value_size);
+  printf("stream: %zu MB, %zu commands, %zu byte values\n", mbytes, commands,
+         value_size);
+
+  RespParser parser;
+  resp_parser_init(&parser);
+  run("whole", &parser, &stream, rounds, vector_length(&stream), commands);
+  run("16k chunks", &parser, &stream, rounds, CHUNK_SIZE, commands);
+  resp_parser_cleanup(&parser);
+
+  vector_cleanup(&stream);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hashmap.h"
+#include "utils.h"
+
+// usage: bench_scan_<engine> [keys]
+//
+// cursor walks over an hmap, the way SCAN drives them. first a walk
+// while keys are inserted and deleted between every call, so the map
+// goes through several incremental resizes mid walk: every key present
+// for the whole walk has to come back at least once (the bench fails
+// otherwise), the duplicates are counted. then the latency of single
+// calls at COUNT 10, 100 and 1000 over a full walk of [keys] keys (1M
+// by default), p50 / p99 / max. built once per hashtable engine
+
+int LOG_LEVEL = 0;
+
+typedef struct Item {
+  HNode node;
+  uint64_t id;
+  uint32_t seen;
+} Item;
+
+static uint64_t item_eq(HNode *lhs, HNode *rhs) {
+  return container_of(lhs, Item, node)->id == container_of(rhs, Item, node)->id;
+}
+
+static Item *item_new(uint64_t id) {
+  Item *item = calloc(1, sizeof(Item));
+  item->id = id;
+  item->node.hash = hash_bytes((const uint8_t *)&id, sizeof(id));
+  return item;
+}
+
+static void item_free(HMap *map, Item *item) {
+  HNode *node = hmap_pop(map, &item->node);
+  if (node != &item->node) {
+    fprintf(stderr, "item %llu missing\n", (unsigned long long)item->id);
+    exit(EXIT_FAILURE);
+  }
+  free(item);
+}
+
+static void mark_seen(HNode *node, void *arg) {
+  size_t *found = arg;
+  container_of(node, Item, node)->seen++;
+  (*found)++;
+}
+
+// one SCAN call, as keyspace_scan does it
+static uint64_t scan_call(HMap *map, uint64_t cursor, size_t count) {
+  size_t found = 0;
+  size_t budget = count * 10;
+  do {
+    cursor = hmap_scan(map, cursor, mark_seen, &found);
+  } while (cursor && found < count && --budget > 0);
+  return cursor;
+}
+
+// stable keys stay for the whole walk, churn keys come and go: each call
+// inserts a batch and deletes an older one, growing the map to 8x the
+// stable keys before the walk ends
+static void run_churn(size_t stable) {
+  HMap map = {0};
+  hmap_initialize(&map, NULL, item_eq);
+  Item **keep = malloc(stable * sizeof(Item *));
+  for (size_t i = 0; i < stable; i++) {
+    keep[i] = item_new(i);
+    hmap_insert(&map, &keep[i]->node);
+  }
+  size_t churn_cap = stable * 8;
+  Item **churn = malloc(churn_cap * sizeof(Item *));
+  size_t head = 0; // oldest live churn key
+  size_t tail = 0; // next one to insert
+  uint64_t next_id = stable;
+
+  size_t calls = 0;
+  size_t resizes = 0;
+  bool resizing = false;
+  uint64_t cursor = 0;
+  do {
+    cursor = scan_call(&map, cursor, 10);
+    calls++;
+    for (size_t i = 0; i < 64 && tail < churn_cap; i++) {
+      churn[tail] = item_new(next_id++);
+      hmap_insert(&map, &churn[tail++]->node);
+    }
+    for (size_t i = 0; i < 16 && head < tail; i++) {
+      item_free(&map, churn[head++]);
+    }
+    if (map.ht2.tab && !resizing) {
+      resizes++;
+    }
+    resizing = map.ht2.tab != NULL;
+  } while (cursor);
+
+  size_t missed = 0;
+  size_t dups = 0;
+  for (size_t i = 0; i < stable; i++) {
+    missed += keep[i]->seen == 0;
+    dups += keep[i]->seen > 1 ? keep[i]->seen - 1 : 0;
+  }
+  printf("%zu stable keys, %zu calls, %zu resizes: %zu missed, %zu "
+         "duplicates\n",
+         stable, calls, resizes, missed, dups);
+  for (size_t i = 0; i < stable; i++) {
+    item_free(&map, keep[i]);
+  }
+  while (head < tail) {
+    item_free(&map, churn[head++]);
+  }
+  hmap_destroy(&map);
+  free(keep);
+  free(churn);
+  if (missed) {
+    fprintf(stderr, "the walk missed keys\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static int cmp_u64(const void *lhs, const void *rhs) {
+  uint64_t a = *(const uint64_t *)lhs;
+  uint64_t b = *(const uint64_t *)rhs;
+  return (a > b) - (a < b);
+}
+
+static void run_latency(size_t keys) {
+  HMap map = {0};
+  hmap_initialize(&map, NULL, item_eq);
+  Item **items = malloc(keys * sizeof(Item *));
+  for (size_t i = 0; i < keys; i++) {
+    items[i] = item_new(i);
+    hmap_insert(&map, &items[i]->node);
+  }
+  // lookups finish a resize the inserts started
+  while (map.ht2.tab) {
+    (void)hmap_lookup(&map, &items[0]->node);
+  }
+
+  printf("%zu keys\n%8s %8s %10s %10s %10s\n", keys, "count", "calls",
+         "p50 ns", "p99 ns", "max ns");
+  const size_t counts[] = {10, 100, 1000};
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    size_t cap = keys / counts[c] * 2 + 16;
+    uint64_t *lat = malloc(cap * sizeof(uint64_t));
+    size_t calls = 0;
+    uint64_t cursor = 0;
+    do {
+      uint64_t start = monotonic_ns();
+      cursor = scan_call(&map, cursor, counts[c]);
+      if (calls < cap) {
+        lat[calls++] = monotonic_ns() - start;
+      }
+    } while (cursor);
+    qsort(lat, calls, sizeof(uint64_t), cmp_u64);
+    printf("%8zu %8zu %10llu %10llu %10llu\n", counts[c], calls,
+           (unsigned long long)lat[calls / 2],
+           (unsigned long long)lat[calls * 99 / 100],
+           (unsigned long long)lat[calls - 1]);
+    free(lat);
+  }
+
+  for (size_t i = 0; i < keys; i++) {
+    item_free(&map, items[i]);
+  }
+  hmap_destroy(&map);
+  free(items);
+}
+
+int main(int argc, char **argv) {
+#ifdef HTABLE_SWISS
+  printf("engine: swiss\n");
+#else
+  printf("engine: chained\n");
+#endif
+  size_t keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  run_churn(1000);
+  run_churn(100000);
+  run_latency(keys);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+
+// usage: bench_shard_scaling [max_threads] [clients] [seconds] [pipeline]
+//
+// starts the sharded server in process with 1..max_threads reactor threads
+// and reports the SET+GET throughput of pipelining clients against it.
+// keys are random, so most multi-shard runs pay for some forwarding; the
+// clients share the machine with the server, so ops/sec only scales while
+// there are cores left for both
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 16379
+#define VALUE "vvvvvvvv"
+// "+OK\r\n" then "$8\r\nvvvvvvvv\r\n"
+#define PAIR_REPLY_LEN (5 + 14)
+
+typedef struct Client {
+  uint16_t port;
+  size_t pipeline;
+  unsigned int seed;
+  atomic_bool *stop;
+  uint64_t ops;
+} Client;
+
+static void *client_run(void *arg) {
+  Client *client = arg;
+  int fd = bench_connect(client->port);
+
+  size_t cap = client->pipeline * 96;
+  char *req = malloc(cap);
+  char *resp = malloc(client->pipeline * PAIR_REPLY_LEN);
+  while (!atomic_load(client->stop)) {
+    size_t len = 0;
+    for (size_t i = 0; i < client->pipeline; i++) {
+      char key[16];
+      int key_len = snprintf(key, sizeof(key), "k%06u",
+                             rand_r(&client->seed) % 1000000);
+      len += snprintf(req + len, cap - len,
+                      "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$8\r\n" VALUE "\r\n"
+                      "*2\r\n$3\r\nGET\r\n$%d\r\n%s\r\n",
+                      key_len, key, key_len, key);
+    }
+    for (size_t sent = 0; sent < len;) {
+      ssize_t res = write(fd, req + sent, len - sent);
+      if (res <= 0) {
+        ERROR(true, "bench write failed")
+      }
+      sent += res;
+    }
+    size_t want = client->pipeline * PAIR_REPLY_LEN;
+    for (size_t got = 0; got < want;) {
+      ssize_t res = read(fd, resp + got, want - got);
+      if (res <= 0) {
+        ERROR(true, "bench read failed")
+      }
+      got += res;
+    }
+    client->ops += client->pipeline * 2;
+  }
+
+  free(req);
+  free(resp);
+  close(fd);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : 4;
+  size_t clients = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+  double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+  size_t pipeline = argc > 4 ? strtoul(argv[4], NULL, 10) : 32;
+
+  printf("%8s %12s %14s\n", "threads", "ops", "ops/sec");
+  for (size_t threads = 1; threads <= max_threads; threads++) {
+    // a fresh port per run, the previous listeners may linger in TIME_WAIT
+    ServerConfig config = {
+        .address = INADDR_LOOPBACK,
+        .port = (uint16_t)(BENCH_PORT + threads),
+        .threads = threads,
+    };
+    Shards *shards = shards_new(&config);
+    pthread_t server;
+    pthread_create(&server, NULL, bench_shards_thread, shards);
+
+    atomic_bool stop;
+    atomic_init(&stop, false);
+    Client *state = calloc(clients, sizeof(Client));
+    pthread_t *tids = calloc(clients, sizeof(pthread_t));
+    for (size_t i = 0; i < clients; i++) {
+      state[i] = (Client){.port = config.port,
+                          .pipeline = pipeline,
+                          .seed = (unsigned int)(i + 1),
+                          .stop = &stop};
+      pthread_create(&tids[i], NULL, client_run, &state[i]);
+    }
+
+    uint64_t start = monotonic_ns();
+    usleep((useconds_t)(seconds * 1e6));
+    atomic_store(&stop, true);
+    uint64_t ops = 0;
+    for (size_t i = 0; i < clients; i++) {
+      pthread_join(tids[i], NULL);
+      ops += state[i].ops;
+    }
+    double elapsed = (double)(monotonic_ns() - start) / 1e9;
+
+    shards_stop(shards);
+    pthread_join(server, NULL);
+    shards_cleanup(shards);
+    free(state);
+    free(tids);
+
+    printf("%8zu %12lu %14.0f\n", threads, ops, (double)ops / elapsed);
+  }
+
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "keyspace.h"
+#include "server.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "utils.h"
+
+// usage: bench_snapshot [keys] [value_bytes] [path]
+//
+// fills a keyspace, then reports how long a fork takes (the only time
+// BGSAVE stops the shards), snapshot write throughput and how long a
+// restart takes to load it back, per GB of snapshot
+
+int LOG_LEVEL = 0;
+
+#define BENCH_PORT 16581
+
+static size_t rss_bytes(void) {
+  size_t pages = 0;
+  size_t resident = 0;
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (!file) {
+    return 0;
+  }
+  if (fscanf(file, "%zu %zu", &pages, &resident) != 2) {
+    resident = 0;
+  }
+  fclose(file);
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char **argv) {
+  size_t keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000000;
+  size_t val_len = argc > 2 ? strtoul(argv[2], NULL, 10) : 100;
+  const char *path = argc > 3 ? argv[3] : "bench.snap";
+
+  ServerConfig config = {.address = INADDR_LOOPBACK,
+                         .port = BENCH_PORT,
+                         .threads = 1,
+                         .snapshot_path = path};
+  Shards *shards = shards_new(&config);
+  Keyspace *ks = &shards->servers[0]->keyspace;
+  char key[32];
+  uint8_t *val = malloc(val_len);
+  memset(val, 'v', val_len);
+  for (size_t i = 0; i < keys; i++) {
+    int len = sprintf(key, "key:%zu", i);
+    keyspace_set(ks, (uint8_t *)key, (size_t)len, val, val_len);
+  }
+  free(val);
+  double rss_gb = (double)rss_bytes() / 1e9;
+
+  uint64_t start = monotonic_ns();
+  pid_t pid = fork();
+  if (pid == 0) {
+    _exit(0);
+  }
+  double fork_ms = (double)(monotonic_ns() - start) / 1e6;
+  waitpid(pid, NULL, 0);
+  printf("fork: %.1f ms with %.2f GB resident (%.1f ms/GB)\n", fork_ms,
+         rss_gb, fork_ms / rss_gb);
+
+  SnapStats stats;
+  start = monotonic_ns();
+  if (!snapshot_write(shards, path, &stats)) {
+    return 1;
+  }
+  double secs = (double)(monotonic_ns() - start) / 1e9;
+  double gb = (double)stats.bytes / 1e9;
+  printf("write: %zu keys, %.2f GB in %.2f s, %.0f MB/s\n", keys, gb, secs,
+         (double)stats.bytes / 1e6 / secs);
+  shards_cleanup(shards);
+
+  shards = shards_new(&config);
+  start = monotonic_ns();
+  if (!snapshot_load(shards, path, &stats)) {
+    return 1;
+  }
+  secs = (double)(monotonic_ns() - start) / 1e9;
+  printf("load: %.2f s, %.2f s/GB, %.0f keys/s\n", secs, secs / gb,
+         (double)stats.keys / secs);
+  shards_cleanup(shards);
+  unlink(path);
+  return 0;
+}
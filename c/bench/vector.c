@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "vec.h"
+#include "vector.h"
+
+// usage: bench_vector [elements] [inserts]
+//
+// ns per operation of the byte-wise Vector as it was (element by element
+// inserts, zeroed growth, every access a call), the Vector now and the
+// typed SliceVec from VEC_DEFINE: push_back and reads of elements
+// (default 10M Slices), inserts at the front (default 20K), small appends
+// to a byte buffer as replies are written and reads into a grown buffer
+
+int LOG_LEVEL = 0;
+
+#define APPEND_BYTES (64 * 1024 * 1024)
+#define READ_CHUNK (16 * 1024)
+#define GET_ELEMENTS 4096
+
+// the Vector before VEC_DEFINE came along, calls kept out of line as they
+// were in vector.c
+static void old_init(Vector *vector, size_t data_size) {
+  *vector = (Vector){.data_size = data_size,
+                     .capacity = 4,
+                     .data = calloc(4, data_size)};
+}
+
+__attribute__((noinline)) static uint8_t *old_get_at(const Vector *vector,
+                                                     size_t position) {
+  if (position >= vector->length) {
+    return NULL;
+  }
+  return &vector->data[position * vector->data_size];
+}
+
+__attribute__((noinline)) static void old_resize(Vector *vector,
+                                                 size_t size) {
+  if (size == vector->length) {
+    return;
+  }
+  if (size > vector->capacity) {
+    while (vector->capacity < size) {
+      vector->capacity <<= 1;
+    }
+    uint8_t *new_data =
+        realloc(vector->data, vector->capacity * vector->data_size);
+    if (new_data == NULL) {
+      return;
+    }
+    vector->data = new_data;
+  }
+  if (size > vector->length) {
+    memset(&vector->data[vector->length * vector->data_size], 0,
+           (size - vector->length) * vector->data_size);
+  }
+  vector->length = size;
+}
+
+__attribute__((noinline)) static bool
+old_insert(Vector *vector, const uint8_t *value, size_t position) {
+  if (value == NULL || position > vector->length) {
+    return false;
+  }
+  old_resize(vector, vector->length + 1);
+  for (size_t pos = vector->length - 1; pos > position; pos--) {
+    memcpy(old_get_at(vector, pos), old_get_at(vector, pos - 1),
+           vector->data_size);
+  }
+  memcpy(old_get_at(vector, position), value, vector->data_size);
+  return true;
+}
+
+__attribute__((noinline)) static bool old_push_back(Vector *vector,
+                                                    const uint8_t *value) {
+  if (value == NULL) {
+    return false;
+  }
+  old_insert(vector, value, vector->length);
+  return true;
+}
+
+__attribute__((noinline)) static void
+old_append(Vector *vector, const uint8_t *values, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  size_t old_length = vector->length;
+  old_resize(vector, old_length + count);
+  memcpy(old_get_at(vector, old_length), values, vector->data_size * count);
+}
+
+enum Impl { IMPL_OLD, IMPL_VECTOR, IMPL_TYPED, IMPL_COUNT };
+static const char *impl_names[IMPL_COUNT] = {"Vector (old)", "Vector",
+                                             "SliceVec"};
+
+static double bench_push(enum Impl impl, size_t n) {
+  Vector vector;
+  SliceVec typed = {0};
+  if (impl == IMPL_OLD) {
+    old_init(&vector, sizeof(Slice));
+  } else {
+    vector_initialize(&vector, 0, sizeof(Slice));
+  }
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < n; i++) {
+    Slice slice = {(const uint8_t *)i, i};
+    if (impl == IMPL_OLD) {
+      old_push_back(&vector, (const uint8_t *)&slice);
+    } else if (impl == IMPL_VECTOR) {
+      vector_push_back(&vector, (const uint8_t *)&slice);
+    } else {
+      slice_vec_push_back(&typed, slice);
+    }
+  }
+  double ns = (double)(monotonic_ns() - start) / (double)n;
+  vector_cleanup(&vector);
+  slice_vec_cleanup(&typed);
+  return ns;
+}
+
+// in order over a cache resident vector, so the access is what is timed
+static double bench_get(enum Impl impl, size_t n) {
+  Vector vector;
+  vector_initialize(&vector, GET_ELEMENTS, sizeof(Slice));
+  SliceVec typed = {0};
+  slice_vec_resize(&typed, GET_ELEMENTS);
+  for (size_t i = 0; i < GET_ELEMENTS; i++) {
+    ((Slice *)vector.data)[i].len = i;
+    typed.data[i].len = i;
+  }
+  size_t sum = 0;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < n; i++) {
+    size_t at = i % GET_ELEMENTS;
+    if (impl == IMPL_OLD) {
+      sum += ((Slice *)old_get_at(&vector, at))->len;
+    } else if (impl == IMPL_VECTOR) {
+      sum += ((Slice *)vector_get_at(&vector, at))->len;
+    } else {
+      sum += slice_vec_at(&typed, at)->len;
+    }
+  }
+  double ns = (double)(monotonic_ns() - start) / (double)n;
+  if (sum == 42) {
+    printf("\n"); // keeps the reads
+  }
+  vector_cleanup(&vector);
+  slice_vec_cleanup(&typed);
+  return ns;
+}
+
+static double bench_insert(enum Impl impl, size_t n) {
+  Vector vector;
+  SliceVec typed = {0};
+  if (impl == IMPL_OLD) {
+    old_init(&vector, sizeof(Slice));
+  } else {
+    vector_initialize(&vector, 0, sizeof(Slice));
+  }
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < n; i++) {
+    Slice slice = {NULL, i};
+    if (impl == IMPL_OLD) {
+      old_insert(&vector, (const uint8_t *)&slice, 0);
+    } else if (impl == IMPL_VECTOR) {
+      vector_insert(&vector, (const uint8_t *)&slice, 0);
+    } else {
+      slice_vec_insert(&typed, 0, slice);
+    }
+  }
+  double ns = (double)(monotonic_ns() - start) / (double)n;
+  vector_cleanup(&vector);
+  slice_vec_cleanup(&typed);
+  return ns;
+}
+
+// "$16\r\n" then 16 bytes then "\r\n", as resp_write_bulk appends them
+static double bench_append(enum Impl impl) {
+  static const uint8_t value[16] = "vvvvvvvvvvvvvvvv";
+  Vector vector;
+  if (impl == IMPL_OLD) {
+    old_init(&vector, sizeof(uint8_t));
+  } else {
+    vector_initialize(&vector, 0, sizeof(uint8_t));
+  }
+  size_t appends = 0;
+  uint64_t start = monotonic_ns();
+  for (int round = 0; round < 4; round++) {
+    vector.length = 0;
+    while (vector.length < APPEND_BYTES) {
+      if (impl == IMPL_OLD) {
+        old_append(&vector, (const uint8_t *)"$16\r\n", 5);
+        old_append(&vector, value, sizeof(value));
+        old_append(&vector, (const uint8_t *)"\r\n", 2);
+      } else {
+        vector_append(&vector, (const uint8_t *)"$16\r\n", 5);
+        vector_append(&vector, value, sizeof(value));
+        vector_append(&vector, (const uint8_t *)"\r\n", 2);
+      }
+      appends += 3;
+    }
+  }
+  double ns = (double)(monotonic_ns() - start) / (double)appends;
+  vector_cleanup(&vector);
+  return ns;
+}
+
+// a chunk read behind what is buffered, then the buffer consumed, as
+// the AOF loader refills. the chunk is written as read() would
+static double bench_read(enum Impl impl) {
+  static uint8_t chunk[READ_CHUNK];
+  Vector vector;
+  if (impl == IMPL_OLD) {
+    old_init(&vector, sizeof(uint8_t));
+  } else {
+    vector_initialize(&vector, 0, sizeof(uint8_t));
+  }
+  size_t rounds = APPEND_BYTES / READ_CHUNK * 4;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < rounds; i++) {
+    size_t rest = (i * 37) % 512; // a partial command left over
+    vector.length = rest;
+    if (impl == IMPL_OLD) {
+      old_resize(&vector, rest + READ_CHUNK);
+    } else if (!vector_grow(&vector, rest + READ_CHUNK)) {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    memcpy(vector.data + rest, chunk, READ_CHUNK);
+  }
+  double ns = (double)(monotonic_ns() - start) / (double)rounds;
+  vector_cleanup(&vector);
+  return ns;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+  size_t inserts = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+
+  printf("%-14s %10s %10s %12s %10s %12s\n", "ns per op", "push_back",
+         "get_at", "insert @0", "append", "16KB read");
+  for (int impl = 0; impl < IMPL_COUNT; impl++) {
+    double push = bench_push(impl, n);
+    double get = bench_get(impl, n);
+    double insert = bench_insert(impl, inserts);
+    double append = impl == IMPL_TYPED ? 0 : bench_append(impl);
+    double read = impl == IMPL_TYPED ? 0 : bench_read(impl);
+    printf("%-14s %10.2f %10.2f %12.1f", impl_names[impl], push, get,
+           insert);
+    if (impl == IMPL_TYPED) {
+      printf(" %10s %12s\n", "-", "-"); // byte buffers stay Vectors
+    } else {
+      printf(" %10.2f %12.1f\n", append, read);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+#include "zset.h"
+
+// usage: bench_zset [members] [queries]
+//
+// ZADD rate and bytes per member while one sorted set grows to members,
+// then ZRANK and ZRANGE / ZRANGEBYSCORE ... LIMIT with offsets near the
+// start and near the end of the set. with ranks kept in the tree both
+// offsets should cost about the same, a list walk would not
+
+int LOG_LEVEL = 0;
+
+#define PAGE 10 // members returned per range query
+
+// small chunks plus the mmapped ones (tables)
+static size_t heap_used(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+// walks PAGE members from node, as a reply would
+static size_t walk_page(ZNode *node) {
+  size_t bytes = 0;
+  for (int i = 0; node && i < PAGE; i++, node = znode_offset(node, 1)) {
+    bytes += node->len;
+  }
+  return bytes;
+}
+
+// ns per ZRANGE of PAGE members starting at a random rank below span,
+// counted from the start or from the end of the set
+static double bench_range(ZSet *zset, size_t queries, size_t span,
+                          bool from_end, size_t *sink) {
+  unsigned int seed = 7;
+  size_t size = zset_size(zset);
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < queries; i++) {
+    size_t off = (size_t)rand_r(&seed) % span;
+    *sink += walk_page(zset_at(zset, (int64_t)(from_end ? size - 1 - off
+                                                        : off)));
+  }
+  return (double)(monotonic_ns() - start) / (double)queries;
+}
+
+// ns per ZRANGEBYSCORE -inf +inf LIMIT offset PAGE
+static double bench_by_score(ZSet *zset, size_t queries, size_t lo,
+                             size_t hi, size_t *sink) {
+  unsigned int seed = 9;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < queries; i++) {
+    size_t off = lo + (size_t)rand_r(&seed) % (hi - lo);
+    ZNode *first = zset_seek(zset, -1.0, false);
+    *sink += walk_page(znode_offset(first, (int64_t)off));
+  }
+  return (double)(monotonic_ns() - start) / (double)queries;
+}
+
+int main(int argc, char **argv) {
+  size_t members = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+  size_t queries = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+  size_t before = heap_used();
+  ZSet *zset = zset_new();
+  char name[32];
+  unsigned int seed = 1;
+  uint64_t start = monotonic_ns();
+  for (size_t i = 0; i < members; i++) {
+    int len = sprintf(name, "member:%zu", i);
+    zset_add(zset, (uint8_t *)name, (size_t)len,
+             (double)rand_r(&seed) / RAND_MAX);
+  }
+  double add_ns = (double)(monotonic_ns() - start) / (double)members;
+  printf("ZADD: %zu members, %.0f ns/op, %.1f bytes/member (%.1f counted)\n",
+         members, add_ns, (double)(heap_used() - before) / (double)members,
+         (double)zset_memory(zset) / (double)members);
+
+  size_t sink = 0;
+  start = monotonic_ns();
+  for (size_t i = 0; i < queries; i++) {
+    int len = sprintf(name, "member:%zu", (size_t)rand_r(&seed) % members);
+    sink += (size_t)znode_rank(zset_lookup(zset, (uint8_t *)name,
+                                           (size_t)len));
+  }
+  printf("ZRANK: %.0f ns/op\n",
+         (double)(monotonic_ns() - start) / (double)queries);
+
+  size_t head = members < 1000 ? members : 1000;
+  printf("ZRANGE %d members: %.0f ns/op at offsets < %zu, %.0f ns/op in "
+         "the whole set, %.0f ns/op at the last %zu\n",
+         PAGE, bench_range(zset, queries, head, false, &sink),
+         head, bench_range(zset, queries, members, false, &sink),
+         bench_range(zset, queries, head, true, &sink), head);
+
+  size_t tail = members > head ? members - head : 0;
+  printf("ZRANGEBYSCORE ... LIMIT <offset> %d: %.0f ns/op at offsets < %zu, "
+         "%.0f ns/op at offsets >= %zu\n",
+         PAGE, bench_by_score(zset, queries, 0, head, &sink), head,
+         bench_by_score(zset, queries, tail, members, &sink), tail);
+
+  start = monotonic_ns();
+  zset_free(zset);
+  printf("free: %.0f ns/member (checksum %zu)\n",
+         (double)(monotonic_ns() - start) / (double)members, sink);
+  return 0;
+}
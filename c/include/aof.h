@@ -0,0 +1,93 @@
+#ifndef AOF_H
+#define AOF_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dlist.h"
+#include "utils.h"
+#include "vector.h"
+
+struct Server;
+struct Shards;
+
+// when the log is fsynced, see aof_flush
+enum AofFsync {
+  AOF_FSYNC_NO,       // left to the kernel
+  AOF_FSYNC_EVERYSEC, // by a background thread, once a second
+  AOF_FSYNC_ALWAYS,   // before the reply of a logged command goes out
+};
+
+typedef enum AofResult {
+  AOF_OK,
+  AOF_OFF,
+  AOF_BUSY,   // a rewrite is running already
+  AOF_FAILED, // see the log
+} AofResult;
+
+typedef struct AofStats {
+  uint64_t commands;
+  uint64_t bytes;
+  bool truncated; // the tail held half a command, it was cut off
+} AofStats;
+
+// append only log of every write, as the commands that replay it. each
+// shard logs what it runs into its own AofShard buffer and writes that
+// with a single write per loop iteration (group commit). the shards share
+// the file, it is opened O_APPEND so their writes never interleave.
+// a rewrite forks a child that writes the live keyspaces as commands,
+// what the shards log meanwhile is kept aside and appended to its result
+typedef struct Aof {
+  const char *path; // NULL while the log is off
+  enum AofFsync fsync;
+  int fd;
+  atomic_uint_fast64_t size;      // bytes in the file
+  atomic_uint_fast64_t base_size; // after the last rewrite
+  // everysec: the syncer thread, it holds lock while it syncs
+  pthread_t syncer;
+  pthread_mutex_t lock; // fd is only swapped while holding it
+  pthread_cond_t cond;
+  bool stopping;
+  atomic_bool dirty; // written since the last fsync
+  // background rewrite, rewriting only changes while the shards are paused
+  atomic_int child;     // pid, 0 when none
+  struct Server *owner; // the shard that forked it, it finishes the rewrite
+  bool rewriting;
+  bool reaped; // the child exited with status, the swap is still to do
+  int status;
+  uint64_t started_ms; // monotonic
+  uint64_t next_poll_ms;
+  uint64_t next_auto_ms; // a failed rewrite delays the next automatic one
+  atomic_bool last_ok;
+  atomic_uint_fast64_t last_ms;
+} Aof;
+
+// the side of the log that belongs to one shard, only touched by its
+// thread or while the shards are paused
+typedef struct AofShard {
+  Vector buf;      // logged since the last flush
+  Vector diff;     // flushed while a rewrite runs, appended to its result
+  DList waiting;   // conns whose replies wait for the fsync (always)
+  Vector parts;    // ShardPart * run here, posted back after the fsync
+  uint64_t logged; // bytes ever logged, positions in the log count these
+  uint64_t synced; // how many of them were flushed (and synced, always)
+} AofShard;
+
+bool aof_parse_fsync(const char *name, enum AofFsync *fsync);
+const char *aof_fsync_name(enum AofFsync fsync);
+void aof_init(Aof *aof, const char *path, enum AofFsync fsync);
+void aof_shard_init(AofShard *log);
+void aof_shard_cleanup(AofShard *log);
+bool aof_load(struct Shards *shards, const char *path, AofStats *stats);
+bool aof_open(struct Shards *shards);
+void aof_feed(struct Server *serv, const Slice *argv, size_t argc);
+bool aof_must_wait(const struct Server *serv, uint64_t mark);
+void aof_flush(struct Server *serv);
+AofResult aof_rewrite(struct Server *serv);
+int aof_poll(struct Server *serv);
+void aof_cleanup(struct Shards *shards);
+
+#endif // AOF_H
@@ -0,0 +1,26 @@
+#ifndef AVL_H
+#define AVL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// intrusive avl tree, should be embedded into the payload. every node
+// also counts its subtree so ranks and offsets are O(log n). the tree
+// is ordered by its owner: it finds the spot, links the node in and
+// calls avl_fix
+typedef struct AVLNode {
+  struct AVLNode *parent;
+  struct AVLNode *left;
+  struct AVLNode *right;
+  uint32_t height;
+  uint32_t count; // nodes in this subtree, itself included
+} AVLNode;
+
+void avl_init(AVLNode *node);
+uint32_t avl_count(const AVLNode *node);
+AVLNode *avl_fix(AVLNode *node);
+AVLNode *avl_del(AVLNode *node);
+AVLNode *avl_offset(AVLNode *node, int64_t offset);
+int64_t avl_rank(const AVLNode *node);
+
+#endif // AVL_H
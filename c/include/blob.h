@@ -0,0 +1,22 @@
+#ifndef BLOB_H
+#define BLOB_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// an immutable refcounted byte string. long values live in one, so a
+// reply can keep sending a value (see output_ref) after the key was
+// overwritten or deleted. the count is atomic: a reply forwarded from
+// another shard drops its reference on the thread of the conn
+typedef struct Blob {
+  atomic_uint refs;
+  uint8_t data[];
+} Blob;
+
+Blob *blob_new(const uint8_t *data, size_t len);
+Blob *blob_ref(Blob *blob);
+void blob_unref(Blob *blob);
+size_t blob_memory(const Blob *blob);
+
+#endif // BLOB_H
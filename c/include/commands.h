@@ -0,0 +1,50 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "output.h"
+#include "utils.h"
+#include "vector.h"
+
+struct Conn;
+struct Server;
+
+// how replies of a command split across shards are put back together
+enum CommandMerge {
+  MERGE_NONE,  // keys always live on one shard
+  MERGE_SUM,   // integer replies are added up
+  MERGE_ARRAY, // one element per key, back in request order
+  MERGE_OK,    // +OK unless a part failed
+};
+
+enum CommandFlags {
+  CMD_WRITE = 1 << 0, // logged to the aof unless it replied with an error
+  CMD_CURSOR = 1 << 1, // argv[1] is a SCAN cursor, it picks the shard
+  CMD_DENYOOM = 1 << 2, // adds data, refused while over maxmemory
+};
+
+// arity counts the command name, negative means "at least -arity"
+// keys are at first_key, first_key + key_step, ... up to last_key
+// (negative counts from the end), first_key 0 means no keys
+typedef struct Command {
+  const char *name;
+  int arity;
+  void (*proc)(struct Server *serv, Slice *argv, size_t argc, Output *out);
+  int first_key;
+  int last_key;
+  int key_step;
+  enum CommandMerge merge;
+  int flags; // CommandFlags
+} Command;
+
+size_t command_count(void);
+const Command *command_at(size_t index);
+const Command *command_lookup(const Slice *name);
+const Command *command_check(Slice *argv, size_t argc, Output *out);
+void command_execute(struct Server *serv, Slice *argv, size_t argc,
+                     Output *out);
+bool command_dispatch(struct Conn *conn, Slice *argv, size_t argc);
+
+#endif // COMMANDS_H
@@ -1,24 +1,73 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "dlist.h"
+#include "output.h"
+#include "pool.h"
+#include "resp.h"
+#include "utils.h"
 #include "vector.h"
 
+struct Server;
+struct ShardReq;
+
+// largest request a conn may send unless the config says otherwise
+#define CONN_MAX_REQUEST (64 * 1024 * 1024)
+
 enum ConnectionState { STATE_REQ, STATE_RES, STATE_END };
 
+// operations submitted to a completion based engine (io_uring) that did
+// not complete yet, they still point into the conn buffers
+enum ConnIoOps {
+  CONN_IO_RECV = 1 << 0,
+  CONN_IO_SEND = 1 << 1,
+  CONN_IO_CANCEL = 1 << 2, // the recv was asked to stop
+};
+
+// conns come out of their server's pool, rbuf and the wbuf storage are
+// only lent to them while they hold unprocessed input / unsent output
 typedef struct Conn {
   int fd;
+  struct Server *serv;
+  Pool *pool;
   enum ConnectionState state;
   size_t rbuf_size;
-  Vector rbuf;
-  size_t wbuf_sent;
+  uint8_t *rbuf;     // NULL while idle, grows for large requests
+  size_t rbuf_alloc; // size of the block, lent by the pool
+  // bytes a completion based engine received that rbuf had no room for
+  Vector backlog;
+  RespParser parser;
+  SliceVec argv; // into rbuf, per argument of the current command
+  size_t wbuf_sent; // of the whole stream, referenced values included
   Vector wbuf;
+  Vector wrefs; // OutRef, long values sent in between wbuf bytes
+  // command waiting on other shards, input is parked until it completes
+  struct ShardReq *pending;
+  bool eof; // the peer closed its side, ends once its input is answered
+  uint8_t io_ops; // ConnIoOps
+  // in the server's idle list, which is kept in last activity order
+  DList idle_node;
+  uint64_t last_active; // monotonic ms
+  // position in the shard's log after the last write the conn ran, with
+  // appendfsync always its replies wait (in the server's list) until the
+  // log is synced up to there
+  uint64_t log_end;
+  DList log_node;
 } Conn;
 
-Conn *connection_create(int fd);
+Conn *connection_create(int fd, struct Server *serv, Pool *pool);
+Output connection_output(Conn *conn);
 void connection_io(Conn *conn);
+// completion based engines move the bytes themselves and report here
+bool connection_wants_input(const Conn *conn);
+void connection_received(Conn *conn, const uint8_t *data, size_t len);
+void connection_sent(Conn *conn, size_t len);
+void connection_advance(Conn *conn);
 void connection_close(Conn *conn);
+void connection_pool_cleanup(Pool *pool);
 
 #endif // CONNECTION_H
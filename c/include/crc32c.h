@@ -0,0 +1,11 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// crc-32c (castagnoli), chained by passing the previous result as crc,
+// start from 0. uses the sse4.2 crc32 instruction when the cpu has it
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif // CRC32C_H
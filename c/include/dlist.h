@@ -0,0 +1,19 @@
+#ifndef DLIST_H
+#define DLIST_H
+
+#include <stdbool.h>
+
+// intrusive circular doubly linked list, should be embedded into the
+// payload. a node on its own links to itself, which is also how the
+// head of an empty list looks
+typedef struct DList {
+  struct DList *prev;
+  struct DList *next;
+} DList;
+
+void dlist_init(DList *node);
+bool dlist_empty(const DList *head);
+void dlist_detach(DList *node);
+void dlist_push_back(DList *head, DList *node);
+
+#endif // DLIST_H
@@ -0,0 +1,54 @@
+#ifndef EVICT_H
+#define EVICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "keyspace.h"
+#include "utils.h"
+
+// which keys go once a shard is over its share of maxmemory
+enum EvictPolicy {
+  EVICT_NOEVICTION,   // none, commands that add data fail instead
+  EVICT_ALLKEYS_LRU,  // the least recently used of all keys
+  EVICT_ALLKEYS_LFU,  // the least frequently used of all keys
+  EVICT_VOLATILE_LRU, // like allkeys-lru among the keys with a ttl
+  EVICT_VOLATILE_LFU, // like allkeys-lfu among the keys with a ttl
+};
+
+// candidates kept between evictions, and keys sampled per eviction
+#define EVICT_POOL_SIZE 16
+#define EVICT_SAMPLES 5
+
+// a sampled key, by name as it may be gone by the time it is picked
+typedef struct EvictCandidate {
+  uint64_t idle; // see keyspace_idle
+  uint8_t *key;
+  size_t len;
+  size_t cap;
+} EvictCandidate;
+
+// approximate LRU / LFU as in redis: every eviction samples a few keys
+// from random buckets (or random ttls) into a pool sorted on how idle
+// they are and evicts the most idle key of the pool. the pool carries
+// the best candidates of earlier samples over, which brings the choice
+// close to the exact one for a handful of samples
+typedef struct Evictor {
+  enum EvictPolicy policy;
+  size_t samples;
+  EvictCandidate pool[EVICT_POOL_SIZE]; // most idle last
+  size_t used;
+  uint64_t rng;
+  uint64_t evicted; // keys
+} Evictor;
+
+bool evict_parse_policy(const char *name, enum EvictPolicy *policy);
+const char *evict_policy_name(enum EvictPolicy policy);
+void evictor_init(Evictor *ev, Keyspace *ks, enum EvictPolicy policy,
+                  size_t samples);
+bool evict_until(Evictor *ev, Keyspace *ks, size_t limit,
+                 void (*fn)(void *, const Slice *), void *arg);
+void evictor_cleanup(Evictor *ev);
+
+#endif // EVICT_H
@@ -0,0 +1,89 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// keys are hashed with wyhash (final version 4) under a seed picked at
+// random when the process starts, so which keys collide can't be worked
+// out from outside. the hash is inline: it runs once per command and a
+// call costs about as much as hashing a short key
+
+// the seed already mixed with the secret, see hash_seed_init
+extern uint64_t hash_seed;
+
+void hash_seed_init(void);
+
+static const uint64_t HASH_SECRET[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL,
+    0x4d5a2da51de1aa47ULL};
+
+// 64x64 -> 128 bit multiply, the low and high halves replace a and b
+static inline void hash_mum(uint64_t *a, uint64_t *b) {
+  __uint128_t product = (__uint128_t)*a * *b;
+  *a = (uint64_t)product;
+  *b = (uint64_t)(product >> 64);
+}
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+  hash_mum(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t hash_read8(const uint8_t *p) {
+  uint64_t v = 0;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t hash_read4(const uint8_t *p) {
+  uint32_t v = 0;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t hash_bytes(const uint8_t *p, size_t len) {
+  const uint64_t *secret = HASH_SECRET;
+  uint64_t seed = hash_seed;
+  uint64_t a = 0;
+  uint64_t b = 0;
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = (hash_read4(p) << 32) | hash_read4(p + mid);
+      b = (hash_read4(p + len - 4) << 32) | hash_read4(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t see1 = seed;
+      uint64_t see2 = seed;
+      do {
+        seed = hash_mix(hash_read8(p) ^ secret[1], hash_read8(p + 8) ^ seed);
+        see1 = hash_mix(hash_read8(p + 16) ^ secret[2],
+                        hash_read8(p + 24) ^ see1);
+        see2 = hash_mix(hash_read8(p + 32) ^ secret[3],
+                        hash_read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = hash_mix(hash_read8(p) ^ secret[1], hash_read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = hash_read8(p + i - 16);
+    b = hash_read8(p + i - 8);
+  }
+  a ^= secret[1];
+  b ^= seed;
+  hash_mum(&a, &b);
+  return hash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+#endif // HASH_H
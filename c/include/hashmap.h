@@ -14,10 +14,23 @@ typedef struct HMap {
   size_t resizing_pos;
   uint64_t (*hash)(void *);
   uint64_t (*eq)(HNode *, HNode *);
+  HKeyLayout keys; // maps of byte-string keys, see hmap_initialize_keys
 } HMap;
 
+void hmap_initialize(HMap *map, uint64_t (*hash)(void *),
+                     uint64_t (*eq)(HNode *, HNode *));
+void hmap_initialize_keys(HMap *map, HKeyLayout keys);
 HNode *hmap_lookup(HMap *map, HNode *key);
+HNode *hmap_lookup_key(HMap *map, uint64_t hash, const uint8_t *key,
+                       size_t len);
 void hmap_insert(HMap *map, HNode *node);
+void hmap_reserve(HMap *map, size_t nodes);
 HNode *hmap_pop(HMap *map, HNode *key);
+HNode *hmap_pop_key(HMap *map, uint64_t hash, const uint8_t *key,
+                    size_t len);
 size_t hmap_size(HMap *map);
+size_t hmap_memory(HMap *map);
+void hmap_foreach(HMap *map, bool (*fn)(HNode *, void *), void *arg);
+uint64_t hmap_scan(HMap *map, uint64_t cursor, void (*fn)(HNode *, void *),
+                   void *arg);
 void hmap_destroy(HMap *map);
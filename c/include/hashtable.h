@@ -3,9 +3,17 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "hnode.h"
 
+// two engines implement this interface, picked at build time
+// (HTABLE_ENGINE in CMakeLists.txt):
+//  chained  separate chaining through HNode::next (default)
+//  swiss    open addressing, slots probed a group at a time through one
+//           control byte per slot holding 7 bits of the hash
+
+#ifndef HTABLE_SWISS
 // a simple fixed-sized hashtable
 typedef struct HTable {
   HNode **tab;
@@ -14,16 +22,62 @@ typedef struct HTable {
   uint64_t (*hash)(void *);
   uint64_t (*eq)(HNode *, HNode *);
 } HTable;
+#else
+// a fixed-sized open addressing hashtable
+typedef struct HTable {
+  HNode **tab;   // slots
+  uint8_t *ctrl; // control byte per slot, same allocation as tab
+  size_t mask;
+  size_t size;
+  size_t growth_left; // empty slots we may still fill before being full
+  uint64_t (*hash)(void *);
+  uint64_t (*eq)(HNode *, HNode *);
+} HTable;
+#endif
+
+// where a payload keeps its byte-string key, relative to its HNode: a
+// uint32_t length at len_off and the bytes at data_off. lookups through
+// it compare keys in place, without the eq callback
+typedef struct HKeyLayout {
+  ptrdiff_t len_off;
+  ptrdiff_t data_off;
+} HKeyLayout;
+
+#define HKEY_LAYOUT(type, node, len, data)                                     \
+  ((HKeyLayout){.len_off = offsetof(type, len) - offsetof(type, node),         \
+                .data_off = offsetof(type, data) - offsetof(type, node)})
+
+// callers compare the stored hashes first
+static inline bool hkey_equal(const HNode *node, const HKeyLayout *layout,
+                              const uint8_t *key, size_t len) {
+  const uint8_t *base = (const uint8_t *)node;
+  uint32_t node_len = 0;
+  memcpy(&node_len, base + layout->len_off, sizeof(node_len));
+  return node_len == len && memcmp(base + layout->data_off, key, len) == 0;
+}
 
 void htable_initialize(HTable *table, size_t capacity, uint64_t (*hash)(void *),
                        uint64_t (*eq)(HNode *, HNode *));
 HTable *htable_new(size_t capacity, uint64_t (*hash)(void *),
                    uint64_t (*eq)(HNode *, HNode *));
 HNode **htable_lookup(HTable *table, HNode *key);
+HNode **htable_lookup_key(HTable *table, const HKeyLayout *layout,
+                          uint64_t hash, const uint8_t *key, size_t len);
 void htable_insert(HTable *table, HNode *node);
 HNode *htable_insert_hash(HTable *table, uint64_t hash);
 HNode *htable_detach(HTable *table, HNode **from);
 HNode *htable_pop(HTable *table, HNode *key);
+HNode **htable_bucket(HTable *table, size_t pos);
 size_t htable_size(HTable *table);
+size_t htable_capacity(HTable *table);
+size_t htable_memory(HTable *table);
+bool htable_foreach(HTable *table, bool (*fn)(HNode *, void *), void *arg);
+size_t htable_bucket_mask(HTable *table);
+void htable_scan(HTable *table, size_t bucket, void (*fn)(HNode *, void *),
+                 void *arg);
+void htable_cleanup(HTable *table);
 void htable_destroy(HTable *table);
 size_t htable_load_factor(HTable *table);
+bool htable_is_full(HTable *table);
+size_t htable_grow_capacity(HTable *table);
+size_t htable_capacity_for(size_t nodes);
@@ -0,0 +1,33 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+// 4-ary min-heap on val, half as deep as a binary one so an update moves
+// (and writes the ref of) fewer items. each item points at the spot where
+// its owner keeps the item's position plus one (zero once it left the
+// heap), kept up to date as items move so owners can update or remove
+// their item
+typedef struct HeapItem {
+  uint64_t val;
+  uint32_t *ref;
+} HeapItem;
+
+typedef struct Heap {
+  Vector items; // HeapItem
+} Heap;
+
+void heap_init(Heap *heap);
+void heap_push(Heap *heap, uint64_t val, uint32_t *ref);
+void heap_update(Heap *heap, size_t pos, uint64_t val);
+void heap_remove(Heap *heap, size_t pos);
+HeapItem *heap_top(Heap *heap);
+HeapItem *heap_at(Heap *heap, size_t pos);
+size_t heap_size(Heap *heap);
+size_t heap_memory(Heap *heap);
+void heap_cleanup(Heap *heap);
+
+#endif // HEAP_H
@@ -5,12 +5,17 @@
 #include <stdint.h>
 
 // hashtable node, should be embedded into the payload
+// (the swiss engine keeps no chains, so its nodes are just the hash)
 typedef struct HNode {
+#ifndef HTABLE_SWISS
   struct HNode *next;
+#endif
   uint64_t hash;
 } HNode;
 
 HNode *hnode_new(uint64_t hash);
+#ifndef HTABLE_SWISS
 HNode *hnode_detach(HNode **from);
 void hnode_destroy(HNode **from);
 void hnode_destroy_chain(HNode **from);
+#endif
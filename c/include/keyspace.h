@@ -0,0 +1,106 @@
+#ifndef KEYSPACE_H
+#define KEYSPACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blob.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "lazyfree.h"
+#include "hnode.h"
+#include "utils.h"
+#include "vector.h"
+#include "zset.h"
+
+// how the value of an entry is stored, the first three are strings
+enum EntryEncoding {
+  ENC_INT,   // canonical decimal int64, kept as the number
+  ENC_EMBED, // short string, right after the key in the entry allocation
+  ENC_RAW,   // longer string in a blob of its own
+  ENC_ZSET,  // sorted set
+};
+
+// values up to this long are embedded
+#define ENTRY_EMBED_MAX 64
+// room to format an ENC_INT value, sign included
+#define ENTRY_INT_BUF 24
+
+// a key with its value, owned by the keyspace. the key always lives in
+// the entry allocation itself, see entry_key / entry_value
+typedef struct Entry {
+  HNode node;
+  uint32_t key_len;
+  uint32_t val_len;       // string encodings only
+  uint32_t enc : 2;       // EntryEncoding
+  uint32_t embed_cap : 7; // room for an embedded value after the key
+  uint32_t access : 23;   // see AccessTracking, in what was padding
+  uint32_t expiry;        // position in the expiry heap + 1, 0 without a ttl
+  union {
+    int64_t integer; // ENC_INT
+    Blob *raw;       // ENC_RAW
+    ZSet *zset;      // ENC_ZSET
+  };
+  uint8_t data[]; // key, then the embedded value
+} Entry;
+
+// what Entry.access holds, set on every lookup and write of the key.
+// the eviction policy picks it, without one nothing is kept
+enum AccessTracking {
+  ACCESS_NONE,
+  ACCESS_LRU, // the clock at the last access, wraps after 9.7 days
+  ACCESS_LFU, // a log counter in the low 8 bits, the minute it was last
+              // decayed above
+};
+
+#define ACCESS_BITS 23
+#define ACCESS_MAX ((1u << ACCESS_BITS) - 1)
+// the resolution of the access clock
+#define ACCESS_TICK_MS 100
+
+// keys with a ttl are also in a min-heap on their deadline (unix ms).
+// an expired key is deleted when it is looked up or by the active expiry
+// cycle the server runs every loop iteration, whichever comes first
+typedef struct Keyspace {
+  HMap map;
+  Heap expires;
+  size_t bytes;   // entries and raw values, as allocated
+  size_t expired; // keys deleted because of their ttl
+  uint8_t access; // AccessTracking
+  uint32_t clock; // unix time in ACCESS_TICK_MS, see keyspace_tick
+  uint64_t rng;   // draws of the LFU counter increments
+  LazyFree *lazy; // frees big values, NULL to free everything inline
+} Keyspace;
+
+const uint8_t *entry_key(const Entry *entry);
+bool entry_is_string(const Entry *entry);
+Slice entry_value(const Entry *entry, char buf[ENTRY_INT_BUF]);
+size_t entry_memory(const Entry *entry);
+void keyspace_init(Keyspace *ks);
+void keyspace_reserve(Keyspace *ks, size_t keys);
+Entry *keyspace_get(Keyspace *ks, const uint8_t *key, size_t key_len);
+Entry *keyspace_set(Keyspace *ks, const uint8_t *key, size_t key_len,
+                    const uint8_t *val, size_t val_len);
+bool keyspace_del(Keyspace *ks, const uint8_t *key, size_t key_len);
+Entry *keyspace_new_zset(Keyspace *ks, const uint8_t *key, size_t key_len,
+                         size_t members);
+int keyspace_zadd(Keyspace *ks, Entry *entry, const uint8_t *name,
+                  size_t len, double score);
+bool keyspace_zrem(Keyspace *ks, Entry *entry, const uint8_t *name,
+                   size_t len);
+void keyspace_set_expiry(Keyspace *ks, Entry *entry, uint64_t when);
+uint64_t keyspace_expiry(Keyspace *ks, const Entry *entry);
+bool keyspace_persist(Keyspace *ks, Entry *entry);
+int keyspace_expire_cycle(Keyspace *ks, uint64_t now, size_t budget);
+void keyspace_tick(Keyspace *ks, uint64_t now);
+uint64_t keyspace_idle(Keyspace *ks, const Entry *entry);
+size_t keyspace_memory(Keyspace *ks);
+void keyspace_flush(Keyspace *ks, bool async);
+uint64_t keyspace_scan(Keyspace *ks, uint64_t cursor, size_t count,
+                       Vector *out);
+size_t keyspace_size(Keyspace *ks);
+size_t keyspace_table_memory(Keyspace *ks);
+void keyspace_cleanup(Keyspace *ks);
+
+#endif // KEYSPACE_H
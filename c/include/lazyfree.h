@@ -0,0 +1,35 @@
+#ifndef LAZYFREE_H
+#define LAZYFREE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mpsc.h"
+
+// values costing more frees than this (members of a set, pages of a
+// string) are freed by the lazy free thread, cheaper ones right away
+#define LAZYFREE_THRESHOLD 64
+
+// one background thread freeing what the shards detached from their
+// keyspaces: big values and whole flushed keyspaces. shards push jobs
+// without locking and post ready once per job
+typedef struct LazyFree {
+  MpscQueue queue;
+  sem_t ready;
+  pthread_t thread;
+  bool started;
+  atomic_bool stopping;
+  atomic_size_t pending; // jobs pushed and not done yet
+  atomic_uint_fast64_t done;
+} LazyFree;
+
+void lazyfree_init(LazyFree *lazy);
+bool lazyfree_start(LazyFree *lazy);
+void lazyfree_push(LazyFree *lazy, void (*fn)(void *), void *arg);
+void lazyfree_stop(LazyFree *lazy);
+
+#endif // LAZYFREE_H
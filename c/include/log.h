@@ -0,0 +1,24 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// LOG statements above this level are compiled out, the build sets it
+// (cmake -DLOG_LEVEL_MAX=n). DEBUG=n picks the level at runtime up to it
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX 2
+#endif
+
+// each thread formats its lines into a ring of this many bytes, a line
+// that does not fit is dropped (and counted) rather than waited for
+#define LOG_RING_SIZE (128 * 1024)
+#define LOG_LINE_MAX 512
+
+void log_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+bool log_start(int fd);
+void log_stop(void);
+uint64_t log_dropped(void);
+
+#endif // LOG_H
@@ -0,0 +1,24 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// intrusive node, should be embedded into the payload
+typedef struct MpscNode {
+  _Atomic(struct MpscNode *) next;
+} MpscNode;
+
+// lock-free unbounded multi-producer single-consumer queue
+// (vyukov's intrusive design): push never blocks, pop is for the owner
+typedef struct MpscQueue {
+  _Atomic(MpscNode *) head; // producers swap themselves in here
+  MpscNode *tail;           // consumer side
+  MpscNode stub;
+} MpscQueue;
+
+void mpsc_init(MpscQueue *queue);
+void mpsc_push(MpscQueue *queue, MpscNode *node);
+MpscNode *mpsc_pop(MpscQueue *queue);
+
+#endif // MPSC_H
@@ -0,0 +1,40 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "blob.h"
+#include "vector.h"
+
+// values at least this long are referenced by replies instead of copied,
+// for shorter ones the copy is cheaper than another iovec
+#define OUTPUT_REF_MIN (16 * 1024)
+// iovecs handed to one writev
+#define OUTPUT_IOV_MAX 64
+
+// len bytes of blob, sent right before bytes[at]
+typedef struct OutRef {
+  size_t at;
+  size_t len;
+  Blob *blob;
+} OutRef;
+
+// where replies go: headers and short values are copied into bytes, long
+// values are kept in refs as references. without refs (NULL) everything
+// is copied, for replies that are parsed again or logged
+typedef struct Output {
+  Vector *bytes;
+  Vector *refs; // OutRef, in stream order
+} Output;
+
+void output_ref(Output *out, Blob *blob, size_t len);
+size_t output_length(const Output *out);
+size_t output_iovecs(const Output *out, size_t from, struct iovec *iov,
+                     size_t max);
+void output_move(Output *dst, Output *src);
+void output_clear(Output *out);
+
+#endif // OUTPUT_H
@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+// per server recycling of fixed size objects and of io buffers, only ever
+// touched by the server's own thread so nothing is locked.
+// objects are carved out of slabs and never given back to the allocator,
+// buffers are plain malloc blocks (so a Vector may still realloc them)
+// cached in power of two size classes
+#define POOL_CLASSES 7 // 1K, 2K, ... 64K
+#define POOL_MIN_BUF 1024
+
+typedef struct PoolStats {
+  size_t slabs;
+  size_t objects;      // carved out of slabs so far
+  size_t objects_used; // handed out right now
+  size_t buffers_lent; // any size, they may grow while lent
+  size_t buffers_cached[POOL_CLASSES];
+  size_t buffer_hits;   // served from the cache
+  size_t buffer_misses; // had to malloc
+} PoolStats;
+
+typedef struct Pool {
+  size_t object_size;
+  Vector slabs;        // uint8_t *
+  Vector free_objects; // void *
+  Vector free_buffers[POOL_CLASSES]; // uint8_t * per class
+  PoolStats stats;
+} Pool;
+
+void pool_init(Pool *pool, size_t object_size);
+void *pool_get(Pool *pool);
+void pool_put(Pool *pool, void *object);
+void *pool_pop_free(Pool *pool);
+uint8_t *pool_buf_get(Pool *pool, size_t size, size_t *capacity);
+void pool_buf_put(Pool *pool, uint8_t *buf, size_t capacity);
+size_t pool_class_size(size_t cls);
+void pool_cleanup(Pool *pool);
+
+#endif // POOL_H
@@ -0,0 +1,67 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vec.h"
+
+// backend is picked at build time (see REACTOR_BACKEND in CMakeLists.txt),
+// epoll is the default on linux
+#if !defined(REACTOR_EPOLL) && !defined(REACTOR_POLL)
+#ifdef __linux__
+#define REACTOR_EPOLL
+#else
+#define REACTOR_POLL
+#endif
+#endif
+
+#ifdef REACTOR_POLL
+#include <poll.h>
+
+#include "utils.h"
+#endif
+
+enum ReactorEvents {
+  REACTOR_READ = 1 << 0,
+  REACTOR_WRITE = 1 << 1,
+  REACTOR_ERROR = 1 << 2,
+};
+
+typedef struct ReactorEvent {
+  int fd;
+  uint32_t events;
+} ReactorEvent;
+
+VEC_DEFINE(ReactorEventVec, reactor_event_vec, ReactorEvent)
+#ifdef REACTOR_POLL
+VEC_DEFINE(PollArgVec, poll_arg_vec, poll_arg)
+VEC_DEFINE(ReactorSlotVec, reactor_slot_vec, size_t)
+#endif
+
+// readiness notifier, interest is registered once per fd and only
+// touched again when it changes
+typedef struct Reactor {
+#ifdef REACTOR_EPOLL
+  int epfd;
+#else
+  PollArgVec poll_args;  // registered fds, packed
+  ReactorSlotVec slots; // fd -> index into poll_args
+#endif
+  ReactorEventVec events; // ready events of the last reactor_wait
+} Reactor;
+
+void reactor_init(Reactor *reactor);
+int reactor_add(Reactor *reactor, int fd, uint32_t interest);
+int reactor_mod(Reactor *reactor, int fd, uint32_t interest);
+int reactor_del(Reactor *reactor, int fd);
+int reactor_wait(Reactor *reactor, int timeout);
+const char *reactor_backend(void);
+void reactor_cleanup(Reactor *reactor);
+
+static inline ReactorEvent *reactor_event_at(Reactor *reactor,
+                                             size_t position) {
+  return reactor_event_vec_at(&reactor->events, position);
+}
+
+#endif // REACTOR_H
@@ -0,0 +1,88 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blob.h"
+#include "output.h"
+#include "vec.h"
+
+// type bytes of RESP2 / RESP3, see rust/protocol-core/src/data_types.rs
+enum RespType {
+  RESP_SIMPLE_STRING = '+',
+  RESP_SIMPLE_ERROR = '-',
+  RESP_INTEGER = ':',
+  RESP_BULK_STRING = '$',
+  RESP_ARRAY = '*',
+  RESP_BOOLEAN = '#',
+  RESP_DOUBLE = ',',
+  RESP_BIG_NUMBER = '(',
+  RESP_BULK_ERROR = '!',
+  RESP_NULL = '_',
+};
+
+enum RespStatus { RESP_INCOMPLETE, RESP_COMPLETE, RESP_INVALID };
+
+// one parsed value, payload is a slice into the parsed buffer
+//  strings / errors / doubles / big numbers: offset + len
+//  integers / booleans: integer
+//  arrays: integer is the element count, the elements follow in order
+//  null bulk strings and arrays have type RESP_NULL
+typedef struct RespValue {
+  enum RespType type;
+  size_t offset; // relative to the start of the message
+  size_t len;
+  int64_t integer;
+  double dbl;
+} RespValue;
+
+VEC_DEFINE(RespValueVec, resp_value_vec, RespValue)
+VEC_DEFINE(RespPendingVec, resp_pending_vec, int64_t)
+
+// incremental parser for one message at a time, values are appended in
+// pre-order to `values` as soon as they are complete, so a message split
+// across reads is resumed where it stopped instead of being re-parsed
+typedef struct RespParser {
+  size_t start; // offset of the current message in the buffer
+  size_t pos;   // offset where parsing resumes
+  RespValueVec values;
+  RespPendingVec pending; // remaining element counts of open arrays
+  // the current message is at least this long, known once a bulk string
+  // it waits for announced its length (0 until then)
+  size_t need;
+  const char *error;
+} RespParser;
+
+void resp_parser_init(RespParser *parser);
+void resp_parser_reset(RespParser *parser, size_t start);
+void resp_parser_move(RespParser *parser, size_t start);
+void resp_parser_cleanup(RespParser *parser);
+enum RespStatus resp_parse(RespParser *parser, const uint8_t *buf, size_t len);
+
+size_t resp_message_len(const RespParser *parser);
+size_t resp_message_need(const RespParser *parser);
+
+static inline size_t resp_value_count(const RespParser *parser) {
+  return parser->values.length;
+}
+
+static inline RespValue *resp_value_at(const RespParser *parser,
+                                       size_t position) {
+  return resp_value_vec_at(&parser->values, position);
+}
+
+const uint8_t *resp_value_data(const RespParser *parser, const uint8_t *buf,
+                               const RespValue *value);
+
+// reply serialization, appends to an output
+void resp_write_simple(Output *out, const char *str);
+void resp_write_error(Output *out, const char *msg);
+void resp_write_integer(Output *out, int64_t value);
+void resp_write_bulk(Output *out, const uint8_t *data, size_t len);
+void resp_write_ref(Output *out, Blob *blob, size_t len);
+void resp_write_null(Output *out);
+void resp_write_array(Output *out, size_t count);
+
+#endif // RESP_H
@@ -1,18 +1,88 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "aof.h"
+#include "dlist.h"
+#include "evict.h"
+#include "keyspace.h"
+#include "mpsc.h"
+#include "pool.h"
+#include "reactor.h"
+#include "stats.h"
+#include "vec.h"
 #include "vector.h"
 
+struct Conn;
+struct Shards;
+struct Uring;
+
+VEC_DEFINE(ConnVec, conn_vec, struct Conn *)
+
+// read-only after startup, shared by every reactor thread
+typedef struct ServerConfig {
+  uint32_t address;
+  uint16_t port;
+  size_t threads;
+  bool io_uring; // falls back to the reactor when unsupported
+  uint64_t idle_timeout_ms; // 0 keeps idle conns open forever
+  const char *snapshot_path; // SAVE / BGSAVE target, loaded at startup
+  const char *aof_path; // NULL keeps the append only log off
+  enum AofFsync aof_fsync;
+  // values from this long on are sent by reference, 0 is OUTPUT_REF_MIN
+  size_t reply_ref_min;
+  size_t max_request; // larger requests close the conn, 0 is the default
+  size_t maxmemory; // bytes over all shards, 0 for no limit
+  enum EvictPolicy maxmemory_policy;
+  size_t maxmemory_samples; // 0 is EVICT_SAMPLES
+  int64_t slowlog_slower_than; // us, negative turns the slowlog off
+  size_t slowlog_max_len; // 0 keeps none
+  // unix socket listened on as well as the port (or instead of it, with
+  // port 0), NULL for none
+  const char *unix_socket;
+  unsigned unix_socket_perm; // its mode, 0 keeps what the umask gave
+} ServerConfig;
+
+// one reactor loop, owning its listening socket, its connections and
+// (with --threads) one shard of the keyspace
 typedef struct Server {
-  int fd;
-  Vector conns;
+  int fd; // -1 without a tcp port
+  int unix_fd; // shared by every shard, -1 without a unix socket
+  ConnVec conns; // by fd, NULL when closed
+  Pool pool; // conns and their buffers
+  DList idle; // conns, least recently active first
+  uint64_t loop_ms; // monotonic, taken once per loop iteration
+  Reactor reactor;
+  struct Uring *uring; // NULL when the reactor drives the io
+  Keyspace keyspace;
+  size_t maxmemory; // this shard's share of it, 0 for no limit
+  Evictor evict;
+  AofShard aof;
+  // value bytes of replies, copied into the conn or sent by reference
+  uint64_t reply_copied;
+  uint64_t reply_referenced;
+  ServerStats stats;
+  const ServerConfig *config;
+  struct Shards *shards;
+  size_t shard_id;
+  MpscQueue inbox; // messages from other shards, see shard.h
+  int wake_fd;
+  uint64_t wake_count; // wake_fd reads of the uring engine land here
+  atomic_bool wake_pending;
+  atomic_bool running;
 } Server;
 
-Server *server_new(uint32_t address, uint16_t port);
-void server_init(Server *serv, uint32_t address, uint16_t port);
+int server_listen_unix(const ServerConfig *config);
+Server *server_new(const ServerConfig *config, int unix_fd);
+void server_init(Server *serv, const ServerConfig *config, int unix_fd);
 int server_run(Server *serv);
+void server_wake(Server *serv);
+void server_stop(Server *serv);
+void server_resume_conn(Server *serv, struct Conn *conn);
 void server_cleanup(Server *serv);
 
 #endif // SERVER_H
@@ -0,0 +1,86 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aof.h"
+#include "commands.h"
+#include "lazyfree.h"
+#include "mpsc.h"
+#include "server.h"
+#include "slowlog.h"
+#include "snapshot.h"
+#include "utils.h"
+#include "vector.h"
+
+struct Conn;
+
+// N shared-nothing reactor threads, each Server owns the keys whose hash
+// maps to its shard_id. a command touching keys of other shards is sent to
+// them as ShardParts through their inbox, the owner runs it against its
+// keyspace and posts the part back with the reply filled in.
+typedef struct Shards {
+  size_t count;
+  Server **servers;
+  pthread_t *threads;
+  int unix_fd; // the listener every server accepts from, -1 for none
+  // stop the world, see shards_pause
+  pthread_mutex_t pause_lock; // held by the pausing shard
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  atomic_bool pausing;
+  size_t paused;  // shards waiting in shard_checkpoint
+  size_t stopped; // shards whose loop returned, they never check in
+  bool running; // set by shards_run, before it pausing is a no-op
+  Snapshot snapshot;
+  Aof aof;
+  LazyFree lazy;
+  Slowlog slowlog;
+} Shards;
+
+// the slice of one command that goes to a single shard
+typedef struct ShardPart {
+  MpscNode node;
+  struct ShardReq *req;
+  Server *target;
+  bool done;
+  uint64_t log_end; // position in the target's log after it ran, 0 if none
+  Vector bytes;     // owned copy of the arguments
+  Vector argv;      // Slice into bytes
+  Vector positions; // index of every key of this part in the command
+  Vector reply;
+  Vector refs; // OutRef into reply, only whole commands reply with them
+} ShardPart;
+
+// a command of conn waiting for its parts
+typedef struct ShardReq {
+  struct Conn *conn;
+  Server *origin;
+  const Command *cmd;
+  size_t nkeys;
+  size_t waiting;
+  bool whole; // sent as is to a single shard, its reply is the answer
+  Vector parts; // ShardPart *
+} ShardReq;
+
+Shards *shards_new(const ServerConfig *config);
+void shards_run(Shards *shards);
+void shards_stop(Shards *shards);
+void shards_cleanup(Shards *shards);
+size_t shards_owner(const Shards *shards, const uint8_t *key, size_t key_len);
+bool shards_pause(Shards *shards);
+void shards_resume(Shards *shards);
+void shard_checkpoint(Server *serv);
+void shard_stopped(Server *serv);
+
+bool shard_forward(struct Conn *conn, const Command *cmd, Slice *argv,
+                   size_t argc);
+void shard_process_inbox(Server *serv);
+void shard_release_parts(Server *serv);
+void shard_req_free(ShardReq *req);
+
+#endif // SHARD_H
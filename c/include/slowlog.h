@@ -0,0 +1,51 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+// defaults of the config, commands slower than this many us are logged
+#define SLOWLOG_SLOWER_THAN 10000
+#define SLOWLOG_MAX_LEN 128
+// arguments past these are cut, as redis does
+#define SLOWLOG_MAX_ARGC 32
+#define SLOWLOG_MAX_ARG_LEN 128
+
+typedef struct SlowlogEntry {
+  uint64_t id;
+  uint64_t time; // unix seconds
+  uint64_t duration_us;
+  size_t shard;
+  size_t argc;
+  Slice *argv; // one block with the argument bytes
+} SlowlogEntry;
+
+// the last max_len commands of any shard that took slower_than_us or
+// longer. shards only lock it to add one, the check before is lock free
+typedef struct Slowlog {
+  pthread_mutex_t lock;
+  int64_t slower_than_us; // negative turns it off, as does max_len 0
+  size_t max_len;
+  SlowlogEntry *entries; // ring of max_len
+  size_t head; // where the next one goes
+  size_t len;
+  uint64_t next_id;
+} Slowlog;
+
+void slowlog_init(Slowlog *log, int64_t slower_than_us, size_t max_len);
+static inline bool slowlog_is_slow(const Slowlog *log, uint64_t ns) {
+  return log->slower_than_us >= 0 && log->max_len > 0 &&
+         ns / 1000 >= (uint64_t)log->slower_than_us;
+}
+void slowlog_push(Slowlog *log, const Slice *argv, size_t argc, uint64_t ns,
+                  size_t shard);
+// the i-th newest, the lock must be held
+const SlowlogEntry *slowlog_at(const Slowlog *log, size_t i);
+void slowlog_reset(Slowlog *log);
+void slowlog_cleanup(Slowlog *log);
+
+#endif // SLOWLOG_H
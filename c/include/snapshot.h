@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct Server;
+struct Shards;
+
+// point in time dump of every shard, written by SAVE in the foreground
+// or by a forked child for BGSAVE while the shards keep serving.
+// little endian layout:
+//   "RMSNAP" u16 version, u64 keys
+//   per key: u8 type (| SNAP_EXPIRES and a u64 unix ms deadline),
+//            u32 key len, key, value:
+//     SNAP_STRING  u32 len, bytes
+//     SNAP_INT     i64
+//     SNAP_ZSET    u64 members, then per member f64 score, u32 len, name
+//   u8 SNAP_EOF, u32 crc32c of everything before it
+enum SnapType {
+  SNAP_STRING = 0,
+  SNAP_INT = 1,
+  SNAP_ZSET = 2,
+  SNAP_EXPIRES = 0x80,
+  SNAP_EOF = 0xff,
+};
+
+typedef enum SnapResult {
+  SNAP_OK,
+  SNAP_BUSY,   // another save is running
+  SNAP_FAILED, // see the log
+} SnapResult;
+
+typedef struct SnapStats {
+  uint64_t keys;
+  uint64_t bytes;
+  uint64_t skipped; // keys already expired when loaded
+} SnapStats;
+
+typedef struct Snapshot {
+  const char *path;
+  atomic_int child;     // pid of the BGSAVE child, 0 when none
+  struct Server *owner; // the shard that forked it, it reaps the child
+  uint64_t started_ms;  // monotonic
+  uint64_t next_poll_ms;
+  pthread_mutex_t lock; // the fields below, INFO reads them anywhere
+  uint64_t last_save;   // unix s of the last successful save
+  bool last_ok;
+  uint64_t last_bytes;
+  uint64_t last_ms; // how long it took
+} Snapshot;
+
+void snapshot_init(Snapshot *snap, const char *path);
+bool snapshot_write(struct Shards *shards, const char *path,
+                    SnapStats *stats);
+bool snapshot_load(struct Shards *shards, const char *path,
+                   SnapStats *stats);
+SnapResult snapshot_save(struct Server *serv);
+SnapResult snapshot_bgsave(struct Server *serv);
+int snapshot_poll(struct Server *serv);
+void snapshot_cleanup(Snapshot *snap);
+
+#endif // SNAPSHOT_H
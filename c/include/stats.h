@@ -0,0 +1,83 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// bumped by the shard owning it only, read by any (INFO and LATENCY sum
+// the shards). a relaxed load and store instead of an atomic add, so a
+// bump costs what a plain increment does and readers see no torn values
+typedef atomic_uint_fast64_t Counter;
+
+static inline void counter_add(Counter *counter, uint64_t value) {
+  atomic_store_explicit(
+      counter,
+      atomic_load_explicit(counter, memory_order_relaxed) + value,
+      memory_order_relaxed);
+}
+
+static inline uint64_t counter_get(const Counter *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// log-linear buckets as in HdrHistogram: exact below HIST_SUB, then
+// HIST_SUB of them per power of two, so a bucket is within 1 / HIST_SUB
+// (6.25%) of the values it holds. covers all of uint64_t
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct Histogram {
+  Counter counts[HIST_BUCKETS];
+  Counter total;
+  Counter sum;
+  Counter max;
+} Histogram;
+
+// plain copy of one or more histograms (added up), for reading
+typedef struct HistSnapshot {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t max;
+} HistSnapshot;
+
+void hist_record(Histogram *hist, uint64_t value);
+void hist_reset(Histogram *hist);
+void hist_collect(const Histogram *hist, HistSnapshot *snap);
+uint64_t hist_bucket_min(size_t bucket);
+uint64_t hist_bucket_max(size_t bucket);
+void hist_snapshot_add(HistSnapshot *snap, uint64_t value, uint64_t count);
+uint64_t hist_value_at(const HistSnapshot *snap, double percentile);
+
+typedef struct CommandStats {
+  Counter calls;
+  Counter failed;   // replied with an error
+  Counter rejected; // refused before running (OOM)
+  Histogram latency; // ns
+} CommandStats;
+
+// what a shard measures of its loop, its conns and the commands it runs
+typedef struct ServerStats {
+  Counter conns_accepted;
+  Counter conns_open; // not reset, see stats_apply_reset
+  Counter net_input; // bytes
+  Counter net_output;
+  Histogram loop_busy; // ns from a wakeup to the next wait
+  Histogram loop_events; // ready events (completions) per wakeup
+  size_t ncommands;
+  CommandStats *commands; // indexed like the command table
+  // set by any thread, the shard zeroes its stats at the next iteration
+  atomic_bool reset;
+} ServerStats;
+
+void stats_init(ServerStats *stats, size_t ncommands);
+void stats_record_command(ServerStats *stats, size_t index, uint64_t ns,
+                          bool failed);
+void stats_request_reset(ServerStats *stats);
+void stats_apply_reset(ServerStats *stats);
+void stats_cleanup(ServerStats *stats);
+
+#endif // STATS_H
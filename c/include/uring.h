@@ -0,0 +1,61 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// completion based io engine, built when IO_URING is on (see CMakeLists.txt)
+// and only used when the kernel supports everything it needs, otherwise
+// uring_new fails and the server stays on the reactor.
+// talks to the kernel through the raw syscalls, no liburing needed
+#ifdef IO_URING
+
+#include <linux/io_uring.h>
+
+typedef struct Uring {
+  int fd;
+  bool disabled; // until uring_enable, see uring_new
+  // submission ring, sqes are filled locally and published on submit
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sqe_tail; // next local sqe, ahead of *sq_tail until submitted
+  struct io_uring_sqe *sqes;
+  // completion ring
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  // provided buffer ring, recv picks one of nbufs buffers of buf_size
+  struct io_uring_buf_ring *buf_ring;
+  uint8_t *bufs;
+  unsigned nbufs;
+  size_t buf_size;
+  // mappings to undo on cleanup
+  void *sq_map;
+  size_t sq_map_len;
+  void *cq_map;
+  size_t cq_map_len;
+  size_t sqes_len;
+  size_t buf_ring_len;
+} Uring;
+
+// buffer group of the provided buffer ring, passed with IOSQE_BUFFER_SELECT
+#define URING_BUF_GROUP 0
+
+Uring *uring_new(unsigned entries, unsigned nbufs, size_t buf_size);
+int uring_enable(Uring *ring);
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, int timeout);
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+uint8_t *uring_buf(Uring *ring, uint16_t bid);
+void uring_buf_recycle(Uring *ring, uint16_t bid);
+void uring_cleanup(Uring *ring);
+
+#endif // IO_URING
+
+#endif // URING_H
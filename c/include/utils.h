@@ -3,21 +3,35 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log.h"
+#include "vec.h"
 
 typedef struct pollfd poll_arg;
 typedef struct sockaddr_in ipv4_addr;
 
+// non owning view of bytes
+typedef struct Slice {
+  const uint8_t *data;
+  size_t len;
+} Slice;
+
+VEC_DEFINE(SliceVec, slice_vec, Slice)
+
 extern int LOG_LEVEL;
 
+#define container_of(ptr, type, member)                                        \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
 #define isint(x) _Generic((x), int: 1, default: 0)
 #define isbool(x) _Generic((x), int: 1, bool: 1, default: 0)
+// levels above LOG_LEVEL_MAX fold to if (0), their arguments included
 #define LOG(log_level, msg...)                                                 \
   {                                                                            \
     static_assert(isint((log_level)) && (log_level) >= 0, "Error in LOG");     \
-    if ((log_level) <= LOG_LEVEL) {                                            \
-      printf("LOG(%d) >> ", log_level);                                        \
-      printf(msg);                                                             \
-      printf("\n");                                                            \
+    if ((log_level) <= LOG_LEVEL_MAX && (log_level) <= LOG_LEVEL) {            \
+      log_write(log_level, msg);                                               \
     }                                                                          \
   }
 #define ERROR(_exit, msg)                                                      \
@@ -30,5 +44,11 @@ extern int LOG_LEVEL;
   }
 
 void fd_to_nonblocking(int fd);
+bool parse_int64(const uint8_t *data, size_t len, int64_t *out);
+bool glob_match(const uint8_t *pattern, size_t plen, const uint8_t *str,
+                size_t slen);
+uint64_t time_ms(void);
+uint64_t monotonic_ms(void);
+uint64_t monotonic_ns(void);
 
 #endif // UTILS_H
@@ -0,0 +1,138 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VEC_MIN_CAPACITY 4
+
+// typed growable array, VEC_DEFINE(IntVec, int_vec, int) declares
+//
+//   typedef struct IntVec { int *data; size_t length, capacity; } IntVec;
+//
+// and static inline int_vec_* over it. unlike Vector the element size is
+// known at compile time, so an access is a plain index (bounds checked by
+// assert only) and moves are one memmove. growth leaves the new elements
+// uninitialized but for _resize, which zeroes them as Vector does. a
+// zeroed struct is an empty vector, storage comes with the first growth.
+// calls that grow return false (and change nothing) when out of memory
+#define VEC_DEFINE(Name, prefix, T)                                            \
+  typedef struct Name {                                                        \
+    T *data;                                                                   \
+    size_t length;                                                             \
+    size_t capacity;                                                           \
+  } Name;                                                                      \
+                                                                               \
+  static inline size_t prefix##_length(const Name *vec) {                      \
+    return vec->length;                                                        \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_is_empty(const Name *vec) {                      \
+    return vec->length == 0;                                                   \
+  }                                                                            \
+                                                                               \
+  static inline T *prefix##_at(const Name *vec, size_t position) {             \
+    assert(position < vec->length);                                            \
+    return &vec->data[position];                                               \
+  }                                                                            \
+                                                                               \
+  static inline T *prefix##_back(const Name *vec) {                            \
+    assert(vec->length > 0);                                                   \
+    return &vec->data[vec->length - 1];                                        \
+  }                                                                            \
+                                                                               \
+  /* room for capacity elements, doubling */                                   \
+  static inline bool prefix##_reserve(Name *vec, size_t capacity) {            \
+    if (capacity <= vec->capacity) {                                           \
+      return true;                                                             \
+    }                                                                          \
+    size_t grown = vec->capacity ? vec->capacity : VEC_MIN_CAPACITY;           \
+    while (grown < capacity) {                                                 \
+      grown <<= 1;                                                             \
+    }                                                                          \
+    T *data = realloc(vec->data, grown * sizeof(T));                           \
+    if (!data) {                                                               \
+      return false;                                                            \
+    }                                                                          \
+    vec->data = data;                                                          \
+    vec->capacity = grown;                                                     \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  /* new elements are left as they are, for buffers written right after */     \
+  static inline bool prefix##_grow(Name *vec, size_t length) {                 \
+    if (!prefix##_reserve(vec, length)) {                                      \
+      return false;                                                            \
+    }                                                                          \
+    vec->length = length;                                                      \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_resize(Name *vec, size_t length) {               \
+    size_t old = vec->length;                                                  \
+    if (!prefix##_grow(vec, length)) {                                         \
+      return false;                                                            \
+    }                                                                          \
+    if (length > old) {                                                        \
+      memset(vec->data + old, 0, (length - old) * sizeof(T));                  \
+    }                                                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_push_back(Name *vec, T value) {                  \
+    if (vec->length == vec->capacity &&                                        \
+        !prefix##_reserve(vec, vec->length + 1)) {                             \
+      return false;                                                            \
+    }                                                                          \
+    vec->data[vec->length++] = value;                                          \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_append(Name *vec, const T *values,               \
+                                     size_t count) {                           \
+    if (count == 0) {                                                          \
+      return true;                                                             \
+    }                                                                          \
+    if (!prefix##_reserve(vec, vec->length + count)) {                         \
+      return false;                                                            \
+    }                                                                          \
+    memcpy(vec->data + vec->length, values, count * sizeof(T));                \
+    vec->length += count;                                                      \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline bool prefix##_insert(Name *vec, size_t position, T value) {    \
+    assert(position <= vec->length);                                           \
+    if (!prefix##_reserve(vec, vec->length + 1)) {                             \
+      return false;                                                            \
+    }                                                                          \
+    memmove(vec->data + position + 1, vec->data + position,                    \
+            (vec->length - position) * sizeof(T));                             \
+    vec->data[position] = value;                                               \
+    vec->length++;                                                             \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_erase(Name *vec, size_t position) {              \
+    assert(position < vec->length);                                            \
+    memmove(vec->data + position, vec->data + position + 1,                    \
+            (vec->length - position - 1) * sizeof(T));                         \
+    vec->length--;                                                             \
+  }                                                                            \
+                                                                               \
+  static inline T prefix##_pop_back(Name *vec) {                               \
+    assert(vec->length > 0);                                                   \
+    return vec->data[--vec->length];                                           \
+  }                                                                            \
+                                                                               \
+  static inline void prefix##_clear(Name *vec) { vec->length = 0; }            \
+                                                                               \
+  static inline void prefix##_cleanup(Name *vec) {                             \
+    free(vec->data);                                                           \
+    *vec = (Name){0};                                                          \
+  }
+
+#endif // VEC_H
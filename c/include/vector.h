@@ -2,6 +2,7 @@
 #define VECTOR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -17,15 +18,39 @@ void vector_initialize(Vector *vector, size_t length, size_t data_size);
 
 void vector_cleanup(Vector *vector);
 
-size_t vector_length(const Vector *vector);
-size_t vector_data_size(const Vector *vector);
-bool vector_is_empty(const Vector *vector);
+// byte-wise growable array, the element size is only known at runtime.
+// for one element type known at compile time see VEC_DEFINE in vec.h
 
-void vector_resize(Vector *vector, size_t size);
-void vector_shrink_to_fit(Vector *vector);
+static inline size_t vector_length(const Vector *vector) {
+  return vector->length;
+}
+
+static inline size_t vector_data_size(const Vector *vector) {
+  return vector->data_size;
+}
+
+static inline bool vector_is_empty(const Vector *vector) {
+  return vector->length == 0;
+}
+
+// NULL when out of bounds
+static inline uint8_t *vector_get_at(const Vector *vector, size_t position) {
+  if (position >= vector->length) {
+    return NULL;
+  }
+  return &vector->data[position * vector->data_size];
+}
 
-uint8_t *vector_get_back(const Vector *vector);
-uint8_t *vector_get_at(const Vector *vector, size_t position);
+static inline uint8_t *vector_get_back(const Vector *vector) {
+  if (vector->length == 0) {
+    return NULL;
+  }
+  return &vector->data[(vector->length - 1) * vector->data_size];
+}
+
+bool vector_resize(Vector *vector, size_t size);
+bool vector_grow(Vector *vector, size_t size);
+void vector_shrink_to_fit(Vector *vector);
 
 bool vector_set_at(const Vector *vector, const uint8_t *value, size_t position);
 
@@ -38,5 +63,9 @@ void vector_clear(Vector *vector);
 
 void vector_copy(Vector *src, Vector *dest);
 void vector_extend(Vector *src, Vector *dest);
+void vector_append(Vector *vector, const uint8_t *values, size_t count);
+
+uint8_t *vector_release(Vector *vector, size_t *capacity);
+void vector_adopt(Vector *vector, uint8_t *data, size_t capacity);
 
 #endif // VECTOR_H
@@ -0,0 +1,43 @@
+#ifndef ZSET_H
+#define ZSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl.h"
+#include "hashmap.h"
+#include "hnode.h"
+#include "vector.h"
+
+// sorted set member, in the tree ordered by (score, name) and in the
+// hash map by name
+typedef struct ZNode {
+  AVLNode tree;
+  HNode hmap;
+  double score;
+  uint32_t len;
+  uint8_t name[];
+} ZNode;
+
+typedef struct ZSet {
+  AVLNode *root;
+  HMap hmap;
+  size_t bytes; // the set and its nodes as allocated, see zset_memory
+} ZSet;
+
+ZSet *zset_new(void);
+void zset_reserve(ZSet *zset, size_t members);
+int zset_add(ZSet *zset, const uint8_t *name, size_t len, double score);
+ZNode *zset_lookup(ZSet *zset, const uint8_t *name, size_t len);
+void zset_delete(ZSet *zset, ZNode *node);
+ZNode *zset_seek(ZSet *zset, double score, bool exclusive);
+ZNode *zset_at(ZSet *zset, int64_t rank);
+ZNode *znode_offset(ZNode *node, int64_t offset);
+int64_t znode_rank(const ZNode *node);
+uint64_t zset_scan(ZSet *zset, uint64_t cursor, size_t count, Vector *out);
+size_t zset_size(const ZSet *zset);
+size_t zset_memory(ZSet *zset);
+void zset_free(ZSet *zset);
+
+#endif // ZSET_H
@@ -0,0 +1,650 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aof.h"
+#include "commands.h"
+#include "hashmap.h"
+#include "keyspace.h"
+#include "output.h"
+#include "resp.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+#include "vector.h"
+#include "zset.h"
+
+// a rewrite flushes and the loader reads in chunks this large
+#define AOF_CHUNK (1 << 20)
+// members per ZADD a rewrite writes
+#define AOF_ZADD_MEMBERS 64
+// how often the shard that forked checks on its child
+#define AOF_POLL_MS 10
+// the log is rewritten by itself once it doubled since the last rewrite
+// and is at least this large, a failed rewrite is retried this much later
+#define AOF_AUTO_MIN (64ULL << 20)
+#define AOF_RETRY_MS 10000
+
+static const char *FSYNC_NAMES[] = {"no", "everysec", "always"};
+
+bool aof_parse_fsync(const char *name, enum AofFsync *fsync) {
+  for (size_t i = 0; i < sizeof(FSYNC_NAMES) / sizeof(*FSYNC_NAMES); i++) {
+    if (strcasecmp(name, FSYNC_NAMES[i]) == 0) {
+      *fsync = (enum AofFsync)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *aof_fsync_name(enum AofFsync fsync) { return FSYNC_NAMES[fsync]; }
+
+void aof_init(Aof *aof, const char *path, enum AofFsync fsync) {
+  aof->path = path;
+  aof->fsync = fsync;
+  aof->fd = -1;
+  atomic_init(&aof->size, 0);
+  atomic_init(&aof->base_size, 0);
+  pthread_mutex_init(&aof->lock, NULL);
+  pthread_cond_init(&aof->cond, NULL);
+  aof->stopping = false;
+  atomic_init(&aof->dirty, false);
+  atomic_init(&aof->child, 0);
+  aof->owner = NULL;
+  aof->rewriting = false;
+  aof->reaped = false;
+  aof->status = 0;
+  aof->started_ms = 0;
+  aof->next_poll_ms = 0;
+  aof->next_auto_ms = 0;
+  atomic_init(&aof->last_ok, true);
+  atomic_init(&aof->last_ms, 0);
+}
+
+void aof_shard_init(AofShard *log) {
+  vector_initialize(&log->buf, 0, sizeof(uint8_t));
+  vector_initialize(&log->diff, 0, sizeof(uint8_t));
+  dlist_init(&log->waiting);
+  vector_initialize(&log->parts, 0, sizeof(void *));
+  log->logged = 0;
+  log->synced = 0;
+}
+
+void aof_shard_cleanup(AofShard *log) {
+  vector_cleanup(&log->buf);
+  vector_cleanup(&log->diff);
+  vector_cleanup(&log->parts);
+}
+
+static void append_command(Vector *buf, const Slice *argv, size_t argc) {
+  Output out = {buf, NULL};
+  resp_write_array(&out, argc);
+  for (size_t i = 0; i < argc; i++) {
+    resp_write_bulk(&out, argv[i].data, argv[i].len);
+  }
+}
+
+// returns how many bytes made it, all of them unless a write failed
+static size_t write_all(int fd, const uint8_t *data, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t res = write(fd, data + done, len - done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      break;
+    }
+    done += (size_t)res;
+  }
+  return done;
+}
+
+static void rewrite_tmp(const Aof *aof, pid_t pid, char tmp[PATH_MAX]) {
+  (void)snprintf(tmp, PATH_MAX, "%s.tmp-%d", aof->path, (int)pid);
+}
+
+typedef struct AofWriter {
+  int fd;
+  Vector buf;
+  Keyspace *ks; // the one being walked
+  bool failed;
+} AofWriter;
+
+static void writer_flush(AofWriter *w) {
+  size_t len = vector_length(&w->buf);
+  if (!w->failed && write_all(w->fd, w->buf.data, len) != len) {
+    w->failed = true;
+  }
+  vector_clear(&w->buf);
+}
+
+static void writer_put(AofWriter *w, const Slice *argv, size_t argc) {
+  append_command(&w->buf, argv, argc);
+  if (vector_length(&w->buf) >= AOF_CHUNK) {
+    writer_flush(w);
+  }
+}
+
+static Slice str_slice(const char *str) {
+  return (Slice){(const uint8_t *)str, strlen(str)};
+}
+
+static void put_zset(AofWriter *w, const Slice *key, ZSet *zset) {
+  Slice argv[2 + 2 * AOF_ZADD_MEMBERS] = {str_slice("ZADD"), *key};
+  char scores[AOF_ZADD_MEMBERS][32];
+  size_t argc = 2;
+  for (ZNode *node = zset_at(zset, 0); node; node = znode_offset(node, 1)) {
+    char *score = scores[(argc - 2) / 2];
+    int len = snprintf(score, sizeof(scores[0]), "%.17g", node->score);
+    argv[argc++] = (Slice){(const uint8_t *)score, (size_t)len};
+    argv[argc++] = (Slice){node->name, node->len};
+    if (argc == sizeof(argv) / sizeof(*argv)) {
+      writer_put(w, argv, argc);
+      argc = 2;
+    }
+  }
+  if (argc > 2) {
+    writer_put(w, argv, argc);
+  }
+}
+
+static bool write_entry(HNode *node, void *arg) {
+  AofWriter *w = arg;
+  Entry *entry = container_of(node, Entry, node);
+  Slice key = {entry_key(entry), entry->key_len};
+  if (entry->enc == ENC_ZSET) {
+    put_zset(w, &key, entry->zset);
+  } else {
+    char buf[ENTRY_INT_BUF];
+    Slice argv[3] = {str_slice("SET"), key, entry_value(entry, buf)};
+    writer_put(w, argv, 3);
+  }
+
+  uint64_t deadline = keyspace_expiry(w->ks, entry);
+  if (deadline) {
+    char when[24];
+    int len = snprintf(when, sizeof(when), "%" PRIu64, deadline);
+    Slice argv[3] = {str_slice("PEXPIREAT"), key,
+                     {(const uint8_t *)when, (size_t)len}};
+    writer_put(w, argv, 3);
+  }
+  return !w->failed;
+}
+
+// every keyspace as the commands that rebuild it, into a new synced file
+// at tmp. the shards must not run meanwhile
+static bool write_dataset(Shards *shards, const char *tmp) {
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    ERROR(false, "aof rewrite open failed")
+    return false;
+  }
+  AofWriter w = {.fd = fd};
+  vector_initialize(&w.buf, 0, sizeof(uint8_t));
+  for (size_t i = 0; i < shards->count && !w.failed; i++) {
+    w.ks = &shards->servers[i]->keyspace;
+    hmap_foreach(&w.ks->map, write_entry, &w);
+  }
+  writer_flush(&w);
+  vector_cleanup(&w.buf);
+
+  bool ok = !w.failed && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  if (!ok) {
+    ERROR(false, "aof rewrite failed")
+    (void)unlink(tmp);
+  }
+  return ok;
+}
+
+// the arguments of a parsed command, false unless it is an array of
+// bulk strings
+static bool command_args(const RespParser *parser, const uint8_t *buf,
+                         Vector *argv) {
+  RespValue *head = resp_value_at(parser, 0);
+  if (head->type != RESP_ARRAY || resp_value_count(parser) < 2) {
+    return false;
+  }
+  vector_clear(argv);
+  for (size_t i = 1; i < resp_value_count(parser); i++) {
+    RespValue *arg = resp_value_at(parser, i);
+    if (arg->type != RESP_BULK_STRING) {
+      return false;
+    }
+    Slice slice = {resp_value_data(parser, buf, arg), arg->len};
+    vector_push_back(argv, (const uint8_t *)&slice);
+  }
+  return true;
+}
+
+// runs one command of the log on the shard owning its keys. commands of
+// several keys are split per key, the shard count may differ from the
+// one that wrote the log
+static bool replay(Shards *shards, Vector *argv, Vector *sub,
+                   Output *reply) {
+  Slice *args = (Slice *)argv->data;
+  size_t argc = vector_length(argv);
+  const Command *cmd = command_lookup(&args[0]);
+  if (!cmd) {
+    return false;
+  }
+  size_t first = (size_t)cmd->first_key;
+  if (shards->count == 1 || first == 0 || first >= argc) {
+    command_execute(shards->servers[0], args, argc, reply);
+    return true;
+  }
+  if (cmd->last_key >= 0) {
+    size_t owner = shards_owner(shards, args[first].data, args[first].len);
+    command_execute(shards->servers[owner], args, argc, reply);
+    return true;
+  }
+
+  size_t step = (size_t)cmd->key_step;
+  for (size_t k = first; k + step <= argc; k += step) {
+    vector_clear(sub);
+    vector_push_back(sub, (const uint8_t *)&args[0]);
+    for (size_t i = 0; i < step; i++) {
+      vector_push_back(sub, (const uint8_t *)&args[k + i]);
+    }
+    size_t owner = shards_owner(shards, args[k].data, args[k].len);
+    command_execute(shards->servers[owner], (Slice *)sub->data,
+                    vector_length(sub), reply);
+  }
+  return true;
+}
+
+// drops the replayed commands from buf and reads the next chunk behind
+// what is left, returns what read returned (-1 when out of memory)
+static ssize_t refill(int fd, Vector *buf, RespParser *parser) {
+  size_t rest = vector_length(buf) - parser->start;
+  memmove(buf->data, buf->data + parser->start, rest);
+  resp_parser_move(parser, 0);
+  if (!vector_grow(buf, rest + AOF_CHUNK)) { // read() fills it
+    ERROR(false, "out of memory loading the aof")
+    return -1;
+  }
+  ssize_t res = 0;
+  do {
+    res = read(fd, buf->data + rest, AOF_CHUNK);
+  } while (res < 0 && errno == EINTR);
+  vector_resize(buf, rest + (res > 0 ? (size_t)res : 0));
+  return res;
+}
+
+// replays path into the shards before they run, a missing file is an
+// empty log. half a command at the end (a crash in the middle of a
+// write) is cut off, anything else malformed fails the load
+bool aof_load(Shards *shards, const char *path, AofStats *stats) {
+  *stats = (AofStats){0};
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    ERROR(false, "aof open failed")
+    return false;
+  }
+
+  Vector buf;
+  Vector argv;
+  Vector sub;
+  Vector reply;
+  vector_initialize(&buf, 0, sizeof(uint8_t));
+  vector_initialize(&argv, 0, sizeof(Slice));
+  vector_initialize(&sub, 0, sizeof(Slice));
+  vector_initialize(&reply, 0, sizeof(uint8_t));
+  RespParser parser;
+  resp_parser_init(&parser);
+  // replies are dropped, nothing references values of the keyspace
+  Output out = {&reply, NULL};
+
+  bool ok = true;
+  bool eof = false;
+  while (ok) {
+    enum RespStatus status =
+        resp_parse(&parser, buf.data, vector_length(&buf));
+    if (status == RESP_COMPLETE) {
+      ok = command_args(&parser, buf.data, &argv) &&
+           replay(shards, &argv, &sub, &out);
+      vector_clear(&reply);
+      stats->commands++;
+      stats->bytes += resp_message_len(&parser);
+      resp_parser_reset(&parser, parser.pos);
+    } else if (status == RESP_INVALID || eof) {
+      ok = status != RESP_INVALID;
+      break;
+    } else {
+      ssize_t res = refill(fd, &buf, &parser);
+      ok = res >= 0;
+      eof = res == 0;
+    }
+  }
+
+  size_t rest = vector_length(&buf) - parser.start;
+  if (ok && rest > 0) {
+    LOG(0, "AOF: cutting off %zu bytes of an incomplete command at the end",
+        rest)
+    stats->truncated = true;
+    ok = ftruncate(fd, (off_t)stats->bytes) == 0;
+  }
+
+  resp_parser_cleanup(&parser);
+  vector_cleanup(&buf);
+  vector_cleanup(&argv);
+  vector_cleanup(&sub);
+  vector_cleanup(&reply);
+  close(fd);
+  return ok;
+}
+
+// everysec: syncs what the shards wrote during the last second, so they
+// never wait for the disk themselves
+static void *aof_syncer(void *arg) {
+  Aof *aof = arg;
+  pthread_mutex_lock(&aof->lock);
+  while (!aof->stopping) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += 1;
+    (void)pthread_cond_timedwait(&aof->cond, &aof->lock, &until);
+    if (atomic_exchange(&aof->dirty, false) && fdatasync(aof->fd) != 0) {
+      ERROR(false, "aof fsync failed")
+    }
+  }
+  pthread_mutex_unlock(&aof->lock);
+  return NULL;
+}
+
+// opens the log for appending once whatever was on disk is loaded. a log
+// that does not exist yet starts out as a rewrite of the loaded keys, so
+// replaying it alone always rebuilds the whole keyspace
+bool aof_open(Shards *shards) {
+  Aof *aof = &shards->aof;
+  if (!aof->path) {
+    return true;
+  }
+  if (access(aof->path, F_OK) != 0) {
+    char tmp[PATH_MAX];
+    rewrite_tmp(aof, getpid(), tmp);
+    if (!write_dataset(shards, tmp)) {
+      return false;
+    }
+    if (rename(tmp, aof->path) != 0) {
+      ERROR(false, "aof rename failed")
+      (void)unlink(tmp);
+      return false;
+    }
+  }
+
+  aof->fd = open(aof->path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  struct stat st;
+  if (aof->fd < 0 || fstat(aof->fd, &st) != 0) {
+    ERROR(false, "aof open failed")
+    return false;
+  }
+  atomic_store(&aof->size, (uint64_t)st.st_size);
+  atomic_store(&aof->base_size, (uint64_t)st.st_size);
+  if (aof->fsync == AOF_FSYNC_EVERYSEC &&
+      pthread_create(&aof->syncer, NULL, aof_syncer, aof)) {
+    ERROR(false, "error starting the aof fsync thread")
+    return false;
+  }
+  return true;
+}
+
+// logs a command serv ran, a no-op while the log is off (or loading)
+void aof_feed(Server *serv, const Slice *argv, size_t argc) {
+  if (!serv->shards || serv->shards->aof.fd < 0) {
+    return;
+  }
+  size_t before = vector_length(&serv->aof.buf);
+  append_command(&serv->aof.buf, argv, argc);
+  serv->aof.logged += vector_length(&serv->aof.buf) - before;
+}
+
+// true while a reply that depends on the log up to mark (a position in
+// serv's log) has to wait for the next flush, only ever under always
+bool aof_must_wait(const Server *serv, uint64_t mark) {
+  return mark > serv->aof.synced &&
+         serv->shards->aof.fsync == AOF_FSYNC_ALWAYS;
+}
+
+// writes what serv logged since the last flush with one write. under
+// always it is synced before returning, failing that is fatal as replies
+// wait for it. otherwise what did not make it out is retried next time
+void aof_flush(Server *serv) {
+  Vector *buf = &serv->aof.buf;
+  size_t len = vector_length(buf);
+  if (len == 0) {
+    return;
+  }
+  Aof *aof = &serv->shards->aof;
+  size_t done = write_all(aof->fd, buf->data, len);
+  if (aof->fsync == AOF_FSYNC_ALWAYS &&
+      (done < len || fdatasync(aof->fd) != 0)) {
+    ERROR(true, "aof write failed")
+  }
+  if (aof->rewriting) {
+    vector_append(&serv->aof.diff, buf->data, done);
+  }
+  atomic_fetch_add(&aof->size, done);
+  atomic_store(&aof->dirty, true);
+  if (done < len) {
+    ERROR(false, "aof write failed")
+    memmove(buf->data, buf->data + done, len - done);
+    vector_resize(buf, len - done);
+    return;
+  }
+  vector_clear(buf);
+  serv->aof.synced = serv->aof.logged;
+}
+
+// BGREWRITEAOF, the shards are only paused to flush their logs and fork
+AofResult aof_rewrite(Server *serv) {
+  Shards *shards = serv->shards;
+  if (!shards || shards->aof.fd < 0) {
+    return AOF_OFF;
+  }
+  Aof *aof = &shards->aof;
+  if (atomic_load(&aof->child) || !shards_pause(shards)) {
+    return AOF_BUSY;
+  }
+  if (atomic_load(&aof->child)) {
+    shards_resume(shards);
+    return AOF_BUSY;
+  }
+
+  // what was logged so far goes into the file and the child writes the
+  // same keys, what is logged from here on is kept aside for its result
+  for (size_t i = 0; i < shards->count; i++) {
+    aof_flush(shards->servers[i]);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    char tmp[PATH_MAX];
+    rewrite_tmp(aof, getpid(), tmp);
+    _exit(write_dataset(shards, tmp) ? 0 : 1);
+  }
+  aof->rewriting = pid > 0;
+  shards_resume(shards);
+  if (pid < 0) {
+    ERROR(false, "aof rewrite fork failed")
+    return AOF_FAILED;
+  }
+  aof->owner = serv;
+  aof->reaped = false;
+  aof->started_ms = monotonic_ms();
+  aof->next_poll_ms = aof->started_ms;
+  atomic_store(&aof->child, pid);
+  LOG(0, "AOF: rewrite started by pid %d", (int)pid)
+  return AOF_OK;
+}
+
+// appends what the shards logged while the child ran to its file, then
+// puts that in place of the log. the shards must not run meanwhile
+static bool rewrite_finish(Shards *shards, const char *tmp) {
+  Aof *aof = &shards->aof;
+  int fd = open(tmp, O_WRONLY | O_APPEND | O_CLOEXEC);
+  bool ok = fd >= 0;
+  for (size_t i = 0; i < shards->count && ok; i++) {
+    Vector *diff = &shards->servers[i]->aof.diff;
+    ok = write_all(fd, diff->data, vector_length(diff)) ==
+         vector_length(diff);
+  }
+  struct stat st;
+  ok = ok && fsync(fd) == 0 && fstat(fd, &st) == 0 &&
+       rename(tmp, aof->path) == 0;
+  if (!ok) {
+    ERROR(false, "aof rewrite failed")
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+
+  // the syncer may be using the old fd
+  pthread_mutex_lock(&aof->lock);
+  int old = aof->fd;
+  aof->fd = fd;
+  pthread_mutex_unlock(&aof->lock);
+  close(old);
+  atomic_store(&aof->size, (uint64_t)st.st_size);
+  atomic_store(&aof->base_size, (uint64_t)st.st_size);
+  return true;
+}
+
+static void rewrite_done(Shards *shards, pid_t pid, int status) {
+  Aof *aof = &shards->aof;
+  char tmp[PATH_MAX];
+  rewrite_tmp(aof, pid, tmp);
+  bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+            rewrite_finish(shards, tmp);
+  uint64_t ms = monotonic_ms() - aof->started_ms;
+  if (ok) {
+    LOG(0, "AOF: rewritten to %" PRIu64 " bytes in %" PRIu64 " ms",
+        (uint64_t)atomic_load(&aof->size), ms)
+  } else {
+    LOG(0, "AOF: rewrite by pid %d failed", (int)pid)
+    (void)unlink(tmp);
+    aof->next_auto_ms = monotonic_ms() + AOF_RETRY_MS;
+  }
+
+  aof->rewriting = false;
+  for (size_t i = 0; i < shards->count; i++) {
+    // it may have grown large, it is not kept around
+    Vector *diff = &shards->servers[i]->aof.diff;
+    vector_cleanup(diff);
+    vector_initialize(diff, 0, sizeof(uint8_t));
+  }
+  atomic_store(&aof->last_ok, ok);
+  if (ok) {
+    atomic_store(&aof->last_ms, ms);
+  }
+  aof->reaped = false;
+  atomic_store(&aof->child, 0);
+}
+
+static bool rewrite_due(Server *serv) {
+  Aof *aof = &serv->shards->aof;
+  uint64_t size = atomic_load(&aof->size);
+  return serv->shard_id == 0 && size >= AOF_AUTO_MIN &&
+         size >= 2 * atomic_load(&aof->base_size) &&
+         monotonic_ms() >= aof->next_auto_ms;
+}
+
+// the shard that forked checks on the child now and then and finishes
+// the rewrite once it exited, shard 0 starts one when the log grew
+// enough. returns how long the loop may wait (ms) for the next check,
+// -1 for no child
+int aof_poll(Server *serv) {
+  if (!serv->shards || serv->shards->aof.fd < 0) {
+    return -1;
+  }
+  Shards *shards = serv->shards;
+  Aof *aof = &shards->aof;
+  pid_t pid = atomic_load(&aof->child);
+  if (!pid) {
+    if (!rewrite_due(serv)) {
+      return -1;
+    }
+    AofResult res = aof_rewrite(serv);
+    if (res == AOF_FAILED) {
+      aof->next_auto_ms = monotonic_ms() + AOF_RETRY_MS;
+    }
+    return res == AOF_OK ? AOF_POLL_MS : -1;
+  }
+  if (aof->owner != serv) {
+    return -1;
+  }
+
+  uint64_t now = monotonic_ms();
+  if (now < aof->next_poll_ms) {
+    return (int)(aof->next_poll_ms - now);
+  }
+  if (!aof->reaped) {
+    pid_t res = waitpid(pid, &aof->status, WNOHANG);
+    if (res == 0) {
+      aof->next_poll_ms = now + AOF_POLL_MS;
+      return AOF_POLL_MS;
+    }
+    if (res != pid) {
+      aof->status = -1;
+    }
+    aof->reaped = true;
+  }
+  if (!shards_pause(shards)) {
+    // another shard paused the world, the swap waits until it is done
+    aof->next_poll_ms = now + AOF_POLL_MS;
+    return AOF_POLL_MS;
+  }
+  rewrite_done(shards, pid, aof->status);
+  shards_resume(shards);
+  return -1;
+}
+
+// the shards stopped, what they logged last is written and synced. a
+// rewrite that is done is finished, one still running is abandoned
+void aof_cleanup(Shards *shards) {
+  Aof *aof = &shards->aof;
+  if (aof->fd >= 0) {
+    for (size_t i = 0; i < shards->count; i++) {
+      aof_flush(shards->servers[i]);
+    }
+    pid_t pid = atomic_load(&aof->child);
+    if (pid) {
+      if (!aof->reaped && waitpid(pid, &aof->status, WNOHANG) != pid) {
+        (void)kill(pid, SIGKILL);
+        aof->status = -1;
+        (void)waitpid(pid, NULL, 0);
+      }
+      rewrite_done(shards, pid, aof->status);
+    }
+    if (aof->fsync == AOF_FSYNC_EVERYSEC) {
+      pthread_mutex_lock(&aof->lock);
+      aof->stopping = true;
+      pthread_cond_signal(&aof->cond);
+      pthread_mutex_unlock(&aof->lock);
+      pthread_join(aof->syncer, NULL);
+    }
+    if (fsync(aof->fd) != 0) {
+      ERROR(false, "aof fsync failed")
+    }
+    close(aof->fd);
+    aof->fd = -1;
+  }
+  pthread_mutex_destroy(&aof->lock);
+  pthread_cond_destroy(&aof->cond);
+}
@@ -0,0 +1,179 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "avl.h"
+
+void avl_init(AVLNode *node) {
+  *node = (AVLNode){.height = 1, .count = 1};
+}
+
+static uint32_t avl_height(const AVLNode *node) {
+  return node ? node->height : 0;
+}
+
+// the count of an empty subtree is 0
+uint32_t avl_count(const AVLNode *node) { return node ? node->count : 0; }
+
+static uint32_t max_u32(uint32_t lhs, uint32_t rhs) {
+  return lhs > rhs ? lhs : rhs;
+}
+
+static void avl_update(AVLNode *node) {
+  node->height = 1 + max_u32(avl_height(node->left), avl_height(node->right));
+  node->count = 1 + avl_count(node->left) + avl_count(node->right);
+}
+
+static AVLNode *rot_left(AVLNode *node) {
+  AVLNode *parent = node->parent;
+  AVLNode *pivot = node->right;
+  AVLNode *inner = pivot->left;
+  node->right = inner;
+  if (inner) {
+    inner->parent = node;
+  }
+  pivot->parent = parent;
+  pivot->left = node;
+  node->parent = pivot;
+  avl_update(node);
+  avl_update(pivot);
+  return pivot;
+}
+
+static AVLNode *rot_right(AVLNode *node) {
+  AVLNode *parent = node->parent;
+  AVLNode *pivot = node->left;
+  AVLNode *inner = pivot->right;
+  node->left = inner;
+  if (inner) {
+    inner->parent = node;
+  }
+  pivot->parent = parent;
+  pivot->right = node;
+  node->parent = pivot;
+  avl_update(node);
+  avl_update(pivot);
+  return pivot;
+}
+
+// the left subtree is 2 levels taller
+static AVLNode *fix_left(AVLNode *node) {
+  if (avl_height(node->left->left) < avl_height(node->left->right)) {
+    node->left = rot_left(node->left);
+  }
+  return rot_right(node);
+}
+
+// the right subtree is 2 levels taller
+static AVLNode *fix_right(AVLNode *node) {
+  if (avl_height(node->right->right) < avl_height(node->right->left)) {
+    node->right = rot_right(node->right);
+  }
+  return rot_left(node);
+}
+
+// updates and rebalances from node up to the root after node or one of
+// its children changed, returns the (possibly new) root
+AVLNode *avl_fix(AVLNode *node) {
+  for (;;) {
+    AVLNode **from = &node; // where the fixed subtree is attached
+    AVLNode *parent = node->parent;
+    if (parent) {
+      from = parent->left == node ? &parent->left : &parent->right;
+    }
+    avl_update(node);
+    uint32_t left = avl_height(node->left);
+    uint32_t right = avl_height(node->right);
+    if (left == right + 2) {
+      *from = fix_left(node);
+    } else if (left + 2 == right) {
+      *from = fix_right(node);
+    }
+    if (!parent) {
+      return *from;
+    }
+    node = parent;
+  }
+}
+
+// unlinks a node with at most one child, returns the new root
+static AVLNode *avl_del_easy(AVLNode *node) {
+  AVLNode *child = node->left ? node->left : node->right;
+  AVLNode *parent = node->parent;
+  if (child) {
+    child->parent = parent;
+  }
+  if (!parent) {
+    return child;
+  }
+  AVLNode **from = parent->left == node ? &parent->left : &parent->right;
+  *from = child;
+  return avl_fix(parent);
+}
+
+// unlinks node from its tree, returns the new root (NULL once empty)
+AVLNode *avl_del(AVLNode *node) {
+  if (!node->left || !node->right) {
+    return avl_del_easy(node);
+  }
+  // the successor has no left child, it is unlinked and takes node's place
+  AVLNode *victim = node->right;
+  while (victim->left) {
+    victim = victim->left;
+  }
+  AVLNode *root = avl_del_easy(victim);
+  *victim = *node;
+  if (victim->left) {
+    victim->left->parent = victim;
+  }
+  if (victim->right) {
+    victim->right->parent = victim;
+  }
+  AVLNode **from = &root;
+  AVLNode *parent = node->parent;
+  if (parent) {
+    from = parent->left == node ? &parent->left : &parent->right;
+  }
+  *from = victim;
+  return root;
+}
+
+// the node offset places away in sorted order, NULL when out of range.
+// walks up and down the tree using the counts, O(log n)
+AVLNode *avl_offset(AVLNode *node, int64_t offset) {
+  int64_t pos = 0; // rank of node relative to the starting one
+  while (offset != pos) {
+    if (pos < offset && pos + avl_count(node->right) >= offset) {
+      // the target is inside the right subtree
+      node = node->right;
+      pos += avl_count(node->left) + 1;
+    } else if (pos > offset && pos - avl_count(node->left) <= offset) {
+      // the target is inside the left subtree
+      node = node->left;
+      pos -= avl_count(node->right) + 1;
+    } else {
+      // go to the parent
+      AVLNode *parent = node->parent;
+      if (!parent) {
+        return NULL;
+      }
+      if (parent->right == node) {
+        pos -= avl_count(node->left) + 1;
+      } else {
+        pos += avl_count(node->right) + 1;
+      }
+      node = parent;
+    }
+  }
+  return node;
+}
+
+// 0 based position of node in sorted order
+int64_t avl_rank(const AVLNode *node) {
+  int64_t rank = avl_count(node->left);
+  for (; node->parent; node = node->parent) {
+    if (node->parent->right == node) {
+      rank += avl_count(node->parent->left) + 1;
+    }
+  }
+  return rank;
+}
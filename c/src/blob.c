@@ -0,0 +1,34 @@
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob.h"
+
+// a copy of data with one reference, NULL when out of memory
+Blob *blob_new(const uint8_t *data, size_t len) {
+  Blob *blob = malloc(sizeof(Blob) + len);
+  if (!blob) {
+    return NULL;
+  }
+  atomic_init(&blob->refs, 1);
+  memcpy(blob->data, data, len);
+  return blob;
+}
+
+Blob *blob_ref(Blob *blob) {
+  atomic_fetch_add_explicit(&blob->refs, 1, memory_order_relaxed);
+  return blob;
+}
+
+// the last reference frees it, on whichever thread drops it
+void blob_unref(Blob *blob) {
+  if (atomic_fetch_sub_explicit(&blob->refs, 1, memory_order_acq_rel) == 1) {
+    free(blob);
+  }
+}
+
+size_t blob_memory(const Blob *blob) {
+  return malloc_usable_size((void *)blob);
+}
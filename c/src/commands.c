@@ -0,0 +1,1321 @@
+#include <ctype.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "aof.h"
+#include "commands.h"
+#include "connection.h"
+#include "evict.h"
+#include "heap.h"
+#include "keyspace.h"
+#include "pool.h"
+#include "resp.h"
+#include "server.h"
+#include "shard.h"
+#include "slowlog.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "utils.h"
+#include "vector.h"
+
+static const char WRONGTYPE[] =
+    "WRONGTYPE Operation against a key holding the wrong kind of value";
+
+static void cmd_ping(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)serv;
+  if (argc > 1) {
+    resp_write_bulk(out, argv[1].data, argv[1].len);
+  } else {
+    resp_write_simple(out, "PONG");
+  }
+}
+
+// long values go out by reference when out takes references, the conn
+// keeps the blob alive if the key changes before the reply is sent
+static void write_value(Server *serv, Output *out, const Entry *entry) {
+  size_t ref_min = serv->config->reply_ref_min;
+  if (entry->enc == ENC_RAW && out->refs &&
+      entry->val_len >= (ref_min ? ref_min : OUTPUT_REF_MIN)) {
+    resp_write_ref(out, entry->raw, entry->val_len);
+    serv->reply_referenced += entry->val_len;
+    return;
+  }
+  char buf[ENTRY_INT_BUF];
+  Slice val = entry_value(entry, buf);
+  resp_write_bulk(out, val.data, val.len);
+  serv->reply_copied += val.len;
+}
+
+static void cmd_get(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  Entry *entry = keyspace_get(&serv->keyspace, argv[1].data, argv[1].len);
+  if (!entry) {
+    resp_write_null(out);
+  } else if (!entry_is_string(entry)) {
+    resp_write_error(out, WRONGTYPE);
+  } else {
+    write_value(serv, out, entry);
+  }
+}
+
+static void cmd_set(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  if (!keyspace_set(&serv->keyspace, argv[1].data, argv[1].len, argv[2].data,
+                    argv[2].len)) {
+    resp_write_error(out, "OOM command not allowed");
+    return;
+  }
+  resp_write_simple(out, "OK");
+}
+
+// DEL and UNLINK alike: the keys are gone right away, values past
+// LAZYFREE_THRESHOLD are freed in the background
+static void cmd_del(Server *serv, Slice *argv, size_t argc, Output *out) {
+  int64_t deleted = 0;
+  for (size_t i = 1; i < argc; i++) {
+    deleted += keyspace_del(&serv->keyspace, argv[i].data, argv[i].len);
+  }
+  resp_write_integer(out, deleted);
+}
+
+static void cmd_exists(Server *serv, Slice *argv, size_t argc, Output *out) {
+  int64_t found = 0;
+  for (size_t i = 1; i < argc; i++) {
+    found += keyspace_get(&serv->keyspace, argv[i].data, argv[i].len) != NULL;
+  }
+  resp_write_integer(out, found);
+}
+
+static void cmd_mget(Server *serv, Slice *argv, size_t argc, Output *out) {
+  resp_write_array(out, argc - 1);
+  // keys of another type read as missing
+  for (size_t i = 1; i < argc; i++) {
+    Entry *entry = keyspace_get(&serv->keyspace, argv[i].data, argv[i].len);
+    if (entry && entry_is_string(entry)) {
+      write_value(serv, out, entry);
+    } else {
+      resp_write_null(out);
+    }
+  }
+}
+
+static void cmd_mset(Server *serv, Slice *argv, size_t argc, Output *out) {
+  if (argc % 2 == 0) {
+    resp_write_error(out, "ERR wrong number of arguments for 'mset' command");
+    return;
+  }
+  for (size_t i = 1; i < argc; i += 2) {
+    if (!keyspace_set(&serv->keyspace, argv[i].data, argv[i].len,
+                      argv[i + 1].data, argv[i + 1].len)) {
+      resp_write_error(out, "OOM command not allowed");
+      return;
+    }
+  }
+  resp_write_simple(out, "OK");
+}
+
+static void write_not_int(Output *out) {
+  resp_write_error(out, "ERR value is not an integer or out of range");
+}
+
+// parses a ttl argument given in unit ms, false when it is not an integer
+// or does not fit in ms
+static bool parse_ttl(const Slice *arg, int64_t unit, int64_t *ms) {
+  int64_t ttl = 0;
+  if (!parse_int64(arg->data, arg->len, &ttl) || ttl > INT64_MAX / unit ||
+      ttl < INT64_MIN / unit) {
+    return false;
+  }
+  *ms = ttl * unit;
+  return true;
+}
+
+// ttls are logged as their deadline, replaying a relative one later on
+// would push it back
+static void log_deadline(Server *serv, const Slice *key, uint64_t when) {
+  char buf[24];
+  int len = snprintf(buf, sizeof(buf), "%" PRIu64, when);
+  Slice argv[3] = {{(const uint8_t *)"PEXPIREAT", 9},
+                   *key,
+                   {(const uint8_t *)buf, (size_t)len}};
+  aof_feed(serv, argv, 3);
+}
+
+// the ttl is relative to now unless absolute (a unix time in unit ms), a
+// deadline that passed already deletes the key right away
+static void expire_generic(Server *serv, Slice *argv, int64_t unit,
+                           bool absolute, Output *out) {
+  int64_t ms = 0;
+  if (!parse_ttl(&argv[2], unit, &ms)) {
+    write_not_int(out);
+    return;
+  }
+  Keyspace *ks = &serv->keyspace;
+  Entry *entry = keyspace_get(ks, argv[1].data, argv[1].len);
+  if (!entry) {
+    resp_write_integer(out, 0);
+    return;
+  }
+  uint64_t now = time_ms();
+  if (absolute ? ms <= (int64_t)now : ms <= 0) {
+    (void)keyspace_del(ks, argv[1].data, argv[1].len);
+    Slice del[2] = {{(const uint8_t *)"DEL", 3}, argv[1]};
+    aof_feed(serv, del, 2);
+  } else {
+    uint64_t when = absolute ? (uint64_t)ms : now + (uint64_t)ms;
+    keyspace_set_expiry(ks, entry, when);
+    log_deadline(serv, &argv[1], when);
+  }
+  resp_write_integer(out, 1);
+}
+
+static void cmd_expire(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  expire_generic(serv, argv, 1000, false, out);
+}
+
+static void cmd_pexpire(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  expire_generic(serv, argv, 1, false, out);
+}
+
+static void cmd_expireat(Server *serv, Slice *argv, size_t argc,
+                         Output *out) {
+  (void)argc;
+  expire_generic(serv, argv, 1000, true, out);
+}
+
+static void cmd_pexpireat(Server *serv, Slice *argv, size_t argc,
+                          Output *out) {
+  (void)argc;
+  expire_generic(serv, argv, 1, true, out);
+}
+
+static void cmd_setex(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  int64_t ms = 0;
+  if (!parse_ttl(&argv[2], 1000, &ms)) {
+    write_not_int(out);
+    return;
+  }
+  if (ms <= 0) {
+    resp_write_error(out, "ERR invalid expire time in 'setex' command");
+    return;
+  }
+  Entry *entry = keyspace_set(&serv->keyspace, argv[1].data, argv[1].len,
+                              argv[3].data, argv[3].len);
+  if (!entry) {
+    resp_write_error(out, "OOM command not allowed");
+    return;
+  }
+  uint64_t when = time_ms() + (uint64_t)ms;
+  keyspace_set_expiry(&serv->keyspace, entry, when);
+  Slice set[3] = {{(const uint8_t *)"SET", 3}, argv[1], argv[3]};
+  aof_feed(serv, set, 3);
+  log_deadline(serv, &argv[1], when);
+  resp_write_simple(out, "OK");
+}
+
+// -2 for a missing key, -1 for one without a ttl
+static void ttl_generic(Server *serv, Slice *argv, bool in_ms, Output *out) {
+  Keyspace *ks = &serv->keyspace;
+  Entry *entry = keyspace_get(ks, argv[1].data, argv[1].len);
+  if (!entry) {
+    resp_write_integer(out, -2);
+    return;
+  }
+  uint64_t when = keyspace_expiry(ks, entry);
+  if (!when) {
+    resp_write_integer(out, -1);
+    return;
+  }
+  uint64_t now = time_ms();
+  int64_t left = when > now ? (int64_t)(when - now) : 0;
+  resp_write_integer(out, in_ms ? left : (left + 500) / 1000);
+}
+
+static void cmd_ttl(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  ttl_generic(serv, argv, false, out);
+}
+
+static void cmd_pttl(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  ttl_generic(serv, argv, true, out);
+}
+
+static void cmd_persist(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  Entry *entry = keyspace_get(&serv->keyspace, argv[1].data, argv[1].len);
+  resp_write_integer(out, entry && keyspace_persist(&serv->keyspace, entry));
+}
+
+static void write_stat(Output *out, const char *name, size_t value) {
+  resp_write_bulk(out, (const uint8_t *)name, strlen(name));
+  resp_write_integer(out, (int64_t)value);
+}
+
+// MEMORY STATS: name / value pairs of the pool of the serving shard
+static void memory_stats(Server *serv, Output *out) {
+  const PoolStats *stats = &serv->pool.stats;
+  resp_write_array(out, 2 * (6 + POOL_CLASSES));
+  write_stat(out, "pool.slabs", stats->slabs);
+  write_stat(out, "pool.conns", stats->objects);
+  write_stat(out, "pool.conns.used", stats->objects_used);
+  write_stat(out, "pool.buffers.lent", stats->buffers_lent);
+  write_stat(out, "pool.buffers.hits", stats->buffer_hits);
+  write_stat(out, "pool.buffers.misses", stats->buffer_misses);
+  for (size_t cls = 0; cls < POOL_CLASSES; cls++) {
+    char name[64];
+    (void)snprintf(name, sizeof(name), "pool.buffers.cached.%zuk",
+                   pool_class_size(cls) / 1024);
+    write_stat(out, name, stats->buffers_cached[cls]);
+  }
+}
+
+// MEMORY USAGE key: bytes allocated for the entry and its value, the
+// tables the keyspace keeps are in INFO memory
+static void memory_usage(Server *serv, const Slice *key, Output *out) {
+  Entry *entry = keyspace_get(&serv->keyspace, key->data, key->len);
+  if (!entry) {
+    resp_write_null(out);
+    return;
+  }
+  resp_write_integer(out, (int64_t)entry_memory(entry));
+}
+
+static bool is_subcommand(const Slice *arg, const char *name) {
+  return arg->len == strlen(name) &&
+         strncasecmp((const char *)arg->data, name, arg->len) == 0;
+}
+
+static void cmd_memory(Server *serv, Slice *argv, size_t argc, Output *out) {
+  if (argc == 2 && is_subcommand(&argv[1], "stats")) {
+    memory_stats(serv, out);
+  } else if (argc == 3 && is_subcommand(&argv[1], "usage")) {
+    memory_usage(serv, &argv[2], out);
+  } else {
+    resp_write_error(out, "ERR unknown subcommand or wrong number of "
+                          "arguments for 'memory' command");
+  }
+}
+
+// appends one "name:value" line
+static void info_line(Vector *text, const char *fmt, ...) {
+  char line[128];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (len < 0) {
+    return;
+  }
+  if ((size_t)len >= sizeof(line)) {
+    len = sizeof(line) - 1;
+  }
+  vector_append(text, (const uint8_t *)line, (size_t)len);
+  vector_append(text, (const uint8_t *)"\r\n", 2);
+}
+
+static void info_memory(Server *serv, Vector *text) {
+  Keyspace *ks = &serv->keyspace;
+  size_t keys = keyspace_size(ks);
+  size_t table = keyspace_table_memory(ks);
+  info_line(text, "# Memory");
+  info_line(text, "used_memory_shard:%zu", keyspace_memory(ks));
+  info_line(text, "keyspace_entry_bytes:%zu", ks->bytes);
+  info_line(text, "keyspace_table_bytes:%zu", table);
+  info_line(text, "keyspace_bytes_per_key:%.2f",
+            keys ? (double)(ks->bytes + table) / (double)keys : 0.0);
+  if (serv->shards) {
+    LazyFree *lazy = &serv->shards->lazy;
+    info_line(text, "lazyfree_pending_objects:%zu",
+              atomic_load(&lazy->pending));
+    info_line(text, "lazyfreed_objects:%" PRIu64,
+              (uint64_t)atomic_load(&lazy->done));
+  }
+  info_line(text, "maxmemory:%zu", serv->config->maxmemory);
+  info_line(text, "maxmemory_shard:%zu", serv->maxmemory);
+  info_line(text, "maxmemory_policy:%s",
+            evict_policy_name(serv->config->maxmemory_policy));
+}
+
+static void info_keyspace(Server *serv, Vector *text) {
+  Keyspace *ks = &serv->keyspace;
+  info_line(text, "# Keyspace");
+  info_line(text, "keys:%zu", keyspace_size(ks));
+  info_line(text, "expires:%zu", heap_size(&ks->expires));
+  info_line(text, "expired_keys:%zu", ks->expired);
+  info_line(text, "evicted_keys:%" PRIu64, serv->evict.evicted);
+}
+
+// the snapshot and the log are shared by every shard
+static void info_persistence(Server *serv, Vector *text) {
+  info_line(text, "# Persistence");
+  if (!serv->shards) {
+    return;
+  }
+  Snapshot *snap = &serv->shards->snapshot;
+  pthread_mutex_lock(&snap->lock);
+  info_line(text, "snapshot_bgsave_in_progress:%d",
+            atomic_load(&snap->child) != 0);
+  info_line(text, "snapshot_last_save_time:%" PRIu64, snap->last_save);
+  info_line(text, "snapshot_last_status:%s", snap->last_ok ? "ok" : "err");
+  info_line(text, "snapshot_last_bytes:%" PRIu64, snap->last_bytes);
+  info_line(text, "snapshot_last_ms:%" PRIu64, snap->last_ms);
+  pthread_mutex_unlock(&snap->lock);
+
+  Aof *aof = &serv->shards->aof;
+  info_line(text, "aof_enabled:%d", aof->path != NULL);
+  if (!aof->path) {
+    return;
+  }
+  info_line(text, "aof_fsync:%s", aof_fsync_name(aof->fsync));
+  info_line(text, "aof_rewrite_in_progress:%d",
+            atomic_load(&aof->child) != 0);
+  info_line(text, "aof_last_rewrite_status:%s",
+            atomic_load(&aof->last_ok) ? "ok" : "err");
+  info_line(text, "aof_last_rewrite_ms:%" PRIu64,
+            (uint64_t)atomic_load(&aof->last_ms));
+  info_line(text, "aof_current_size:%" PRIu64,
+            (uint64_t)atomic_load(&aof->size));
+  info_line(text, "aof_base_size:%" PRIu64,
+            (uint64_t)atomic_load(&aof->base_size));
+  info_line(text, "aof_buffer_bytes:%zu", vector_length(&serv->aof.buf));
+}
+
+// the stats of every shard are read (and summed) while their owners
+// keep bumping them, see Counter
+static size_t stats_shards(Server *serv) {
+  return serv->shards ? serv->shards->count : 1;
+}
+
+static ServerStats *stats_of(Server *serv, size_t shard) {
+  return serv->shards ? &serv->shards->servers[shard]->stats : &serv->stats;
+}
+
+static void command_latency(Server *serv, size_t index, HistSnapshot *snap) {
+  *snap = (HistSnapshot){0};
+  for (size_t i = 0; i < stats_shards(serv); i++) {
+    hist_collect(&stats_of(serv, i)->commands[index].latency, snap);
+  }
+}
+
+static double ns_to_us(uint64_t ns) {
+  return (double)ns / 1000.0;
+}
+
+static void info_stats(Server *serv, Vector *text) {
+  uint64_t accepted = 0;
+  uint64_t open = 0;
+  uint64_t input = 0;
+  uint64_t output = 0;
+  uint64_t calls = 0;
+  uint64_t failed = 0;
+  uint64_t rejected = 0;
+  HistSnapshot busy = {0};
+  HistSnapshot events = {0};
+  for (size_t i = 0; i < stats_shards(serv); i++) {
+    ServerStats *stats = stats_of(serv, i);
+    accepted += counter_get(&stats->conns_accepted);
+    open += counter_get(&stats->conns_open);
+    input += counter_get(&stats->net_input);
+    output += counter_get(&stats->net_output);
+    for (size_t cmd = 0; cmd < stats->ncommands; cmd++) {
+      calls += counter_get(&stats->commands[cmd].calls);
+      failed += counter_get(&stats->commands[cmd].failed);
+      rejected += counter_get(&stats->commands[cmd].rejected);
+    }
+    hist_collect(&stats->loop_busy, &busy);
+    hist_collect(&stats->loop_events, &events);
+  }
+  info_line(text, "# Stats");
+  info_line(text, "shards:%zu", stats_shards(serv));
+  info_line(text, "total_connections_received:%" PRIu64, accepted);
+  info_line(text, "connected_clients:%" PRIu64, open);
+  info_line(text, "total_commands_processed:%" PRIu64, calls);
+  info_line(text, "total_error_replies:%" PRIu64, failed);
+  info_line(text, "rejected_calls:%" PRIu64, rejected);
+  info_line(text, "total_net_input_bytes:%" PRIu64, input);
+  info_line(text, "total_net_output_bytes:%" PRIu64, output);
+  info_line(text, "eventloop_cycles:%" PRIu64, events.total);
+  info_line(text, "eventloop_duration_sum:%" PRIu64, busy.sum / 1000);
+  info_line(text,
+            "eventloop_duration_usec:p50=%.3f,p99=%.3f,p99.9=%.3f,"
+            "max=%.3f",
+            ns_to_us(hist_value_at(&busy, 50)),
+            ns_to_us(hist_value_at(&busy, 99)),
+            ns_to_us(hist_value_at(&busy, 99.9)), ns_to_us(busy.max));
+  info_line(text, "eventloop_events_sum:%" PRIu64, events.sum);
+  info_line(text,
+            "eventloop_events_per_cycle:p50=%" PRIu64 ",p99=%" PRIu64
+            ",max=%" PRIu64,
+            hist_value_at(&events, 50), hist_value_at(&events, 99),
+            events.max);
+}
+
+// "cmdstat_<name>:..." of every command that ran since the last reset
+static void info_commandstats(Server *serv, Vector *text) {
+  info_line(text, "# Commandstats");
+  for (size_t index = 0; index < command_count(); index++) {
+    uint64_t calls = 0;
+    uint64_t failed = 0;
+    uint64_t rejected = 0;
+    uint64_t ns = 0;
+    for (size_t i = 0; i < stats_shards(serv); i++) {
+      CommandStats *stats = &stats_of(serv, i)->commands[index];
+      calls += counter_get(&stats->calls);
+      failed += counter_get(&stats->failed);
+      rejected += counter_get(&stats->rejected);
+      ns += counter_get(&stats->latency.sum);
+    }
+    if (calls || rejected) {
+      info_line(text,
+                "cmdstat_%s:calls=%" PRIu64 ",usec=%" PRIu64
+                ",usec_per_call=%.2f,rejected_calls=%" PRIu64
+                ",failed_calls=%" PRIu64,
+                command_at(index)->name, calls, ns / 1000,
+                calls ? ns_to_us(ns) / (double)calls : 0.0, rejected,
+                failed);
+    }
+  }
+}
+
+static void info_latencystats(Server *serv, Vector *text) {
+  info_line(text, "# Latencystats");
+  HistSnapshot snap;
+  for (size_t index = 0; index < command_count(); index++) {
+    command_latency(serv, index, &snap);
+    if (snap.total) {
+      info_line(text,
+                "latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,"
+                "p99.9=%.3f",
+                command_at(index)->name, ns_to_us(hist_value_at(&snap, 50)),
+                ns_to_us(hist_value_at(&snap, 99)),
+                ns_to_us(hist_value_at(&snap, 99.9)));
+    }
+  }
+}
+
+static const struct {
+  const char *name;
+  void (*write)(Server *serv, Vector *text);
+} INFO_SECTIONS[] = {
+    {"memory", info_memory},
+    {"persistence", info_persistence},
+    {"stats", info_stats},
+    {"commandstats", info_commandstats},
+    {"latencystats", info_latencystats},
+    {"keyspace", info_keyspace},
+};
+
+// INFO [section]: "name:value" lines, every section without an argument
+// (or with all / default). memory and keyspace are of the serving shard,
+// the stats sections sum every shard
+static void cmd_info(Server *serv, Slice *argv, size_t argc, Output *out) {
+  if (argc > 2) {
+    resp_write_error(out, "ERR syntax error");
+    return;
+  }
+  bool all = argc == 1 || is_subcommand(&argv[1], "all") ||
+             is_subcommand(&argv[1], "default");
+  Vector text;
+  vector_initialize(&text, 0, sizeof(uint8_t));
+  for (size_t i = 0; i < sizeof(INFO_SECTIONS) / sizeof(*INFO_SECTIONS);
+       i++) {
+    if (all || is_subcommand(&argv[1], INFO_SECTIONS[i].name)) {
+      if (!vector_is_empty(&text)) {
+        vector_append(&text, (const uint8_t *)"\r\n", 2);
+      }
+      INFO_SECTIONS[i].write(serv, &text);
+    }
+  }
+  resp_write_bulk(out, text.data, vector_length(&text));
+  vector_cleanup(&text);
+}
+
+// histogram_usec of LATENCY HISTOGRAM: the calls that took up to 1, 2,
+// 4, ... us, as redis has it (cumulative, empty steps left out)
+static void write_histogram_usec(Output *out, const HistSnapshot *snap) {
+  uint64_t steps[64] = {0};
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    if (snap->counts[i]) {
+      uint64_t us = (hist_bucket_max(i) + 999) / 1000;
+      size_t step = us <= 1 ? 0 : 64 - (size_t)__builtin_clzll(us - 1);
+      steps[step] += snap->counts[i];
+    }
+  }
+  size_t used = 0;
+  for (size_t step = 0; step < 64; step++) {
+    used += steps[step] != 0;
+  }
+  resp_write_array(out, 2 * used);
+  uint64_t below = 0;
+  for (size_t step = 0; step < 64; step++) {
+    if (steps[step]) {
+      below += steps[step];
+      resp_write_integer(out, (int64_t)((uint64_t)1 << step));
+      resp_write_integer(out, (int64_t)below);
+    }
+  }
+}
+
+static void write_command_latency(Server *serv, size_t index, Output *out) {
+  HistSnapshot snap;
+  command_latency(serv, index, &snap);
+  const char *name = command_at(index)->name;
+  resp_write_bulk(out, (const uint8_t *)name, strlen(name));
+  resp_write_array(out, 4);
+  resp_write_bulk(out, (const uint8_t *)"calls", 5);
+  resp_write_integer(out, (int64_t)snap.total);
+  resp_write_bulk(out, (const uint8_t *)"histogram_usec", 14);
+  write_histogram_usec(out, &snap);
+}
+
+// LATENCY HISTOGRAM [command ...]: name / histogram pairs of the named
+// commands that ran (all of them without names). LATENCY RESET zeroes
+// every stat of every shard, INFO stats included
+static void cmd_latency(Server *serv, Slice *argv, size_t argc,
+                        Output *out) {
+  if (argc == 2 && is_subcommand(&argv[1], "reset")) {
+    for (size_t i = 0; i < stats_shards(serv); i++) {
+      stats_request_reset(stats_of(serv, i));
+      if (serv->shards) {
+        server_wake(serv->shards->servers[i]);
+      }
+    }
+    resp_write_simple(out, "OK");
+    return;
+  }
+  if (!is_subcommand(&argv[1], "histogram")) {
+    resp_write_error(out, "ERR unknown subcommand or wrong number of "
+                          "arguments for 'latency' command");
+    return;
+  }
+  // the commands to write, to count them before the array header
+  Vector picked;
+  vector_initialize(&picked, 0, sizeof(size_t));
+  for (size_t index = 0; index < command_count(); index++) {
+    bool named = argc == 2;
+    for (size_t i = 2; i < argc && !named; i++) {
+      named = is_subcommand(&argv[i], command_at(index)->name);
+    }
+    bool ran = false;
+    for (size_t i = 0; i < stats_shards(serv) && !ran; i++) {
+      ran = counter_get(&stats_of(serv, i)->commands[index].calls) != 0;
+    }
+    if (named && ran) {
+      vector_push_back(&picked, (const uint8_t *)&index);
+    }
+  }
+  resp_write_array(out, 2 * vector_length(&picked));
+  for (size_t i = 0; i < vector_length(&picked); i++) {
+    write_command_latency(serv, *(size_t *)vector_get_at(&picked, i), out);
+  }
+  vector_cleanup(&picked);
+}
+
+static void write_slowlog_entry(Output *out, const SlowlogEntry *entry) {
+  resp_write_array(out, 4);
+  resp_write_integer(out, (int64_t)entry->id);
+  resp_write_integer(out, (int64_t)entry->time);
+  resp_write_integer(out, (int64_t)entry->duration_us);
+  resp_write_array(out, entry->argc);
+  for (size_t i = 0; i < entry->argc; i++) {
+    resp_write_bulk(out, entry->argv[i].data, entry->argv[i].len);
+  }
+}
+
+// SLOWLOG GET [count] | LEN | RESET, the log is shared by the shards.
+// entries are id, unix time, duration in us and the arguments
+static void cmd_slowlog(Server *serv, Slice *argv, size_t argc,
+                        Output *out) {
+  Slowlog *log = serv->shards ? &serv->shards->slowlog : NULL;
+  if (argc == 2 && is_subcommand(&argv[1], "len")) {
+    resp_write_integer(out, log ? (int64_t)log->len : 0);
+  } else if (argc == 2 && is_subcommand(&argv[1], "reset")) {
+    if (log) {
+      slowlog_reset(log);
+    }
+    resp_write_simple(out, "OK");
+  } else if (argc <= 3 && is_subcommand(&argv[1], "get")) {
+    int64_t count = 10;
+    if (argc == 3 && !parse_int64(argv[2].data, argv[2].len, &count)) {
+      write_not_int(out);
+      return;
+    }
+    if (!log) {
+      resp_write_array(out, 0);
+      return;
+    }
+    pthread_mutex_lock(&log->lock);
+    size_t n = count < 0 || (uint64_t)count > log->len ? log->len
+                                                       : (size_t)count;
+    resp_write_array(out, n);
+    for (size_t i = 0; i < n; i++) {
+      write_slowlog_entry(out, slowlog_at(log, i));
+    }
+    pthread_mutex_unlock(&log->lock);
+  } else {
+    resp_write_error(out, "ERR unknown subcommand or wrong number of "
+                          "arguments for 'slowlog' command");
+  }
+}
+
+static void write_snap_result(Output *out, SnapResult res) {
+  if (res == SNAP_BUSY) {
+    resp_write_error(out, "ERR Background save already in progress");
+  } else if (res == SNAP_FAILED) {
+    resp_write_error(out, "ERR snapshot failed, see the server log");
+  }
+}
+
+// FLUSHALL [ASYNC | SYNC], FLUSHDB too as there is one db. the shards
+// are paused while each keyspace is swapped for an empty one, with ASYNC
+// the old ones are freed on the lazy free thread so the pause is short
+static void cmd_flushall(Server *serv, Slice *argv, size_t argc,
+                         Output *out) {
+  bool async = argc == 2 && is_subcommand(&argv[1], "async");
+  if (argc > 2 || (argc == 2 && !async && !is_subcommand(&argv[1], "sync"))) {
+    resp_write_error(out, "ERR syntax error");
+    return;
+  }
+  Shards *shards = serv->shards;
+  if (!shards) {
+    keyspace_flush(&serv->keyspace, async);
+    resp_write_simple(out, "OK");
+    return;
+  }
+  if (!shards_pause(shards)) {
+    resp_write_error(out, "ERR another shard paused the server, try again");
+    return;
+  }
+  for (size_t i = 0; i < shards->count; i++) {
+    keyspace_flush(&shards->servers[i]->keyspace, async);
+  }
+  // written before any shard logs a write that comes after it
+  aof_feed(serv, argv, argc);
+  aof_flush(serv);
+  shards_resume(shards);
+  resp_write_simple(out, "OK");
+}
+
+static void cmd_save(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argv;
+  (void)argc;
+  SnapResult res = snapshot_save(serv);
+  if (res == SNAP_OK) {
+    resp_write_simple(out, "OK");
+  }
+  write_snap_result(out, res);
+}
+
+static void cmd_bgsave(Server *serv, Slice *argv, size_t argc,
+                       Output *out) {
+  (void)argv;
+  (void)argc;
+  SnapResult res = snapshot_bgsave(serv);
+  if (res == SNAP_OK) {
+    resp_write_simple(out, "Background saving started");
+  }
+  write_snap_result(out, res);
+}
+
+static void cmd_bgrewriteaof(Server *serv, Slice *argv, size_t argc,
+                             Output *out) {
+  (void)argv;
+  (void)argc;
+  switch (aof_rewrite(serv)) {
+  case AOF_OK:
+    resp_write_simple(out, "Background append only file rewriting started");
+    break;
+  case AOF_OFF:
+    resp_write_error(out, "ERR append only file is off");
+    break;
+  case AOF_BUSY:
+    resp_write_error(out, "ERR Background append only file rewriting "
+                          "already in progress");
+    break;
+  case AOF_FAILED:
+    resp_write_error(out, "ERR rewrite failed, see the server log");
+    break;
+  }
+}
+
+static void cmd_lastsave(Server *serv, Slice *argv, size_t argc,
+                         Output *out) {
+  (void)argv;
+  (void)argc;
+  uint64_t last = 0;
+  if (serv->shards) {
+    Snapshot *snap = &serv->shards->snapshot;
+    pthread_mutex_lock(&snap->lock);
+    last = snap->last_save;
+    pthread_mutex_unlock(&snap->lock);
+  }
+  resp_write_integer(out, (int64_t)last);
+}
+
+// the entry at key when it holds a sorted set. a missing key gives NULL,
+// a key of another type too after the error is written
+static Entry *zset_entry(Server *serv, const Slice *key, Output *out,
+                         bool *wrong) {
+  Entry *entry = keyspace_get(&serv->keyspace, key->data, key->len);
+  *wrong = entry && entry->enc != ENC_ZSET;
+  if (*wrong) {
+    resp_write_error(out, WRONGTYPE);
+    return NULL;
+  }
+  return entry;
+}
+
+// a score or a range bound, "inf" and "-inf" included but not nan
+static bool parse_score(const Slice *arg, double *score) {
+  char buf[64];
+  if (arg->len == 0 || arg->len >= sizeof(buf) || isspace(arg->data[0])) {
+    return false;
+  }
+  memcpy(buf, arg->data, arg->len);
+  buf[arg->len] = '\0';
+  char *end = NULL;
+  *score = strtod(buf, &end);
+  return end == buf + arg->len && !isnan(*score);
+}
+
+static void write_score(Output *out, double score) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%.17g", score);
+  resp_write_bulk(out, (const uint8_t *)buf, (size_t)len);
+}
+
+static void write_not_float(Output *out) {
+  resp_write_error(out, "ERR value is not a valid float");
+}
+
+// out of memory after the members before argv[argc] went in: they stay
+// and are logged on their own (the error reply is not), a set that got
+// none of them goes away again
+static void zadd_oom(Server *serv, Entry *entry, Slice *argv, size_t argc,
+                     Output *out) {
+  if (zset_size(entry->zset) == 0) {
+    (void)keyspace_del(&serv->keyspace, argv[1].data, argv[1].len);
+  } else if (argc > 2) {
+    aof_feed(serv, argv, argc);
+  }
+  resp_write_error(out, "OOM command not allowed");
+}
+
+// every score is checked before the set is touched
+static void cmd_zadd(Server *serv, Slice *argv, size_t argc, Output *out) {
+  if (argc % 2 != 0) {
+    resp_write_error(out, "ERR syntax error");
+    return;
+  }
+  double score = 0;
+  for (size_t i = 2; i < argc; i += 2) {
+    if (!parse_score(&argv[i], &score)) {
+      write_not_float(out);
+      return;
+    }
+  }
+  bool wrong = false;
+  Entry *entry = zset_entry(serv, &argv[1], out, &wrong);
+  if (wrong) {
+    return;
+  }
+  Keyspace *ks = &serv->keyspace;
+  if (!entry && !(entry = keyspace_new_zset(ks, argv[1].data, argv[1].len,
+                                            (argc - 2) / 2))) {
+    resp_write_error(out, "OOM command not allowed");
+    return;
+  }
+  int64_t added = 0;
+  for (size_t i = 2; i < argc; i += 2) {
+    (void)parse_score(&argv[i], &score);
+    int rv = keyspace_zadd(ks, entry, argv[i + 1].data, argv[i + 1].len, score);
+    if (rv < 0) {
+      zadd_oom(serv, entry, argv, i, out);
+      return;
+    }
+    added += rv;
+  }
+  resp_write_integer(out, added);
+}
+
+// the key goes away with its last member
+static void cmd_zrem(Server *serv, Slice *argv, size_t argc, Output *out) {
+  bool wrong = false;
+  Entry *entry = zset_entry(serv, &argv[1], out, &wrong);
+  if (wrong) {
+    return;
+  }
+  int64_t removed = 0;
+  for (size_t i = 2; entry && i < argc; i++) {
+    removed += keyspace_zrem(&serv->keyspace, entry, argv[i].data, argv[i].len);
+  }
+  if (entry && zset_size(entry->zset) == 0) {
+    (void)keyspace_del(&serv->keyspace, argv[1].data, argv[1].len);
+  }
+  resp_write_integer(out, removed);
+}
+
+// the member named by argv[2], NULL when it or the key is missing
+static ZNode *zset_member(Server *serv, Slice *argv, Output *out,
+                          bool *wrong) {
+  Entry *entry = zset_entry(serv, &argv[1], out, wrong);
+  return entry ? zset_lookup(entry->zset, argv[2].data, argv[2].len) : NULL;
+}
+
+static void cmd_zscore(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  bool wrong = false;
+  ZNode *node = zset_member(serv, argv, out, &wrong);
+  if (node) {
+    write_score(out, node->score);
+  } else if (!wrong) {
+    resp_write_null(out);
+  }
+}
+
+static void cmd_zrank(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  bool wrong = false;
+  ZNode *node = zset_member(serv, argv, out, &wrong);
+  if (node) {
+    resp_write_integer(out, znode_rank(node));
+  } else if (!wrong) {
+    resp_write_null(out);
+  }
+}
+
+static void cmd_zcard(Server *serv, Slice *argv, size_t argc, Output *out) {
+  (void)argc;
+  bool wrong = false;
+  Entry *entry = zset_entry(serv, &argv[1], out, &wrong);
+  if (!wrong) {
+    resp_write_integer(out, entry ? (int64_t)zset_size(entry->zset) : 0);
+  }
+}
+
+// count members walked in order from node. the first one is found in
+// O(log n) whatever its rank, each next one in O(1) amortized
+static void write_members(Output *out, ZNode *node, int64_t count,
+                          bool scores) {
+  resp_write_array(out, (size_t)(scores ? count * 2 : count));
+  for (int64_t i = 0; i < count; i++, node = znode_offset(node, 1)) {
+    resp_write_bulk(out, node->name, node->len);
+    if (scores) {
+      write_score(out, node->score);
+    }
+  }
+}
+
+// ZRANGE key start stop [WITHSCORES], negative indices count from the end
+static void cmd_zrange(Server *serv, Slice *argv, size_t argc, Output *out) {
+  int64_t start = 0;
+  int64_t stop = 0;
+  if (!parse_int64(argv[2].data, argv[2].len, &start) ||
+      !parse_int64(argv[3].data, argv[3].len, &stop)) {
+    write_not_int(out);
+    return;
+  }
+  bool scores = argc == 5 && is_subcommand(&argv[4], "withscores");
+  if (argc > 5 || (argc == 5 && !scores)) {
+    resp_write_error(out, "ERR syntax error");
+    return;
+  }
+  bool wrong = false;
+  Entry *entry = zset_entry(serv, &argv[1], out, &wrong);
+  if (wrong) {
+    return;
+  }
+  int64_t size = entry ? (int64_t)zset_size(entry->zset) : 0;
+  start = start < 0 ? (start + size < 0 ? 0 : start + size) : start;
+  stop = stop < 0 ? stop + size : (stop >= size ? size - 1 : stop);
+  if (start > stop || start >= size) {
+    resp_write_array(out, 0);
+    return;
+  }
+  write_members(out, zset_at(entry->zset, start), stop - start + 1, scores);
+}
+
+// a range bound, "(" in front makes it exclusive
+static bool parse_bound(const Slice *arg, double *score, bool *exclusive) {
+  *exclusive = arg->len > 0 && arg->data[0] == '(';
+  Slice rest = {arg->data + *exclusive, arg->len - *exclusive};
+  return parse_score(&rest, score);
+}
+
+// ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]. both ends
+// of the range and the offset are found by rank, so a large offset costs
+// no more than a small one
+static void cmd_zrangebyscore(Server *serv, Slice *argv, size_t argc,
+                              Output *out) {
+  double min = 0;
+  double max = 0;
+  bool min_excl = false;
+  bool max_excl = false;
+  if (!parse_bound(&argv[2], &min, &min_excl) ||
+      !parse_bound(&argv[3], &max, &max_excl)) {
+    resp_write_error(out, "ERR min or max is not a float");
+    return;
+  }
+  bool scores = false;
+  int64_t offset = 0;
+  int64_t limit = -1;
+  for (size_t i = 4; i < argc; i++) {
+    if (is_subcommand(&argv[i], "withscores")) {
+      scores = true;
+    } else if (is_subcommand(&argv[i], "limit") && i + 2 < argc) {
+      if (!parse_int64(argv[i + 1].data, argv[i + 1].len, &offset) ||
+          !parse_int64(argv[i + 2].data, argv[i + 2].len, &limit)) {
+        write_not_int(out);
+        return;
+      }
+      i += 2;
+    } else {
+      resp_write_error(out, "ERR syntax error");
+      return;
+    }
+  }
+  bool wrong = false;
+  Entry *entry = zset_entry(serv, &argv[1], out, &wrong);
+  if (wrong) {
+    return;
+  }
+  ZNode *first = entry ? zset_seek(entry->zset, min, min_excl) : NULL;
+  if (!first || offset < 0) {
+    resp_write_array(out, 0);
+    return;
+  }
+  // the first node past max bounds the range
+  ZNode *end = zset_seek(entry->zset, max, !max_excl);
+  int64_t begin = znode_rank(first);
+  int64_t count = (end ? znode_rank(end) : (int64_t)zset_size(entry->zset)) -
+                  begin - offset;
+  if (limit >= 0 && limit < count) {
+    count = limit;
+  }
+  if (count <= 0) {
+    resp_write_array(out, 0);
+    return;
+  }
+  write_members(out, znode_offset(first, offset), count, scores);
+}
+
+// the options SCAN and ZSCAN share, argv[from] on
+typedef struct ScanOptions {
+  Slice match; // len 0 for no pattern
+  size_t count;
+  Slice type; // SCAN only, len 0 for any type
+} ScanOptions;
+
+static bool parse_cursor(const Slice *arg, uint64_t *cursor) {
+  int64_t value = 0;
+  if (!parse_int64(arg->data, arg->len, &value) || value < 0) {
+    return false;
+  }
+  *cursor = (uint64_t)value;
+  return true;
+}
+
+static bool parse_scan_options(Slice *argv, size_t argc, size_t from,
+                               bool types, ScanOptions *opts, Output *out) {
+  *opts = (ScanOptions){.count = 10};
+  for (size_t i = from; i < argc; i += 2) {
+    if (i + 1 == argc) {
+      resp_write_error(out, "ERR syntax error");
+      return false;
+    }
+    if (is_subcommand(&argv[i], "match")) {
+      opts->match = argv[i + 1];
+    } else if (is_subcommand(&argv[i], "count")) {
+      int64_t count = 0;
+      if (!parse_int64(argv[i + 1].data, argv[i + 1].len, &count)) {
+        write_not_int(out);
+        return false;
+      }
+      if (count < 1) {
+        resp_write_error(out, "ERR syntax error");
+        return false;
+      }
+      opts->count = (size_t)count;
+    } else if (types && is_subcommand(&argv[i], "type")) {
+      opts->type = argv[i + 1];
+    } else {
+      resp_write_error(out, "ERR syntax error");
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool scan_matches(const ScanOptions *opts, const uint8_t *str,
+                         size_t len) {
+  return opts->match.len == 0 ||
+         glob_match(opts->match.data, opts->match.len, str, len);
+}
+
+static bool scan_type_matches(const ScanOptions *opts, const Entry *entry) {
+  if (opts->type.len == 0) {
+    return true;
+  }
+  // unknown type names match nothing, as in redis
+  return entry_is_string(entry) ? is_subcommand(&opts->type, "string")
+                                : is_subcommand(&opts->type, "zset");
+}
+
+static void write_cursor(Output *out, uint64_t cursor) {
+  char buf[24];
+  int len = snprintf(buf, sizeof(buf), "%" PRIu64, cursor);
+  resp_write_array(out, 2);
+  resp_write_bulk(out, (const uint8_t *)buf, (size_t)len);
+}
+
+// SCAN cursor [MATCH pattern] [COUNT n] [TYPE type]. each shard scans its
+// own keyspace, the cursor is the shard's table cursor * shards + the
+// shard, so cursor % shards names the shard it belongs to (see
+// shard_forward) and a shard that is done hands over to the next one.
+// keys present for the whole scan are returned at least once, even
+// across resizes, some may come twice
+static void cmd_scan(Server *serv, Slice *argv, size_t argc, Output *out) {
+  uint64_t cursor = 0;
+  if (!parse_cursor(&argv[1], &cursor)) {
+    resp_write_error(out, "ERR invalid cursor");
+    return;
+  }
+  ScanOptions opts;
+  if (!parse_scan_options(argv, argc, 2, true, &opts, out)) {
+    return;
+  }
+  uint64_t shards = serv->shards ? serv->shards->count : 1;
+  uint64_t shard = cursor % shards;
+  Vector entries;
+  vector_initialize(&entries, 0, sizeof(Entry *));
+  uint64_t next =
+      keyspace_scan(&serv->keyspace, cursor / shards, opts.count, &entries);
+  if (next) {
+    next = next * shards + shard;
+  } else if (shard + 1 < shards) {
+    next = shard + 1;
+  }
+
+  // filtered afterwards, COUNT bounds the work and not the reply
+  size_t kept = 0;
+  for (size_t i = 0; i < vector_length(&entries); i++) {
+    Entry *entry = *(Entry **)vector_get_at(&entries, i);
+    if (scan_type_matches(&opts, entry) &&
+        scan_matches(&opts, entry_key(entry), entry->key_len)) {
+      vector_set_at(&entries, (const uint8_t *)&entry, kept++);
+    }
+  }
+  write_cursor(out, next);
+  resp_write_array(out, kept);
+  for (size_t i = 0; i < kept; i++) {
+    Entry *entry = *(Entry **)vector_get_at(&entries, i);
+    resp_write_bulk(out, entry_key(entry), entry->key_len);
+  }
+  vector_cleanup(&entries);
+}
+
+// ZSCAN key cursor [MATCH pattern] [COUNT n], members with their scores
+static void cmd_zscan(Server *serv, Slice *argv, size_t argc, Output *out) {
+  uint64_t cursor = 0;
+  if (!parse_cursor(&argv[2], &cursor)) {
+    resp_write_error(out, "ERR invalid cursor");
+    return;
+  }
+  ScanOptions opts;
+  if (!parse_scan_options(argv, argc, 3, false, &opts, out)) {
+    return;
+  }
+  bool wrong = false;
+  Entry *entry = zset_entry(serv, &argv[1], out, &wrong);
+  if (wrong) {
+    return;
+  }
+  if (!entry) {
+    write_cursor(out, 0);
+    resp_write_array(out, 0);
+    return;
+  }
+  Vector nodes;
+  vector_initialize(&nodes, 0, sizeof(ZNode *));
+  uint64_t next = zset_scan(entry->zset, cursor, opts.count, &nodes);
+  size_t kept = 0;
+  for (size_t i = 0; i < vector_length(&nodes); i++) {
+    ZNode *node = *(ZNode **)vector_get_at(&nodes, i);
+    if (scan_matches(&opts, node->name, node->len)) {
+      vector_set_at(&nodes, (const uint8_t *)&node, kept++);
+    }
+  }
+  write_cursor(out, next);
+  resp_write_array(out, kept * 2);
+  for (size_t i = 0; i < kept; i++) {
+    ZNode *node = *(ZNode **)vector_get_at(&nodes, i);
+    resp_write_bulk(out, node->name, node->len);
+    write_score(out, node->score);
+  }
+  vector_cleanup(&nodes);
+}
+
+static const Command COMMANDS[] = {
+    {"ping", -1, cmd_ping, 0, 0, 0, MERGE_NONE, 0},
+    {"get", 2, cmd_get, 1, 1, 1, MERGE_NONE, 0},
+    {"set", 3, cmd_set, 1, 1, 1, MERGE_NONE, CMD_WRITE | CMD_DENYOOM},
+    {"del", -2, cmd_del, 1, -1, 1, MERGE_SUM, CMD_WRITE},
+    {"unlink", -2, cmd_del, 1, -1, 1, MERGE_SUM, CMD_WRITE},
+    {"exists", -2, cmd_exists, 1, -1, 1, MERGE_SUM, 0},
+    {"mget", -2, cmd_mget, 1, -1, 1, MERGE_ARRAY, 0},
+    {"mset", -3, cmd_mset, 1, -1, 2, MERGE_OK, CMD_WRITE | CMD_DENYOOM},
+    // ttls are logged as PEXPIREAT by the commands, see log_deadline
+    {"setex", 4, cmd_setex, 1, 1, 1, MERGE_NONE, CMD_DENYOOM},
+    {"expire", 3, cmd_expire, 1, 1, 1, MERGE_NONE, 0},
+    {"pexpire", 3, cmd_pexpire, 1, 1, 1, MERGE_NONE, 0},
+    {"expireat", 3, cmd_expireat, 1, 1, 1, MERGE_NONE, 0},
+    {"pexpireat", 3, cmd_pexpireat, 1, 1, 1, MERGE_NONE, 0},
+    {"ttl", 2, cmd_ttl, 1, 1, 1, MERGE_NONE, 0},
+    {"pttl", 2, cmd_pttl, 1, 1, 1, MERGE_NONE, 0},
+    {"persist", 2, cmd_persist, 1, 1, 1, MERGE_NONE, CMD_WRITE},
+    // the key of MEMORY USAGE routes it, STATS has none and stays local
+    {"memory", -2, cmd_memory, 2, 2, 1, MERGE_NONE, 0},
+    {"info", -1, cmd_info, 0, 0, 0, MERGE_NONE, 0},
+    {"latency", -2, cmd_latency, 0, 0, 0, MERGE_NONE, 0},
+    {"slowlog", -2, cmd_slowlog, 0, 0, 0, MERGE_NONE, 0},
+    {"zadd", -4, cmd_zadd, 1, 1, 1, MERGE_NONE, CMD_WRITE | CMD_DENYOOM},
+    {"zrem", -3, cmd_zrem, 1, 1, 1, MERGE_NONE, CMD_WRITE},
+    {"zscore", 3, cmd_zscore, 1, 1, 1, MERGE_NONE, 0},
+    {"zrank", 3, cmd_zrank, 1, 1, 1, MERGE_NONE, 0},
+    {"zcard", 2, cmd_zcard, 1, 1, 1, MERGE_NONE, 0},
+    {"zrange", -4, cmd_zrange, 1, 1, 1, MERGE_NONE, 0},
+    {"zrangebyscore", -4, cmd_zrangebyscore, 1, 1, 1, MERGE_NONE, 0},
+    {"zscan", -3, cmd_zscan, 1, 1, 1, MERGE_NONE, 0},
+    {"scan", -2, cmd_scan, 0, 0, 0, MERGE_NONE, CMD_CURSOR},
+    {"save", 1, cmd_save, 0, 0, 0, MERGE_NONE, 0},
+    {"bgsave", 1, cmd_bgsave, 0, 0, 0, MERGE_NONE, 0},
+    {"lastsave", 1, cmd_lastsave, 0, 0, 0, MERGE_NONE, 0},
+    {"bgrewriteaof", 1, cmd_bgrewriteaof, 0, 0, 0, MERGE_NONE, 0},
+    {"flushall", -1, cmd_flushall, 0, 0, 0, MERGE_NONE, 0},
+    {"flushdb", -1, cmd_flushall, 0, 0, 0, MERGE_NONE, 0},
+};
+
+size_t command_count(void) {
+  return sizeof(COMMANDS) / sizeof(*COMMANDS);
+}
+
+const Command *command_at(size_t index) {
+  return &COMMANDS[index];
+}
+
+const Command *command_lookup(const Slice *name) {
+  for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(*COMMANDS); i++) {
+    const Command *cmd = &COMMANDS[i];
+    if (strlen(cmd->name) == name->len &&
+        strncasecmp(cmd->name, (const char *)name->data, name->len) == 0) {
+      return cmd;
+    }
+  }
+  return NULL;
+}
+
+// looks up the command and checks its arity, errors go to out
+const Command *command_check(Slice *argv, size_t argc, Output *out) {
+  const Command *cmd = command_lookup(&argv[0]);
+  if (!cmd) {
+    char msg[128];
+    (void)snprintf(msg, sizeof(msg), "ERR unknown command '%.*s'",
+                   (int)(argv[0].len > 64 ? 64 : argv[0].len), argv[0].data);
+    resp_write_error(out, msg);
+    return NULL;
+  }
+
+  if ((cmd->arity > 0 && argc != (size_t)cmd->arity) ||
+      (cmd->arity < 0 && argc < (size_t)-cmd->arity)) {
+    char msg[128];
+    (void)snprintf(msg, sizeof(msg),
+                   "ERR wrong number of arguments for '%s' command",
+                   cmd->name);
+    resp_write_error(out, msg);
+    return NULL;
+  }
+  return cmd;
+}
+
+// evicted keys are logged as deleted, a replay would bring them back
+static void log_eviction(void *arg, const Slice *key) {
+  Slice del[2] = {{(const uint8_t *)"DEL", 3}, *key};
+  aof_feed(arg, del, 2);
+}
+
+// over its share of maxmemory a shard evicts before every command, when
+// that is not enough commands that add data fail
+static bool make_room(Server *serv) {
+  size_t limit = serv->maxmemory;
+  return limit == 0 || keyspace_memory(&serv->keyspace) <= limit ||
+         evict_until(&serv->evict, &serv->keyspace, limit, log_eviction,
+                     serv);
+}
+
+// runs cmd and logs it when it is a write that went through. commands
+// whose arguments would replay differently (relative ttls) log
+// themselves, see log_deadline. every call is timed into the stats of
+// its command, the slow ones are also kept in the slowlog
+static void command_call(Server *serv, const Command *cmd, Slice *argv,
+                         size_t argc, Output *out) {
+  size_t index = (size_t)(cmd - COMMANDS);
+  if (!make_room(serv) && (cmd->flags & CMD_DENYOOM)) {
+    counter_add(&serv->stats.commands[index].rejected, 1);
+    resp_write_error(out, "OOM command not allowed when used memory > "
+                          "'maxmemory'");
+    return;
+  }
+  size_t mark = vector_length(out->bytes);
+  uint64_t start = monotonic_ns();
+  cmd->proc(serv, argv, argc, out);
+  uint64_t took = monotonic_ns() - start;
+  bool replied = vector_length(out->bytes) > mark;
+  bool failed = replied && out->bytes->data[mark] == '-';
+  stats_record_command(&serv->stats, index, took, failed);
+  if (serv->shards && slowlog_is_slow(&serv->shards->slowlog, took)) {
+    slowlog_push(&serv->shards->slowlog, argv, argc, took, serv->shard_id);
+  }
+  if ((cmd->flags & CMD_WRITE) && replied && !failed) {
+    aof_feed(serv, argv, argc);
+  }
+}
+
+// runs the command against serv's own keyspace
+void command_execute(Server *serv, Slice *argv, size_t argc, Output *out) {
+  const Command *cmd = command_check(argv, argc, out);
+  if (cmd) {
+    command_call(serv, cmd, argv, argc, out);
+  }
+}
+
+// runs a command for conn, returns false when (part of) it went to other
+// shards and the reply will be appended once they answer
+bool command_dispatch(Conn *conn, Slice *argv, size_t argc) {
+  Output out = connection_output(conn);
+  const Command *cmd = command_check(argv, argc, &out);
+  if (!cmd) {
+    return true;
+  }
+  if (shard_forward(conn, cmd, argv, argc)) {
+    return false;
+  }
+  Server *serv = conn->serv;
+  uint64_t logged = serv->aof.logged;
+  command_call(serv, cmd, argv, argc, &out);
+  if (serv->aof.logged != logged) {
+    conn->log_end = serv->aof.logged;
+  }
+  return true;
+}
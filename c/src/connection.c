@@ -7,68 +7,250 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "aof.h"
+#include "commands.h"
 #include "connection.h"
+#include "output.h"
+#include "pool.h"
+#include "resp.h"
+#include "server.h"
+#include "stats.h"
 #include "utils.h"
 #include "vector.h"
 
 typedef struct sockaddr_in ipv4_addr;
-const size_t MAX_MSG_SIZE = 1024;
+// rbuf as first lent, from the pool's 2K class. it grows for requests
+// that do not fit, up to the max_request of the config
+const size_t RBUF_SIZE = 2048;
+// a grown rbuf is swapped for a small one once this much of it is unused
+const size_t RBUF_SHRINK = 64 * 1024;
+// stop reading more pipelined commands once this much output is queued
+const size_t MAX_PENDING_OUTPUT = 64 * 1024;
+// received bytes held back before a completion based engine stops reading
+const size_t MAX_BACKLOG = 64 * 1024;
 
-Conn *connection_create(int fd) {
-  Conn *conn = malloc(sizeof(Conn));
+// returns NULL when out of memory
+Conn *connection_create(int fd, struct Server *serv, Pool *pool) {
+  Conn *conn = pool_get(pool);
   if (!conn) {
     return NULL;
   }
+  if (!conn->pool) {
+    // first use of this slot, its vectors are kept when it goes back to
+    // the pool so later conns start without allocating
+    resp_parser_init(&conn->parser);
+    conn->argv = (SliceVec){0};
+    vector_initialize(&conn->backlog, 0, sizeof(uint8_t));
+    conn->wbuf = (Vector){.data_size = sizeof(uint8_t)};
+    vector_initialize(&conn->wrefs, 0, sizeof(OutRef));
+  }
   conn->fd = fd;
+  conn->serv = serv;
+  conn->pool = pool;
   conn->state = STATE_REQ;
+  conn->rbuf = NULL;
   conn->rbuf_size = 0;
+  conn->rbuf_alloc = 0;
   conn->wbuf_sent = 0;
-  vector_initialize(&conn->rbuf, MAX_MSG_SIZE + 4, sizeof(uint8_t));
-  vector_initialize(&conn->wbuf, MAX_MSG_SIZE + 4, sizeof(uint8_t));
+  conn->pending = NULL;
+  conn->eof = false;
+  conn->io_ops = 0;
+  dlist_init(&conn->idle_node);
+  conn->last_active = 0;
+  conn->log_end = 0;
+  dlist_init(&conn->log_node);
+  counter_add(&serv->stats.conns_accepted, 1);
+  counter_add(&serv->stats.conns_open, 1);
   return conn;
 }
 
-static bool is_read_complete(Conn *conn) {
-  size_t len = 0;
-  if (*(char *)vector_get_at(&conn->rbuf, 0) == '*') {
-    len = atol((char *)vector_get_at(&conn->rbuf, 1));
-  } else {
-    len = atol((char *)vector_get_at(&conn->rbuf, 0));
-  }
+// replies of the conn's commands are written here
+Output connection_output(Conn *conn) {
+  return (Output){&conn->wbuf, &conn->wrefs};
+}
+
+static size_t rbuf_space(const Conn *conn) {
+  return conn->rbuf_alloc - conn->rbuf_size;
+}
 
-  if (!len || len > conn->rbuf_size) {
+static size_t max_request(const Conn *conn) {
+  size_t limit = conn->serv->config->max_request;
+  return limit ? limit : CONN_MAX_REQUEST;
+}
+
+static void too_large(Conn *conn) {
+  ERROR(false, "request too large")
+  LOG(1, "Conn(%d): request over %zu bytes", conn->fd, max_request(conn))
+  conn->state = STATE_END;
+}
+
+// rbuf is full of one incomplete command: makes room for the rest of it.
+// once the length of the bulk string being read is known the buffer is
+// sized for all of it, so the payload lands in place with one read after
+// the other instead of being copied through every doubling. false (and
+// the conn ends) when the command is larger than the limit
+static bool rbuf_grow(Conn *conn) {
+  size_t limit = max_request(conn);
+  size_t need = resp_message_need(&conn->parser);
+  size_t size = conn->rbuf_alloc * 2;
+  size = size > need ? size : need;
+  size = size < limit ? size : limit;
+  if (need > limit || size <= conn->rbuf_alloc) {
+    too_large(conn);
     return false;
   }
-  if (len < conn->rbuf_size) {
-    ERROR(false, "invalid message sent")
+  // lent buffers are plain malloc blocks, see pool.h
+  uint8_t *rbuf = realloc(conn->rbuf, size);
+  if (!rbuf) {
+    ERROR(false, "out of memory for connection buffers")
     conn->state = STATE_END;
     return false;
   }
+  conn->rbuf = rbuf;
+  conn->rbuf_alloc = size;
+  return true;
+}
+
+// after a large command, the few bytes left move to a small buffer again
+static void rbuf_shrink(Conn *conn) {
+  if (conn->rbuf_alloc < RBUF_SHRINK || conn->rbuf_size > RBUF_SIZE) {
+    return;
+  }
+  size_t alloc = 0;
+  uint8_t *rbuf = pool_buf_get(conn->pool, RBUF_SIZE, &alloc);
+  if (!rbuf) {
+    return;
+  }
+  memcpy(rbuf, conn->rbuf, conn->rbuf_size);
+  pool_buf_put(conn->pool, conn->rbuf, conn->rbuf_alloc);
+  conn->rbuf = rbuf;
+  conn->rbuf_alloc = alloc;
+}
 
+// borrows rbuf / wbuf storage before input arrives or output is produced,
+// false when out of memory
+static bool lend_buffers(Conn *conn) {
+  if (!conn->rbuf) {
+    conn->rbuf = pool_buf_get(conn->pool, RBUF_SIZE, &conn->rbuf_alloc);
+    if (!conn->rbuf) {
+      return false;
+    }
+  }
+  if (!conn->wbuf.data) {
+    size_t capacity = 0;
+    uint8_t *data = pool_buf_get(conn->pool, POOL_MIN_BUF, &capacity);
+    if (!data) {
+      return false;
+    }
+    vector_adopt(&conn->wbuf, data, capacity);
+  }
   return true;
 }
 
+// gives the buffers back once nothing is left in them
+static void return_buffers(Conn *conn) {
+  if (conn->pending) {
+    return;
+  }
+  if (conn->rbuf && conn->rbuf_size == 0) {
+    pool_buf_put(conn->pool, conn->rbuf, conn->rbuf_alloc);
+    conn->rbuf = NULL;
+    conn->rbuf_alloc = 0;
+  }
+  if (conn->wbuf.data && vector_is_empty(&conn->wbuf)) {
+    size_t capacity = 0;
+    uint8_t *data = vector_release(&conn->wbuf, &capacity);
+    pool_buf_put(conn->pool, data, capacity);
+  }
+}
+
+// resumes parsing the buffered bytes
+static bool is_read_complete(Conn *conn) {
+  enum RespStatus status =
+      resp_parse(&conn->parser, conn->rbuf, conn->rbuf_size);
+
+  if (status == RESP_INVALID) {
+    ERROR(false, "invalid message sent")
+    LOG(1, "Conn(%d): protocol error: %s", conn->fd, conn->parser.error)
+    conn->state = STATE_END;
+    return false;
+  }
+  // refused as soon as its length is known, before it is buffered
+  if (resp_message_need(&conn->parser) > max_request(conn)) {
+    too_large(conn);
+    return false;
+  }
+
+  return status == RESP_COMPLETE;
+}
+
 // force if connection terminated before complete
 //  command data transfer
 static void build_response(Conn *conn, bool force) {
-  vector_copy(&conn->rbuf, &conn->wbuf);
-  vector_clear(&conn->rbuf);
-  vector_resize(&conn->rbuf, MAX_MSG_SIZE + 4);
-  conn->rbuf_size = 0;
+  if (force) {
+    return;
+  }
+
+  // commands are arrays of strings, argv slices point into rbuf
+  RespParser *parser = &conn->parser;
+  RespValue *head = resp_value_at(parser, 0);
+  Output out = connection_output(conn);
+  if (head->type != RESP_ARRAY) {
+    resp_write_error(&out, "ERR Protocol error: expected array");
+    return;
+  }
+  slice_vec_clear(&conn->argv);
+  for (size_t i = 1; i < resp_value_count(parser); i++) {
+    RespValue *arg = resp_value_at(parser, i);
+    if (arg->type != RESP_BULK_STRING && arg->type != RESP_SIMPLE_STRING) {
+      resp_write_error(&out, "ERR Protocol error: expected bulk strings");
+      return;
+    }
+    Slice slice = {resp_value_data(parser, conn->rbuf, arg), arg->len};
+    if (!slice_vec_push_back(&conn->argv, slice)) {
+      resp_write_error(&out, "OOM command not allowed");
+      return;
+    }
+  }
+  if (slice_vec_is_empty(&conn->argv)) {
+    return; // empty inline command
+  }
+
+  command_dispatch(conn, conn->argv.data, conn->argv.length);
+}
+
+// executes every complete command in rbuf, then moves the leftover
+// partial command to the front of rbuf
+static void process_requests(Conn *conn) {
+  size_t consumed = 0;
+  while (conn->state == STATE_REQ && !conn->pending &&
+         is_read_complete(conn)) {
+    build_response(conn, false);
+    consumed = conn->parser.pos;
+    resp_parser_reset(&conn->parser, consumed);
+  }
+
+  if (consumed) {
+    size_t rest = conn->rbuf_size - consumed;
+    memmove(conn->rbuf, conn->rbuf + consumed, rest);
+    conn->rbuf_size = rest;
+    resp_parser_move(&conn->parser, 0);
+    rbuf_shrink(conn);
+  }
 }
 
 // return:
 //  true   read success (can try again)
 //  false  read fail (dont try again)
 static bool connection_read(Conn *conn) {
-  assert(conn->rbuf_size < vector_length(&conn->rbuf));
+  assert(conn->rbuf_size < conn->rbuf_alloc);
 
   ssize_t rv = 0;
   do {
-    size_t cap = vector_length(&conn->rbuf) - conn->rbuf_size;
-    rv = read(conn->fd, vector_get_at(&conn->rbuf, conn->rbuf_size), cap);
+    rv = read(conn->fd, conn->rbuf + conn->rbuf_size, rbuf_space(conn));
   } while (rv < 0 && errno == EINTR);
 
   if (rv < 0 && errno == EAGAIN) {
@@ -83,40 +265,77 @@ static bool connection_read(Conn *conn) {
   }
 
   if (rv == 0) {
-    if (conn->rbuf_size > 0) {
-      ERROR(false, "unexpected EOF")
-      build_response(conn, true);
-    } else {
-      LOG(2, "EOF")
-    }
-    conn->state = STATE_END;
+    conn->eof = true;
     return false;
   }
 
   conn->rbuf_size += (size_t)rv;
-  assert(conn->rbuf_size <= vector_length(&conn->rbuf));
+  assert(conn->rbuf_size <= conn->rbuf_alloc);
+  counter_add(&conn->serv->stats.net_input, (uint64_t)rv);
 
   return true;
 }
 
+// output not sent yet, referenced values included
+static size_t queued(Conn *conn) {
+  Output out = connection_output(conn);
+  return output_length(&out) - conn->wbuf_sent;
+}
+
+// the peer closed its side: the conn ends once every command it sent
+// before is answered and the replies are out, a partial one is dropped
+static void finish_eof(Conn *conn) {
+  if (!conn->eof || conn->state != STATE_REQ || conn->pending ||
+      queued(conn) > 0) {
+    return;
+  }
+  if (conn->rbuf_size > 0 || !vector_is_empty(&conn->backlog)) {
+    ERROR(false, "unexpected EOF")
+    build_response(conn, true);
+  } else {
+    LOG(2, "EOF")
+  }
+  conn->state = STATE_END;
+}
+
 static void handle_req(Conn *conn) {
   LOG(3, "Conn(%d): reading from req", conn->fd)
 
-  while (conn->state == STATE_REQ && connection_read(conn)) {
-    if (is_read_complete(conn)) {
-      build_response(conn, false);
-      conn->state = STATE_RES;
+  if (!lend_buffers(conn)) {
+    ERROR(false, "out of memory for connection buffers")
+    conn->state = STATE_END;
+    return;
+  }
+  // rbuf may still hold commands from a previous read
+  process_requests(conn);
+  while (conn->state == STATE_REQ && !conn->pending && !conn->eof &&
+         queued(conn) < MAX_PENDING_OUTPUT) {
+    if (rbuf_space(conn) == 0 && !rbuf_grow(conn)) {
+      break;
+    }
+    if (!connection_read(conn)) {
+      break;
     }
+    process_requests(conn);
+  }
+
+  // all responses of this batch go out with one write
+  if (conn->state == STATE_REQ && !vector_is_empty(&conn->wbuf)) {
+    conn->state = STATE_RES;
   }
+  finish_eof(conn);
 
-  LOG(3, "Conn(%d): recieved:\n%s", conn->fd, vector_get_at(&conn->wbuf, 0))
+  LOG(3, "Conn(%d): queued %zu bytes", conn->fd, queued(conn))
 }
 
+// replies go out with one writev, long values straight from their blobs
 static bool connection_write(Conn *conn) {
+  Output out = connection_output(conn);
+  struct iovec iov[OUTPUT_IOV_MAX];
+  size_t count = output_iovecs(&out, conn->wbuf_sent, iov, OUTPUT_IOV_MAX);
   ssize_t rv = 0;
   do {
-    size_t remain = vector_length(&conn->wbuf) - conn->wbuf_sent;
-    rv = write(conn->fd, vector_get_at(&conn->wbuf, conn->wbuf_sent), remain);
+    rv = writev(conn->fd, iov, (int)count);
   } while (rv < 0 && errno == EINTR);
 
   if (rv < 0 && errno == EAGAIN) {
@@ -131,16 +350,18 @@ static bool connection_write(Conn *conn) {
   }
 
   conn->wbuf_sent += (size_t)rv;
-  assert(conn->wbuf_sent <= vector_length(&conn->wbuf));
+  counter_add(&conn->serv->stats.net_output, (uint64_t)rv);
+  size_t len = output_length(&out);
+  assert(conn->wbuf_sent <= len);
 
-  if (conn->wbuf_sent == vector_length(&conn->wbuf)) {
+  if (conn->wbuf_sent == len) {
     // response was fully sent, change state back
     conn->state = STATE_REQ;
     conn->wbuf_sent = 0;
-    vector_clear(&conn->wbuf);
+    output_clear(&out);
     return false;
   }
-  // still got some data in wbuf, could try to write again
+  // the rest resumes where this write stopped, could try to write again
   return true;
 }
 
@@ -155,27 +376,155 @@ static void send_res(Conn *conn) {
   LOG(3, "Conn(%d): writing done", conn->fd)
 }
 
+// keeps switching between reading and writing for as long as progress is
+// possible, so the conn only stops once the socket would block
+// (required for edge triggered readiness)
 void connection_io(Conn *conn) {
   LOG(3, "Conn(%d): New IO Available", conn->fd)
 
-  if (conn->state == STATE_REQ) {
-    handle_req(conn);
-  } else if (conn->state == STATE_RES) {
-    send_res(conn);
-  } else {
-    assert(0); // not expected
+  assert(conn->state == STATE_REQ || conn->state == STATE_RES);
+  while (1) {
+    if (conn->state == STATE_REQ) {
+      handle_req(conn);
+      if (conn->state != STATE_RES) {
+        break;
+      }
+    } else if (conn->state == STATE_RES) {
+      if (aof_must_wait(conn->serv, conn->log_end)) {
+        break; // the server sends it once the log is synced
+      }
+      send_res(conn);
+      if (conn->state != STATE_REQ) {
+        break;
+      }
+    } else {
+      break;
+    }
   }
+  return_buffers(conn);
 
   LOG(3, "Conn(%d): IO done", conn->fd)
 }
 
+// moves as much of the backlog into rbuf as fits
+static void refill_rbuf(Conn *conn) {
+  size_t len = vector_length(&conn->backlog);
+  size_t space = rbuf_space(conn);
+  len = len < space ? len : space;
+  if (len == 0) {
+    return;
+  }
+  memcpy(conn->rbuf + conn->rbuf_size, conn->backlog.data, len);
+  conn->rbuf_size += len;
+  memmove(conn->backlog.data, conn->backlog.data + len,
+          vector_length(&conn->backlog) - len);
+  vector_resize(&conn->backlog, vector_length(&conn->backlog) - len);
+}
+
+// false once the engine should stop receiving until the backlog drained
+bool connection_wants_input(const Conn *conn) {
+  return conn->state != STATE_END && !conn->eof &&
+         vector_length(&conn->backlog) < MAX_BACKLOG;
+}
+
+// runs the buffered commands, refilling rbuf from the backlog as they are
+// consumed (growing it for a command that does not fit), then queues
+// their replies
+void connection_advance(Conn *conn) {
+  if (conn->state == STATE_REQ && !lend_buffers(conn)) {
+    ERROR(false, "out of memory for connection buffers")
+    conn->state = STATE_END;
+    return;
+  }
+  while (conn->state == STATE_REQ && !conn->pending &&
+         queued(conn) < MAX_PENDING_OUTPUT) {
+    refill_rbuf(conn);
+    size_t buffered = conn->rbuf_size;
+    process_requests(conn);
+    if (conn->rbuf_size != buffered) {
+      continue;
+    }
+    // nothing consumed, rbuf holds a partial command
+    if (rbuf_space(conn) > 0 || vector_is_empty(&conn->backlog) ||
+        !rbuf_grow(conn)) {
+      break;
+    }
+  }
+  if (conn->state == STATE_REQ && !vector_is_empty(&conn->wbuf)) {
+    conn->state = STATE_RES;
+  }
+  finish_eof(conn);
+  return_buffers(conn);
+}
+
+// len of 0 is the peer closing the connection
+void connection_received(Conn *conn, const uint8_t *data, size_t len) {
+  if (len == 0) {
+    // what is still buffered gets answered first
+    conn->eof = true;
+    connection_advance(conn);
+    return;
+  }
+
+  counter_add(&conn->serv->stats.net_input, len);
+  // straight into rbuf when nothing is queued before these bytes
+  size_t direct = 0;
+  if (vector_is_empty(&conn->backlog) && lend_buffers(conn)) {
+    size_t space = rbuf_space(conn);
+    direct = len < space ? len : space;
+    memcpy(conn->rbuf + conn->rbuf_size, data, direct);
+    conn->rbuf_size += direct;
+  }
+  vector_append(&conn->backlog, data + direct, len - direct);
+  connection_advance(conn);
+}
+
+void connection_sent(Conn *conn, size_t len) {
+  Output out = connection_output(conn);
+  conn->wbuf_sent += len;
+  assert(conn->wbuf_sent <= output_length(&out));
+  counter_add(&conn->serv->stats.net_output, len);
+
+  if (conn->wbuf_sent == output_length(&out)) {
+    conn->state = STATE_REQ;
+    conn->wbuf_sent = 0;
+    output_clear(&out);
+    connection_advance(conn);
+  }
+}
+
+// back into the pool, keeping the vectors of the conn for its next user
 void connection_close(Conn *conn) {
   LOG(2, "Conn(%d): Closing", conn->fd)
 
   close(conn->fd);
-  vector_cleanup(&conn->wbuf);
-  vector_cleanup(&conn->rbuf);
-  free(conn);
+  counter_add(&conn->serv->stats.conns_open, (uint64_t)-1);
+  conn->rbuf_size = 0;
+  Output out = connection_output(conn);
+  output_clear(&out);
+  return_buffers(conn);
+  slice_vec_clear(&conn->argv);
+  resp_parser_reset(&conn->parser, 0);
+  if (conn->backlog.capacity > POOL_MIN_BUF) {
+    vector_cleanup(&conn->backlog);
+    vector_initialize(&conn->backlog, 0, sizeof(uint8_t));
+  }
+  vector_clear(&conn->backlog);
+  pool_put(conn->pool, conn);
 
   LOG(1, "Conn: Closed")
 }
+
+// frees what the pooled conns kept, they must all be closed
+void connection_pool_cleanup(Pool *pool) {
+  Conn *conn = NULL;
+  while ((conn = pool_pop_free(pool)) != NULL) {
+    if (conn->pool) {
+      resp_parser_cleanup(&conn->parser);
+      slice_vec_cleanup(&conn->argv);
+      vector_cleanup(&conn->backlog);
+      vector_cleanup(&conn->wrefs);
+    }
+  }
+  pool_cleanup(pool);
+}
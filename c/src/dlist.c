@@ -0,0 +1,22 @@
+#include <stdbool.h>
+
+#include "dlist.h"
+
+void dlist_init(DList *node) { node->prev = node->next = node; }
+
+bool dlist_empty(const DList *head) { return head->next == head; }
+
+// a node that is not in a list stays as it is
+void dlist_detach(DList *node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  dlist_init(node);
+}
+
+// inserts node right before head, at the back of the list
+void dlist_push_back(DList *head, DList *node) {
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+}
@@ -0,0 +1,174 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "evict.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "keyspace.h"
+#include "utils.h"
+
+static const char *const POLICY_NAMES[] = {
+    "noeviction",   "allkeys-lru",  "allkeys-lfu",
+    "volatile-lru", "volatile-lfu",
+};
+
+bool evict_parse_policy(const char *name, enum EvictPolicy *policy) {
+  for (size_t i = 0; i < sizeof(POLICY_NAMES) / sizeof(*POLICY_NAMES); i++) {
+    if (strcasecmp(name, POLICY_NAMES[i]) == 0) {
+      *policy = (enum EvictPolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *evict_policy_name(enum EvictPolicy policy) {
+  return POLICY_NAMES[policy];
+}
+
+// also tells the keyspace what to keep track of for the policy
+void evictor_init(Evictor *ev, Keyspace *ks, enum EvictPolicy policy,
+                  size_t samples) {
+  *ev = (Evictor){.policy = policy,
+                  .samples = samples ? samples : EVICT_SAMPLES,
+                  .rng = 0x2545f4914f6cdd1dULL};
+  bool lfu = policy == EVICT_ALLKEYS_LFU || policy == EVICT_VOLATILE_LFU;
+  ks->access = policy == EVICT_NOEVICTION ? ACCESS_NONE
+               : lfu                      ? ACCESS_LFU
+                                          : ACCESS_LRU;
+}
+
+static uint64_t next_random(Evictor *ev) {
+  ev->rng ^= ev->rng << 13;
+  ev->rng ^= ev->rng >> 7;
+  ev->rng ^= ev->rng << 17;
+  return ev->rng;
+}
+
+// keeps the pool sorted, a key less idle than all of a full pool is left
+// out. the same key may be in twice, the second one is skipped as gone
+static void pool_offer(Evictor *ev, Keyspace *ks, const Entry *entry) {
+  uint64_t idle = keyspace_idle(ks, entry);
+  size_t at = 0;
+  while (at < ev->used && ev->pool[at].idle < idle) {
+    at++;
+  }
+  bool full = ev->used == EVICT_POOL_SIZE;
+  if (at == 0 && full) {
+    return;
+  }
+  // the buffer of the slot that falls off (or the free one) is reused,
+  // the candidate is left out when it cannot grow to fit the key
+  EvictCandidate *spare = &ev->pool[full ? 0 : ev->used];
+  if (spare->cap < entry->key_len) {
+    uint8_t *key = realloc(spare->key, entry->key_len);
+    if (!key) {
+      return;
+    }
+    spare->key = key;
+    spare->cap = entry->key_len;
+  }
+  EvictCandidate slot = *spare;
+  if (!full) {
+    memmove(&ev->pool[at + 1], &ev->pool[at],
+            (ev->used - at) * sizeof(EvictCandidate));
+    ev->used++;
+  } else {
+    at--;
+    memmove(&ev->pool[0], &ev->pool[1], at * sizeof(EvictCandidate));
+  }
+  memcpy(slot.key, entry_key(entry), entry->key_len);
+  slot.len = entry->key_len;
+  slot.idle = idle;
+  ev->pool[at] = slot;
+}
+
+typedef struct SampleArg {
+  Evictor *ev;
+  Keyspace *ks;
+  size_t left;
+} SampleArg;
+
+static void sample_entry(HNode *node, void *arg) {
+  SampleArg *sample = arg;
+  if (sample->left > 0) {
+    sample->left--;
+    pool_offer(sample->ev, sample->ks, container_of(node, Entry, node));
+  }
+}
+
+// samples the buckets a cursor walk visits from a random one on, they
+// are spread over the table. a sparse table gives up after samples * 10
+static void sample_keys(Evictor *ev, Keyspace *ks) {
+  SampleArg arg = {.ev = ev, .ks = ks, .left = ev->samples};
+  uint64_t cursor = next_random(ev);
+  size_t budget = ev->samples * 10;
+  do {
+    cursor = hmap_scan(&ks->map, cursor, sample_entry, &arg);
+  } while (arg.left > 0 && --budget > 0);
+}
+
+// the heap holds exactly the keys with a ttl, any position is one
+static void sample_volatile(Evictor *ev, Keyspace *ks) {
+  size_t size = heap_size(&ks->expires);
+  for (size_t i = 0; i < ev->samples && size > 0; i++) {
+    HeapItem *item = heap_at(&ks->expires, next_random(ev) % size);
+    pool_offer(ev, ks, container_of(item->ref, Entry, expiry));
+  }
+}
+
+// evicts the most idle key of the pool after sampling more into it,
+// false once there is nothing left to evict
+static bool evict_one(Evictor *ev, Keyspace *ks,
+                      void (*fn)(void *, const Slice *), void *arg) {
+  bool volatile_only =
+      ev->policy == EVICT_VOLATILE_LRU || ev->policy == EVICT_VOLATILE_LFU;
+  while (true) {
+    if (volatile_only) {
+      sample_volatile(ev, ks);
+    } else {
+      sample_keys(ev, ks);
+    }
+    if (ev->used == 0) {
+      return false;
+    }
+    // candidates that went meanwhile are dropped, then sample again
+    while (ev->used > 0) {
+      EvictCandidate *best = &ev->pool[--ev->used];
+      Slice key = {best->key, best->len};
+      if (keyspace_del(ks, best->key, best->len)) {
+        ev->evicted++;
+        if (fn) {
+          fn(arg, &key);
+        }
+        return true;
+      }
+    }
+  }
+}
+
+// evicts keys until the keyspace is down to limit bytes (keyspace_memory)
+// and calls fn, if set, with each of them. false when the policy or the
+// lack of keys it may pick stops it short of that
+bool evict_until(Evictor *ev, Keyspace *ks, size_t limit,
+                 void (*fn)(void *, const Slice *), void *arg) {
+  if (ev->policy == EVICT_NOEVICTION) {
+    return keyspace_memory(ks) <= limit;
+  }
+  while (keyspace_memory(ks) > limit) {
+    if (!evict_one(ev, ks, fn, arg)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void evictor_cleanup(Evictor *ev) {
+  for (size_t i = 0; i < EVICT_POOL_SIZE; i++) {
+    free(ev->pool[i].key);
+  }
+  *ev = (Evictor){0};
+}
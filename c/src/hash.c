@@ -0,0 +1,24 @@
+#include <stdint.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+// fixed until hash_seed_init runs, so tools and benchmarks that never
+// call it still hash the same way every run
+uint64_t hash_seed = 0x9e3779b97f4a7c15ULL;
+
+// picks the seed of this process, before any key is hashed. forked
+// children inherit it with the keyspaces they walk
+void hash_seed_init(void) {
+  uint64_t seed = 0;
+  if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed)) {
+    // no entropy yet (early boot), still differs per process
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 20) ^
+           ((uint64_t)getpid() << 40);
+  }
+  hash_seed = seed ^ hash_mix(seed ^ HASH_SECRET[0], HASH_SECRET[1]);
+}
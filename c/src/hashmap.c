@@ -6,7 +6,6 @@
 #include "hashmap.h"
 #include "hashtable.h"
 
-const size_t HMAP__MAX_LOAD_FACTOR = 8;
 const size_t HMAP__RESIZIN_WORK = 128; // constant work
 
 void hmap_initialize(HMap *map, uint64_t (*hash)(void *),
@@ -16,13 +15,23 @@ void hmap_initialize(HMap *map, uint64_t (*hash)(void *),
   htable_initialize(&map->ht1, 4, hash, eq);
 }
 
+// for payloads keeping their key as length + bytes (see HKeyLayout),
+// looked up and popped with the _key variants, which compare keys in
+// place instead of calling eq
+void hmap_initialize_keys(HMap *map, HKeyLayout keys) {
+  hmap_initialize(map, NULL, NULL);
+  map->keys = keys;
+}
+
 static void hmap_help_resizing(HMap *map) {
   size_t nwork = 0;
   while (nwork < HMAP__RESIZIN_WORK && map->ht2.size > 0) {
     // scan for nodes from ht2 and move them to ht1
-    HNode **from = &map->ht2.tab[map->resizing_pos];
-    if (!*from) {
+    HNode **from = htable_bucket(&map->ht2, map->resizing_pos);
+    if (!from) {
+      // empty slots count as work too, a sparse table must not stall us
       map->resizing_pos++;
+      nwork++;
       continue;
     }
 
@@ -32,8 +41,7 @@ static void hmap_help_resizing(HMap *map) {
 
   if (map->ht2.size == 0 && map->ht2.tab) {
     // done
-    free(map->ht2.tab);
-    map->ht2 = (HTable){0};
+    htable_cleanup(&map->ht2);
   }
 }
 
@@ -41,7 +49,8 @@ static void hmap_start_resizing(HMap *map) {
   assert(map->ht2.tab == NULL);
   // create a bigger hashtable and swap them
   map->ht2 = map->ht1;
-  htable_initialize(&map->ht1, (map->ht1.mask + 1) * 2, map->hash, map->eq);
+  htable_initialize(&map->ht1, htable_grow_capacity(&map->ht2), map->hash,
+                    map->eq);
   map->resizing_pos = 0;
 }
 
@@ -52,6 +61,14 @@ HNode *hmap_lookup(HMap *map, HNode *key) {
   return from ? *from : NULL;
 }
 
+HNode *hmap_lookup_key(HMap *map, uint64_t hash, const uint8_t *key,
+                       size_t len) {
+  hmap_help_resizing(map);
+  HNode **from = htable_lookup_key(&map->ht1, &map->keys, hash, key, len);
+  from = from ? from : htable_lookup_key(&map->ht2, &map->keys, hash, key, len);
+  return from ? *from : NULL;
+}
+
 void hmap_insert(HMap *map, HNode *node) {
   if (!map->ht1.tab) {
     htable_initialize(&map->ht1, 4, map->hash, map->eq);
@@ -60,13 +77,25 @@ void hmap_insert(HMap *map, HNode *node) {
 
   if (!map->ht2.tab) {
     // check whether we need to resize
-    if (htable_load_factor(&map->ht1) >= HMAP__MAX_LOAD_FACTOR) {
+    if (htable_is_full(&map->ht1)) {
       hmap_start_resizing(map);
     }
   }
   hmap_help_resizing(map);
 }
 
+// sizes an empty map for nodes up front, so filling it in bulk never
+// resizes. a map already holding nodes is left alone
+void hmap_reserve(HMap *map, size_t nodes) {
+  if (hmap_size(map) > 0) {
+    return;
+  }
+  htable_cleanup(&map->ht1);
+  htable_cleanup(&map->ht2);
+  htable_initialize(&map->ht1, htable_capacity_for(nodes), map->hash,
+                    map->eq);
+}
+
 HNode *hmap_pop(HMap *map, HNode *key) {
   hmap_help_resizing(map);
   HNode **from = htable_lookup(&map->ht1, key);
@@ -80,12 +109,83 @@ HNode *hmap_pop(HMap *map, HNode *key) {
   return NULL;
 }
 
+HNode *hmap_pop_key(HMap *map, uint64_t hash, const uint8_t *key,
+                    size_t len) {
+  hmap_help_resizing(map);
+  HNode **from = htable_lookup_key(&map->ht1, &map->keys, hash, key, len);
+  if (from) {
+    return htable_detach(&map->ht1, from);
+  }
+  from = htable_lookup_key(&map->ht2, &map->keys, hash, key, len);
+  if (from) {
+    return htable_detach(&map->ht2, from);
+  }
+  return NULL;
+}
+
 size_t hmap_size(HMap *map) {
   return htable_size(&map->ht1) + htable_size(&map->ht2);
 }
 
+// bytes of both tables (the older one while resizing), nodes not included
+size_t hmap_memory(HMap *map) {
+  return htable_memory(&map->ht1) + htable_memory(&map->ht2);
+}
+
+// visits both tables, fn returning false stops the walk
+void hmap_foreach(HMap *map, bool (*fn)(HNode *, void *), void *arg) {
+  if (htable_foreach(&map->ht1, fn, arg)) {
+    (void)htable_foreach(&map->ht2, fn, arg);
+  }
+}
+
+static uint64_t reverse_bits(uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+  v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+  v = ((v >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((v & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  return __builtin_bswap64(v);
+}
+
+// adds one to the bits under mask counting from the top one down, so the
+// buckets of a table twice (or half) the size still line up: bucket b
+// splits into b and b | (mask + 1), which come right after each other
+static uint64_t cursor_next(uint64_t cursor, uint64_t mask) {
+  cursor |= ~mask;
+  return reverse_bits(reverse_bits(cursor) + 1);
+}
+
+// one step of a cursor walk: calls fn on the nodes of one bucket (and of
+// the buckets it splits into in the larger table while resizing) and
+// returns the cursor to continue from, 0 once the walk is complete. start
+// at 0. every node that is in the map for the whole walk is visited at
+// least once, however the map resizes between steps, some may come
+// twice. fn may not modify the map
+uint64_t hmap_scan(HMap *map, uint64_t cursor, void (*fn)(HNode *, void *),
+                   void *arg) {
+  HTable *small = &map->ht1;
+  HTable *large = &map->ht2;
+  if (!large->tab) {
+    uint64_t mask = htable_bucket_mask(small);
+    htable_scan(small, cursor & mask, fn, arg);
+    return cursor_next(cursor, mask);
+  }
+  if (htable_bucket_mask(small) > htable_bucket_mask(large)) {
+    small = &map->ht2;
+    large = &map->ht1;
+  }
+  uint64_t small_mask = htable_bucket_mask(small);
+  uint64_t large_mask = htable_bucket_mask(large);
+  htable_scan(small, cursor & small_mask, fn, arg);
+  // the buckets of the larger table the small bucket splits into
+  do {
+    htable_scan(large, cursor & large_mask, fn, arg);
+    cursor = cursor_next(cursor, large_mask);
+  } while (cursor & (small_mask ^ large_mask));
+  return cursor;
+}
+
 void hmap_destroy(HMap *map) {
-  free(map->ht1.tab);
-  free(map->ht2.tab);
+  htable_cleanup(&map->ht1);
+  htable_cleanup(&map->ht2);
   *map = (HMap){0};
 }
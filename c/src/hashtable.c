@@ -6,6 +6,10 @@
 #include "hashtable.h"
 #include "hnode.h"
 
+#ifndef HTABLE_SWISS
+
+const size_t HTABLE__MAX_LOAD_FACTOR = 8;
+
 void htable_initialize(HTable *table, size_t capacity, uint64_t (*hash)(void *),
                        uint64_t (*eq)(HNode *, HNode *)) {
   if (capacity <= 0) {
@@ -33,6 +37,7 @@ HTable *htable_new(size_t capacity, uint64_t (*hash)(void *),
   return table;
 }
 
+// eq only runs for nodes whose stored hash matches
 HNode **htable_lookup(HTable *table, HNode *key) {
   if (!table->tab) {
     return NULL;
@@ -41,7 +46,23 @@ HNode **htable_lookup(HTable *table, HNode *key) {
   size_t pos = key->hash & table->mask;
   HNode **from = &table->tab[pos];
   for (HNode *curr; (curr = *from) != NULL; from = &curr->next) {
-    if (table->eq(curr, key)) {
+    if (curr->hash == key->hash && table->eq(curr, key)) {
+      return from;
+    }
+  }
+  return NULL;
+}
+
+// htable_lookup for byte-string keys, no call through eq
+HNode **htable_lookup_key(HTable *table, const HKeyLayout *layout,
+                          uint64_t hash, const uint8_t *key, size_t len) {
+  if (!table->tab) {
+    return NULL;
+  }
+
+  HNode **from = &table->tab[hash & table->mask];
+  for (HNode *curr; (curr = *from) != NULL; from = &curr->next) {
+    if (curr->hash == hash && hkey_equal(curr, layout, key, len)) {
       return from;
     }
   }
@@ -67,6 +88,11 @@ HNode *htable_detach(HTable *table, HNode **from) {
   return node;
 }
 
+// the chain at pos, NULL when it is empty
+HNode **htable_bucket(HTable *table, size_t pos) {
+  return table->tab[pos] ? &table->tab[pos] : NULL;
+}
+
 HNode *htable_pop(HTable *table, HNode *key) {
   HNode **from = htable_lookup(table, key);
   if (from) {
@@ -76,9 +102,55 @@ HNode *htable_pop(HTable *table, HNode *key) {
 }
 
 size_t htable_size(HTable *table) { return table->size; }
+size_t htable_capacity(HTable *table) {
+  return table->tab ? table->mask + 1 : 0;
+}
+
+// bytes of the bucket array, nodes not included
+size_t htable_memory(HTable *table) {
+  return htable_capacity(table) * sizeof(HNode *);
+}
+
+// calls fn on every node until it returns false, fn may not modify the table
+bool htable_foreach(HTable *table, bool (*fn)(HNode *, void *), void *arg) {
+  if (!table->tab) {
+    return true;
+  }
+  for (size_t ind = 0; ind <= table->mask; ind++) {
+    for (HNode *curr = table->tab[ind]; curr != NULL; curr = curr->next) {
+      if (!fn(curr, arg)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// the buckets a scan cursor walks, see hmap_scan
+size_t htable_bucket_mask(HTable *table) {
+  return table->tab ? table->mask : 0;
+}
+
+// calls fn on every node whose hash picks bucket, fn may not modify the
+// table
+void htable_scan(HTable *table, size_t bucket, void (*fn)(HNode *, void *),
+                 void *arg) {
+  if (!table->tab) {
+    return;
+  }
+  for (HNode *curr = table->tab[bucket]; curr != NULL; curr = curr->next) {
+    fn(curr, arg);
+  }
+}
+
+// frees the buckets only, nodes belong to their payloads
+void htable_cleanup(HTable *table) {
+  free(table->tab);
+  *table = (HTable){0};
+}
 
 void htable_destroy(HTable *table) {
-  for (size_t ind = 0; ind < table->size; ind++) {
+  for (size_t ind = 0; table->tab && ind <= table->mask; ind++) {
     hnode_destroy_chain(&table->tab[ind]);
   }
   free(table->tab);
@@ -88,3 +160,20 @@ void htable_destroy(HTable *table) {
 size_t htable_load_factor(HTable *table) {
   return table->size / (table->mask + 1);
 }
+
+bool htable_is_full(HTable *table) {
+  return htable_load_factor(table) >= HTABLE__MAX_LOAD_FACTOR;
+}
+
+size_t htable_grow_capacity(HTable *table) { return (table->mask + 1) * 2; }
+
+// the smallest capacity holding nodes without being full
+size_t htable_capacity_for(size_t nodes) {
+  size_t capacity = 4;
+  while (nodes / capacity >= HTABLE__MAX_LOAD_FACTOR) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+#endif
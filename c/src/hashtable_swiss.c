@@ -0,0 +1,331 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hashtable.h"
+#include "hnode.h"
+
+#ifdef HTABLE_SWISS
+
+// control bytes: 0 is empty (so calloc'd tables need no init pass),
+// 1 is a tombstone and full slots store 0x80 | the top 7 bits of the hash
+const uint8_t CTRL_EMPTY = 0x00;
+const uint8_t CTRL_DELETED = 0x01;
+const uint8_t CTRL_FULL = 0x80;
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+// slots are probed one aligned group at a time
+#define GROUP_WIDTH 16
+typedef uint32_t GroupMask; // bit i set for slot i of the group
+
+static inline GroupMask group_match(const uint8_t *group, uint8_t byte) {
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+}
+
+static inline GroupMask group_match_free(const uint8_t *group) {
+  // empty and deleted are the only bytes without the high bit
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return ~_mm_movemask_epi8(ctrl) & 0xffffU;
+}
+
+static inline size_t mask_next(GroupMask *mask) {
+  size_t slot = __builtin_ctz(*mask);
+  *mask &= *mask - 1;
+  return slot;
+}
+
+#else
+#include <string.h>
+
+// portable fallback, 8 control bytes per uint64_t
+#define GROUP_WIDTH 8
+typedef uint64_t GroupMask; // high bit of byte i set for slot i
+
+static const uint64_t LSBS = 0x0101010101010101ULL;
+static const uint64_t MSBS = 0x8080808080808080ULL;
+
+static inline uint64_t group_load(const uint8_t *group) {
+  uint64_t word = 0;
+  memcpy(&word, group, sizeof(word));
+  return word;
+}
+
+// may report false positives above a real match, callers verify the slot
+static inline GroupMask group_match(const uint8_t *group, uint8_t byte) {
+  uint64_t x = group_load(group) ^ (LSBS * byte);
+  return (x - LSBS) & ~x & MSBS;
+}
+
+static inline GroupMask group_match_free(const uint8_t *group) {
+  return ~group_load(group) & MSBS;
+}
+
+static inline size_t mask_next(GroupMask *mask) {
+  size_t slot = __builtin_ctzll(*mask) / 8;
+  *mask &= *mask - 1;
+  return slot;
+}
+
+#endif
+
+const size_t HTABLE__MIN_CAPACITY = GROUP_WIDTH;
+
+static inline uint8_t h2(uint64_t hash) { return CTRL_FULL | (hash >> 57); }
+
+static inline size_t n_groups(HTable *table) {
+  return (table->mask + 1) / GROUP_WIDTH;
+}
+
+// at most 7/8 of the slots are filled, so probes stay short
+static size_t max_fill(size_t capacity) { return capacity - capacity / 8; }
+
+void htable_initialize(HTable *table, size_t capacity, uint64_t (*hash)(void *),
+                       uint64_t (*eq)(HNode *, HNode *)) {
+  if (capacity < HTABLE__MIN_CAPACITY) {
+    capacity = HTABLE__MIN_CAPACITY;
+  }
+  if (capacity & (capacity - 1)) {
+    while (capacity & (capacity - 1)) {
+      capacity &= capacity - 1;
+    }
+    capacity <<= 1;
+  }
+  // control bytes first, they are GROUP_WIDTH aligned as capacity is
+  uint8_t *mem = calloc(capacity, sizeof(uint8_t) + sizeof(HNode *));
+  *table = (HTable){.tab = (HNode **)(mem + capacity),
+                    .ctrl = mem,
+                    .mask = capacity - 1,
+                    .size = 0,
+                    .growth_left = max_fill(capacity),
+                    .hash = hash,
+                    .eq = eq};
+}
+
+HTable *htable_new(size_t capacity, uint64_t (*hash)(void *),
+                   uint64_t (*eq)(HNode *, HNode *)) {
+  HTable *table = malloc(sizeof(HTable));
+  htable_initialize(table, capacity, hash, eq);
+  return table;
+}
+
+// triangular probing over groups visits every group once
+// since the group count is a power of two. match is a constant in both
+// callers, so it is inlined into each of them
+static inline __attribute__((always_inline)) HNode **
+probe(HTable *table, uint64_t hash, bool (*match)(HNode *, const void *),
+      const void *arg) {
+  if (!table->tab) {
+    return NULL;
+  }
+
+  size_t group_mask = n_groups(table) - 1;
+  size_t group = hash & group_mask;
+  uint8_t tag = h2(hash);
+  for (size_t step = 1; step <= group_mask + 1; group = (group + step++) &
+                                                         group_mask) {
+    const uint8_t *ctrl = &table->ctrl[group * GROUP_WIDTH];
+    GroupMask found = group_match(ctrl, tag);
+    while (found) {
+      size_t pos = group * GROUP_WIDTH + mask_next(&found);
+      HNode *curr = table->tab[pos];
+      if (curr->hash == hash && match(curr, arg)) {
+        return &table->tab[pos];
+      }
+    }
+    if (group_match(ctrl, CTRL_EMPTY)) {
+      // the key would have been placed here
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+typedef struct EqArg {
+  HTable *table;
+  HNode *key;
+} EqArg;
+
+static inline bool match_eq(HNode *node, const void *arg) {
+  const EqArg *eq = arg;
+  return eq->table->eq(node, eq->key);
+}
+
+typedef struct KeyArg {
+  const HKeyLayout *layout;
+  const uint8_t *key;
+  size_t len;
+} KeyArg;
+
+static inline bool match_key(HNode *node, const void *arg) {
+  const KeyArg *key = arg;
+  return hkey_equal(node, key->layout, key->key, key->len);
+}
+
+HNode **htable_lookup(HTable *table, HNode *key) {
+  EqArg arg = {.table = table, .key = key};
+  return probe(table, key->hash, match_eq, &arg);
+}
+
+// htable_lookup for byte-string keys, no call through eq
+HNode **htable_lookup_key(HTable *table, const HKeyLayout *layout,
+                          uint64_t hash, const uint8_t *key, size_t len) {
+  KeyArg arg = {.layout = layout, .key = key, .len = len};
+  return probe(table, hash, match_key, &arg);
+}
+
+void htable_insert(HTable *table, HNode *node) {
+  size_t group_mask = n_groups(table) - 1;
+  size_t group = node->hash & group_mask;
+  for (size_t step = 1;; group = (group + step++) & group_mask) {
+    GroupMask free_slots = group_match_free(&table->ctrl[group * GROUP_WIDTH]);
+    if (!free_slots) {
+      continue;
+    }
+    size_t pos = group * GROUP_WIDTH + mask_next(&free_slots);
+    if (table->ctrl[pos] == CTRL_EMPTY) {
+      // reusing a tombstone does not consume growth
+      table->growth_left--;
+    }
+    table->ctrl[pos] = h2(node->hash);
+    table->tab[pos] = node;
+    table->size++;
+    return;
+  }
+}
+
+HNode *htable_insert_hash(HTable *table, uint64_t hash) {
+  HNode *node = hnode_new(hash);
+  htable_insert(table, node);
+  return node;
+}
+
+HNode *htable_detach(HTable *table, HNode **from) {
+  size_t pos = from - table->tab;
+  HNode *node = *from;
+  *from = NULL;
+  table->size--;
+
+  // a group that still has an empty slot never made a probe move on,
+  // so the slot can go back to empty instead of becoming a tombstone
+  const uint8_t *group = &table->ctrl[pos & ~(size_t)(GROUP_WIDTH - 1)];
+  if (group_match(group, CTRL_EMPTY)) {
+    table->ctrl[pos] = CTRL_EMPTY;
+    table->growth_left++;
+  } else {
+    table->ctrl[pos] = CTRL_DELETED;
+  }
+  return node;
+}
+
+HNode *htable_pop(HTable *table, HNode *key) {
+  HNode **from = htable_lookup(table, key);
+  if (from) {
+    return htable_detach(table, from);
+  }
+  return NULL;
+}
+
+// the slot at pos, NULL when it holds no node
+HNode **htable_bucket(HTable *table, size_t pos) {
+  return (table->ctrl[pos] & CTRL_FULL) ? &table->tab[pos] : NULL;
+}
+
+size_t htable_size(HTable *table) { return table->size; }
+size_t htable_capacity(HTable *table) {
+  return table->tab ? table->mask + 1 : 0;
+}
+
+// bytes of the slots and their control bytes, nodes not included
+size_t htable_memory(HTable *table) {
+  return htable_capacity(table) * (sizeof(HNode *) + sizeof(uint8_t));
+}
+
+// calls fn on every node until it returns false, fn may not modify the table
+bool htable_foreach(HTable *table, bool (*fn)(HNode *, void *), void *arg) {
+  if (!table->tab) {
+    return true;
+  }
+  for (size_t pos = 0; pos <= table->mask; pos++) {
+    if ((table->ctrl[pos] & CTRL_FULL) && !fn(table->tab[pos], arg)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// a scan walks groups, a node belongs to the one its probe starts at
+size_t htable_bucket_mask(HTable *table) {
+  return table->tab ? n_groups(table) - 1 : 0;
+}
+
+// calls fn on every node whose probe starts at group bucket, fn may not
+// modify the table. like a lookup they are all on that probe sequence
+// before the first group with an empty slot
+void htable_scan(HTable *table, size_t bucket, void (*fn)(HNode *, void *),
+                 void *arg) {
+  if (!table->tab) {
+    return;
+  }
+  size_t group_mask = n_groups(table) - 1;
+  size_t group = bucket;
+  for (size_t step = 1; step <= group_mask + 1; group = (group + step++) &
+                                                         group_mask) {
+    const uint8_t *ctrl = &table->ctrl[group * GROUP_WIDTH];
+    for (size_t i = 0; i < GROUP_WIDTH; i++) {
+      HNode *node = table->tab[group * GROUP_WIDTH + i];
+      if ((ctrl[i] & CTRL_FULL) && (node->hash & group_mask) == bucket) {
+        fn(node, arg);
+      }
+    }
+    if (group_match(ctrl, CTRL_EMPTY)) {
+      return;
+    }
+  }
+}
+
+// frees the slots only, nodes belong to their payloads
+void htable_cleanup(HTable *table) {
+  free(table->ctrl);
+  *table = (HTable){0};
+}
+
+void htable_destroy(HTable *table) {
+  for (size_t pos = 0; table->tab && pos <= table->mask; pos++) {
+    if (table->ctrl[pos] & CTRL_FULL) {
+      free(table->tab[pos]);
+    }
+  }
+  free(table->ctrl);
+  free(table);
+}
+
+size_t htable_load_factor(HTable *table) {
+  return table->size / (table->mask + 1);
+}
+
+bool htable_is_full(HTable *table) { return table->growth_left == 0; }
+
+// sized from the live nodes, a table full of tombstones is rebuilt at
+// the same size instead of doubling
+size_t htable_grow_capacity(HTable *table) {
+  size_t capacity = HTABLE__MIN_CAPACITY;
+  while (max_fill(capacity) < table->size * 2) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+// the smallest capacity holding nodes without being full
+size_t htable_capacity_for(size_t nodes) {
+  size_t capacity = HTABLE__MIN_CAPACITY;
+  while (max_fill(capacity) <= nodes) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+#endif
@@ -0,0 +1,121 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "heap.h"
+#include "vector.h"
+
+// the array is only shrunk while it holds at least this many items
+const size_t HEAP_MIN_SHRINK = 256;
+
+static HeapItem *heap_items(Heap *heap) {
+  return (HeapItem *)heap->items.data;
+}
+
+static void heap_place(HeapItem *items, size_t pos, HeapItem item) {
+  items[pos] = item;
+  *item.ref = (uint32_t)(pos + 1);
+}
+
+static void heap_sift_up(HeapItem *items, size_t pos) {
+  HeapItem item = items[pos];
+  while (pos > 0) {
+    size_t parent = (pos - 1) / 4;
+    if (items[parent].val <= item.val) {
+      break;
+    }
+    heap_place(items, pos, items[parent]);
+    pos = parent;
+  }
+  heap_place(items, pos, item);
+}
+
+static void heap_sift_down(HeapItem *items, size_t len, size_t pos) {
+  HeapItem item = items[pos];
+  for (;;) {
+    size_t first = 4 * pos + 1;
+    if (first >= len) {
+      break;
+    }
+    size_t child = first;
+    size_t end = first + 4 < len ? first + 4 : len;
+    for (size_t c = first + 1; c < end; c++) {
+      if (items[c].val < items[child].val) {
+        child = c;
+      }
+    }
+    if (item.val <= items[child].val) {
+      break;
+    }
+    heap_place(items, pos, items[child]);
+    pos = child;
+  }
+  heap_place(items, pos, item);
+}
+
+// restores the order around pos after its val changed
+static void heap_fix(Heap *heap, size_t pos) {
+  HeapItem *items = heap_items(heap);
+  if (pos > 0 && items[(pos - 1) / 4].val > items[pos].val) {
+    heap_sift_up(items, pos);
+  } else {
+    heap_sift_down(items, vector_length(&heap->items), pos);
+  }
+}
+
+void heap_init(Heap *heap) {
+  vector_initialize(&heap->items, 0, sizeof(HeapItem));
+}
+
+void heap_push(Heap *heap, uint64_t val, uint32_t *ref) {
+  HeapItem item = {.val = val, .ref = ref};
+  vector_push_back(&heap->items, (const uint8_t *)&item);
+  heap_sift_up(heap_items(heap), vector_length(&heap->items) - 1);
+}
+
+void heap_update(Heap *heap, size_t pos, uint64_t val) {
+  heap_items(heap)[pos].val = val;
+  heap_fix(heap, pos);
+}
+
+void heap_remove(Heap *heap, size_t pos) {
+  HeapItem *items = heap_items(heap);
+  size_t last = vector_length(&heap->items) - 1;
+  *items[pos].ref = 0;
+  if (pos != last) {
+    // popping never moves the items
+    heap_place(items, pos, items[last]);
+    vector_pop_back(&heap->items);
+    heap_fix(heap, pos);
+  } else {
+    vector_pop_back(&heap->items);
+  }
+
+  // gives memory back after mass removals, refs hold positions so the
+  // items may move
+  if (last >= HEAP_MIN_SHRINK && last < heap->items.capacity / 4) {
+    vector_shrink_to_fit(&heap->items);
+  }
+}
+
+HeapItem *heap_top(Heap *heap) {
+  return vector_is_empty(&heap->items) ? NULL : heap_items(heap);
+}
+
+HeapItem *heap_at(Heap *heap, size_t pos) {
+  return (HeapItem *)vector_get_at(&heap->items, pos);
+}
+
+size_t heap_size(Heap *heap) { return vector_length(&heap->items); }
+
+size_t heap_memory(Heap *heap) {
+  return heap->items.capacity * sizeof(HeapItem);
+}
+
+// owners see their items as removed
+void heap_cleanup(Heap *heap) {
+  HeapItem *items = heap_items(heap);
+  for (size_t i = 0; i < vector_length(&heap->items); i++) {
+    *items[i].ref = 0;
+  }
+  vector_cleanup(&heap->items);
+}
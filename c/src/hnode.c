@@ -7,11 +7,12 @@
 
 HNode *hnode_new(uint64_t hash) {
   HNode *node = malloc(sizeof(HNode));
-  node->next = NULL;
-  node->hash = hash;
+  *node = (HNode){.hash = hash};
   return node;
 }
 
+#ifndef HTABLE_SWISS
+
 // from is pointer to location storing ref to node
 // so we can safely destroy the node without having a
 // dangling pointer
@@ -32,3 +33,5 @@ void hnode_destroy_chain(HNode **from) {
     hnode_destroy(from);
   }
 }
+
+#endif
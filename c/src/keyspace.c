@@ -0,0 +1,464 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob.h"
+#include "hash.h"
+#include "hashmap.h"
+#include "heap.h"
+#include "hnode.h"
+#include "keyspace.h"
+#include "utils.h"
+#include "vector.h"
+#include "zset.h"
+
+const uint8_t *entry_key(const Entry *entry) { return entry->data; }
+
+bool entry_is_string(const Entry *entry) { return entry->enc != ENC_ZSET; }
+
+// strings only, ENC_INT values are formatted into buf
+Slice entry_value(const Entry *entry, char buf[ENTRY_INT_BUF]) {
+  switch (entry->enc) {
+  case ENC_INT: {
+    int len = snprintf(buf, ENTRY_INT_BUF, "%" PRId64, entry->integer);
+    return (Slice){(const uint8_t *)buf, (size_t)len};
+  }
+  case ENC_EMBED:
+    return (Slice){entry->data + entry->key_len, entry->val_len};
+  default:
+    return (Slice){entry->raw->data, entry->val_len};
+  }
+}
+
+// bytes allocated for the entry and its value
+size_t entry_memory(const Entry *entry) {
+  size_t bytes = malloc_usable_size((void *)entry);
+  if (entry->enc == ENC_RAW) {
+    bytes += blob_memory(entry->raw);
+  } else if (entry->enc == ENC_ZSET) {
+    bytes += zset_memory(entry->zset);
+  }
+  return bytes;
+}
+
+// LFU as in redis: a new key starts at LFU_INIT, each hit adds one with
+// a chance of 1 / ((counter - LFU_INIT) * LFU_LOG_FACTOR + 1), so about
+// a million hits saturate the 8 bits, and every minute without hits
+// takes one off
+#define LFU_INIT 5
+#define LFU_LOG_FACTOR 10
+#define LFU_MINUTES_MAX (ACCESS_MAX >> 8)
+
+static uint32_t lfu_minutes(const Keyspace *ks) {
+  return (ks->clock / (60000 / ACCESS_TICK_MS)) & LFU_MINUTES_MAX;
+}
+
+// the counter of access, less the minutes since it was last decayed
+static uint32_t lfu_decayed(const Keyspace *ks, uint32_t access) {
+  uint32_t counter = access & 0xff;
+  uint32_t elapsed = (lfu_minutes(ks) - (access >> 8)) & LFU_MINUTES_MAX;
+  return elapsed > counter ? 0 : counter - elapsed;
+}
+
+// xorshift64, good enough for coin flips
+static uint64_t next_random(Keyspace *ks) {
+  ks->rng ^= ks->rng << 13;
+  ks->rng ^= ks->rng >> 7;
+  ks->rng ^= ks->rng << 17;
+  return ks->rng;
+}
+
+// a hit on entry
+static void entry_touch(Keyspace *ks, Entry *entry) {
+  if (ks->access == ACCESS_LRU) {
+    entry->access = ks->clock & ACCESS_MAX;
+  } else if (ks->access == ACCESS_LFU) {
+    uint32_t counter = lfu_decayed(ks, entry->access);
+    uint32_t base = counter > LFU_INIT ? counter - LFU_INIT : 0;
+    if (counter < 0xff && next_random(ks) % (base * LFU_LOG_FACTOR + 1) == 0) {
+      counter++;
+    }
+    entry->access = (lfu_minutes(ks) << 8) | counter;
+  }
+}
+
+// the key is copied in, embed bytes are reserved after it and whatever
+// the allocator rounds up to is kept as room for later values
+static Entry *entry_alloc(Keyspace *ks, uint64_t hash, const uint8_t *key,
+                          size_t key_len, size_t embed) {
+  Entry *entry = malloc(sizeof(Entry) + key_len + embed);
+  if (!entry) {
+    return NULL;
+  }
+  size_t room = malloc_usable_size(entry) - sizeof(Entry) - key_len;
+  *entry = (Entry){.node.hash = hash,
+                   .key_len = (uint32_t)key_len,
+                   .embed_cap = room > ENTRY_EMBED_MAX ? ENTRY_EMBED_MAX
+                                                       : (uint8_t)room};
+  if (ks->access == ACCESS_LFU) {
+    entry->access = (lfu_minutes(ks) << 8) | LFU_INIT;
+  } else if (ks->access == ACCESS_LRU) {
+    entry->access = ks->clock & ACCESS_MAX;
+  }
+  memcpy(entry->data, key, key_len);
+  ks->bytes += malloc_usable_size(entry);
+  return entry;
+}
+
+static void free_blob(void *blob) { blob_unref(blob); }
+
+static void free_zset(void *zset) { zset_free(zset); }
+
+// values past LAZYFREE_THRESHOLD go to the lazy free thread
+static void free_value(Keyspace *ks, size_t effort, void (*fn)(void *),
+                       void *value) {
+  if (ks->lazy && effort > LAZYFREE_THRESHOLD) {
+    lazyfree_push(ks->lazy, fn, value);
+  } else {
+    fn(value);
+  }
+}
+
+// a raw value still referenced by unsent replies outlives the entry, it
+// stops counting towards the keyspace right away. so does a value freed
+// in the background
+static void entry_drop_value(Keyspace *ks, Entry *entry) {
+  if (entry->enc == ENC_RAW) {
+    ks->bytes -= blob_memory(entry->raw);
+    free_value(ks, entry->val_len / 4096, free_blob, entry->raw);
+  } else if (entry->enc == ENC_ZSET) {
+    ks->bytes -= zset_memory(entry->zset);
+    free_value(ks, zset_size(entry->zset), free_zset, entry->zset);
+  }
+  entry->enc = ENC_INT;
+  entry->integer = 0;
+  entry->val_len = 0;
+}
+
+static void entry_destroy(Keyspace *ks, Entry *entry) {
+  (void)keyspace_persist(ks, entry);
+  entry_drop_value(ks, entry);
+  ks->bytes -= malloc_usable_size(entry);
+  free(entry);
+}
+
+void keyspace_init(Keyspace *ks) {
+  *ks = (Keyspace){0};
+  // keys are compared in place, see HKeyLayout
+  hmap_initialize_keys(&ks->map, HKEY_LAYOUT(Entry, node, key_len, data));
+  heap_init(&ks->expires);
+  keyspace_tick(ks, time_ms());
+  ks->rng = 0x9e3779b97f4a7c15ULL;
+}
+
+// sizes the table of an empty keyspace for keys, see hmap_reserve
+void keyspace_reserve(Keyspace *ks, size_t keys) {
+  hmap_reserve(&ks->map, keys);
+}
+
+static bool entry_expired(Keyspace *ks, const Entry *entry, uint64_t now) {
+  return entry->expiry &&
+         heap_at(&ks->expires, entry->expiry - 1)->val <= now;
+}
+
+// an expired key is deleted on the spot and reported missing
+Entry *keyspace_get(Keyspace *ks, const uint8_t *key, size_t key_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  HNode *node = hmap_lookup_key(&ks->map, hash, key, key_len);
+  if (!node) {
+    return NULL;
+  }
+  Entry *entry = container_of(node, Entry, node);
+  if (entry_expired(ks, entry, time_ms())) {
+    hmap_pop_key(&ks->map, hash, key, key_len);
+    entry_destroy(ks, entry);
+    ks->expired++;
+    return NULL;
+  }
+  entry_touch(ks, entry);
+  return entry;
+}
+
+// picks the most compact encoding for val. an existing entry loses its
+// ttl and is updated in place unless an embedded value outgrows its
+// room, then the entry is replaced by a larger one
+Entry *keyspace_set(Keyspace *ks, const uint8_t *key, size_t key_len,
+                    const uint8_t *val, size_t val_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  HNode *node = hmap_lookup_key(&ks->map, hash, key, key_len);
+  Entry *entry = node ? container_of(node, Entry, node) : NULL;
+
+  int64_t integer = 0;
+  enum EntryEncoding enc = ENC_RAW;
+  if (parse_int64(val, val_len, &integer)) {
+    enc = ENC_INT;
+  } else if (val_len <= ENTRY_EMBED_MAX) {
+    enc = ENC_EMBED;
+  }
+
+  Blob *raw = NULL;
+  if (enc == ENC_RAW) {
+    raw = blob_new(val, val_len);
+    if (!raw) {
+      return NULL;
+    }
+  }
+
+  if (entry && (enc != ENC_EMBED || val_len <= entry->embed_cap)) {
+    (void)keyspace_persist(ks, entry);
+    entry_drop_value(ks, entry);
+    entry_touch(ks, entry);
+  } else {
+    Entry *fresh = entry_alloc(ks, hash, key, key_len,
+                               enc == ENC_EMBED ? val_len : 0);
+    if (!fresh) {
+      if (raw) {
+        blob_unref(raw);
+      }
+      return NULL;
+    }
+    if (entry) {
+      // the replacement keeps the access history of the key
+      fresh->access = entry->access;
+      entry_touch(ks, fresh);
+      hmap_pop_key(&ks->map, hash, key, key_len);
+      entry_destroy(ks, entry);
+    }
+    hmap_insert(&ks->map, &fresh->node);
+    entry = fresh;
+  }
+
+  entry->enc = enc;
+  switch (enc) {
+  case ENC_INT:
+    entry->integer = integer;
+    break;
+  case ENC_EMBED:
+    memcpy(entry->data + key_len, val, val_len);
+    entry->val_len = (uint32_t)val_len;
+    break;
+  case ENC_RAW:
+    entry->raw = raw;
+    entry->val_len = (uint32_t)val_len;
+    ks->bytes += blob_memory(raw);
+    break;
+  case ENC_ZSET:
+    assert(false); // sorted sets come from keyspace_new_zset
+    break;
+  }
+  return entry;
+}
+
+// false when the key was missing or already expired
+bool keyspace_del(Keyspace *ks, const uint8_t *key, size_t key_len) {
+  HNode *node =
+      hmap_pop_key(&ks->map, hash_bytes(key, key_len), key, key_len);
+  if (!node) {
+    return false;
+  }
+  Entry *entry = container_of(node, Entry, node);
+  bool expired = entry_expired(ks, entry, time_ms());
+  ks->expired += expired;
+  entry_destroy(ks, entry);
+  return !expired;
+}
+
+// a new key holding an empty sorted set sized for members, the key must
+// not exist yet
+Entry *keyspace_new_zset(Keyspace *ks, const uint8_t *key, size_t key_len,
+                         size_t members) {
+  ZSet *zset = zset_new();
+  if (!zset) {
+    return NULL;
+  }
+  zset_reserve(zset, members);
+  Entry *entry = entry_alloc(ks, hash_bytes(key, key_len), key, key_len, 0);
+  if (!entry) {
+    zset_free(zset);
+    return NULL;
+  }
+  entry->enc = ENC_ZSET;
+  entry->zset = zset;
+  ks->bytes += zset_memory(zset);
+  hmap_insert(&ks->map, &entry->node);
+  return entry;
+}
+
+// sorted set changes go through here to keep the byte count right.
+// 1 when name was added, 0 when only its score changed, -1 out of memory
+int keyspace_zadd(Keyspace *ks, Entry *entry, const uint8_t *name,
+                  size_t len, double score) {
+  size_t before = zset_memory(entry->zset);
+  int added = zset_add(entry->zset, name, len, score);
+  ks->bytes += zset_memory(entry->zset) - before;
+  return added;
+}
+
+// the key stays even once its set is empty, callers delete it
+bool keyspace_zrem(Keyspace *ks, Entry *entry, const uint8_t *name,
+                   size_t len) {
+  ZNode *node = zset_lookup(entry->zset, name, len);
+  if (!node) {
+    return false;
+  }
+  size_t before = zset_memory(entry->zset);
+  zset_delete(entry->zset, node);
+  ks->bytes -= before - zset_memory(entry->zset);
+  return true;
+}
+
+// when is an absolute deadline in unix ms, replacing any earlier one
+void keyspace_set_expiry(Keyspace *ks, Entry *entry, uint64_t when) {
+  if (entry->expiry) {
+    heap_update(&ks->expires, entry->expiry - 1, when);
+  } else {
+    heap_push(&ks->expires, when, &entry->expiry);
+  }
+}
+
+// the deadline of entry, 0 when it has no ttl
+uint64_t keyspace_expiry(Keyspace *ks, const Entry *entry) {
+  return entry->expiry ? heap_at(&ks->expires, entry->expiry - 1)->val : 0;
+}
+
+// drops the ttl of entry, false when it had none
+bool keyspace_persist(Keyspace *ks, Entry *entry) {
+  if (!entry->expiry) {
+    return false;
+  }
+  heap_remove(&ks->expires, entry->expiry - 1);
+  return true;
+}
+
+// deletes keys whose deadline passed, at most budget of them, so a burst
+// of expiries is spread over several loop iterations. returns how long
+// the caller may sleep in ms: 0 when expired keys are left over, -1 when
+// no key has a ttl
+int keyspace_expire_cycle(Keyspace *ks, uint64_t now, size_t budget) {
+  HeapItem *top = NULL;
+  for (size_t done = 0; (top = heap_top(&ks->expires)) != NULL; done++) {
+    if (top->val > now) {
+      uint64_t wait = top->val - now;
+      return wait > INT_MAX ? INT_MAX : (int)wait;
+    }
+    if (done == budget) {
+      return 0;
+    }
+    Entry *entry = container_of(top->ref, Entry, expiry);
+    hmap_pop_key(&ks->map, entry->node.hash, entry->data, entry->key_len);
+    entry_destroy(ks, entry);
+    ks->expired++;
+  }
+  return -1;
+}
+
+// the clock of the access times, the server ticks it once per loop
+// iteration like the expiry cycle. now is unix ms
+void keyspace_tick(Keyspace *ks, uint64_t now) {
+  ks->clock = (uint32_t)(now / ACCESS_TICK_MS);
+}
+
+// how good a candidate for eviction entry is, higher goes first: the
+// ticks since its last access under LRU, 255 less its decayed counter
+// under LFU
+uint64_t keyspace_idle(Keyspace *ks, const Entry *entry) {
+  if (ks->access == ACCESS_LFU) {
+    return 0xff - lfu_decayed(ks, entry->access);
+  }
+  return (ks->clock - entry->access) & ACCESS_MAX;
+}
+
+size_t keyspace_size(Keyspace *ks) { return hmap_size(&ks->map); }
+
+// bytes of the hash tables and the expiry heap, entries not included
+size_t keyspace_table_memory(Keyspace *ks) {
+  return hmap_memory(&ks->map) + heap_memory(&ks->expires);
+}
+
+// what maxmemory holds the keyspace to: entries, values and tables
+size_t keyspace_memory(Keyspace *ks) {
+  return ks->bytes + keyspace_table_memory(ks);
+}
+
+typedef struct ScanArg {
+  Keyspace *ks;
+  uint64_t now;
+  Vector *out;
+} ScanArg;
+
+static void scan_entry(HNode *node, void *arg) {
+  ScanArg *scan = arg;
+  Entry *entry = container_of(node, Entry, node);
+  if (!entry_expired(scan->ks, entry, scan->now)) {
+    vector_push_back(scan->out, (const uint8_t *)&entry);
+  }
+}
+
+// one SCAN call: walks the table from cursor on until about count keys
+// were found (or count * 10 buckets were empty), appends them to out
+// (Entry *) and returns the cursor of the next call, 0 once done.
+// expired keys are skipped and left to the expiry cycle
+uint64_t keyspace_scan(Keyspace *ks, uint64_t cursor, size_t count,
+                       Vector *out) {
+  ScanArg arg = {.ks = ks, .now = time_ms(), .out = out};
+  size_t found = vector_length(out);
+  size_t budget = count * 10;
+  do {
+    cursor = hmap_scan(&ks->map, cursor, scan_entry, &arg);
+  } while (cursor && vector_length(out) - found < count && --budget > 0);
+  return cursor;
+}
+
+static void free_keyspace(void *ks) {
+  keyspace_cleanup(ks);
+  free(ks);
+}
+
+// drops every key. the keyspace is swapped for an empty one, the old
+// one is freed on the lazy free thread when async (and there is one)
+void keyspace_flush(Keyspace *ks, bool async) {
+  Keyspace *old = async && ks->lazy ? malloc(sizeof(Keyspace)) : NULL;
+  Keyspace sync;
+  if (!old) {
+    old = &sync;
+  }
+  *old = *ks;
+  keyspace_init(ks);
+  ks->expired = old->expired;
+  ks->access = old->access;
+  ks->rng = old->rng;
+  ks->lazy = old->lazy;
+  // its values go with it, no need for more jobs
+  old->lazy = NULL;
+  if (old == &sync) {
+    keyspace_cleanup(old);
+  } else {
+    lazyfree_push(ks->lazy, free_keyspace, old);
+  }
+}
+
+static bool collect_entry(HNode *node, void *arg) {
+  Vector *entries = arg;
+  Entry *entry = container_of(node, Entry, node);
+  vector_push_back(entries, (const uint8_t *)&entry);
+  return true;
+}
+
+void keyspace_cleanup(Keyspace *ks) {
+  heap_cleanup(&ks->expires);
+  // nodes are collected first, freeing them would break the walk
+  Vector entries;
+  vector_initialize(&entries, 0, sizeof(Entry *));
+  hmap_foreach(&ks->map, collect_entry, &entries);
+  for (size_t i = 0; i < vector_length(&entries); i++) {
+    entry_destroy(ks, *(Entry **)vector_get_at(&entries, i));
+  }
+  vector_cleanup(&entries);
+  hmap_destroy(&ks->map);
+}
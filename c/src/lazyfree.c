@@ -0,0 +1,81 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lazyfree.h"
+#include "mpsc.h"
+#include "utils.h"
+
+typedef struct LazyJob {
+  MpscNode node;
+  void (*fn)(void *);
+  void *arg;
+} LazyJob;
+
+void lazyfree_init(LazyFree *lazy) {
+  mpsc_init(&lazy->queue);
+  sem_init(&lazy->ready, 0, 0);
+  lazy->started = false;
+  atomic_init(&lazy->stopping, false);
+  atomic_init(&lazy->pending, 0);
+  atomic_init(&lazy->done, 0);
+}
+
+// a pop may come up empty while a push is half way through, the post
+// that push makes once it is through wakes the thread again
+static void *lazyfree_run(void *arg) {
+  LazyFree *lazy = arg;
+  while (true) {
+    while (sem_wait(&lazy->ready) != 0) {
+    }
+    MpscNode *node = NULL;
+    while ((node = mpsc_pop(&lazy->queue)) != NULL) {
+      LazyJob *job = container_of(node, LazyJob, node);
+      job->fn(job->arg);
+      free(job);
+      atomic_fetch_sub(&lazy->pending, 1);
+      atomic_fetch_add(&lazy->done, 1);
+    }
+    if (atomic_load(&lazy->stopping) && atomic_load(&lazy->pending) == 0) {
+      return NULL;
+    }
+  }
+}
+
+bool lazyfree_start(LazyFree *lazy) {
+  if (pthread_create(&lazy->thread, NULL, lazyfree_run, lazy)) {
+    ERROR(false, "error starting the lazy free thread")
+    return false;
+  }
+  lazy->started = true;
+  return true;
+}
+
+// runs fn(arg) on the lazy free thread, or right here when it is not
+// running (or the job can not be allocated)
+void lazyfree_push(LazyFree *lazy, void (*fn)(void *), void *arg) {
+  LazyJob *job = lazy->started ? malloc(sizeof(LazyJob)) : NULL;
+  if (!job) {
+    fn(arg);
+    return;
+  }
+  job->fn = fn;
+  job->arg = arg;
+  atomic_fetch_add(&lazy->pending, 1);
+  mpsc_push(&lazy->queue, &job->node);
+  sem_post(&lazy->ready);
+}
+
+// waits for the jobs pushed so far, nothing may be pushed meanwhile
+void lazyfree_stop(LazyFree *lazy) {
+  if (lazy->started) {
+    atomic_store(&lazy->stopping, true);
+    sem_post(&lazy->ready);
+    pthread_join(lazy->thread, NULL);
+    lazy->started = false;
+  }
+  sem_destroy(&lazy->ready);
+}
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// the writer wakes up this often unless a ring half full wakes it sooner
+#define LOG_FLUSH_MS 10
+
+// bytes from one thread to the writer: single producer (the thread that
+// claimed it) single consumer, head and tail only grow
+typedef struct LogRing {
+  struct LogRing *next; // every ring made so far, reused once released
+  atomic_bool used; // claimed by a live thread
+  atomic_size_t head;
+  atomic_size_t tail;
+  atomic_uint_fast64_t dropped;
+  char data[LOG_RING_SIZE];
+} LogRing;
+
+typedef struct Logger {
+  _Atomic(LogRing *) rings;
+  atomic_bool started;
+  atomic_bool stopping;
+  int fd;
+  sem_t ready;
+  pthread_t thread;
+  pthread_mutex_t drain_lock; // the writer, or exit() racing it
+  uint64_t dropped_seen;
+  pthread_key_t key; // releases the ring of an exiting thread
+} Logger;
+
+static Logger logger = {.drain_lock = PTHREAD_MUTEX_INITIALIZER};
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static _Thread_local LogRing *thread_ring = NULL;
+
+static void ring_release(void *ring) {
+  atomic_store(&((LogRing *)ring)->used, false);
+}
+
+static void key_init(void) {
+  (void)pthread_key_create(&logger.key, ring_release);
+}
+
+// a ring some exited thread left, or a new one. what the old owner did
+// not get written yet goes out first
+static LogRing *ring_claim(void) {
+  pthread_once(&key_once, key_init);
+  LogRing *ring = atomic_load(&logger.rings);
+  for (; ring; ring = ring->next) {
+    bool unused = false;
+    if (atomic_compare_exchange_strong(&ring->used, &unused, true)) {
+      break;
+    }
+  }
+  if (!ring) {
+    ring = malloc(sizeof(LogRing));
+    if (!ring) {
+      return NULL;
+    }
+    atomic_init(&ring->used, true);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+    ring->next = atomic_load(&logger.rings);
+    while (!atomic_compare_exchange_weak(&logger.rings, &ring->next, ring)) {
+    }
+  }
+  (void)pthread_setspecific(logger.key, ring);
+  return ring;
+}
+
+static void ring_push(LogRing *ring, const char *line, size_t len) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  size_t used = head - tail;
+  if (LOG_RING_SIZE - used < len) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  size_t at = head % LOG_RING_SIZE;
+  size_t first = len < LOG_RING_SIZE - at ? len : LOG_RING_SIZE - at;
+  memcpy(ring->data + at, line, first);
+  memcpy(ring->data, line + first, len - first);
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+  // the writer is woken when a ring fills up, not once per line
+  if (used < LOG_RING_SIZE / 2 && used + len >= LOG_RING_SIZE / 2) {
+    sem_post(&logger.ready);
+  }
+}
+
+// "LOG(level) >> message\n", cut at LOG_LINE_MAX. written right away to
+// stdout before log_start (and after log_stop), else through the writer
+void log_write(int level, const char *fmt, ...) {
+  char line[LOG_LINE_MAX];
+  int prefix = snprintf(line, sizeof(line), "LOG(%d) >> ", level);
+  size_t room = sizeof(line) - (size_t)prefix - 1; // '\n' goes last
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(line + prefix, room, fmt, args);
+  va_end(args);
+  size_t body = len < 0 ? 0 : (size_t)len < room ? (size_t)len : room - 1;
+  size_t total = (size_t)prefix + body;
+  line[total++] = '\n';
+
+  if (!atomic_load_explicit(&logger.started, memory_order_acquire)) {
+    (void)fwrite(line, 1, total, stdout);
+    return;
+  }
+  if (!thread_ring) {
+    thread_ring = ring_claim();
+    if (!thread_ring) {
+      return;
+    }
+  }
+  ring_push(thread_ring, line, total);
+}
+
+static void ring_drain(LogRing *ring) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  while (tail != head) {
+    size_t at = tail % LOG_RING_SIZE;
+    size_t len = head - tail;
+    len = len < LOG_RING_SIZE - at ? len : LOG_RING_SIZE - at;
+    ssize_t res = write(logger.fd, ring->data + at, len);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      tail = head; // the output is gone, so are the lines
+      break;
+    }
+    tail += (size_t)res;
+  }
+  atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+// at most two writes per ring, each holding every line it had
+static void log_drain(void) {
+  pthread_mutex_lock(&logger.drain_lock);
+  for (LogRing *ring = atomic_load(&logger.rings); ring; ring = ring->next) {
+    ring_drain(ring);
+  }
+  uint64_t dropped = log_dropped();
+  if (dropped > logger.dropped_seen) {
+    (void)dprintf(logger.fd, "LOG(0) >> Log: dropped %" PRIu64 " lines\n",
+                  dropped - logger.dropped_seen);
+    logger.dropped_seen = dropped;
+  }
+  pthread_mutex_unlock(&logger.drain_lock);
+}
+
+static void *log_run(void *arg) {
+  (void)arg;
+  while (!atomic_load(&logger.stopping)) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += LOG_FLUSH_MS * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+    (void)sem_timedwait(&logger.ready, &until);
+    log_drain();
+  }
+  return NULL;
+}
+
+// a process exiting without log_stop (ERROR) still writes what is left
+static void log_at_exit(void) {
+  if (atomic_load(&logger.started)) {
+    log_drain();
+  }
+}
+
+// from now on lines go to fd through a background thread, false (and
+// they keep going to stdout) when it can not be started
+bool log_start(int fd) {
+  static bool at_exit = false;
+  if (atomic_load(&logger.started)) {
+    return true;
+  }
+  (void)fflush(stdout); // written before anything the thread writes
+  logger.fd = fd;
+  atomic_store(&logger.stopping, false);
+  sem_init(&logger.ready, 0, 0);
+  if (pthread_create(&logger.thread, NULL, log_run, NULL)) {
+    sem_destroy(&logger.ready);
+    return false;
+  }
+  if (!at_exit) {
+    at_exit = atexit(log_at_exit) == 0;
+  }
+  atomic_store_explicit(&logger.started, true, memory_order_release);
+  return true;
+}
+
+// writes what the rings hold and goes back to writing right away, once
+// no other thread logs anymore
+void log_stop(void) {
+  if (!atomic_load(&logger.started)) {
+    return;
+  }
+  atomic_store(&logger.stopping, true);
+  sem_post(&logger.ready);
+  pthread_join(logger.thread, NULL);
+  atomic_store(&logger.started, false);
+  log_drain(); // what was pushed after the thread's last drain
+  sem_destroy(&logger.ready);
+}
+
+uint64_t log_dropped(void) {
+  uint64_t dropped = 0;
+  for (LogRing *ring = atomic_load(&logger.rings); ring; ring = ring->next) {
+    dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+  }
+  return dropped;
+}
@@ -1,11 +1,227 @@
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <unistd.h>
 
+#include "aof.h"
+#include "connection.h"
+#include "evict.h"
+#include "hash.h"
+#include "log.h"
 #include "server.h"
+#include "shard.h"
+#include "slowlog.h"
+#include "snapshot.h"
+#include "utils.h"
 
 const int PORT = 6379;
+const char *SNAPSHOT_PATH = "dump.snap";
+const char *VERSION = "0.1.0";
 int LOG_LEVEL = -1;
 
-int main(void) {
+static Shards *running_shards = NULL;
+
+static void usage(const char *name) {
+  printf("usage: %s [options]\n"
+         "  -p, --port PORT      tcp port to listen on, 0 for none\n"
+         "                       (default %d)\n"
+         "  -U, --unixsocket PATH\n"
+         "                       unix socket to listen on as well\n"
+         "  -P, --unixsocketperm MODE\n"
+         "                       its permissions in octal, e.g. 700\n"
+         "  -t, --threads N      reactor threads, each owning a shard of the\n"
+         "                       keyspace (default 1)\n"
+         "  -u, --io-uring       use the io_uring engine, falls back to\n"
+         "                       the reactor when the kernel lacks it\n"
+         "  -i, --idle-timeout SECS\n"
+         "                       close connections idle for longer than\n"
+         "                       this (default 0, never)\n"
+         "  -s, --snapshot FILE  SAVE / BGSAVE target, loaded at startup\n"
+         "                       (default %s)\n"
+         "  -a, --appendonly FILE\n"
+         "                       log every write to FILE, it is loaded at\n"
+         "                       startup instead of the snapshot\n"
+         "  -f, --appendfsync always|everysec|no\n"
+         "                       when the log is fsynced (default everysec)\n"
+         "  -m, --max-request BYTES\n"
+         "                       close connections sending a larger request\n"
+         "                       (default %d)\n"
+         "  -M, --maxmemory BYTES\n"
+         "                       evict keys (or refuse writes) past this\n"
+         "                       much data, split evenly between the\n"
+         "                       shards (default 0, no limit)\n"
+         "  -e, --maxmemory-policy noeviction|allkeys-lru|allkeys-lfu|\n"
+         "                       volatile-lru|volatile-lfu\n"
+         "                       which keys go (default noeviction)\n"
+         "  -E, --maxmemory-samples N\n"
+         "                       keys sampled per eviction (default %d)\n"
+         "  -l, --slowlog-log-slower-than US\n"
+         "                       keep commands taking this long or longer\n"
+         "                       in the slowlog, negative for none\n"
+         "                       (default %d)\n"
+         "  -L, --slowlog-max-len N\n"
+         "                       slowlog entries kept (default %d)\n"
+         "  -v, --version        print the version and exit\n"
+         "  -h, --help           print this help and exit\n",
+         name, PORT, SNAPSHOT_PATH, CONN_MAX_REQUEST, EVICT_SAMPLES,
+         SLOWLOG_SLOWER_THAN, SLOWLOG_MAX_LEN);
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  if (running_shards) {
+    shards_stop(running_shards);
+  }
+}
+
+static void parse_args(int argc, char **argv, ServerConfig *config) {
+  static const struct option options[] = {
+      {"port", required_argument, NULL, 'p'},
+      {"unixsocket", required_argument, NULL, 'U'},
+      {"unixsocketperm", required_argument, NULL, 'P'},
+      {"threads", required_argument, NULL, 't'},
+      {"io-uring", no_argument, NULL, 'u'},
+      {"idle-timeout", required_argument, NULL, 'i'},
+      {"snapshot", required_argument, NULL, 's'},
+      {"appendonly", required_argument, NULL, 'a'},
+      {"appendfsync", required_argument, NULL, 'f'},
+      {"max-request", required_argument, NULL, 'm'},
+      {"maxmemory", required_argument, NULL, 'M'},
+      {"maxmemory-policy", required_argument, NULL, 'e'},
+      {"maxmemory-samples", required_argument, NULL, 'E'},
+      {"slowlog-log-slower-than", required_argument, NULL, 'l'},
+      {"slowlog-max-len", required_argument, NULL, 'L'},
+      {"version", no_argument, NULL, 'v'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  int opt = 0;
+  while ((opt = getopt_long(argc, argv, "p:U:P:t:ui:s:a:f:m:M:e:E:l:L:vh",
+                            options, NULL)) != -1) {
+    switch (opt) {
+    case 'p':
+      config->port = (uint16_t)atoi(optarg);
+      break;
+    case 'U':
+      config->unix_socket = optarg;
+      break;
+    case 'P':
+      config->unix_socket_perm = (unsigned)strtoul(optarg, NULL, 8);
+      break;
+    case 't':
+      config->threads = strtoul(optarg, NULL, 10);
+      if (config->threads == 0) {
+        fprintf(stderr, "--threads must be at least 1\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'u':
+      config->io_uring = true;
+      break;
+    case 'i':
+      config->idle_timeout_ms = strtoull(optarg, NULL, 10) * 1000;
+      break;
+    case 's':
+      config->snapshot_path = optarg;
+      break;
+    case 'a':
+      config->aof_path = optarg;
+      break;
+    case 'f':
+      if (!aof_parse_fsync(optarg, &config->aof_fsync)) {
+        fprintf(stderr, "--appendfsync must be always, everysec or no\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'm':
+      config->max_request = strtoull(optarg, NULL, 10);
+      if (config->max_request == 0) {
+        fprintf(stderr, "--max-request must be at least 1\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'M':
+      config->maxmemory = strtoull(optarg, NULL, 10);
+      break;
+    case 'e':
+      if (!evict_parse_policy(optarg, &config->maxmemory_policy)) {
+        fprintf(stderr, "--maxmemory-policy must be noeviction, "
+                        "allkeys-lru, allkeys-lfu, volatile-lru or "
+                        "volatile-lfu\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'E':
+      config->maxmemory_samples = strtoul(optarg, NULL, 10);
+      if (config->maxmemory_samples == 0) {
+        fprintf(stderr, "--maxmemory-samples must be at least 1\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'l':
+      config->slowlog_slower_than = strtoll(optarg, NULL, 10);
+      break;
+    case 'L':
+      config->slowlog_max_len = strtoul(optarg, NULL, 10);
+      break;
+    case 'v':
+      printf("redis_mini %s\n", VERSION);
+      exit(EXIT_SUCCESS);
+    case 'h':
+      usage(argv[0]);
+      exit(EXIT_SUCCESS);
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!config->port && !config->unix_socket) {
+    fprintf(stderr, "--port 0 needs a --unixsocket to listen on\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void load_snapshot(Shards *shards, const char *path) {
+  uint64_t start = monotonic_ms();
+  SnapStats stats;
+  if (!snapshot_load(shards, path, &stats)) {
+    fprintf(stderr, "snapshot %s is unreadable or corrupt\n", path);
+    exit(EXIT_FAILURE);
+  }
+  if (stats.keys) {
+    LOG(0, "Snapshot: loaded %" PRIu64 " keys (%" PRIu64 " expired) from %s "
+        "in %" PRIu64 " ms", stats.keys, stats.skipped, path,
+        monotonic_ms() - start)
+  }
+}
+
+// the log holds every write since it was created, so once it exists it
+// is loaded in place of the snapshot
+static void load_data(Shards *shards, const ServerConfig *config) {
+  const char *path = config->aof_path;
+  if (!path || access(path, F_OK) != 0) {
+    load_snapshot(shards, config->snapshot_path);
+  } else {
+    uint64_t start = monotonic_ms();
+    AofStats stats;
+    if (!aof_load(shards, path, &stats)) {
+      fprintf(stderr, "append only file %s is unreadable or corrupt\n",
+              path);
+      exit(EXIT_FAILURE);
+    }
+    LOG(0, "AOF: replayed %" PRIu64 " commands from %s in %" PRIu64 " ms",
+        stats.commands, path, monotonic_ms() - start)
+  }
+  if (!aof_open(shards)) {
+    fprintf(stderr, "could not open append only file %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char **argv) {
   char *dbg_lvl = getenv("DEBUG");
   if (dbg_lvl) {
     LOG_LEVEL = atoi(dbg_lvl);
@@ -13,9 +229,30 @@ int main(void) {
     LOG_LEVEL = 0;
   }
 
-  Server *serv = server_new(0, PORT);
-  server_run(serv);
-  server_cleanup(serv);
+  ServerConfig config = {.address = 0, .port = PORT, .threads = 1,
+                         .io_uring = false, .snapshot_path = SNAPSHOT_PATH,
+                         .aof_fsync = AOF_FSYNC_EVERYSEC,
+                         .slowlog_slower_than = SLOWLOG_SLOWER_THAN,
+                         .slowlog_max_len = SLOWLOG_MAX_LEN};
+  parse_args(argc, argv, &config);
+  if (LOG_LEVEL > LOG_LEVEL_MAX) {
+    fprintf(stderr, "DEBUG=%d: levels above %d are compiled out, build "
+                    "with -DLOG_LEVEL_MAX=%d for them\n",
+            LOG_LEVEL, LOG_LEVEL_MAX, LOG_LEVEL);
+  }
+  // the loops never wait on stdout, a thread writes it
+  (void)log_start(STDOUT_FILENO);
+
+  (void)signal(SIGPIPE, SIG_IGN);
+  hash_seed_init();
+  running_shards = shards_new(&config);
+  load_data(running_shards, &config);
+  (void)signal(SIGINT, on_signal);
+  (void)signal(SIGTERM, on_signal);
+
+  shards_run(running_shards);
+  shards_cleanup(running_shards);
+  log_stop();
 
   return EXIT_SUCCESS;
 }
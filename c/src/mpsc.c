@@ -0,0 +1,51 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "mpsc.h"
+
+void mpsc_init(MpscQueue *queue) {
+  atomic_store(&queue->stub.next, NULL);
+  atomic_store(&queue->head, &queue->stub);
+  queue->tail = &queue->stub;
+}
+
+void mpsc_push(MpscQueue *queue, MpscNode *node) {
+  atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+  MpscNode *prev = atomic_exchange(&queue->head, node);
+  // between the exchange and this store the queue looks cut short,
+  // pop treats that as empty and the consumer gets woken again anyway
+  atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+// returns NULL when empty (or when a push is half way through)
+MpscNode *mpsc_pop(MpscQueue *queue) {
+  MpscNode *tail = queue->tail;
+  MpscNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+  if (tail == &queue->stub) {
+    if (!next) {
+      return NULL;
+    }
+    queue->tail = next;
+    tail = next;
+    next = atomic_load_explicit(&next->next, memory_order_acquire);
+  }
+
+  if (next) {
+    queue->tail = next;
+    return tail;
+  }
+
+  if (tail != atomic_load(&queue->head)) {
+    return NULL;
+  }
+
+  // tail is the last node, put the stub behind it so it can be handed out
+  mpsc_push(queue, &queue->stub);
+  next = atomic_load_explicit(&tail->next, memory_order_acquire);
+  if (next) {
+    queue->tail = next;
+    return tail;
+  }
+  return NULL;
+}
@@ -0,0 +1,99 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "blob.h"
+#include "output.h"
+#include "vector.h"
+
+static size_t ref_count(const Output *out) {
+  return out->refs ? vector_length(out->refs) : 0;
+}
+
+static OutRef *ref_at(const Output *out, size_t i) {
+  return (OutRef *)vector_get_at(out->refs, i);
+}
+
+// appends a reference to the first len bytes of blob, out->refs must be
+// set. the blob stays alive until the reply was sent
+void output_ref(Output *out, Blob *blob, size_t len) {
+  OutRef ref = {.at = vector_length(out->bytes), .len = len,
+                .blob = blob_ref(blob)};
+  vector_push_back(out->refs, (const uint8_t *)&ref);
+}
+
+// bytes in the stream, referenced ones included
+size_t output_length(const Output *out) {
+  size_t len = vector_length(out->bytes);
+  for (size_t i = 0; i < ref_count(out); i++) {
+    len += ref_at(out, i)->len;
+  }
+  return len;
+}
+
+// one piece of the stream into iov, minus what skip says was sent already
+static size_t segment(struct iovec *iov, const uint8_t *data, size_t len,
+                      size_t *skip) {
+  if (*skip >= len) {
+    *skip -= len;
+    return 0;
+  }
+  *iov = (struct iovec){(void *)(data + *skip), len - *skip};
+  *skip = 0;
+  return 1;
+}
+
+// fills up to max iovecs with the stream from offset `from` on (what
+// was sent so far), returns how many. 0 once everything was sent
+size_t output_iovecs(const Output *out, size_t from, struct iovec *iov,
+                     size_t max) {
+  size_t count = 0;
+  size_t pos = 0;
+  size_t refs = ref_count(out);
+  for (size_t i = 0; i <= refs && count < max; i++) {
+    size_t end = i < refs ? ref_at(out, i)->at : vector_length(out->bytes);
+    count += segment(&iov[count], out->bytes->data + pos, end - pos, &from);
+    pos = end;
+    if (i < refs && count < max) {
+      OutRef *ref = ref_at(out, i);
+      count += segment(&iov[count], ref->blob->data, ref->len, &from);
+    }
+  }
+  return count;
+}
+
+// appends the stream of src to dst and empties src, references move over
+// as they are unless dst takes none, then their bytes are copied
+void output_move(Output *dst, Output *src) {
+  size_t pos = 0;
+  for (size_t i = 0; i < ref_count(src); i++) {
+    OutRef ref = *ref_at(src, i);
+    vector_append(dst->bytes, src->bytes->data + pos, ref.at - pos);
+    pos = ref.at;
+    if (dst->refs) {
+      ref.at = vector_length(dst->bytes);
+      vector_push_back(dst->refs, (const uint8_t *)&ref);
+    } else {
+      vector_append(dst->bytes, ref.blob->data, ref.len);
+      blob_unref(ref.blob);
+    }
+  }
+  vector_append(dst->bytes, src->bytes->data + pos,
+                vector_length(src->bytes) - pos);
+  vector_clear(src->bytes);
+  if (src->refs) {
+    vector_clear(src->refs);
+  }
+}
+
+// drops everything, sent or not
+void output_clear(Output *out) {
+  for (size_t i = 0; i < ref_count(out); i++) {
+    blob_unref(ref_at(out, i)->blob);
+  }
+  vector_clear(out->bytes);
+  if (out->refs) {
+    vector_clear(out->refs);
+  }
+}
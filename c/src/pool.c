@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "utils.h"
+#include "vector.h"
+
+// objects per slab
+const size_t POOL_SLAB_OBJECTS = 64;
+// idle bytes kept per buffer class, the rest goes back to the allocator
+const size_t POOL_MAX_CACHED_BYTES = 1024 * 1024;
+
+void pool_init(Pool *pool, size_t object_size) {
+  // objects stay 16 byte aligned like malloc'ed ones
+  pool->object_size = (object_size + 15) & ~(size_t)15;
+  vector_initialize(&pool->slabs, 0, sizeof(uint8_t *));
+  vector_initialize(&pool->free_objects, 0, sizeof(void *));
+  for (size_t i = 0; i < POOL_CLASSES; i++) {
+    vector_initialize(&pool->free_buffers[i], 0, sizeof(uint8_t *));
+  }
+  memset(&pool->stats, 0, sizeof(pool->stats));
+}
+
+static void pool_grow(Pool *pool) {
+  uint8_t *slab = calloc(POOL_SLAB_OBJECTS, pool->object_size);
+  if (!slab) {
+    return;
+  }
+  vector_push_back(&pool->slabs, (const uint8_t *)&slab);
+  // lowest address on top, handed out first
+  for (size_t i = POOL_SLAB_OBJECTS; i-- > 0;) {
+    void *object = slab + i * pool->object_size;
+    vector_push_back(&pool->free_objects, (const uint8_t *)&object);
+  }
+  pool->stats.slabs++;
+  pool->stats.objects += POOL_SLAB_OBJECTS;
+}
+
+// the object keeps whatever its previous user left in it, fresh slabs are
+// zeroed
+void *pool_get(Pool *pool) {
+  if (vector_is_empty(&pool->free_objects)) {
+    pool_grow(pool);
+  }
+  void *object = pool_pop_free(pool);
+  if (object) {
+    pool->stats.objects_used++;
+  }
+  return object;
+}
+
+void pool_put(Pool *pool, void *object) {
+  vector_push_back(&pool->free_objects, (const uint8_t *)&object);
+  pool->stats.objects_used--;
+}
+
+// takes a free object out without handing it to anyone, lets the owner
+// release what objects point to before pool_cleanup
+void *pool_pop_free(Pool *pool) {
+  if (vector_is_empty(&pool->free_objects)) {
+    return NULL;
+  }
+  void *object = *(void **)vector_get_back(&pool->free_objects);
+  vector_pop_back(&pool->free_objects);
+  return object;
+}
+
+size_t pool_class_size(size_t cls) { return (size_t)POOL_MIN_BUF << cls; }
+
+// class whose buffers hold size bytes, POOL_CLASSES when none does
+static size_t pool_class_of(size_t size) {
+  size_t cls = 0;
+  while (cls < POOL_CLASSES && pool_class_size(cls) < size) {
+    cls++;
+  }
+  return cls;
+}
+
+// returns a buffer of at least size bytes, its real size in capacity
+uint8_t *pool_buf_get(Pool *pool, size_t size, size_t *capacity) {
+  size_t cls = pool_class_of(size);
+  uint8_t *buf = NULL;
+  if (cls < POOL_CLASSES) {
+    *capacity = pool_class_size(cls);
+    Vector *cached = &pool->free_buffers[cls];
+    if (!vector_is_empty(cached)) {
+      buf = *(uint8_t **)vector_get_back(cached);
+      vector_pop_back(cached);
+      pool->stats.buffers_cached[cls]--;
+      pool->stats.buffer_hits++;
+    }
+  } else {
+    *capacity = size;
+  }
+
+  if (!buf) {
+    buf = malloc(*capacity);
+    if (!buf) {
+      return NULL;
+    }
+    pool->stats.buffer_misses++;
+  }
+  pool->stats.buffers_lent++;
+  return buf;
+}
+
+// capacity is the size the buffer has now, only exact class sizes are kept
+void pool_buf_put(Pool *pool, uint8_t *buf, size_t capacity) {
+  pool->stats.buffers_lent--;
+  size_t cls = pool_class_of(capacity);
+  if (cls == POOL_CLASSES || pool_class_size(cls) != capacity ||
+      (pool->stats.buffers_cached[cls] + 1) * capacity >
+          POOL_MAX_CACHED_BYTES) {
+    free(buf);
+    return;
+  }
+  vector_push_back(&pool->free_buffers[cls], (const uint8_t *)&buf);
+  pool->stats.buffers_cached[cls]++;
+}
+
+// every object must be back, whatever they point to already released
+void pool_cleanup(Pool *pool) {
+  for (size_t i = 0; i < vector_length(&pool->slabs); i++) {
+    free(*(uint8_t **)vector_get_at(&pool->slabs, i));
+  }
+  for (size_t cls = 0; cls < POOL_CLASSES; cls++) {
+    Vector *cached = &pool->free_buffers[cls];
+    for (size_t i = 0; i < vector_length(cached); i++) {
+      free(*(uint8_t **)vector_get_at(cached, i));
+    }
+    vector_cleanup(cached);
+  }
+  vector_cleanup(&pool->slabs);
+  vector_cleanup(&pool->free_objects);
+}
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "utils.h"
+
+#ifdef REACTOR_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+const size_t REACTOR__MAX_EVENTS = 1024;
+
+#ifdef REACTOR_EPOLL
+
+const char *reactor_backend(void) { return "epoll"; }
+
+void reactor_init(Reactor *reactor) {
+  reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (reactor->epfd < 0) {
+    ERROR(true, "epoll creation failed")
+  }
+  reactor->events = (ReactorEventVec){0};
+}
+
+static uint32_t to_epoll(uint32_t interest) {
+  // edge triggered: callers must drain fds until EAGAIN
+  uint32_t events = EPOLLET;
+  if (interest & REACTOR_READ) {
+    events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (interest & REACTOR_WRITE) {
+    events |= EPOLLOUT;
+  }
+  return events;
+}
+
+int reactor_add(Reactor *reactor, int fd, uint32_t interest) {
+  struct epoll_event ev = {.events = to_epoll(interest), .data.fd = fd};
+  return epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int reactor_mod(Reactor *reactor, int fd, uint32_t interest) {
+  // re-arming also re-checks readiness, so data that arrived while we
+  // were not interested in it still produces an event
+  struct epoll_event ev = {.events = to_epoll(interest), .data.fd = fd};
+  return epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int reactor_del(Reactor *reactor, int fd) {
+  return epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int reactor_wait(Reactor *reactor, int timeout) {
+  struct epoll_event raw[REACTOR__MAX_EVENTS];
+
+  int res = 0;
+  do {
+    res = epoll_wait(reactor->epfd, raw, (int)REACTOR__MAX_EVENTS, timeout);
+  } while (res < 0 && errno == EINTR);
+  if (res < 0) {
+    return res;
+  }
+
+  // every event is written below
+  if (!reactor_event_vec_grow(&reactor->events, (size_t)res)) {
+    errno = ENOMEM;
+    return -1;
+  }
+  for (int i = 0; i < res; i++) {
+    ReactorEvent *ev = reactor_event_at(reactor, i);
+    ev->fd = raw[i].data.fd;
+    ev->events = 0;
+    if (raw[i].events & (EPOLLIN | EPOLLRDHUP)) {
+      ev->events |= REACTOR_READ;
+    }
+    if (raw[i].events & EPOLLOUT) {
+      ev->events |= REACTOR_WRITE;
+    }
+    if (raw[i].events & (EPOLLERR | EPOLLHUP)) {
+      ev->events |= REACTOR_ERROR;
+    }
+  }
+  return res;
+}
+
+void reactor_cleanup(Reactor *reactor) {
+  close(reactor->epfd);
+  reactor_event_vec_cleanup(&reactor->events);
+}
+
+#else // REACTOR_POLL
+
+const char *reactor_backend(void) { return "poll"; }
+
+void reactor_init(Reactor *reactor) {
+  *reactor = (Reactor){0};
+}
+
+static short to_poll(uint32_t interest) {
+  short events = POLLERR;
+  if (interest & REACTOR_READ) {
+    events |= POLLIN;
+  }
+  if (interest & REACTOR_WRITE) {
+    events |= POLLOUT;
+  }
+  return events;
+}
+
+// slots store index + 1 so that zero filled slots mean "not registered"
+static size_t *slot_of(Reactor *reactor, int fd) {
+  if (fd < 0 || (size_t)fd >= reactor->slots.length) {
+    return NULL;
+  }
+  size_t *slot = reactor_slot_vec_at(&reactor->slots, fd);
+  return *slot ? slot : NULL;
+}
+
+int reactor_add(Reactor *reactor, int fd, uint32_t interest) {
+  if (fd < 0 || slot_of(reactor, fd)) {
+    errno = EEXIST;
+    return -1;
+  }
+  if ((reactor->slots.length <= (size_t)fd &&
+       !reactor_slot_vec_resize(&reactor->slots, fd + 1)) ||
+      !poll_arg_vec_push_back(&reactor->poll_args,
+                              (poll_arg){fd, to_poll(interest), 0})) {
+    errno = ENOMEM;
+    return -1;
+  }
+  *reactor_slot_vec_at(&reactor->slots, fd) = reactor->poll_args.length;
+  return 0;
+}
+
+int reactor_mod(Reactor *reactor, int fd, uint32_t interest) {
+  size_t *slot = slot_of(reactor, fd);
+  if (!slot) {
+    errno = ENOENT;
+    return -1;
+  }
+  poll_arg *arg = poll_arg_vec_at(&reactor->poll_args, *slot - 1);
+  arg->events = to_poll(interest);
+  return 0;
+}
+
+int reactor_del(Reactor *reactor, int fd) {
+  size_t *slot = slot_of(reactor, fd);
+  if (!slot) {
+    errno = ENOENT;
+    return -1;
+  }
+  // swap with the last registered fd to keep poll_args packed
+  size_t index = *slot - 1;
+  poll_arg moved = poll_arg_vec_pop_back(&reactor->poll_args);
+  if (index != reactor->poll_args.length) {
+    *poll_arg_vec_at(&reactor->poll_args, index) = moved;
+    *reactor_slot_vec_at(&reactor->slots, moved.fd) = index + 1;
+  }
+  *slot = 0;
+  return 0;
+}
+
+int reactor_wait(Reactor *reactor, int timeout) {
+  size_t n_poll_args = reactor->poll_args.length;
+  poll_arg *args = reactor->poll_args.data;
+
+  int res = 0;
+  do {
+    res = poll(args, n_poll_args, timeout);
+  } while (res < 0 && errno == EINTR);
+  if (res < 0) {
+    return res;
+  }
+
+  reactor_event_vec_clear(&reactor->events);
+  if (!reactor_event_vec_reserve(&reactor->events, (size_t)res)) {
+    errno = ENOMEM;
+    return -1;
+  }
+  for (size_t i = 0; i < n_poll_args && reactor->events.length < (size_t)res;
+       i++) {
+    if (!args[i].revents) {
+      continue;
+    }
+    ReactorEvent ev = {.fd = args[i].fd, .events = 0};
+    if (args[i].revents & POLLIN) {
+      ev.events |= REACTOR_READ;
+    }
+    if (args[i].revents & POLLOUT) {
+      ev.events |= REACTOR_WRITE;
+    }
+    if (args[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+      ev.events |= REACTOR_ERROR;
+    }
+    (void)reactor_event_vec_push_back(&reactor->events, ev); // reserved
+  }
+  return (int)reactor->events.length;
+}
+
+void reactor_cleanup(Reactor *reactor) {
+  poll_arg_vec_cleanup(&reactor->poll_args);
+  reactor_slot_vec_cleanup(&reactor->slots);
+  reactor_event_vec_cleanup(&reactor->events);
+}
+
+#endif
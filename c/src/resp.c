@@ -0,0 +1,366 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "resp.h"
+#include "vector.h"
+
+const size_t RESP__MAX_LINE = 64 * 1024;
+const int64_t RESP__MAX_ELEMENTS = 1024 * 1024;
+const int64_t RESP__MAX_BULK = 512 * 1024 * 1024;
+
+void resp_parser_init(RespParser *parser) {
+  parser->values = (RespValueVec){0};
+  parser->pending = (RespPendingVec){0};
+  resp_parser_reset(parser, 0);
+}
+
+// start parsing a new message at `start`
+void resp_parser_reset(RespParser *parser, size_t start) {
+  parser->start = start;
+  parser->pos = start;
+  parser->need = 0;
+  parser->error = NULL;
+  resp_value_vec_clear(&parser->values);
+  resp_pending_vec_clear(&parser->pending);
+}
+
+// the buffer was compacted and the current message now begins at `start`
+void resp_parser_move(RespParser *parser, size_t start) {
+  parser->pos = parser->pos - parser->start + start;
+  parser->start = start;
+}
+
+void resp_parser_cleanup(RespParser *parser) {
+  resp_value_vec_cleanup(&parser->values);
+  resp_pending_vec_cleanup(&parser->pending);
+}
+
+size_t resp_message_len(const RespParser *parser) {
+  return parser->pos - parser->start;
+}
+
+// a lower bound on the length of the incomplete message, so the caller
+// can make room for all of it at once
+size_t resp_message_need(const RespParser *parser) {
+  size_t parsed = parser->pos - parser->start;
+  return parser->need > parsed ? parser->need : parsed;
+}
+
+const uint8_t *resp_value_data(const RespParser *parser, const uint8_t *buf,
+                               const RespValue *value) {
+  return buf + parser->start + value->offset;
+}
+
+static enum RespStatus fail(RespParser *parser, const char *error) {
+  parser->error = error;
+  return RESP_INVALID;
+}
+
+// finds the end of the line starting at `from`, returns the offset of '\r'
+static enum RespStatus find_crlf(RespParser *parser, const uint8_t *buf,
+                                 size_t len, size_t from, size_t *eol) {
+  const uint8_t *cr = NULL;
+  size_t scan = from;
+  while (scan < len &&
+         (cr = memchr(buf + scan, '\r', len - scan)) != NULL) {
+    size_t at = cr - buf;
+    if (at + 1 >= len) {
+      break;
+    }
+    if (buf[at + 1] == '\n') {
+      *eol = at;
+      return RESP_COMPLETE;
+    }
+    scan = at + 1;
+  }
+  if (len - from > RESP__MAX_LINE) {
+    return fail(parser, "line too long");
+  }
+  return RESP_INCOMPLETE;
+}
+
+static bool parse_int(const uint8_t *data, size_t len, int64_t *out) {
+  size_t i = 0;
+  bool neg = false;
+  if (len > 0 && (data[0] == '-' || data[0] == '+')) {
+    neg = data[0] == '-';
+    i = 1;
+  }
+  if (i == len || len - i > 19) {
+    return false;
+  }
+  uint64_t val = 0;
+  for (; i < len; i++) {
+    if (data[i] < '0' || data[i] > '9') {
+      return false;
+    }
+    val = val * 10 + (data[i] - '0');
+  }
+  if (val > (uint64_t)INT64_MAX + neg) {
+    return false;
+  }
+  *out = neg ? (int64_t)(0 - val) : (int64_t)val;
+  return true;
+}
+
+static bool parse_double(const uint8_t *data, size_t len, double *out) {
+  char tmp[64];
+  if (len == 0 || len >= sizeof(tmp)) {
+    return false;
+  }
+  memcpy(tmp, data, len);
+  tmp[len] = '\0';
+  char *end = NULL;
+  *out = strtod(tmp, &end);
+  return end == tmp + len;
+}
+
+// false when out of memory
+static bool push_value(RespParser *parser, RespValue *value) {
+  value->offset -= parser->start;
+  return resp_value_vec_push_back(&parser->values, *value);
+}
+
+// a value (scalar or whole array) finished, close every array it completes
+static void value_done(RespParser *parser) {
+  while (!resp_pending_vec_is_empty(&parser->pending)) {
+    if (--*resp_pending_vec_back(&parser->pending) > 0) {
+      return;
+    }
+    (void)resp_pending_vec_pop_back(&parser->pending);
+  }
+}
+
+// inline commands (`SET a b\r\n`) are handed out as an array of bulk strings
+static enum RespStatus parse_inline(RespParser *parser, const uint8_t *buf,
+                                    size_t len) {
+  size_t eol = 0;
+  enum RespStatus status = find_crlf(parser, buf, len, parser->pos, &eol);
+  if (status != RESP_COMPLETE) {
+    return status;
+  }
+
+  size_t header = parser->values.length;
+  RespValue array = {.type = RESP_ARRAY, .offset = parser->pos};
+  if (!push_value(parser, &array)) {
+    return fail(parser, "out of memory");
+  }
+
+  size_t i = parser->pos;
+  while (i < eol) {
+    while (i < eol && (buf[i] == ' ' || buf[i] == '\t')) {
+      i++;
+    }
+    size_t from = i;
+    while (i < eol && buf[i] != ' ' && buf[i] != '\t') {
+      i++;
+    }
+    if (i > from) {
+      RespValue arg = {
+          .type = RESP_BULK_STRING, .offset = from, .len = i - from};
+      if (!push_value(parser, &arg)) {
+        return fail(parser, "out of memory");
+      }
+    }
+  }
+  resp_value_at(parser, header)->integer =
+      (int64_t)(parser->values.length - header - 1);
+  parser->pos = eol + 2;
+  return RESP_COMPLETE;
+}
+
+// parses one value at parser->pos, pos only moves once it is complete
+static enum RespStatus parse_value(RespParser *parser, const uint8_t *buf,
+                                   size_t len) {
+  size_t eol = 0;
+  enum RespStatus status = find_crlf(parser, buf, len, parser->pos + 1, &eol);
+  if (status != RESP_COMPLETE) {
+    return status;
+  }
+
+  enum RespType type = buf[parser->pos];
+  const uint8_t *line = buf + parser->pos + 1;
+  size_t line_len = eol - parser->pos - 1;
+  size_t next = eol + 2;
+  RespValue value = {.type = type, .offset = parser->pos + 1, .len = line_len};
+
+  switch (type) {
+  case RESP_SIMPLE_STRING:
+  case RESP_SIMPLE_ERROR:
+    break;
+  case RESP_INTEGER:
+    if (!parse_int(line, line_len, &value.integer)) {
+      return fail(parser, "invalid integer");
+    }
+    break;
+  case RESP_BIG_NUMBER:
+    for (size_t i = 0; i < line_len; i++) {
+      if ((line[i] < '0' || line[i] > '9') &&
+          !(i == 0 && (line[i] == '-' || line[i] == '+'))) {
+        return fail(parser, "invalid big number");
+      }
+    }
+    if (line_len == 0) {
+      return fail(parser, "invalid big number");
+    }
+    break;
+  case RESP_DOUBLE:
+    if (!parse_double(line, line_len, &value.dbl)) {
+      return fail(parser, "invalid double");
+    }
+    break;
+  case RESP_BOOLEAN:
+    if (line_len != 1 || (line[0] != 't' && line[0] != 'f')) {
+      return fail(parser, "invalid boolean");
+    }
+    value.integer = line[0] == 't';
+    break;
+  case RESP_NULL:
+    if (line_len != 0) {
+      return fail(parser, "invalid null");
+    }
+    break;
+  case RESP_BULK_STRING:
+  case RESP_BULK_ERROR: {
+    int64_t n = 0;
+    if (!parse_int(line, line_len, &n) || n < -1 || n > RESP__MAX_BULK) {
+      return fail(parser, "invalid bulk length");
+    }
+    if (n == -1) {
+      value.type = RESP_NULL;
+      value.len = 0;
+      break;
+    }
+    if (len - next < (size_t)n + 2) {
+      parser->need = next + (size_t)n + 2 - parser->start;
+      return RESP_INCOMPLETE;
+    }
+    if (buf[next + n] != '\r' || buf[next + n + 1] != '\n') {
+      return fail(parser, "bulk string not terminated");
+    }
+    value.offset = next;
+    value.len = n;
+    next += n + 2;
+    break;
+  }
+  case RESP_ARRAY: {
+    int64_t n = 0;
+    if (!parse_int(line, line_len, &n) || n < -1 || n > RESP__MAX_ELEMENTS) {
+      return fail(parser, "invalid array length");
+    }
+    value.type = n == -1 ? RESP_NULL : RESP_ARRAY;
+    value.integer = n;
+    value.len = 0;
+    if (!push_value(parser, &value)) {
+      return fail(parser, "out of memory");
+    }
+    parser->pos = next;
+    if (n > 0) {
+      if (!resp_pending_vec_push_back(&parser->pending, n)) {
+        return fail(parser, "out of memory");
+      }
+    } else {
+      value_done(parser);
+    }
+    return RESP_COMPLETE;
+  }
+  default:
+    return fail(parser, "unknown type byte");
+  }
+
+  if (!push_value(parser, &value)) {
+    return fail(parser, "out of memory");
+  }
+  parser->pos = next;
+  value_done(parser);
+  return RESP_COMPLETE;
+}
+
+// parses buf[parser->pos, len), resuming a previously incomplete message
+//  RESP_COMPLETE    a whole message was parsed, see parser->values
+//  RESP_INCOMPLETE  need more bytes
+//  RESP_INVALID     protocol error, see parser->error
+enum RespStatus resp_parse(RespParser *parser, const uint8_t *buf,
+                           size_t len) {
+  assert(parser->pos <= len);
+
+  if (parser->pos == parser->start && parser->pos < len) {
+    // first byte of a message decides between RESP and inline commands
+    switch (buf[parser->pos]) {
+    case RESP_SIMPLE_STRING:
+    case RESP_SIMPLE_ERROR:
+    case RESP_INTEGER:
+    case RESP_BULK_STRING:
+    case RESP_ARRAY:
+    case RESP_BOOLEAN:
+    case RESP_DOUBLE:
+    case RESP_BIG_NUMBER:
+    case RESP_BULK_ERROR:
+    case RESP_NULL:
+      break;
+    default:
+      return parse_inline(parser, buf, len);
+    }
+  }
+
+  while (parser->pos < len) {
+    enum RespStatus status = parse_value(parser, buf, len);
+    if (status != RESP_COMPLETE) {
+      return status;
+    }
+    if (resp_pending_vec_is_empty(&parser->pending)) {
+      return RESP_COMPLETE;
+    }
+  }
+  return RESP_INCOMPLETE;
+}
+
+static void write_header(Output *out, char type, int64_t value) {
+  char head[32];
+  int n = snprintf(head, sizeof(head), "%c%" PRId64 "\r\n", type, value);
+  vector_append(out->bytes, (const uint8_t *)head, n);
+}
+
+void resp_write_simple(Output *out, const char *str) {
+  vector_append(out->bytes, (const uint8_t *)"+", 1);
+  vector_append(out->bytes, (const uint8_t *)str, strlen(str));
+  vector_append(out->bytes, (const uint8_t *)"\r\n", 2);
+}
+
+void resp_write_error(Output *out, const char *msg) {
+  vector_append(out->bytes, (const uint8_t *)"-", 1);
+  vector_append(out->bytes, (const uint8_t *)msg, strlen(msg));
+  vector_append(out->bytes, (const uint8_t *)"\r\n", 2);
+}
+
+void resp_write_integer(Output *out, int64_t value) {
+  write_header(out, RESP_INTEGER, value);
+}
+
+void resp_write_bulk(Output *out, const uint8_t *data, size_t len) {
+  write_header(out, RESP_BULK_STRING, (int64_t)len);
+  vector_append(out->bytes, data, len);
+  vector_append(out->bytes, (const uint8_t *)"\r\n", 2);
+}
+
+// a bulk string whose data is referenced, see output_ref
+void resp_write_ref(Output *out, Blob *blob, size_t len) {
+  write_header(out, RESP_BULK_STRING, (int64_t)len);
+  output_ref(out, blob, len);
+  vector_append(out->bytes, (const uint8_t *)"\r\n", 2);
+}
+
+// RESP2 null bulk string, understood by every client
+void resp_write_null(Output *out) {
+  vector_append(out->bytes, (const uint8_t *)"$-1\r\n", 5);
+}
+
+void resp_write_array(Output *out, size_t count) {
+  write_header(out, RESP_ARRAY, (int64_t)count);
+}
@@ -1,32 +1,57 @@
 #include <asm-generic/socket.h>
+#include <errno.h>
+#include <limits.h>
 #include <netinet/in.h>
-#include <poll.h>
+#include <netinet/tcp.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "aof.h"
+#include "commands.h"
 #include "connection.h"
+#include "dlist.h"
+#include "keyspace.h"
+#include "mpsc.h"
+#include "output.h"
+#include "reactor.h"
 #include "server.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "uring.h"
 #include "utils.h"
 #include "vector.h"
 
-const int POLL_TIMEOUT = 1000; // 1 sec
+// expired keys deleted / idle conns closed per loop iteration at most
+const size_t EXPIRE_BUDGET = 1000;
+const size_t REAP_BUDGET = 1000;
+// io_uring engine: ring size and provided recv buffers (count must be a
+// power of two), shared by every conn of a shard
+const unsigned URING_ENTRIES = 1024;
+const unsigned URING_BUFS = 256;
+const size_t URING_BUF_SIZE = 4096;
 
-Server *server_new(uint32_t address, uint16_t port) {
+Server *server_new(const ServerConfig *config, int unix_fd) {
   LOG(1, "Server Creation: Started")
 
   Server *serv = malloc(sizeof(Server));
-  server_init(serv, address, port);
+  server_init(serv, config, unix_fd);
 
   LOG(1, "Server Creation: Completed")
 
   return serv;
 }
 
-static int setup_sock(uint32_t address, uint16_t port) {
+static int setup_sock(uint32_t address, uint16_t port, bool reuse_port) {
   LOG(1, "Socket setup: Started")
 
   // create socket
@@ -36,6 +61,11 @@ static int setup_sock(uint32_t address, uint16_t port) {
   }
   int opt = 1;
   (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  if (reuse_port) {
+    // every reactor thread binds its own socket, the kernel spreads
+    // incoming connections between them
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+  }
 
   // bind socket to address
   ipv4_addr addr = {.sin_family = AF_INET,
@@ -51,116 +81,618 @@ static int setup_sock(uint32_t address, uint16_t port) {
   return fd;
 }
 
-void server_init(Server *serv, uint32_t address, uint16_t port) {
+// one listener for every shard, unlike the port there is no SO_REUSEPORT
+// to spread conns: each reactor is woken by a new one and whichever
+// accepts first serves it. a socket file left at the path is replaced
+int server_listen_unix(const ServerConfig *config) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(config->unix_socket) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "unix socket path %s is too long\n",
+            config->unix_socket);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, config->unix_socket);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    ERROR(true, "unix socket creation failed")
+  }
+  (void)unlink(config->unix_socket);
+  if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+    ERROR(true, "error binding unix socket")
+  }
+  if (config->unix_socket_perm &&
+      chmod(config->unix_socket, config->unix_socket_perm)) {
+    ERROR(true, "error setting the unix socket permissions")
+  }
+  if (listen(fd, SOMAXCONN)) {
+    ERROR(true, "error listening on unix socket")
+  }
+  fd_to_nonblocking(fd);
+  return fd;
+}
+
+void server_init(Server *serv, const ServerConfig *config, int unix_fd) {
   LOG(1, "Server setup: Started")
 
-  // create and bind socket
-  serv->fd = setup_sock(address, port);
+  serv->config = config;
+  serv->shards = NULL;
+  serv->shard_id = 0;
+  serv->unix_fd = unix_fd;
+
+  // create, bind and listen on the port, port 0 leaves only the unix
+  // socket
+  serv->fd = -1;
+  if (config->port) {
+    serv->fd =
+        setup_sock(config->address, config->port, config->threads > 1);
+    if (listen(serv->fd, SOMAXCONN)) {
+      ERROR(true, "error listening on socket")
+    }
+    fd_to_nonblocking(serv->fd);
+  }
 
-  // listen
-  int fail = listen(serv->fd, SOMAXCONN);
-  if (fail) {
-    ERROR(true, "error listening on socket")
+  // initialize conns
+  serv->conns = (ConnVec){0};
+  pool_init(&serv->pool, sizeof(Conn));
+  dlist_init(&serv->idle);
+  serv->loop_ms = monotonic_ms();
+
+  keyspace_init(&serv->keyspace);
+  serv->maxmemory = 0; // shards_new splits the limit
+  evictor_init(&serv->evict, &serv->keyspace, config->maxmemory_policy,
+               config->maxmemory_samples);
+  aof_shard_init(&serv->aof);
+  serv->reply_copied = 0;
+  serv->reply_referenced = 0;
+  stats_init(&serv->stats, command_count());
+
+  // register the listening sockets once, they stay interested in reads
+  reactor_init(&serv->reactor);
+  if ((serv->fd >= 0 &&
+       reactor_add(&serv->reactor, serv->fd, REACTOR_READ)) ||
+      (serv->unix_fd >= 0 &&
+       reactor_add(&serv->reactor, serv->unix_fd, REACTOR_READ))) {
+    ERROR(true, "error registering socket")
   }
 
-  // make socket non blocking
-  fd_to_nonblocking(serv->fd);
+  // other threads post to the inbox and kick wake_fd
+  mpsc_init(&serv->inbox);
+  serv->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (serv->wake_fd < 0 || reactor_add(&serv->reactor, serv->wake_fd,
+                                       REACTOR_READ)) {
+    ERROR(true, "error creating wakeup fd")
+  }
 
-  // initialize conns
-  vector_initialize(&serv->conns, 0, sizeof(Conn *));
+  serv->uring = NULL;
+  if (config->io_uring) {
+#ifdef IO_URING
+    serv->uring = uring_new(URING_ENTRIES, URING_BUFS, URING_BUF_SIZE);
+#endif
+    if (!serv->uring) {
+      LOG(0, "io_uring unavailable, falling back to %s", reactor_backend())
+    }
+  }
+  atomic_init(&serv->wake_pending, false);
+  atomic_init(&serv->running, true);
 
   LOG(1, "Server setup: Completed")
 }
 
-static int connection_accept(Server *serv) {
+static uint32_t conn_interest(Conn *conn) {
+  return conn->state == STATE_REQ ? REACTOR_READ : REACTOR_WRITE;
+}
+
+// moves conn to the back of the idle list, it was just active
+static void server_touch_conn(Server *serv, Conn *conn) {
+  if (conn->state == STATE_END) {
+    return; // closing, see server_close_conn
+  }
+  conn->last_active = serv->loop_ms;
+  dlist_detach(&conn->idle_node);
+  dlist_push_back(&serv->idle, &conn->idle_node);
+}
+
+static int connection_accept(Server *serv, int listen_fd) {
   LOG(2, "Conn: New")
 
-  ipv4_addr client_addr;
-  uint addr_size = sizeof(client_addr);
-  int fd = accept(serv->fd, (struct sockaddr *)&client_addr, &addr_size);
+  int fd = accept(listen_fd, NULL, NULL);
   if (fd < 0) {
-    ERROR(true, "error accepting connection")
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+        errno != ECONNABORTED) {
+      ERROR(false, "error accepting connection")
+    }
+    return -1;
   }
 
   fd_to_nonblocking(fd);
+  // replies of forwarded commands go out in separate writes, nagle would
+  // hold them back until the client acks the previous one
+  if (listen_fd == serv->fd) {
+    int opt = 1;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  }
 
-  Conn *conn_ptr = connection_create(fd);
-  if (!conn_ptr) {
+  Conn *conn_ptr = NULL;
+  if ((serv->conns.length <= (size_t)fd &&
+       !conn_vec_resize(&serv->conns, (size_t)fd + 1)) ||
+      !(conn_ptr = connection_create(fd, serv, &serv->pool))) {
     (void)close(fd);
-    return -1;
+    return 0;
   }
 
-  if (vector_length(&serv->conns) <= fd) {
-    vector_resize(&serv->conns, fd + 1);
+  if (reactor_add(&serv->reactor, fd, conn_interest(conn_ptr))) {
+    ERROR(false, "error registering connection")
+    connection_close(conn_ptr);
+    return 0;
   }
-  vector_set_at(&serv->conns, (const uint8_t *)&conn_ptr, fd);
+
+  *conn_vec_at(&serv->conns, fd) = conn_ptr;
+  server_touch_conn(serv, conn_ptr);
 
   LOG(1, "Conn(%d): Accepted", fd)
 
   return 0;
 }
 
-static void prepare_poll_args(Vector *poll_args, Server *serv) {
-  vector_clear(poll_args);
-  vector_push_back(poll_args,
-                   (const uint8_t *)(&(poll_arg){serv->fd, POLLIN, 0}));
-  for (size_t i = 0; i < vector_length(&serv->conns); i++) {
-    Conn *conn = *(Conn **)vector_get_at(&serv->conns, i);
-    if (conn == NULL) {
-      continue;
+static void server_close_conn(Server *serv, Conn **conn) {
+  dlist_detach(&(*conn)->idle_node);
+  dlist_detach(&(*conn)->log_node);
+  if (!serv->uring) {
+    (void)reactor_del(&serv->reactor, (*conn)->fd);
+  }
+  if ((*conn)->pending || (*conn)->io_ops) {
+    // another shard still holds a request of this conn, or the kernel
+    // still holds its buffers, the close is finished once they are back
+    if ((*conn)->io_ops) {
+      // fails the outstanding recv / send right away
+      (void)shutdown((*conn)->fd, SHUT_RDWR);
+    }
+    (*conn)->state = STATE_END;
+    return;
+  }
+  connection_close(*conn);
+  *conn = NULL;
+}
+
+// the reply of conn waits for the log, see server_flush_log
+static void server_hold_reply(Server *serv, Conn *conn) {
+  dlist_detach(&conn->log_node);
+  dlist_push_back(&serv->aof.waiting, &conn->log_node);
+}
+
+#ifdef IO_URING
+static void server_uring_arm(Server *serv, Conn **conn);
+#endif
+
+static void server_conn_io(Server *serv, Conn **conn) {
+  server_touch_conn(serv, *conn);
+#ifdef IO_URING
+  if (serv->uring) {
+    connection_advance(*conn);
+    server_uring_arm(serv, conn);
+    return;
+  }
+#endif
+
+  enum ConnectionState prev = (*conn)->state;
+  connection_io(*conn);
+
+  if ((*conn)->state == STATE_END) {
+    // destroy this connection
+    server_close_conn(serv, conn);
+    return;
+  }
+  if ((*conn)->state == STATE_RES &&
+      aof_must_wait(serv, (*conn)->log_end)) {
+    server_hold_reply(serv, *conn);
+  }
+  if ((*conn)->state != prev) {
+    // interest only changes when switching between REQ and RES
+    (void)reactor_mod(&serv->reactor, (*conn)->fd, conn_interest(*conn));
+  }
+}
+
+// safe to call from any thread (and from signal handlers)
+void server_wake(Server *serv) {
+  if (!atomic_exchange(&serv->wake_pending, true)) {
+    uint64_t one = 1;
+    (void)write(serv->wake_fd, &one, sizeof(one));
+  }
+}
+
+void server_stop(Server *serv) {
+  atomic_store(&serv->running, false);
+  server_wake(serv);
+}
+
+// a conn whose forwarded command got its reply, carry on with its input
+void server_resume_conn(Server *serv, Conn *conn) {
+  Conn **slot = conn_vec_at(&serv->conns, conn->fd);
+  conn->pending = NULL;
+  if (conn->state == STATE_END) {
+    server_close_conn(serv, slot);
+    return;
+  }
+  server_conn_io(serv, slot);
+}
+
+// closes conns idle for longer than the configured limit. the idle list
+// is in last activity order, so only conns that are due get looked at.
+// returns how long the loop may wait (ms) for the next one to be due,
+// 0 while due conns are left over, -1 when none can become due
+static int server_reap_idle(Server *serv) {
+  uint64_t limit = serv->config->idle_timeout_ms;
+  if (!limit) {
+    return -1;
+  }
+  uint64_t now = monotonic_ms();
+  for (size_t done = 0; !dlist_empty(&serv->idle); done++) {
+    Conn *conn = container_of(serv->idle.next, Conn, idle_node);
+    uint64_t due = conn->last_active + limit;
+    if (due > now) {
+      return due - now > INT_MAX ? INT_MAX : (int)(due - now);
+    }
+    if (done == REAP_BUDGET) {
+      return 0;
+    }
+    LOG(1, "Conn(%d): Idle, closing", conn->fd)
+    // leaves the list even when the close has to wait for the kernel
+    server_close_conn(serv, conn_vec_at(&serv->conns, conn->fd));
+  }
+  return -1;
+}
+
+// the shorter of two waits in ms, -1 being forever
+static int wait_min(int lhs, int rhs) {
+  return lhs < 0 || (rhs >= 0 && rhs < lhs) ? rhs : lhs;
+}
+
+// runs a slice of the timed work (the access clock, key expiry, idle
+// conns, a snapshot child) and returns how long the loop may wait for io
+// in ms, -1 for forever
+static int server_timers(Server *serv) {
+  stats_apply_reset(&serv->stats);
+  uint64_t now = time_ms();
+  keyspace_tick(&serv->keyspace, now);
+  int expire = keyspace_expire_cycle(&serv->keyspace, now, EXPIRE_BUDGET);
+  int children = wait_min(snapshot_poll(serv), aof_poll(serv));
+  return wait_min(wait_min(expire, server_reap_idle(serv)), children);
+}
+
+// group commit: what the shard logged during the last iteration goes out
+// with one write, then the replies held for it are released. returns 0
+// when released conns logged again and wait for the next flush, else -1
+static int server_flush_log(Server *serv) {
+  aof_flush(serv);
+  shard_release_parts(serv);
+  // conns held again while the others are released join a fresh list
+  DList held;
+  dlist_init(&held);
+  while (!dlist_empty(&serv->aof.waiting)) {
+    DList *node = serv->aof.waiting.next;
+    dlist_detach(node);
+    dlist_push_back(&held, node);
+  }
+  while (!dlist_empty(&held)) {
+    Conn *conn = container_of(held.next, Conn, log_node);
+    dlist_detach(&conn->log_node);
+    server_conn_io(serv, conn_vec_at(&serv->conns, conn->fd));
+  }
+  return dlist_empty(&serv->aof.waiting) &&
+                 vector_is_empty(&serv->aof.parts)
+             ? -1
+             : 0;
+}
+
+// time from the wakeup at woke (0 before the first) to the next wait,
+// the timed work and the log flush included
+static void server_loop_busy(Server *serv, uint64_t woke) {
+  if (woke) {
+    hist_record(&serv->stats.loop_busy, monotonic_ns() - woke);
+  }
+}
+
+static void server_drain_inbox(Server *serv) {
+  uint64_t count = 0;
+  // read before clearing the flag: a wake sent in between would be read
+  // here and the flag left set, every later wake would then be skipped
+  (void)read(serv->wake_fd, &count, sizeof(count));
+  atomic_store(&serv->wake_pending, false);
+  shard_process_inbox(serv);
+}
+
+#ifdef IO_URING
+// user_data of every sqe: the conn it belongs to (if any) tagged with the
+// operation in the low bits, pooled conns are 16 byte aligned
+enum UringOp {
+  URING_OP_ACCEPT,
+  URING_OP_ACCEPT_UNIX,
+  URING_OP_WAKE,
+  URING_OP_RECV,
+  URING_OP_SEND,
+  URING_OP_CANCEL,
+  URING_OP_MASK = 7,
+};
+
+static struct io_uring_sqe *server_uring_prep(Server *serv, uint8_t opcode,
+                                              int fd, const void *addr,
+                                              size_t len, Conn *conn,
+                                              enum UringOp op) {
+  struct io_uring_sqe *sqe = uring_get_sqe(serv->uring);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)addr;
+  sqe->len = (uint32_t)len;
+  sqe->user_data = (uint64_t)conn | op;
+  return sqe;
+}
+
+// one multishot accept keeps posting a completion per new connection
+static void server_uring_accept(Server *serv, enum UringOp op) {
+  int fd = op == URING_OP_ACCEPT ? serv->fd : serv->unix_fd;
+  struct io_uring_sqe *sqe =
+      server_uring_prep(serv, IORING_OP_ACCEPT, fd, NULL, 0, NULL, op);
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+static void server_uring_wake(Server *serv) {
+  (void)server_uring_prep(serv, IORING_OP_READ, serv->wake_fd,
+                          &serv->wake_count, sizeof(serv->wake_count), NULL,
+                          URING_OP_WAKE);
+}
+
+// multishot, keeps posting a completion per chunk the kernel received into
+// one of the provided buffers until it fails, is cancelled or hits EOF
+static void server_uring_recv(Server *serv, Conn *conn) {
+  struct io_uring_sqe *sqe = server_uring_prep(
+      serv, IORING_OP_RECV, conn->fd, NULL, 0, conn, URING_OP_RECV);
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+  conn->io_ops |= CONN_IO_RECV;
+}
+
+// stops the recv of a conn whose backlog is full, rearmed once it drained
+static void server_uring_cancel_recv(Server *serv, Conn *conn) {
+  struct io_uring_sqe *sqe = server_uring_prep(
+      serv, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, NULL, URING_OP_CANCEL);
+  sqe->addr = (uint64_t)conn | URING_OP_RECV;
+  conn->io_ops |= CONN_IO_CANCEL;
+}
+
+// queues the next operations the conn state asks for, they are all
+// submitted together by the next uring_submit_and_wait
+static void server_uring_arm(Server *serv, Conn **conn) {
+  Conn *c = *conn;
+  if (c->state == STATE_END) {
+    server_close_conn(serv, conn);
+    return;
+  }
+
+  if (!(c->io_ops & CONN_IO_RECV) && connection_wants_input(c)) {
+    server_uring_recv(serv, c);
+  } else if ((c->io_ops & CONN_IO_RECV) && !(c->io_ops & CONN_IO_CANCEL) &&
+             !connection_wants_input(c)) {
+    server_uring_cancel_recv(serv, c);
+  }
+
+  // shard_complete appends to wbuf, it must not move under a send
+  if (c->state == STATE_RES && !c->pending &&
+      !(c->io_ops & CONN_IO_SEND)) {
+    if (aof_must_wait(serv, c->log_end)) {
+      server_hold_reply(serv, c);
+      return;
+    }
+    // one piece of the output per send, referenced values go out from
+    // their blobs without being copied into wbuf
+    Output out = connection_output(c);
+    struct iovec next = {0};
+    (void)output_iovecs(&out, c->wbuf_sent, &next, 1);
+    struct io_uring_sqe *sqe =
+        server_uring_prep(serv, IORING_OP_SEND, c->fd, next.iov_base,
+                          next.iov_len, c, URING_OP_SEND);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    c->io_ops |= CONN_IO_SEND;
+  }
+}
+
+static void server_uring_accepted(Server *serv, int fd, bool tcp) {
+  if (tcp) {
+    int opt = 1;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  }
+
+  Conn *conn_ptr = NULL;
+  if ((serv->conns.length <= (size_t)fd &&
+       !conn_vec_resize(&serv->conns, (size_t)fd + 1)) ||
+      !(conn_ptr = connection_create(fd, serv, &serv->pool))) {
+    (void)close(fd);
+    return;
+  }
+  *conn_vec_at(&serv->conns, fd) = conn_ptr;
+  server_touch_conn(serv, conn_ptr);
+  LOG(1, "Conn(%d): Accepted", fd)
+
+  server_uring_arm(serv, conn_vec_at(&serv->conns, fd));
+}
+
+static void server_uring_complete(Server *serv,
+                                  const struct io_uring_cqe *cqe) {
+  enum UringOp op = cqe->user_data & URING_OP_MASK;
+  Conn *conn = (Conn *)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+  bool has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+  uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+  switch (op) {
+  case URING_OP_ACCEPT:
+  case URING_OP_ACCEPT_UNIX:
+    if (cqe->res >= 0) {
+      server_uring_accepted(serv, cqe->res, op == URING_OP_ACCEPT);
+    } else if (cqe->res != -EAGAIN && cqe->res != -ECONNABORTED) {
+      errno = -cqe->res;
+      ERROR(false, "error accepting connection")
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      server_uring_accept(serv, op);
+    }
+    return;
+  case URING_OP_WAKE:
+    atomic_store(&serv->wake_pending, false);
+    shard_process_inbox(serv);
+    server_uring_wake(serv);
+    return;
+  case URING_OP_CANCEL:
+    return;
+  case URING_OP_RECV:
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      conn->io_ops &= ~(CONN_IO_RECV | CONN_IO_CANCEL);
+    }
+    if (cqe->res == -ENOBUFS || cqe->res == -ECANCELED) {
+      // every buffer was taken (they are recycled before the rearmed recv
+      // runs), or the backlog is full
+    } else if (cqe->res < 0 && conn->state != STATE_END) {
+      errno = -cqe->res;
+      ERROR(false, "error reading from connection")
+      conn->state = STATE_END;
+    } else if (cqe->res >= 0 && conn->state != STATE_END) {
+      connection_received(conn, has_buf ? uring_buf(serv->uring, bid) : NULL,
+                          (size_t)cqe->res);
+    }
+    break;
+  case URING_OP_SEND:
+    conn->io_ops &= ~CONN_IO_SEND;
+    if (cqe->res < 0 && conn->state != STATE_END) {
+      errno = -cqe->res;
+      ERROR(false, "error writing to connection")
+      conn->state = STATE_END;
+    } else if (cqe->res >= 0 && conn->state != STATE_END) {
+      connection_sent(conn, (size_t)cqe->res);
+    }
+    break;
+  default:
+    return;
+  }
+
+  server_touch_conn(serv, conn);
+  if (has_buf) {
+    uring_buf_recycle(serv->uring, bid);
+  }
+  server_uring_arm(serv, conn_vec_at(&serv->conns, conn->fd));
+}
+
+// completion based loop, one io_uring_enter per iteration submits every
+// queued accept / recv / send and waits for the next completions
+static int server_run_uring(Server *serv) {
+  LOG(0, "Server(%zu): Started (io_uring)", serv->shard_id)
+
+  if (uring_enable(serv->uring) < 0) {
+    ERROR(true, "error enabling io_uring")
+  }
+  if (serv->fd >= 0) {
+    server_uring_accept(serv, URING_OP_ACCEPT);
+  }
+  if (serv->unix_fd >= 0) {
+    server_uring_accept(serv, URING_OP_ACCEPT_UNIX);
+  }
+  server_uring_wake(serv);
+  uint64_t woke = 0;
+  while (atomic_load(&serv->running)) {
+    int flush = server_flush_log(serv);
+    shard_checkpoint(serv);
+    int timeout = wait_min(flush, server_timers(serv));
+    server_loop_busy(serv, woke);
+    if (uring_submit_and_wait(serv->uring, 1, timeout) < 0) {
+      ERROR(true, "error waiting for io_uring completions")
+    }
+    woke = monotonic_ns();
+    serv->loop_ms = woke / 1000000;
+
+    uint64_t events = 0;
+    struct io_uring_cqe *cqe = NULL;
+    while ((cqe = uring_peek_cqe(serv->uring)) != NULL) {
+      struct io_uring_cqe done = *cqe;
+      uring_cqe_seen(serv->uring);
+      server_uring_complete(serv, &done);
+      events++;
     }
-    poll_arg tmp;
-    tmp.fd = conn->fd;
-    // NOLINTNEXTLINE(bugprone-narrowing-conversions)
-    tmp.events = ((conn->state == STATE_REQ) ? POLLIN : POLLOUT) | POLLERR;
-    vector_push_back(poll_args, (const uint8_t *)&tmp);
+    hist_record(&serv->stats.loop_events, events);
   }
+  shard_stopped(serv);
+
+  LOG(0, "Server: Closing")
+
+  return 0;
 }
+#endif
 
 int server_run(Server *serv) {
-  LOG(0, "Server: Started")
+#ifdef IO_URING
+  if (serv->uring) {
+    return server_run_uring(serv);
+  }
+#endif
 
-  Vector poll_args;
-  vector_initialize(&poll_args, 0, sizeof(poll_arg));
+  LOG(0, "Server(%zu): Started (%s)", serv->shard_id, reactor_backend())
 
   // manage connections
-  while (1) {
-    // prepare for polling
+  uint64_t woke = 0;
+  while (atomic_load(&serv->running)) {
+    int flush = server_flush_log(serv);
+    shard_checkpoint(serv);
+    int timeout = wait_min(flush, server_timers(serv));
+    server_loop_busy(serv, woke);
     LOG(3, "Connection Polling: Started")
 
-    // poll for new activity on connections or socket
-    prepare_poll_args(&poll_args, serv);
-    size_t n_poll_args = vector_length(&poll_args);
-    int res = poll((poll_arg *)vector_get_at(&poll_args, 0), n_poll_args,
-                   POLL_TIMEOUT);
+    // wait for new activity on connections or socket, or for the next
+    // key to expire / conn to idle out
+    int res = reactor_wait(&serv->reactor, timeout);
     if (res < 0) {
       ERROR(true, "error polling connections / socket")
     }
+    woke = monotonic_ns();
+    serv->loop_ms = woke / 1000000;
+    hist_record(&serv->stats.loop_events, (uint64_t)res);
 
     LOG(3, "Connection Polling: Completed")
 
     // process active connections
-    for (size_t i = 1; i < n_poll_args; ++i) {
-      poll_arg *curr = (poll_arg *)vector_get_at(&poll_args, i);
-      Conn **conn = (Conn **)vector_get_at(&serv->conns, curr->fd);
-      if (curr->revents) {
-        connection_io(*conn);
+    bool accept_ready = false;
+    bool unix_ready = false;
+    for (int i = 0; i < res; ++i) {
+      ReactorEvent *ev = reactor_event_at(&serv->reactor, i);
+      if (ev->fd == serv->fd) {
+        accept_ready = true;
+        continue;
+      }
+      if (ev->fd == serv->unix_fd) {
+        unix_ready = true;
+        continue;
       }
-      if ((*conn)->state == STATE_END) {
-        // destroy this connection
-        connection_close(*conn);
-        *conn = NULL;
+      if (ev->fd == serv->wake_fd) {
+        server_drain_inbox(serv);
+        continue;
+      }
+      Conn **conn = (size_t)ev->fd < serv->conns.length
+                        ? conn_vec_at(&serv->conns, ev->fd)
+                        : NULL;
+      if (conn && *conn) {
+        server_conn_io(serv, conn);
       }
     }
 
-    // accept new connection
-    poll_arg *serv_poll_arg = (poll_arg *)vector_get_at(&poll_args, 0);
-    if (serv_poll_arg->revents) {
-      (void)connection_accept(serv);
+    // accept new connections, until the backlog is drained
+    if (accept_ready) {
+      while (connection_accept(serv, serv->fd) == 0) {
+      }
+    }
+    if (unix_ready) {
+      while (connection_accept(serv, serv->unix_fd) == 0) {
+      }
     }
   }
-
-  vector_cleanup(&poll_args);
+  shard_stopped(serv);
 
   LOG(0, "Server: Closing")
 
@@ -170,11 +702,34 @@ int server_run(Server *serv) {
 void server_cleanup(Server *serv) {
   LOG(1, "Server Cleanup: Started")
 
-  close(serv->fd);
-  for (size_t i = 0; i < vector_length(&serv->conns); i++) {
-    connection_close(*(Conn **)vector_get_at(&serv->conns, i));
+#ifdef IO_URING
+  // cancels whatever the kernel still holds before the conns go away
+  if (serv->uring) {
+    uring_cleanup(serv->uring);
+    serv->uring = NULL;
+  }
+#endif
+  if (serv->fd >= 0) {
+    close(serv->fd);
+  }
+  for (size_t i = 0; i < serv->conns.length; i++) {
+    Conn **conn = conn_vec_at(&serv->conns, i);
+    if (*conn) {
+      // every thread has stopped, nobody will answer a pending request
+      shard_req_free((*conn)->pending);
+      (*conn)->pending = NULL;
+      (*conn)->io_ops = 0;
+      server_close_conn(serv, conn);
+    }
   }
-  vector_cleanup(&serv->conns);
+  close(serv->wake_fd);
+  conn_vec_cleanup(&serv->conns);
+  connection_pool_cleanup(&serv->pool);
+  reactor_cleanup(&serv->reactor);
+  keyspace_cleanup(&serv->keyspace);
+  evictor_cleanup(&serv->evict);
+  aof_shard_cleanup(&serv->aof);
+  stats_cleanup(&serv->stats);
   free(serv);
 
   LOG(1, "Server Cleanup: Completed")
@@ -0,0 +1,508 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aof.h"
+#include "commands.h"
+#include "connection.h"
+#include "hash.h"
+#include "keyspace.h"
+#include "mpsc.h"
+#include "output.h"
+#include "resp.h"
+#include "server.h"
+#include "shard.h"
+#include "utils.h"
+#include "vector.h"
+
+Shards *shards_new(const ServerConfig *config) {
+  Shards *shards = malloc(sizeof(Shards));
+  if (!shards) {
+    ERROR(true, "out of memory for the shards")
+  }
+  shards->count = config->threads > 0 ? config->threads : 1;
+  shards->servers = calloc(shards->count, sizeof(Server *));
+  shards->threads = calloc(shards->count, sizeof(pthread_t));
+  if (!shards->servers || !shards->threads) {
+    ERROR(true, "out of memory for the shards")
+  }
+  shards->unix_fd = config->unix_socket ? server_listen_unix(config) : -1;
+  for (size_t i = 0; i < shards->count; i++) {
+    Server *serv = server_new(config, shards->unix_fd);
+    serv->shards = shards;
+    serv->shard_id = i;
+    // shared-nothing, so is the limit. rounded up to stay non zero
+    serv->maxmemory =
+        (config->maxmemory + shards->count - 1) / shards->count;
+    serv->keyspace.lazy = &shards->lazy;
+    shards->servers[i] = serv;
+  }
+  pthread_mutex_init(&shards->pause_lock, NULL);
+  pthread_mutex_init(&shards->lock, NULL);
+  pthread_cond_init(&shards->cond, NULL);
+  atomic_init(&shards->pausing, false);
+  shards->paused = 0;
+  shards->stopped = 0;
+  snapshot_init(&shards->snapshot, config->snapshot_path);
+  aof_init(&shards->aof, config->aof_path, config->aof_fsync);
+  shards->running = false;
+  lazyfree_init(&shards->lazy);
+  (void)lazyfree_start(&shards->lazy); // frees inline without it
+  slowlog_init(&shards->slowlog, config->slowlog_slower_than,
+               config->slowlog_max_len);
+  return shards;
+}
+
+static void *shard_thread(void *arg) {
+  server_run(arg);
+  return NULL;
+}
+
+// runs shard 0 on the calling thread, returns once every shard stopped
+void shards_run(Shards *shards) {
+  shards->running = true;
+  for (size_t i = 1; i < shards->count; i++) {
+    if (pthread_create(&shards->threads[i], NULL, shard_thread,
+                       shards->servers[i])) {
+      ERROR(true, "error starting reactor thread")
+    }
+  }
+
+  server_run(shards->servers[0]);
+
+  shards_stop(shards);
+  for (size_t i = 1; i < shards->count; i++) {
+    pthread_join(shards->threads[i], NULL);
+  }
+}
+
+void shards_stop(Shards *shards) {
+  for (size_t i = 0; i < shards->count; i++) {
+    server_stop(shards->servers[i]);
+  }
+}
+
+void shards_cleanup(Shards *shards) {
+  // parts still queued belong to requests freed with their conns below,
+  // so every queue is emptied before any server goes away
+  for (size_t i = 0; i < shards->count; i++) {
+    while (mpsc_pop(&shards->servers[i]->inbox)) {
+    }
+  }
+  aof_cleanup(shards);
+  if (shards->unix_fd >= 0) {
+    close(shards->unix_fd);
+    (void)unlink(shards->servers[0]->config->unix_socket);
+  }
+  for (size_t i = 0; i < shards->count; i++) {
+    server_cleanup(shards->servers[i]);
+  }
+  lazyfree_stop(&shards->lazy);
+  slowlog_cleanup(&shards->slowlog);
+  snapshot_cleanup(&shards->snapshot);
+  pthread_mutex_destroy(&shards->pause_lock);
+  pthread_mutex_destroy(&shards->lock);
+  pthread_cond_destroy(&shards->cond);
+  free(shards->servers);
+  free(shards->threads);
+  free(shards);
+}
+
+// the low bits of the hash pick buckets inside each shard, the high ones
+// pick the shard
+size_t shards_owner(const Shards *shards, const uint8_t *key, size_t key_len) {
+  uint64_t hash = hash_bytes(key, key_len);
+  return (size_t)(((hash >> 32) * shards->count) >> 32);
+}
+
+// parks every other shard at the top of its loop, so the caller may read
+// (or fork with) every keyspace until shards_resume. a shard never waits
+// on another one, so they all get there quickly. false when another
+// shard is pausing already, waiting for it could deadlock
+bool shards_pause(Shards *shards) {
+  if (pthread_mutex_trylock(&shards->pause_lock)) {
+    return false;
+  }
+  if (!shards->running) {
+    return true; // still loading, no loop to park
+  }
+  atomic_store(&shards->pausing, true);
+  for (size_t i = 0; i < shards->count; i++) {
+    server_wake(shards->servers[i]);
+  }
+  pthread_mutex_lock(&shards->lock);
+  while (shards->paused + shards->stopped < shards->count - 1) {
+    pthread_cond_wait(&shards->cond, &shards->lock);
+  }
+  pthread_mutex_unlock(&shards->lock);
+  return true;
+}
+
+void shards_resume(Shards *shards) {
+  pthread_mutex_lock(&shards->lock);
+  atomic_store(&shards->pausing, false);
+  pthread_cond_broadcast(&shards->cond);
+  // every shard has to be out before the next pause may count them
+  while (shards->paused > 0) {
+    pthread_cond_wait(&shards->cond, &shards->lock);
+  }
+  pthread_mutex_unlock(&shards->lock);
+  pthread_mutex_unlock(&shards->pause_lock);
+}
+
+// called once per loop iteration, blocks while another shard paused
+// the world. the pausing shard itself never gets here meanwhile
+void shard_checkpoint(Server *serv) {
+  Shards *shards = serv->shards;
+  if (!shards || !atomic_load(&shards->pausing)) {
+    return;
+  }
+  pthread_mutex_lock(&shards->lock);
+  shards->paused++;
+  pthread_cond_broadcast(&shards->cond);
+  while (atomic_load(&shards->pausing)) {
+    pthread_cond_wait(&shards->cond, &shards->lock);
+  }
+  shards->paused--;
+  pthread_cond_broadcast(&shards->cond);
+  pthread_mutex_unlock(&shards->lock);
+}
+
+// a shard whose loop returned counts as paused from then on
+void shard_stopped(Server *serv) {
+  Shards *shards = serv->shards;
+  if (!shards) {
+    return;
+  }
+  pthread_mutex_lock(&shards->lock);
+  shards->stopped++;
+  pthread_cond_broadcast(&shards->cond);
+  pthread_mutex_unlock(&shards->lock);
+}
+
+// returns NULL when out of memory
+static ShardPart *part_new(ShardReq *req, Server *target, const Slice *name) {
+  ShardPart *part = malloc(sizeof(ShardPart));
+  if (!part) {
+    return NULL;
+  }
+  part->req = req;
+  part->target = target;
+  part->done = false;
+  part->log_end = 0;
+  vector_initialize(&part->bytes, 0, sizeof(uint8_t));
+  vector_initialize(&part->argv, 0, sizeof(Slice));
+  vector_initialize(&part->positions, 0, sizeof(size_t));
+  vector_initialize(&part->reply, 0, sizeof(uint8_t));
+  vector_initialize(&part->refs, 0, sizeof(OutRef));
+  vector_append(&part->bytes, name->data, name->len);
+  vector_push_back(&part->argv, (const uint8_t *)name);
+  return part;
+}
+
+static void part_add(ShardPart *part, const Slice *args, size_t count,
+                     size_t position) {
+  for (size_t i = 0; i < count; i++) {
+    vector_append(&part->bytes, args[i].data, args[i].len);
+    vector_push_back(&part->argv, (const uint8_t *)&args[i]);
+  }
+  vector_push_back(&part->positions, (const uint8_t *)&position);
+}
+
+// points argv at the copied bytes, once nothing is appended anymore
+static void part_seal(ShardPart *part) {
+  size_t offset = 0;
+  for (size_t i = 0; i < vector_length(&part->argv); i++) {
+    Slice *arg = (Slice *)vector_get_at(&part->argv, i);
+    arg->data = part->bytes.data + offset;
+    offset += arg->len;
+  }
+}
+
+// replies of whole commands are handed on as they are, so they may
+// reference values of the target's keyspace. merged ones are parsed
+static Output part_output(ShardPart *part) {
+  return (Output){&part->reply, part->req->whole ? &part->refs : NULL};
+}
+
+static void part_free(ShardPart *part) {
+  Output out = part_output(part);
+  output_clear(&out);
+  vector_cleanup(&part->bytes);
+  vector_cleanup(&part->argv);
+  vector_cleanup(&part->positions);
+  vector_cleanup(&part->reply);
+  vector_cleanup(&part->refs);
+  free(part);
+}
+
+static void part_execute(ShardPart *part, Server *serv) {
+  uint64_t logged = serv->aof.logged;
+  Output out = part_output(part);
+  command_execute(serv, (Slice *)part->argv.data, vector_length(&part->argv),
+                  &out);
+  if (serv->aof.logged != logged) {
+    part->log_end = serv->aof.logged;
+  }
+  part->done = true;
+}
+
+void shard_req_free(ShardReq *req) {
+  if (!req) {
+    return;
+  }
+  for (size_t i = 0; i < vector_length(&req->parts); i++) {
+    ShardPart *part = *(ShardPart **)vector_get_at(&req->parts, i);
+    if (part) {
+      part_free(part);
+    }
+  }
+  vector_cleanup(&req->parts);
+  free(req);
+}
+
+// nothing was sent yet, the command fails as a whole
+static void forward_oom(Conn *conn, ShardReq *req) {
+  shard_req_free(req);
+  Output out = connection_output(conn);
+  resp_write_error(&out, "OOM command not allowed");
+}
+
+// sends the keys of the command that other shards own to them,
+// returns false when every key is local (or the command has none). out
+// of memory the command is refused with an error reply instead
+bool shard_forward(Conn *conn, const Command *cmd, Slice *argv, size_t argc) {
+  Server *serv = conn->serv;
+  Shards *shards = serv->shards;
+  if (!shards || shards->count == 1) {
+    return false;
+  }
+
+  size_t first = cmd->first_key;
+  size_t step = cmd->key_step;
+  size_t last = cmd->last_key < 0 ? argc - (size_t)-cmd->last_key
+                                  : (size_t)cmd->last_key;
+  size_t owner = 0;
+  bool single = true;
+  if (cmd->flags & CMD_CURSOR) {
+    // the cursor names its shard, see cmd_scan
+    int64_t cursor = 0;
+    if (!parse_int64(argv[1].data, argv[1].len, &cursor) || cursor < 0) {
+      return false; // the command reports it
+    }
+    owner = (size_t)cursor % shards->count;
+  } else if (first == 0 || last >= argc || (argc - first) % step) {
+    return false; // no keys, or malformed and the command reports it
+  } else {
+    owner = shards_owner(shards, argv[first].data, argv[first].len);
+    for (size_t k = first + step; k <= last && single; k += step) {
+      single = shards_owner(shards, argv[k].data, argv[k].len) == owner;
+    }
+  }
+  if (single && owner == serv->shard_id) {
+    return false;
+  }
+
+  ShardReq *req = malloc(sizeof(ShardReq));
+  if (!req) {
+    forward_oom(conn, NULL);
+    return true;
+  }
+  *req = (ShardReq){.conn = conn, .origin = serv, .cmd = cmd};
+  // one slot per shard, only shards owning a key get a part
+  vector_initialize(&req->parts, shards->count, sizeof(ShardPart *));
+  if (single) {
+    // the whole command goes to the owner as is
+    ShardPart **part = (ShardPart **)vector_get_at(&req->parts, owner);
+    if (!(*part = part_new(req, shards->servers[owner], &argv[0]))) {
+      forward_oom(conn, req);
+      return true;
+    }
+    part_add(*part, &argv[1], argc - 1, 0);
+    req->whole = true;
+  } else {
+    // only multi-key commands get here, their arguments are all keys
+    // (each followed by key_step - 1 values)
+    for (size_t k = first; k <= last; k += step, req->nkeys++) {
+      owner = shards_owner(shards, argv[k].data, argv[k].len);
+      ShardPart **part = (ShardPart **)vector_get_at(&req->parts, owner);
+      if (!*part && !(*part = part_new(req, shards->servers[owner],
+                                       &argv[0]))) {
+        forward_oom(conn, req);
+        return true;
+      }
+      part_add(*part, &argv[k], step, req->nkeys);
+    }
+  }
+
+  conn->pending = req;
+  for (size_t i = 0; i < shards->count; i++) {
+    ShardPart *part = *(ShardPart **)vector_get_at(&req->parts, i);
+    if (!part) {
+      continue;
+    }
+    part_seal(part);
+    if (part->target == serv) {
+      part_execute(part, serv);
+      if (part->log_end) {
+        conn->log_end = part->log_end;
+      }
+    } else {
+      req->waiting++;
+    }
+  }
+  for (size_t i = 0; i < shards->count; i++) {
+    ShardPart *part = *(ShardPart **)vector_get_at(&req->parts, i);
+    if (part && !part->done) {
+      mpsc_push(&part->target->inbox, &part->node);
+      server_wake(part->target);
+    }
+  }
+  return true;
+}
+
+static bool merge_error(ShardReq *req, Output *out) {
+  for (size_t i = 0; i < vector_length(&req->parts); i++) {
+    ShardPart *part = *(ShardPart **)vector_get_at(&req->parts, i);
+    if (part && !vector_is_empty(&part->reply) && part->reply.data[0] == '-') {
+      vector_append(out->bytes, part->reply.data,
+                    vector_length(&part->reply));
+      return true;
+    }
+  }
+  return false;
+}
+
+// element i of the reply of every part belongs to key positions[i]
+static void merge_array(ShardReq *req, Output *out) {
+  Vector elems;
+  vector_initialize(&elems, req->nkeys, sizeof(Slice));
+  RespParser parser;
+  resp_parser_init(&parser);
+
+  for (size_t i = 0; i < vector_length(&req->parts); i++) {
+    ShardPart *part = *(ShardPart **)vector_get_at(&req->parts, i);
+    if (!part) {
+      continue;
+    }
+    resp_parser_reset(&parser, 0);
+    if (resp_parse(&parser, part->reply.data, vector_length(&part->reply)) !=
+        RESP_COMPLETE) {
+      continue;
+    }
+    for (size_t j = 1; j < resp_value_count(&parser) &&
+                       j <= vector_length(&part->positions);
+         j++) {
+      RespValue *val = resp_value_at(&parser, j);
+      size_t pos = *(size_t *)vector_get_at(&part->positions, j - 1);
+      Slice *elem = (Slice *)vector_get_at(&elems, pos);
+      if (val->type != RESP_NULL) {
+        *elem = (Slice){resp_value_data(&parser, part->reply.data, val),
+                        val->len};
+      }
+    }
+  }
+
+  resp_write_array(out, req->nkeys);
+  for (size_t i = 0; i < req->nkeys; i++) {
+    Slice *elem = (Slice *)vector_get_at(&elems, i);
+    if (elem->data) {
+      resp_write_bulk(out, elem->data, elem->len);
+    } else {
+      resp_write_null(out);
+    }
+  }
+
+  resp_parser_cleanup(&parser);
+  vector_cleanup(&elems);
+}
+
+static void merge_sum(ShardReq *req, Output *out) {
+  int64_t sum = 0;
+  for (size_t i = 0; i < vector_length(&req->parts); i++) {
+    ShardPart *part = *(ShardPart **)vector_get_at(&req->parts, i);
+    if (part && vector_length(&part->reply) > 1) {
+      sum += strtoll((const char *)part->reply.data + 1, NULL, 10);
+    }
+  }
+  resp_write_integer(out, sum);
+}
+
+static void shard_complete(ShardReq *req) {
+  Conn *conn = req->conn;
+  Server *origin = req->origin;
+  Output out = connection_output(conn);
+
+  if (req->whole) {
+    ShardPart *part = NULL;
+    for (size_t i = 0; i < vector_length(&req->parts) && !part; i++) {
+      part = *(ShardPart **)vector_get_at(&req->parts, i);
+    }
+    Output reply = part_output(part);
+    output_move(&out, &reply);
+  } else if (!merge_error(req, &out)) {
+    switch (req->cmd->merge) {
+    case MERGE_SUM:
+      merge_sum(req, &out);
+      break;
+    case MERGE_ARRAY:
+      merge_array(req, &out);
+      break;
+    case MERGE_OK:
+      resp_write_simple(&out, "OK");
+      break;
+    case MERGE_NONE:
+      for (size_t i = 0; i < vector_length(&req->parts); i++) {
+        ShardPart *part = *(ShardPart **)vector_get_at(&req->parts, i);
+        if (part) {
+          vector_append(out.bytes, part->reply.data,
+                        vector_length(&part->reply));
+        }
+      }
+      break;
+    }
+  }
+
+  shard_req_free(req);
+  server_resume_conn(origin, conn);
+}
+
+// runs parts other shards sent us and completes requests whose parts
+// came back, only ever called on serv's own thread
+void shard_process_inbox(Server *serv) {
+  MpscNode *node = NULL;
+  while ((node = mpsc_pop(&serv->inbox)) != NULL) {
+    ShardPart *part = container_of(node, ShardPart, node);
+    if (!part->done) {
+      Server *origin = part->req->origin;
+      part_execute(part, serv);
+      if (aof_must_wait(serv, part->log_end)) {
+        vector_push_back(&serv->aof.parts, (const uint8_t *)&part);
+        continue;
+      }
+      mpsc_push(&origin->inbox, &part->node);
+      server_wake(origin);
+      continue;
+    }
+    ShardReq *req = part->req;
+    if (--req->waiting == 0) {
+      shard_complete(req);
+    }
+  }
+}
+
+// posts back the parts that waited for the log to be synced, once it is
+void shard_release_parts(Server *serv) {
+  Vector *parts = &serv->aof.parts;
+  for (size_t i = 0; i < vector_length(parts); i++) {
+    ShardPart *part = *(ShardPart **)vector_get_at(parts, i);
+    Server *origin = part->req->origin;
+    mpsc_push(&origin->inbox, &part->node);
+    server_wake(origin);
+  }
+  vector_clear(parts);
+}
@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slowlog.h"
+#include "utils.h"
+
+void slowlog_init(Slowlog *log, int64_t slower_than_us, size_t max_len) {
+  pthread_mutex_init(&log->lock, NULL);
+  log->slower_than_us = slower_than_us;
+  log->max_len = max_len;
+  log->entries = calloc(max_len ? max_len : 1, sizeof(SlowlogEntry));
+  log->head = 0;
+  log->len = 0;
+  log->next_id = 0;
+}
+
+// a cut argument ends in "... (N more bytes)", the last one kept of a
+// cut command reads "... (N more arguments)"
+static size_t arg_note(char *note, size_t size, const Slice *argv,
+                       size_t argc, size_t i) {
+  if (argc > SLOWLOG_MAX_ARGC && i == SLOWLOG_MAX_ARGC - 1) {
+    return (size_t)snprintf(note, size, "... (%zu more arguments)",
+                            argc - SLOWLOG_MAX_ARGC + 1);
+  }
+  if (argv[i].len > SLOWLOG_MAX_ARG_LEN) {
+    return (size_t)snprintf(note, size, "... (%zu more bytes)",
+                            argv[i].len - SLOWLOG_MAX_ARG_LEN);
+  }
+  note[0] = '\0';
+  return 0;
+}
+
+static size_t arg_kept(const Slice *argv, size_t argc, size_t i) {
+  if (argc > SLOWLOG_MAX_ARGC && i == SLOWLOG_MAX_ARGC - 1) {
+    return 0;
+  }
+  return argv[i].len < SLOWLOG_MAX_ARG_LEN ? argv[i].len
+                                           : SLOWLOG_MAX_ARG_LEN;
+}
+
+// copies what is kept of the arguments into one block, the Slices first
+static Slice *copy_args(const Slice *argv, size_t argc, size_t *kept) {
+  *kept = argc < SLOWLOG_MAX_ARGC ? argc : SLOWLOG_MAX_ARGC;
+  char note[64];
+  size_t bytes = *kept * sizeof(Slice);
+  for (size_t i = 0; i < *kept; i++) {
+    bytes += arg_kept(argv, argc, i) +
+             arg_note(note, sizeof(note), argv, argc, i);
+  }
+  Slice *args = malloc(bytes);
+  if (!args) {
+    return NULL;
+  }
+  uint8_t *pos = (uint8_t *)(args + *kept);
+  for (size_t i = 0; i < *kept; i++) {
+    size_t len = arg_kept(argv, argc, i);
+    memcpy(pos, argv[i].data, len);
+    size_t note_len = arg_note(note, sizeof(note), argv, argc, i);
+    memcpy(pos + len, note, note_len);
+    args[i] = (Slice){pos, len + note_len};
+    pos += len + note_len;
+  }
+  return args;
+}
+
+void slowlog_push(Slowlog *log, const Slice *argv, size_t argc, uint64_t ns,
+                  size_t shard) {
+  size_t kept = 0;
+  Slice *args = copy_args(argv, argc, &kept);
+  if (!args) {
+    return;
+  }
+  pthread_mutex_lock(&log->lock);
+  SlowlogEntry *entry = &log->entries[log->head];
+  free(entry->argv); // the oldest one, once the ring is full
+  *entry = (SlowlogEntry){.id = log->next_id++,
+                          .time = time_ms() / 1000,
+                          .duration_us = ns / 1000,
+                          .shard = shard,
+                          .argc = kept,
+                          .argv = args};
+  log->head = (log->head + 1) % log->max_len;
+  log->len += log->len < log->max_len;
+  pthread_mutex_unlock(&log->lock);
+}
+
+const SlowlogEntry *slowlog_at(const Slowlog *log, size_t i) {
+  return &log->entries[(log->head + log->max_len - 1 - i) % log->max_len];
+}
+
+void slowlog_reset(Slowlog *log) {
+  pthread_mutex_lock(&log->lock);
+  for (size_t i = 0; i < log->max_len; i++) {
+    free(log->entries[i].argv);
+    log->entries[i] = (SlowlogEntry){0};
+  }
+  log->head = 0;
+  log->len = 0;
+  pthread_mutex_unlock(&log->lock);
+}
+
+void slowlog_cleanup(Slowlog *log) {
+  slowlog_reset(log);
+  free(log->entries);
+  pthread_mutex_destroy(&log->lock);
+}
@@ -0,0 +1,503 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "hashmap.h"
+#include "keyspace.h"
+#include "server.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "utils.h"
+#include "vector.h"
+#include "zset.h"
+
+static const char SNAP_MAGIC[6] = {'R', 'M', 'S', 'N', 'A', 'P'};
+#define SNAP_VERSION 1
+// the writer flushes and the reader refills in chunks this large
+#define SNAP_BUF (1 << 20)
+// how often the shard that forked checks on its child
+#define SNAP_POLL_MS 10
+
+typedef struct SnapWriter {
+  int fd;
+  uint8_t *buf;
+  size_t len;
+  uint32_t crc;
+  Keyspace *ks; // the one being walked
+  uint64_t keys;
+  uint64_t bytes;
+  bool failed;
+} SnapWriter;
+
+static void writer_flush(SnapWriter *w) {
+  w->crc = crc32c(w->crc, w->buf, w->len);
+  for (size_t done = 0; done < w->len && !w->failed;) {
+    ssize_t res = write(w->fd, w->buf + done, w->len - done);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      w->failed = true;
+      break;
+    }
+    done += (size_t)res;
+  }
+  w->bytes += w->len;
+  w->len = 0;
+}
+
+static void put_bytes(SnapWriter *w, const void *data, size_t len) {
+  const uint8_t *src = data;
+  while (len > 0) {
+    if (w->len == SNAP_BUF) {
+      writer_flush(w);
+    }
+    size_t chunk = SNAP_BUF - w->len < len ? SNAP_BUF - w->len : len;
+    memcpy(w->buf + w->len, src, chunk);
+    w->len += chunk;
+    src += chunk;
+    len -= chunk;
+  }
+}
+
+static void put_uint(SnapWriter *w, uint64_t val, size_t size) {
+  uint8_t bytes[8];
+  for (size_t i = 0; i < size; i++) {
+    bytes[i] = (uint8_t)(val >> (8 * i));
+  }
+  put_bytes(w, bytes, size);
+}
+
+static void put_zset(SnapWriter *w, ZSet *zset) {
+  put_uint(w, zset_size(zset), 8);
+  // in order, so the loader only ever appends to the tree
+  for (ZNode *node = zset_at(zset, 0); node; node = znode_offset(node, 1)) {
+    uint64_t score = 0;
+    memcpy(&score, &node->score, sizeof(score));
+    put_uint(w, score, 8);
+    put_uint(w, node->len, 4);
+    put_bytes(w, node->name, node->len);
+  }
+}
+
+static bool write_entry(HNode *node, void *arg) {
+  SnapWriter *w = arg;
+  Entry *entry = container_of(node, Entry, node);
+  uint64_t deadline = keyspace_expiry(w->ks, entry);
+  uint8_t type = entry->enc == ENC_INT    ? SNAP_INT
+                 : entry->enc == ENC_ZSET ? SNAP_ZSET
+                                          : SNAP_STRING;
+  put_uint(w, type | (deadline ? SNAP_EXPIRES : 0), 1);
+  if (deadline) {
+    put_uint(w, deadline, 8);
+  }
+  put_uint(w, entry->key_len, 4);
+  put_bytes(w, entry_key(entry), entry->key_len);
+
+  switch (type) {
+  case SNAP_INT:
+    put_uint(w, (uint64_t)entry->integer, 8);
+    break;
+  case SNAP_ZSET:
+    put_zset(w, entry->zset);
+    break;
+  default: {
+    char buf[ENTRY_INT_BUF];
+    Slice val = entry_value(entry, buf);
+    put_uint(w, val.len, 4);
+    put_bytes(w, val.data, val.len);
+  }
+  }
+  w->keys++;
+  return !w->failed;
+}
+
+// writes every keyspace to a temporary file renamed over path once it is
+// complete and synced, so path always holds a whole snapshot. keys that
+// expired but were not deleted yet are written too, the loader drops
+// them. the shards must not run meanwhile
+bool snapshot_write(Shards *shards, const char *path, SnapStats *stats) {
+  uint8_t *buf = malloc(SNAP_BUF);
+  if (!buf) {
+    ERROR(false, "out of memory for the snapshot buffer")
+    return false;
+  }
+  char tmp[PATH_MAX];
+  (void)snprintf(tmp, sizeof(tmp), "%s.tmp-%d", path, (int)getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    ERROR(false, "snapshot open failed")
+    free(buf);
+    return false;
+  }
+
+  SnapWriter w = {.fd = fd, .buf = buf};
+  uint64_t keys = 0;
+  for (size_t i = 0; i < shards->count; i++) {
+    keys += keyspace_size(&shards->servers[i]->keyspace);
+  }
+  put_bytes(&w, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+  put_uint(&w, SNAP_VERSION, 2);
+  put_uint(&w, keys, 8);
+  for (size_t i = 0; i < shards->count && !w.failed; i++) {
+    w.ks = &shards->servers[i]->keyspace;
+    hmap_foreach(&w.ks->map, write_entry, &w);
+  }
+  put_uint(&w, SNAP_EOF, 1);
+  writer_flush(&w); // the crc now covers everything before it
+  put_uint(&w, w.crc, 4);
+  writer_flush(&w);
+  free(w.buf);
+
+  bool ok = !w.failed && fsync(fd) == 0;
+  ok = close(fd) == 0 && ok;
+  ok = ok && rename(tmp, path) == 0;
+  if (!ok) {
+    ERROR(false, "snapshot write failed")
+    (void)unlink(tmp);
+  }
+  if (stats) {
+    *stats = (SnapStats){.keys = w.keys, .bytes = w.bytes};
+  }
+  return ok;
+}
+
+typedef struct SnapReader {
+  int fd;
+  uint8_t *buf;
+  size_t cap;
+  size_t pos; // next byte to hand out
+  size_t len; // bytes read into buf
+  size_t crc_pos; // bytes of buf before it went into crc
+  uint32_t crc;
+} SnapReader;
+
+// the next n bytes, contiguous and valid until the next call. NULL when
+// the file ends first or a read fails
+static const uint8_t *take(SnapReader *r, size_t n) {
+  if (r->len - r->pos < n) {
+    // what is left moves to the front, then the buffer is refilled
+    r->crc = crc32c(r->crc, r->buf + r->crc_pos, r->pos - r->crc_pos);
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+    r->crc_pos = 0;
+    if (n > r->cap) {
+      uint8_t *buf = realloc(r->buf, n);
+      if (!buf) {
+        return NULL;
+      }
+      r->buf = buf;
+      r->cap = n;
+    }
+    while (r->len < n) {
+      ssize_t res = read(r->fd, r->buf + r->len, r->cap - r->len);
+      if (res < 0 && errno == EINTR) {
+        continue;
+      }
+      if (res <= 0) {
+        return NULL;
+      }
+      r->len += (size_t)res;
+    }
+  }
+  const uint8_t *data = r->buf + r->pos;
+  r->pos += n;
+  return data;
+}
+
+static bool get_uint(SnapReader *r, size_t size, uint64_t *val) {
+  const uint8_t *bytes = take(r, size);
+  if (!bytes) {
+    return false;
+  }
+  *val = 0;
+  for (size_t i = 0; i < size; i++) {
+    *val |= (uint64_t)bytes[i] << (8 * i);
+  }
+  return true;
+}
+
+// crc of every byte handed out so far
+static uint32_t reader_crc(SnapReader *r) {
+  r->crc = crc32c(r->crc, r->buf + r->crc_pos, r->pos - r->crc_pos);
+  r->crc_pos = r->pos;
+  return r->crc;
+}
+
+static Entry *load_zset(Keyspace *ks, SnapReader *r, const Vector *key) {
+  uint64_t members = 0;
+  if (!get_uint(r, 8, &members)) {
+    return NULL;
+  }
+  (void)keyspace_del(ks, key->data, vector_length(key));
+  Entry *entry =
+      keyspace_new_zset(ks, key->data, vector_length(key), members);
+  for (uint64_t i = 0; entry && i < members; i++) {
+    uint64_t bits = 0;
+    uint64_t len = 0;
+    const uint8_t *name = NULL;
+    if (!get_uint(r, 8, &bits) || !get_uint(r, 4, &len) ||
+        !(name = take(r, len))) {
+      return NULL;
+    }
+    double score = 0;
+    memcpy(&score, &bits, sizeof(score));
+    if (keyspace_zadd(ks, entry, name, len, score) < 0) {
+      return NULL;
+    }
+  }
+  return entry;
+}
+
+// one key into the shard owning it, false on a malformed record
+static bool load_entry(Shards *shards, SnapReader *r, uint8_t type,
+                       Vector *key, uint64_t now, SnapStats *stats) {
+  uint64_t deadline = 0;
+  uint64_t key_len = 0;
+  const uint8_t *data = NULL;
+  if (((type & SNAP_EXPIRES) && !get_uint(r, 8, &deadline)) ||
+      !get_uint(r, 4, &key_len) || !(data = take(r, key_len))) {
+    return false;
+  }
+  // the key is copied out, taking the value may move the buffer
+  vector_clear(key);
+  vector_append(key, data, key_len);
+  Keyspace *ks =
+      &shards->servers[shards_owner(shards, key->data, key_len)]->keyspace;
+
+  Entry *entry = NULL;
+  uint64_t val = 0;
+  switch (type & ~SNAP_EXPIRES) {
+  case SNAP_STRING:
+    if (get_uint(r, 4, &val) && (data = take(r, val))) {
+      entry = keyspace_set(ks, key->data, key_len, data, val);
+    }
+    break;
+  case SNAP_INT:
+    if (get_uint(r, 8, &val)) {
+      char buf[ENTRY_INT_BUF];
+      int len = snprintf(buf, sizeof(buf), "%" PRId64, (int64_t)val);
+      entry = keyspace_set(ks, key->data, key_len, (uint8_t *)buf,
+                           (size_t)len);
+    }
+    break;
+  case SNAP_ZSET:
+    entry = load_zset(ks, r, key);
+    break;
+  default:
+    break;
+  }
+  if (!entry) {
+    return false;
+  }
+
+  stats->keys++;
+  if (deadline && deadline <= now) {
+    (void)keyspace_del(ks, key->data, key_len);
+    stats->skipped++;
+  } else if (deadline) {
+    keyspace_set_expiry(ks, entry, deadline);
+  }
+  return true;
+}
+
+static bool load_all(Shards *shards, SnapReader *r, SnapStats *stats) {
+  const uint8_t *magic = take(r, sizeof(SNAP_MAGIC));
+  uint64_t version = 0;
+  uint64_t keys = 0;
+  if (!magic || memcmp(magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) ||
+      !get_uint(r, 2, &version) || version != SNAP_VERSION ||
+      !get_uint(r, 8, &keys)) {
+    return false;
+  }
+
+  // every table is sized once for its share of the keys (plus some room
+  // for an uneven spread), the load never resizes progressively
+  size_t share = keys / shards->count;
+  for (size_t i = 0; i < shards->count; i++) {
+    keyspace_reserve(&shards->servers[i]->keyspace, share + share / 16);
+  }
+
+  Vector key;
+  vector_initialize(&key, 0, sizeof(uint8_t));
+  uint64_t now = time_ms();
+  uint64_t type = 0;
+  bool ok = true;
+  while (ok && (ok = get_uint(r, 1, &type)) && type != SNAP_EOF) {
+    ok = load_entry(shards, r, (uint8_t)type, &key, now, stats);
+  }
+  vector_cleanup(&key);
+
+  uint32_t want = reader_crc(r);
+  uint64_t crc = 0;
+  return ok && get_uint(r, 4, &crc) && crc == want;
+}
+
+// loads path into the shards before they run. keys go to whichever shard
+// owns them now, so the shard count may differ from the one that saved.
+// a missing file is an empty snapshot, a corrupt one fails the load
+bool snapshot_load(Shards *shards, const char *path, SnapStats *stats) {
+  *stats = (SnapStats){0};
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return true;
+    }
+    ERROR(false, "snapshot open failed")
+    return false;
+  }
+  SnapReader r = {.fd = fd, .buf = malloc(SNAP_BUF), .cap = SNAP_BUF};
+  bool ok = r.buf && load_all(shards, &r, stats);
+  struct stat st;
+  stats->bytes = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+  free(r.buf);
+  close(fd);
+  return ok;
+}
+
+void snapshot_init(Snapshot *snap, const char *path) {
+  snap->path = path;
+  atomic_init(&snap->child, 0);
+  snap->owner = NULL;
+  snap->started_ms = 0;
+  snap->next_poll_ms = 0;
+  pthread_mutex_init(&snap->lock, NULL);
+  snap->last_save = 0;
+  snap->last_ok = true;
+  snap->last_bytes = 0;
+  snap->last_ms = 0;
+}
+
+static void snapshot_done(Snapshot *snap, bool ok, uint64_t bytes,
+                          uint64_t ms) {
+  pthread_mutex_lock(&snap->lock);
+  snap->last_ok = ok;
+  if (ok) {
+    snap->last_save = time_ms() / 1000;
+    snap->last_bytes = bytes;
+    snap->last_ms = ms;
+  }
+  pthread_mutex_unlock(&snap->lock);
+  if (ok) {
+    LOG(0, "Snapshot: saved %" PRIu64 " bytes in %" PRIu64 " ms", bytes, ms)
+  }
+}
+
+// pauses every shard for the save, saves already running are checked
+// again once paused as only one shard at a time gets that far
+static SnapResult snapshot_begin(Server *serv) {
+  Shards *shards = serv->shards;
+  if (!shards || !shards->snapshot.path) {
+    return SNAP_FAILED;
+  }
+  if (atomic_load(&shards->snapshot.child) || !shards_pause(shards)) {
+    return SNAP_BUSY;
+  }
+  if (atomic_load(&shards->snapshot.child)) {
+    shards_resume(shards);
+    return SNAP_BUSY;
+  }
+  return SNAP_OK;
+}
+
+// SAVE, every shard waits until the snapshot is on disk
+SnapResult snapshot_save(Server *serv) {
+  SnapResult res = snapshot_begin(serv);
+  if (res != SNAP_OK) {
+    return res;
+  }
+  Snapshot *snap = &serv->shards->snapshot;
+  uint64_t start = monotonic_ms();
+  SnapStats stats = {0};
+  bool ok = snapshot_write(serv->shards, snap->path, &stats);
+  shards_resume(serv->shards);
+  snapshot_done(snap, ok, stats.bytes, monotonic_ms() - start);
+  return ok ? SNAP_OK : SNAP_FAILED;
+}
+
+// BGSAVE, the shards are only paused for the fork. the child gets a
+// frozen copy of every keyspace (pages are shared copy on write) and
+// writes it while the shards go on serving
+SnapResult snapshot_bgsave(Server *serv) {
+  SnapResult res = snapshot_begin(serv);
+  if (res != SNAP_OK) {
+    return res;
+  }
+  Shards *shards = serv->shards;
+  Snapshot *snap = &shards->snapshot;
+  pid_t pid = fork();
+  if (pid == 0) {
+    // only this thread is copied into the child, the others were parked
+    // between commands so every keyspace is consistent
+    _exit(snapshot_write(shards, snap->path, NULL) ? 0 : 1);
+  }
+  shards_resume(shards);
+  if (pid < 0) {
+    ERROR(false, "snapshot fork failed")
+    return SNAP_FAILED;
+  }
+  snap->owner = serv;
+  snap->started_ms = monotonic_ms();
+  snap->next_poll_ms = snap->started_ms;
+  atomic_store(&snap->child, pid);
+  LOG(0, "Snapshot: background save started by pid %d", (int)pid)
+  return SNAP_OK;
+}
+
+static void snapshot_reap(Snapshot *snap, pid_t pid, int status) {
+  bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  struct stat st;
+  uint64_t bytes =
+      ok && stat(snap->path, &st) == 0 ? (uint64_t)st.st_size : 0;
+  if (!ok) {
+    LOG(0, "Snapshot: background save by pid %d failed", (int)pid)
+  }
+  snapshot_done(snap, ok, bytes, monotonic_ms() - snap->started_ms);
+  atomic_store(&snap->child, 0);
+}
+
+// the shard that forked checks on the child now and then, returns how
+// long its loop may wait (ms) before the next check, -1 for no child
+int snapshot_poll(Server *serv) {
+  if (!serv->shards) {
+    return -1;
+  }
+  Snapshot *snap = &serv->shards->snapshot;
+  pid_t pid = atomic_load(&snap->child);
+  if (!pid || snap->owner != serv) {
+    return -1;
+  }
+  uint64_t now = monotonic_ms();
+  if (now < snap->next_poll_ms) {
+    return (int)(snap->next_poll_ms - now);
+  }
+  int status = 0;
+  pid_t res = waitpid(pid, &status, WNOHANG);
+  if (res == 0) {
+    snap->next_poll_ms = now + SNAP_POLL_MS;
+    return SNAP_POLL_MS;
+  }
+  snapshot_reap(snap, pid, res == pid ? status : -1);
+  return -1;
+}
+
+// a save still running is waited for, it is the latest state
+void snapshot_cleanup(Snapshot *snap) {
+  pid_t pid = atomic_load(&snap->child);
+  if (pid) {
+    LOG(0, "Snapshot: waiting for the background save to finish")
+    int status = 0;
+    snapshot_reap(snap, pid, waitpid(pid, &status, 0) == pid ? status : -1);
+  }
+  pthread_mutex_destroy(&snap->lock);
+}
@@ -0,0 +1,140 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+static size_t hist_bucket(uint64_t value) {
+  if (value < HIST_SUB) {
+    return (size_t)value;
+  }
+  // the top HIST_SUB_BITS + 1 bits pick the bucket, the leading one
+  // the power of two
+  size_t exp = 63 - (size_t)__builtin_clzll(value);
+  size_t sub = (size_t)(value >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1);
+  return (exp - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+uint64_t hist_bucket_min(size_t bucket) {
+  return bucket == 0 ? 0 : hist_bucket_max(bucket - 1) + 1;
+}
+
+// the largest value that lands in bucket
+uint64_t hist_bucket_max(size_t bucket) {
+  if (bucket < HIST_SUB) {
+    return bucket;
+  }
+  size_t shift = bucket / HIST_SUB - 1;
+  uint64_t low = (uint64_t)(HIST_SUB + bucket % HIST_SUB) << shift;
+  return low + ((uint64_t)1 << shift) - 1;
+}
+
+void hist_record(Histogram *hist, uint64_t value) {
+  counter_add(&hist->counts[hist_bucket(value)], 1);
+  counter_add(&hist->total, 1);
+  counter_add(&hist->sum, value);
+  if (value > counter_get(&hist->max)) {
+    atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+  }
+}
+
+// only by the owner, see stats_request_reset
+void hist_reset(Histogram *hist) {
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    atomic_store_explicit(&hist->counts[i], 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&hist->total, 0, memory_order_relaxed);
+  atomic_store_explicit(&hist->sum, 0, memory_order_relaxed);
+  atomic_store_explicit(&hist->max, 0, memory_order_relaxed);
+}
+
+// adds hist to snap. read while the owner records, the total may be a
+// few values off the sum of the counts
+void hist_collect(const Histogram *hist, HistSnapshot *snap) {
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    snap->counts[i] += counter_get(&hist->counts[i]);
+  }
+  snap->total += counter_get(&hist->total);
+  snap->sum += counter_get(&hist->sum);
+  uint64_t max = counter_get(&hist->max);
+  snap->max = max > snap->max ? max : snap->max;
+}
+
+// count values into a snapshot, for values made up after the fact
+void hist_snapshot_add(HistSnapshot *snap, uint64_t value, uint64_t count) {
+  snap->counts[hist_bucket(value)] += count;
+  snap->total += count;
+  snap->sum += value * count;
+  snap->max = value > snap->max ? value : snap->max;
+}
+
+// the value percentile (0 - 100) of the recorded ones are at or below,
+// as the top of its bucket (never above the max)
+uint64_t hist_value_at(const HistSnapshot *snap, double percentile) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    total += snap->counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+  rank = rank == 0 ? 1 : rank;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    seen += snap->counts[i];
+    if (seen >= rank) {
+      uint64_t top = hist_bucket_max(i);
+      return top < snap->max ? top : snap->max;
+    }
+  }
+  return snap->max;
+}
+
+void stats_init(ServerStats *stats, size_t ncommands) {
+  *stats = (ServerStats){.ncommands = ncommands};
+  stats->commands = calloc(ncommands, sizeof(CommandStats));
+  atomic_init(&stats->reset, false);
+}
+
+void stats_record_command(ServerStats *stats, size_t index, uint64_t ns,
+                          bool failed) {
+  CommandStats *cmd = &stats->commands[index];
+  counter_add(&cmd->calls, 1);
+  if (failed) {
+    counter_add(&cmd->failed, 1);
+  }
+  hist_record(&cmd->latency, ns);
+}
+
+// the owner is the only writer, so it is the one to zero them
+void stats_request_reset(ServerStats *stats) {
+  atomic_store(&stats->reset, true);
+}
+
+void stats_apply_reset(ServerStats *stats) {
+  if (!atomic_exchange(&stats->reset, false)) {
+    return;
+  }
+  // conns_open is a gauge, not a total
+  Counter *counters[] = {&stats->conns_accepted, &stats->net_input,
+                         &stats->net_output};
+  for (size_t i = 0; i < sizeof(counters) / sizeof(*counters); i++) {
+    atomic_store_explicit(counters[i], 0, memory_order_relaxed);
+  }
+  hist_reset(&stats->loop_busy);
+  hist_reset(&stats->loop_events);
+  for (size_t i = 0; i < stats->ncommands; i++) {
+    CommandStats *cmd = &stats->commands[i];
+    atomic_store_explicit(&cmd->calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&cmd->failed, 0, memory_order_relaxed);
+    atomic_store_explicit(&cmd->rejected, 0, memory_order_relaxed);
+    hist_reset(&cmd->latency);
+  }
+}
+
+void stats_cleanup(ServerStats *stats) {
+  free(stats->commands);
+  stats->commands = NULL;
+}
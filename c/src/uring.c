@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uring.h"
+#include "utils.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete,
+                     unsigned flags, const void *arg, size_t arg_size) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                      flags, arg, arg_size);
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg,
+                        unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static bool uring_map_rings(Uring *ring, const struct io_uring_params *p) {
+  ring->sq_map_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  ring->cq_map_len =
+      p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_map_len > ring->sq_map_len) {
+      ring->sq_map_len = ring->cq_map_len;
+    }
+    ring->cq_map_len = 0;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    return false;
+  }
+  ring->cq_map = ring->sq_map;
+  if (ring->cq_map_len) {
+    ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      return false;
+    }
+  }
+
+  ring->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    return false;
+  }
+
+  uint8_t *sq = ring->sq_map;
+  ring->sq_head = (unsigned *)(sq + p->sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+  ring->sq_array = (unsigned *)(sq + p->sq_off.array);
+  ring->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+  ring->sq_entries = p->sq_entries;
+  ring->sqe_tail = *ring->sq_tail;
+
+  uint8_t *cq = ring->cq_map;
+  ring->cq_head = (unsigned *)(cq + p->cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+  return true;
+}
+
+// nbufs must be a power of two
+static bool uring_setup_buffers(Uring *ring, unsigned nbufs, size_t buf_size) {
+  ring->nbufs = nbufs;
+  ring->buf_size = buf_size;
+  ring->buf_ring_len = nbufs * sizeof(struct io_uring_buf);
+  ring->buf_ring = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buf_ring == MAP_FAILED) {
+    ring->buf_ring = NULL;
+    return false;
+  }
+  ring->bufs = malloc(nbufs * buf_size);
+  if (!ring->bufs) {
+    return false;
+  }
+
+  struct io_uring_buf_reg reg = {.ring_addr = (uint64_t)ring->buf_ring,
+                                 .ring_entries = nbufs,
+                                 .bgid = URING_BUF_GROUP};
+  if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    return false;
+  }
+
+  ring->buf_ring->tail = 0;
+  for (unsigned i = 0; i < nbufs; i++) {
+    uring_buf_recycle(ring, (uint16_t)i);
+  }
+  return true;
+}
+
+// returns NULL when the kernel lacks io_uring or one of the features used
+// (extended enter arguments, provided buffer rings)
+Uring *uring_new(unsigned entries, unsigned nbufs, size_t buf_size) {
+  Uring *ring = calloc(1, sizeof(Uring));
+  if (!ring) {
+    return NULL;
+  }
+
+  // completions are only run when the owner thread waits for them, the
+  // ring starts disabled so that owner is the thread that enables it.
+  // older kernels reject the newer flags, each attempt drops some
+  static const unsigned attempts[] = {
+      IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN |
+          IORING_SETUP_R_DISABLED,
+      IORING_SETUP_COOP_TASKRUN,
+      0,
+  };
+  struct io_uring_params params;
+  ring->fd = -1;
+  for (size_t i = 0; i < sizeof(attempts) / sizeof(*attempts); i++) {
+    memset(&params, 0, sizeof(params));
+    params.flags = attempts[i];
+    ring->fd = sys_setup(entries, &params);
+    if (ring->fd >= 0 || errno != EINVAL) {
+      break;
+    }
+  }
+  ring->disabled = ring->fd >= 0 && (params.flags & IORING_SETUP_R_DISABLED);
+  if (ring->fd < 0) {
+    LOG(1, "io_uring_setup failed: %s", strerror(errno))
+    free(ring);
+    return NULL;
+  }
+
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_NODROP) ||
+      !uring_map_rings(ring, &params) ||
+      !uring_setup_buffers(ring, nbufs, buf_size)) {
+    LOG(1, "io_uring lacks required features")
+    uring_cleanup(ring);
+    return NULL;
+  }
+
+  return ring;
+}
+
+// must be called by the thread that submits from then on
+int uring_enable(Uring *ring) {
+  if (!ring->disabled) {
+    return 0;
+  }
+  ring->disabled = false;
+  return sys_register(ring->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0);
+}
+
+// flushes the submission queue when it is full, so this never fails
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  while (ring->sqe_tail - head >= ring->sq_entries) {
+    (void)uring_submit_and_wait(ring, 0, 0);
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  }
+
+  unsigned idx = ring->sqe_tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[idx] = idx;
+  ring->sqe_tail++;
+  return sqe;
+}
+
+// submits every queued sqe with a single syscall and waits for at least
+// wait_nr completions, timeout in ms (negative waits forever)
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, int timeout) {
+  unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+  unsigned flags = 0;
+  struct timespec ts = {.tv_sec = timeout / 1000,
+                        .tv_nsec = (long)(timeout % 1000) * 1000000};
+  struct io_uring_getevents_arg arg = {.sigmask_sz = _NSIG / 8};
+  if (wait_nr) {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    if (timeout >= 0) {
+      arg.ts = (uint64_t)&ts;
+    }
+  }
+
+  int res = sys_enter(ring->fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+  if (res < 0 && (errno == EINTR || errno == ETIME)) {
+    return 0;
+  }
+  return res;
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+  unsigned head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(Uring *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+uint8_t *uring_buf(Uring *ring, uint16_t bid) {
+  return ring->bufs + (size_t)bid * ring->buf_size;
+}
+
+// hands a buffer picked by a recv back to the kernel
+void uring_buf_recycle(Uring *ring, uint16_t bid) {
+  uint16_t tail = ring->buf_ring->tail;
+  struct io_uring_buf *buf = &ring->buf_ring->bufs[tail & (ring->nbufs - 1)];
+  buf->addr = (uint64_t)uring_buf(ring, bid);
+  buf->len = (uint32_t)ring->buf_size;
+  buf->bid = bid;
+  __atomic_store_n(&ring->buf_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void uring_cleanup(Uring *ring) {
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  if (ring->sqes) {
+    munmap(ring->sqes, ring->sqes_len);
+  }
+  if (ring->cq_map && ring->cq_map != ring->sq_map) {
+    munmap(ring->cq_map, ring->cq_map_len);
+  }
+  if (ring->sq_map) {
+    munmap(ring->sq_map, ring->sq_map_len);
+  }
+  if (ring->buf_ring) {
+    munmap(ring->buf_ring, ring->buf_ring_len);
+  }
+  free(ring->bufs);
+  free(ring);
+}
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "utils.h"
 
@@ -19,3 +20,123 @@ void fd_to_nonblocking(int fd) {
     exit(EXIT_FAILURE);
   }
 }
+
+// decimal int64 in the one form it formats back to: digits with an
+// optional '-', no leading zeros, no "-0"
+bool parse_int64(const uint8_t *val, size_t len, int64_t *out) {
+  if (len == 0 || len > 20) {
+    return false;
+  }
+  bool neg = val[0] == '-';
+  size_t i = neg;
+  if (i == len || (val[i] == '0' && (neg || len > 1))) {
+    return false;
+  }
+
+  uint64_t acc = 0;
+  for (; i < len; i++) {
+    if (val[i] < '0' || val[i] > '9') {
+      return false;
+    }
+    uint64_t digit = val[i] - '0';
+    if (acc > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    acc = acc * 10 + digit;
+  }
+  if (acc > (neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX)) {
+    return false;
+  }
+  *out = neg ? (int64_t)(0 - acc) : (int64_t)acc;
+  return true;
+}
+
+// unix time in ms
+uint64_t time_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// for intervals, unaffected by changes to the wall clock
+uint64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// the item of pattern at *pos (a byte, '?', an escaped byte or a [class]
+// with ranges and ^) against c, *pos moves past it
+static bool glob_item(const uint8_t *pattern, size_t len, size_t *pos,
+                      uint8_t c) {
+  size_t i = *pos;
+  if (pattern[i] == '?') {
+    *pos = i + 1;
+    return true;
+  }
+  if (pattern[i] == '\\' && i + 1 < len) {
+    *pos = i + 2;
+    return pattern[i + 1] == c;
+  }
+  if (pattern[i] != '[') {
+    *pos = i + 1;
+    return pattern[i] == c;
+  }
+  i++;
+  bool negate = i < len && pattern[i] == '^';
+  i += negate;
+  bool match = false;
+  for (; i < len && pattern[i] != ']'; i++) {
+    if (pattern[i] == '\\' && i + 1 < len) {
+      match |= pattern[++i] == c;
+    } else if (i + 2 < len && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+      uint8_t lo = pattern[i] < pattern[i + 2] ? pattern[i] : pattern[i + 2];
+      uint8_t hi = pattern[i] < pattern[i + 2] ? pattern[i + 2] : pattern[i];
+      match |= c >= lo && c <= hi;
+      i += 2;
+    } else {
+      match |= pattern[i] == c;
+    }
+  }
+  *pos = i < len ? i + 1 : i;
+  return match != negate;
+}
+
+// glob style matching as in SCAN MATCH: *, ?, [a-z], [^abc] and \ to
+// escape. on a mismatch only the last '*' swallows one more byte, the
+// earlier ones can not lead to a match the last one would miss
+bool glob_match(const uint8_t *pattern, size_t plen, const uint8_t *str,
+                size_t slen) {
+  size_t p = 0;
+  size_t s = 0;
+  size_t star = SIZE_MAX; // pattern position after the last '*'
+  size_t star_s = 0;      // where the bytes it swallows end
+  while (s < slen) {
+    if (p < plen && pattern[p] == '*') {
+      star = ++p;
+      star_s = s;
+      continue;
+    }
+    size_t next = p;
+    if (p < plen && glob_item(pattern, plen, &next, str[s])) {
+      p = next;
+      s++;
+      continue;
+    }
+    if (star == SIZE_MAX) {
+      return false;
+    }
+    p = star;
+    s = ++star_s;
+  }
+  while (p < plen && pattern[p] == '*') {
+    p++;
+  }
+  return p == plen;
+}
@@ -41,32 +41,44 @@ void vector_cleanup(Vector *vector) {
   vector->data_size = 0; // Reset struct fields
 }
 
-size_t vector_length(const Vector *vector) { return vector->length; }
-size_t vector_data_size(const Vector *vector) { return vector->data_size; }
-bool vector_is_empty(const Vector *vector) { return vector->length == 0; }
-
-void vector_resize(Vector *vector, size_t size) {
-  if (size == vector->length) {
-    return;
+static bool vector_reserve(Vector *vector, size_t size) {
+  if (size <= vector->capacity) {
+    return true;
+  }
+  size_t capacity = vector->capacity ? vector->capacity : VEC_MIN_SIZE;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+  uint8_t *new_data = realloc(vector->data, capacity * vector->data_size);
+  if (new_data == NULL) {
+    return false; // Handle allocation error
   }
+  vector->data = new_data;
+  vector->capacity = capacity;
+  return true;
+}
 
-  if (size > vector->capacity) {
-    while (vector->capacity < size) {
-      vector->capacity <<= 1;
-    }
-    uint8_t *new_data =
-        realloc(vector->data, vector->capacity * vector->data_size);
-    if (new_data == NULL) {
-      return; // Handle allocation error
-    }
-    vector->data = new_data;
+// new elements are zeroed. false (and nothing changes) when out of memory
+bool vector_resize(Vector *vector, size_t size) {
+  size_t old_length = vector->length;
+  if (!vector_grow(vector, size)) {
+    return false;
   }
+  if (size > old_length) {
+    memset(&vector->data[old_length * vector->data_size], 0,
+           (size - old_length) * vector->data_size);
+  }
+  return true;
+}
 
-  if (size > vector->length) {
-    memset(&vector->data[vector->length * vector_data_size(vector)], 0,
-           (size - vector->length) * vector_data_size(vector));
+// as vector_resize, but new elements are left uninitialized for callers
+// that write them right away (read() into the tail, appends)
+bool vector_grow(Vector *vector, size_t size) {
+  if (!vector_reserve(vector, size)) {
+    return false;
   }
   vector->length = size;
+  return true;
 }
 
 void vector_shrink_to_fit(Vector *vector) {
@@ -81,23 +93,9 @@ void vector_shrink_to_fit(Vector *vector) {
   }
 }
 
-uint8_t *vector_get_back(const Vector *vector) {
-  if (vector_is_empty(vector)) {
-    return NULL; // Vector is empty
-  }
-  return vector_get_at(vector, vector_length(vector) - 1);
-}
-
-uint8_t *vector_get_at(const Vector *vector, size_t position) {
-  if (position >= vector->length) {
-    return NULL; // Out of bounds
-  }
-  return &vector->data[position * vector->data_size];
-}
-
 bool vector_set_at(const Vector *vector, const uint8_t *value,
                    size_t position) {
-  if (value == NULL || position > vector_length(vector)) {
+  if (value == NULL || position >= vector_length(vector)) {
     return false; // Invalid parameters
   }
   memcpy(vector_get_at(vector, position), value, vector_data_size(vector));
@@ -108,7 +106,12 @@ bool vector_push_back(Vector *vector, const uint8_t *value) {
   if (value == NULL) {
     return false; // Invalid value
   }
-  vector_insert(vector, value, vector_length(vector));
+  if (!vector_reserve(vector, vector->length + 1)) {
+    return false;
+  }
+  memcpy(&vector->data[vector->length * vector->data_size], value,
+         vector->data_size);
+  vector->length++;
   return true;
 }
 
@@ -116,12 +119,14 @@ bool vector_insert(Vector *vector, const uint8_t *value, size_t position) {
   if (value == NULL || position > vector_length(vector)) {
     return false; // Invalid parameters
   }
-  vector_resize(vector, vector->length + 1);
-  for (size_t pos = vector_length(vector) - 1; pos > position; pos--) {
-    memcpy(vector_get_at(vector, pos), vector_get_at(vector, pos - 1),
-           vector_data_size(vector));
+  if (!vector_reserve(vector, vector->length + 1)) {
+    return false;
   }
-  memcpy(vector_get_at(vector, position), value, vector_data_size(vector));
+  uint8_t *at = &vector->data[position * vector->data_size];
+  memmove(at + vector->data_size, at,
+          (vector->length - position) * vector->data_size);
+  memcpy(at, value, vector->data_size);
+  vector->length++;
   return true;
 }
 
@@ -129,7 +134,7 @@ bool vector_pop_back(Vector *vector) {
   if (vector_length(vector) == 0) {
     return false; // Nothing to pop
   }
-  vector_resize(vector, vector_length(vector) - 1);
+  vector->length--;
   return true;
 }
 
@@ -137,21 +142,20 @@ bool vector_erase(Vector *vector, size_t position) {
   if (position >= vector_length(vector)) {
     return false; // Invalid position
   }
-  if (position < vector_length(vector) - 1) {
-    memcpy(vector_get_at(vector, position), vector_get_at(vector, position + 1),
-           vector_data_size(vector) * (vector_length(vector) - position - 1));
-  }
-  vector_resize(vector, vector_length(vector) - 1);
+  uint8_t *at = &vector->data[position * vector->data_size];
+  memmove(at, at + vector->data_size,
+          (vector->length - position - 1) * vector->data_size);
+  vector->length--;
   return true;
 }
 
-void vector_clear(Vector *vector) { vector_resize(vector, 0); }
+void vector_clear(Vector *vector) { vector->length = 0; }
 
 void vector_copy(Vector *src, Vector *dest) {
   if (vector_data_size(src) != vector_data_size(dest)) {
     return; // Data sizes must match
   }
-  vector_resize(dest, vector_length(src));
+  vector_grow(dest, vector_length(src));
   memcpy(dest->data, src->data, vector_data_size(src) * vector_length(src));
 }
 
@@ -160,7 +164,39 @@ void vector_extend(Vector *src, Vector *dest) {
     return; // Data sizes must match
   }
   size_t old_dest_length = vector_length(dest);
-  vector_resize(dest, old_dest_length + vector_length(src));
+  vector_grow(dest, old_dest_length + vector_length(src));
   memcpy(vector_get_at(dest, old_dest_length), src->data,
          vector_data_size(src) * vector_length(src));
 }
+
+void vector_append(Vector *vector, const uint8_t *values, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  if (!vector_reserve(vector, vector->length + count)) {
+    return;
+  }
+  memcpy(&vector->data[vector->length * vector->data_size], values,
+         vector->data_size * count);
+  vector->length += count;
+}
+
+// hands the storage (capacity elements) to the caller, the vector is left
+// empty without any until vector_adopt
+uint8_t *vector_release(Vector *vector, size_t *capacity) {
+  uint8_t *data = vector->data;
+  *capacity = vector->capacity;
+  vector->data = NULL;
+  vector->capacity = 0;
+  vector->length = 0;
+  return data;
+}
+
+// takes over malloc'ed storage for capacity elements, the vector must be
+// without storage (released or cleaned up) and becomes empty
+void vector_adopt(Vector *vector, uint8_t *data, size_t capacity) {
+  assert(vector->data == NULL && capacity > 0);
+  vector->data = data;
+  vector->capacity = capacity;
+  vector->length = 0;
+}
@@ -0,0 +1,164 @@
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "avl.h"
+#include "hash.h"
+#include "hashmap.h"
+#include "hnode.h"
+#include "utils.h"
+#include "vector.h"
+#include "zset.h"
+
+ZSet *zset_new(void) {
+  ZSet *zset = malloc(sizeof(ZSet));
+  if (!zset) {
+    return NULL;
+  }
+  *zset = (ZSet){0};
+  hmap_initialize_keys(&zset->hmap, HKEY_LAYOUT(ZNode, hmap, len, name));
+  zset->bytes = malloc_usable_size(zset);
+  return zset;
+}
+
+// sizes the member table of an empty set up front
+void zset_reserve(ZSet *zset, size_t members) {
+  hmap_reserve(&zset->hmap, members);
+}
+
+// (score, name) order
+static bool znode_less(const ZNode *lhs, const ZNode *rhs) {
+  if (lhs->score != rhs->score) {
+    return lhs->score < rhs->score;
+  }
+  size_t len = lhs->len < rhs->len ? lhs->len : rhs->len;
+  int cmp = memcmp(lhs->name, rhs->name, len);
+  return cmp != 0 ? cmp < 0 : lhs->len < rhs->len;
+}
+
+static void tree_insert(ZSet *zset, ZNode *node) {
+  AVLNode *parent = NULL;
+  AVLNode **from = &zset->root;
+  while (*from) {
+    parent = *from;
+    from = znode_less(node, container_of(parent, ZNode, tree))
+               ? &parent->left
+               : &parent->right;
+  }
+  avl_init(&node->tree);
+  node->tree.parent = parent;
+  *from = &node->tree;
+  zset->root = avl_fix(&node->tree);
+}
+
+// returns 1 when name was added, 0 when only its score changed and -1
+// when out of memory
+int zset_add(ZSet *zset, const uint8_t *name, size_t len, double score) {
+  ZNode *node = zset_lookup(zset, name, len);
+  if (node) {
+    if (node->score != score) {
+      zset->root = avl_del(&node->tree);
+      node->score = score;
+      tree_insert(zset, node);
+    }
+    return 0;
+  }
+
+  node = malloc(sizeof(ZNode) + len);
+  if (!node) {
+    return -1;
+  }
+  node->hmap.hash = hash_bytes(name, len);
+  node->score = score;
+  node->len = (uint32_t)len;
+  memcpy(node->name, name, len);
+  hmap_insert(&zset->hmap, &node->hmap);
+  tree_insert(zset, node);
+  zset->bytes += malloc_usable_size(node);
+  return 1;
+}
+
+ZNode *zset_lookup(ZSet *zset, const uint8_t *name, size_t len) {
+  HNode *found = hmap_lookup_key(&zset->hmap, hash_bytes(name, len), name, len);
+  return found ? container_of(found, ZNode, hmap) : NULL;
+}
+
+void zset_delete(ZSet *zset, ZNode *node) {
+  hmap_pop_key(&zset->hmap, node->hmap.hash, node->name, node->len);
+  zset->root = avl_del(&node->tree);
+  zset->bytes -= malloc_usable_size(node);
+  free(node);
+}
+
+// the first node with a score above (exclusive) or at least score
+ZNode *zset_seek(ZSet *zset, double score, bool exclusive) {
+  AVLNode *found = NULL;
+  for (AVLNode *node = zset->root; node;) {
+    double at = container_of(node, ZNode, tree)->score;
+    if (exclusive ? at > score : at >= score) {
+      found = node; // a candidate, a smaller one may be on the left
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return found ? container_of(found, ZNode, tree) : NULL;
+}
+
+// the node at 0 based rank, NULL when out of range
+ZNode *zset_at(ZSet *zset, int64_t rank) {
+  if (!zset->root) {
+    return NULL;
+  }
+  AVLNode *node =
+      avl_offset(zset->root, rank - (int64_t)avl_count(zset->root->left));
+  return node ? container_of(node, ZNode, tree) : NULL;
+}
+
+ZNode *znode_offset(ZNode *node, int64_t offset) {
+  AVLNode *found = avl_offset(&node->tree, offset);
+  return found ? container_of(found, ZNode, tree) : NULL;
+}
+
+int64_t znode_rank(const ZNode *node) { return avl_rank(&node->tree); }
+
+size_t zset_size(const ZSet *zset) { return avl_count(zset->root); }
+
+static void scan_member(HNode *node, void *arg) {
+  ZNode *znode = container_of(node, ZNode, hmap);
+  vector_push_back(arg, (const uint8_t *)&znode);
+}
+
+// ZSCAN through the member table, like keyspace_scan: appends about count
+// members to out (ZNode *), returns the next cursor
+uint64_t zset_scan(ZSet *zset, uint64_t cursor, size_t count, Vector *out) {
+  size_t found = vector_length(out);
+  size_t budget = count * 10;
+  do {
+    cursor = hmap_scan(&zset->hmap, cursor, scan_member, out);
+  } while (cursor && vector_length(out) - found < count && --budget > 0);
+  return cursor;
+}
+
+// bytes of the set, its nodes and its hash table
+size_t zset_memory(ZSet *zset) {
+  return zset->bytes + hmap_memory(&zset->hmap);
+}
+
+// post order, children are freed before their parent
+static void tree_free(AVLNode *node) {
+  if (!node) {
+    return;
+  }
+  tree_free(node->left);
+  tree_free(node->right);
+  free(container_of(node, ZNode, tree));
+}
+
+void zset_free(ZSet *zset) {
+  tree_free(zset->root);
+  hmap_destroy(&zset->hmap);
+  free(zset);
+}